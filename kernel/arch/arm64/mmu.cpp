@@ -1106,6 +1106,11 @@ void arch_zero_page(void* _ptr) {
     } while (ptr != end_ptr);
 }
 
+// dc zva already zeroes without reading the lines in, so there is nothing better to do.
+void arch_zero_page_nontemporal(void* ptr) {
+    arch_zero_page(ptr);
+}
+
 zx_status_t arm64_mmu_translate(vaddr_t va, paddr_t* pa, bool user, bool write) {
     // disable interrupts around this operation to make the at/par instruction combination atomic
     spin_lock_saved_state_t state;
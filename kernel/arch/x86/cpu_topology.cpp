@@ -8,6 +8,7 @@
 #include <arch/x86/cpu_topology.h>
 #include <arch/x86/feature.h>
 #include <bits.h>
+#include <kernel/mp.h>
 #include <pow2.h>
 #include <stdio.h>
 #include <string.h>
@@ -33,9 +34,15 @@ static uint32_t core_shift = 0;
 
 static uint32_t smt_mask = 0;
 
+// Number of low apic id bits that distinguish cpus sharing the last level
+// cache. UINT32_MAX if unknown, in which case the cache is assumed to be
+// shared by the whole node.
+static uint32_t llc_shift = UINT32_MAX;
+
 static void legacy_topology_init();
 static void modern_intel_topology_init();
 static void extended_amd_topology_init();
+static void cache_topology_init();
 
 void x86_cpu_topology_init() {
     static int initialized;
@@ -51,6 +58,8 @@ void x86_cpu_topology_init() {
     } else {
         legacy_topology_init();
     }
+
+    cache_topology_init();
 }
 
 static void modern_intel_topology_init() {
@@ -166,6 +175,38 @@ static void legacy_topology_init() {
     core_mask = ~package_mask ^ smt_mask;
 }
 
+static void cache_topology_init() {
+    // Intel's deterministic cache parameters leaf and AMD's cache topology leaf
+    // share a layout: one subleaf per cache, terminated by a null cache type.
+    enum x86_cpuid_leaf_num leaf_num;
+    if (x86_vendor == X86_VENDOR_INTEL) {
+        leaf_num = X86_CPUID_CACHE_V2;
+    } else if (x86_vendor == X86_VENDOR_AMD && x86_feature_test(X86_FEATURE_AMD_TOPO)) {
+        leaf_num = X86_CPUID_AMD_CACHE_TOPOLOGY;
+    } else {
+        return;
+    }
+
+    uint32_t llc_level = 0;
+    struct cpuid_leaf leaf;
+    for (uint32_t i = 0; i < 16 && x86_get_cpuid_subleaf(leaf_num, i, &leaf); ++i) {
+        uint32_t type = BITS(leaf.a, 4, 0);
+        if (type == 0) {
+            break;
+        }
+
+        uint32_t level = BITS_SHIFT(leaf.a, 7, 5);
+        if (level > llc_level) {
+            llc_level = level;
+            // maximum number of addressable ids sharing this cache, minus one
+            uint32_t sharing = BITS_SHIFT(leaf.a, 25, 14) + 1;
+            llc_shift = log2_uint_ceil(sharing);
+        }
+    }
+
+    LTRACEF("last level cache L%u, shift %u\n", llc_level, llc_shift);
+}
+
 void x86_cpu_topology_decode(uint32_t apic_id, x86_cpu_topology_t* topo) {
     *topo = {};
 
@@ -179,3 +220,39 @@ void x86_cpu_topology_decode(uint32_t apic_id, x86_cpu_topology_t* topo) {
     topo->core_id = (apic_id & core_mask) >> core_shift;
     topo->smt_id = apic_id & smt_mask;
 }
+
+// Returns an id that is equal for two apic ids iff they share the last level cache.
+static uint32_t llc_id(uint32_t apic_id) {
+    if (llc_shift == UINT32_MAX) {
+        return apic_id & (package_mask | node_mask);
+    }
+    return (llc_shift >= 32) ? 0 : (apic_id >> llc_shift);
+}
+
+void x86_cpu_topology_set_cpu_masks(const uint32_t* apic_ids, uint32_t cpu_count) {
+    DEBUG_ASSERT(cpu_count <= SMP_MAX_CPUS);
+
+    for (cpu_num_t i = 0; i < cpu_count; ++i) {
+        x86_cpu_topology_t topo_i;
+        x86_cpu_topology_decode(apic_ids[i], &topo_i);
+
+        cpu_mask_t smt_siblings = 0;
+        cpu_mask_t cache_siblings = 0;
+        for (cpu_num_t j = 0; j < cpu_count; ++j) {
+            x86_cpu_topology_t topo_j;
+            x86_cpu_topology_decode(apic_ids[j], &topo_j);
+
+            if (topo_i.package_id == topo_j.package_id &&
+                topo_i.node_id == topo_j.node_id &&
+                topo_i.core_id == topo_j.core_id) {
+                smt_siblings |= cpu_num_to_mask(j);
+            }
+            if (topo_i.package_id == topo_j.package_id &&
+                llc_id(apic_ids[i]) == llc_id(apic_ids[j])) {
+                cache_siblings |= cpu_num_to_mask(j);
+            }
+        }
+
+        mp_set_cpu_topology(i, smt_siblings, cache_siblings);
+    }
+}
@@ -94,8 +94,21 @@ public:
     paddr_t pt_phys() const { return pt_->phys(); }
     size_t pt_pages() const { return pt_->pages(); }
 
+    bool BeginBatch() override { return pt_->BeginBatch(); }
+    void EndBatch() override { pt_->EndBatch(); }
+
+    // The number of TLB shootdowns issued for this aspace.
+    uint64_t tlb_shootdowns() const { return pt_->shootdowns(); }
+
     int active_cpus() { return active_cpus_.load(); }
 
+    // Called before a TLB shootdown for this aspace. CPUs that are not running
+    // the aspace may still hold entries for it tagged with its PCID, so they
+    // have to flush them the next time they switch to it.
+    void MarkTlbStale();
+    // Called by a CPU running the aspace once it has handled a shootdown.
+    void ClearTlbStale(uint cpu);
+
     IoBitmap& io_bitmap() { return io_bitmap_; }
 
     static void ContextSwitch(X86ArchVmAspace* from, X86ArchVmAspace* to);
@@ -106,6 +119,10 @@ private:
         return (vaddr >= base_ && vaddr <= base_ + size_ - 1);
     }
 
+    // Returns the value to load into CR3 to switch |cpu| to this aspace, which
+    // includes our PCID if they are in use. Interrupts must be disabled.
+    ulong SwitchCr3(uint cpu);
+
     fbl::Canary<fbl::magic("VAAS")> canary_;
     IoBitmap io_bitmap_;
 
@@ -129,6 +146,14 @@ private:
     // CPUs that are currently executing in this aspace.
     // Actually an mp_cpu_mask_t, but header dependencies.
     fbl::atomic_int active_cpus_{0};
+
+    // Our PCID and the generation it belongs to, packed as
+    // (generation << 12 | pcid), or 0 if we have not been given one yet.
+    fbl::atomic<uint64_t> pcid_{0};
+
+    // CPUs that have to flush the entries tagged with our PCID before they use
+    // it again. Also an mp_cpu_mask_t.
+    fbl::atomic_int tlb_stale_cpus_{0};
 };
 
 using ArchVmAspace = X86ArchVmAspace;
@@ -22,4 +22,8 @@ typedef struct {
 void x86_cpu_topology_init(void);
 void x86_cpu_topology_decode(uint32_t apic_id, x86_cpu_topology_t *topo);
 
+/* publish the smt and last level cache sibling masks to the kernel's topology map.
+ * |apic_ids| is indexed by logical cpu number. */
+void x86_cpu_topology_set_cpu_masks(const uint32_t *apic_ids, uint32_t cpu_count);
+
 __END_CDECLS
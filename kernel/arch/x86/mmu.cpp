@@ -16,7 +16,12 @@
 #include <arch/x86/feature.h>
 #include <arch/x86/mmu.h>
 #include <arch/x86/mmu_mem_types.h>
+#include <fbl/atomic.h>
+#include <kernel/auto_lock.h>
+#include <kernel/cmdline.h>
 #include <kernel/mp.h>
+#include <kernel/spinlock.h>
+#include <lib/ktrace.h>
 #include <vm/arch_vm_aspace.h>
 #include <vm/pmm.h>
 #include <vm/vm.h>
@@ -50,6 +55,25 @@ volatile pt_entry_t linear_map_pdp[(64ULL * GB) / (2 * MB)] __ALIGNED(PAGE_SIZE)
 /* kernel base top level page table in physical space */
 static const paddr_t kernel_pt_phys = (vaddr_t)KERNEL_PT - KERNEL_BASE + KERNEL_LOAD_OFFSET;
 
+/* PCIDs (process-context identifiers) tag TLB entries with the address space
+ * they belong to, so that switching address spaces does not flush the TLB.
+ * PCID 0 is used for the kernel aspace, user aspaces get one of the others the
+ * first time they are switched to. A PCID is handed out at most once per
+ * generation; when they run out a new generation starts, and every CPU flushes
+ * the entries of all PCIDs before it loads one from the new generation. */
+static bool use_pcid = false;
+static bool use_invpcid = false;
+
+static constexpr uint kPcidBits = 12;
+static constexpr uint64_t kPcidCount = 1u << kPcidBits;
+
+static SpinLock pcid_lock;
+static fbl::atomic<uint64_t> pcid_generation{1};
+static uint64_t pcid_next TA_GUARDED(pcid_lock) = 1;
+
+/* generation of the PCIDs that each CPU's TLB may hold entries for */
+static uint64_t pcid_cpu_generation[SMP_MAX_CPUS];
+
 /* valid EPT MMU flags */
 static const uint kValidEptFlags =
     ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE | ARCH_MMU_FLAG_PERM_EXECUTE;
@@ -126,21 +150,43 @@ static void x86_tlb_nonglobal_invalidate() {
     x86_set_cr3(x86_get_cr3());
 }
 
+/**
+ * @brief  invalidate all TLB entries of every PCID, excluding global entries
+ */
+static void x86_tlb_all_pcids_invalidate() {
+    if (use_invpcid) {
+        /* See Intel 3A section 4.10.4.1, type 3 is all contexts except globals */
+        struct {
+            uint64_t pcid;
+            uint64_t addr;
+        } desc = {0, 0};
+        __asm__ volatile("invpcid %0, %1" ::"m"(desc), "r"(3ul) : "memory");
+    } else {
+        x86_tlb_global_invalidate();
+    }
+}
+
 /* Task used for invalidating a TLB entry on each CPU */
 struct TlbInvalidatePage_context {
     ulong target_cr3;
+    X86ArchVmAspace* aspace;
     const PendingTlbInvalidation* pending;
 };
 static void TlbInvalidatePage_task(void* raw_context) {
     DEBUG_ASSERT(arch_ints_disabled());
     TlbInvalidatePage_context* context = (TlbInvalidatePage_context*)raw_context;
 
-    ulong cr3 = x86_get_cr3();
+    ulong cr3 = x86_get_cr3() & ~(ulong)X86_CR3_PCID_MASK;
     if (context->target_cr3 != cr3 && !context->pending->contains_global) {
         /* This invalidation doesn't apply to this CPU, ignore it */
         return;
     }
 
+    /* The entries of the aspace on this CPU are up to date once we are done */
+    if (context->aspace && context->target_cr3 == cr3) {
+        context->aspace->ClearTlbStale(arch_curr_cpu_num());
+    }
+
     if (context->pending->full_shootdown) {
         if (context->pending->contains_global) {
             x86_tlb_global_invalidate();
@@ -175,9 +221,9 @@ static void x86_tlb_invalidate_page(const X86PageTableBase* pt, PendingTlbInvali
         return;
     }
 
-    ulong cr3 = pt ? pt->phys() : x86_get_cr3();
+    ulong cr3 = pt ? pt->phys() : x86_get_cr3() & ~(ulong)X86_CR3_PCID_MASK;
     struct TlbInvalidatePage_context task_context = {
-        .target_cr3 = cr3, .pending = pending,
+        .target_cr3 = cr3, .aspace = nullptr, .pending = pending,
     };
 
     /* Target only CPUs this aspace is active on.  It may be the case that some
@@ -191,9 +237,23 @@ static void x86_tlb_invalidate_page(const X86PageTableBase* pt, PendingTlbInvali
         target = MP_IPI_TARGET_ALL;
     } else {
         target = MP_IPI_TARGET_MASK;
-        target_mask = static_cast<X86ArchVmAspace*>(pt->ctx())->active_cpus();
+        X86ArchVmAspace* aspace = static_cast<X86ArchVmAspace*>(pt->ctx());
+        /* With PCIDs, CPUs that ran the aspace earlier may still have its
+         * entries. Mark them stale before looking at the active CPUs, so that a
+         * CPU switching to the aspace now either gets the IPI or flushes. */
+        aspace->MarkTlbStale();
+        target_mask = aspace->active_cpus();
+        task_context.aspace = aspace;
     }
 
+    /* count the IPIs, the local CPU runs the task directly */
+    cpu_mask_t ipi_mask = (target == MP_IPI_TARGET_ALL) ? mp_get_online_mask()
+                                                         : target_mask & mp_get_online_mask();
+    ipi_mask &= ~cpu_num_to_mask(arch_curr_cpu_num());
+    ktrace(TAG_TLB_SHOOTDOWN, (target == MP_IPI_TARGET_ALL) ? mp_get_online_mask() : target_mask,
+           __builtin_popcount(ipi_mask), pending->full_shootdown ? 0 : pending->count,
+           pending->contains_global);
+
     mp_sync_exec(target, target_mask, TlbInvalidatePage_task, &task_context);
     pending->clear();
 }
@@ -454,7 +514,20 @@ void x86_mmu_early_init() {
     LTRACEF("paddr_width %u vaddr_width %u\n", g_paddr_width, g_vaddr_width);
 }
 
-void x86_mmu_init(void) {}
+void x86_mmu_init(void) {
+    bool pcid = x86_feature_test(X86_FEATURE_PCID) && cmdline_get_bool("kernel.x86.pcid", true);
+    dprintf(INFO, "x86: PCIDs %s\n", pcid ? "enabled" : "disabled");
+
+    /* The secondary CPUs enable them in x86_mmu_percpu_init(), which ran on
+     * the boot CPU before we knew. CR3 holds the kernel aspace, PCID 0. Enable
+     * them before ContextSwitch() starts putting PCIDs in CR3. */
+    if (pcid) {
+        DEBUG_ASSERT((x86_get_cr3() & X86_CR3_PCID_MASK) == 0);
+        x86_set_cr4(x86_get_cr4() | X86_CR4_PCIDE);
+    }
+    use_invpcid = pcid && x86_feature_test(X86_FEATURE_INVPCID);
+    use_pcid = pcid;
+}
 
 X86PageTableBase::X86PageTableBase() {
 }
@@ -600,21 +673,81 @@ zx_status_t X86ArchVmAspace::Protect(vaddr_t vaddr, size_t count, uint mmu_flags
     return pt_->ProtectPages(vaddr, count, mmu_flags);
 }
 
+void X86ArchVmAspace::MarkTlbStale() {
+    if (use_pcid) {
+        tlb_stale_cpus_.fetch_or(~0);
+    }
+}
+
+void X86ArchVmAspace::ClearTlbStale(uint cpu) {
+    if (use_pcid) {
+        tlb_stale_cpus_.fetch_and(~cpu_num_to_mask(cpu));
+    }
+}
+
+ulong X86ArchVmAspace::SwitchCr3(uint cpu) {
+    DEBUG_ASSERT(arch_ints_disabled());
+    paddr_t phys = pt_phys();
+    if (!use_pcid) {
+        return phys;
+    }
+
+    uint64_t generation = pcid_generation.load();
+    uint64_t pcid = pcid_.load();
+    if (unlikely((pcid >> kPcidBits) != generation ||
+                 pcid_cpu_generation[cpu] != generation)) {
+        AutoSpinLockNoIrqSave guard(&pcid_lock);
+
+        generation = pcid_generation.load();
+        pcid = pcid_.load();
+        if ((pcid >> kPcidBits) != generation) {
+            if (pcid_next == kPcidCount) {
+                generation++;
+                pcid_generation.store(generation);
+                pcid_next = 1;
+            }
+            pcid = (generation << kPcidBits) | pcid_next++;
+            pcid_.store(pcid);
+        }
+
+        if (pcid_cpu_generation[cpu] != generation) {
+            /* The PCIDs of the new generation may have been used before */
+            x86_tlb_all_pcids_invalidate();
+            pcid_cpu_generation[cpu] = generation;
+            ClearTlbStale(cpu);
+        }
+    }
+
+    ulong cr3 = phys | (pcid & X86_CR3_PCID_MASK);
+
+    /* active_cpus_ is set by now, so shootdowns after this point will reach
+     * us. Keep the entries of our PCID unless one we missed left them stale. */
+    cpu_mask_t cpu_bit = cpu_num_to_mask(cpu);
+    if (likely(!(tlb_stale_cpus_.load() & cpu_bit))) {
+        return cr3 | X86_CR3_NOFLUSH;
+    }
+    tlb_stale_cpus_.fetch_and(~cpu_bit);
+    return cr3;
+}
+
 void X86ArchVmAspace::ContextSwitch(X86ArchVmAspace* old_aspace, X86ArchVmAspace* aspace) {
-    cpu_mask_t cpu_bit = cpu_num_to_mask(arch_curr_cpu_num());
+    cpu_num_t cpu = arch_curr_cpu_num();
+    cpu_mask_t cpu_bit = cpu_num_to_mask(cpu);
     if (aspace != nullptr) {
         aspace->canary_.Assert();
-        paddr_t phys = aspace->pt_phys();
-        LTRACEF_LEVEL(3, "switching to aspace %p, pt %#" PRIXPTR "\n", aspace, phys);
-        x86_set_cr3(phys);
+        /* Become active before picking the CR3 value, see SwitchCr3() */
+        aspace->active_cpus_.fetch_or(cpu_bit);
+        ulong cr3 = aspace->SwitchCr3(cpu);
+        LTRACEF_LEVEL(3, "switching to aspace %p, cr3 %#lx\n", aspace, cr3);
+        x86_set_cr3(cr3);
 
-        if (old_aspace != nullptr) {
+        if (old_aspace != nullptr && old_aspace != aspace) {
             old_aspace->active_cpus_.fetch_and(~cpu_bit);
         }
-        aspace->active_cpus_.fetch_or(cpu_bit);
     } else {
         LTRACEF_LEVEL(3, "switching to kernel aspace, pt %#" PRIxPTR "\n", kernel_pt_phys);
-        x86_set_cr3(kernel_pt_phys);
+        /* Only user aspaces have PCIDs, so the entries of PCID 0 can stay */
+        x86_set_cr3(use_pcid ? kernel_pt_phys | X86_CR3_NOFLUSH : kernel_pt_phys);
         if (old_aspace != nullptr) {
             old_aspace->active_cpus_.fetch_and(~cpu_bit);
         }
@@ -650,6 +783,9 @@ void x86_mmu_percpu_init(void) {
         cr4 |= X86_CR4_SMEP;
     if (x86_feature_test(X86_FEATURE_SMAP))
         cr4 |= X86_CR4_SMAP;
+    /* Only set once x86_mmu_init() has decided, CPUs come up with PCID 0 in CR3 */
+    if (use_pcid)
+        cr4 |= X86_CR4_PCIDE;
     x86_set_cr4(cr4);
 
     // Set NXE bit in X86_MSR_IA32_EFER.
@@ -27,6 +27,7 @@
 #include <dev/hw_rng.h>
 #include <dev/interrupt.h>
 #include <kernel/event.h>
+#include <kernel/sched.h>
 #include <kernel/timer.h>
 #include <platform.h>
 #include <zircon/types.h>
@@ -90,6 +91,14 @@ zx_status_t x86_allocate_ap_structures(uint32_t* apic_ids, uint8_t cpu_count) {
         apic_idx++;
     }
 
+    // Hand the scheduler the topology, indexed by logical cpu number.
+    uint32_t cpu_apic_ids[SMP_MAX_CPUS];
+    cpu_apic_ids[0] = bootstrap_ap;
+    for (uint i = 1; i < cpu_count; ++i) {
+        cpu_apic_ids[i] = ap_percpus[i - 1].apic_id;
+    }
+    x86_cpu_topology_set_cpu_masks(cpu_apic_ids, cpu_count);
+
     x86_num_cpus = cpu_count;
     return ZX_OK;
 }
@@ -262,6 +271,7 @@ __NO_RETURN int arch_idle_thread_routine(void*) {
     if (use_monitor) {
         struct x86_percpu* percpu = x86_get_percpu();
         for (;;) {
+            sched_idle_balance();
             while (*percpu->monitor) {
                 x86_monitor(percpu->monitor);
                 // Check percpu->monitor in case it was cleared between the first check and
@@ -275,6 +285,7 @@ __NO_RETURN int arch_idle_thread_routine(void*) {
         }
     } else {
         for (;;) {
+            sched_idle_balance();
             x86_idle();
         }
     }
@@ -6,9 +6,12 @@
 
 #pragma once
 
+#include <fbl/atomic.h>
 #include <fbl/canary.h>
 #include <fbl/mutex.h>
 #include <hwreg/bitfields.h>
+#include <kernel/thread.h>
+#include <list.h>
 
 typedef uint64_t pt_entry_t;
 #define PRIxPTE PRIx64
@@ -50,6 +53,9 @@ struct PendingTlbInvalidation {
     // bit set.
     void enqueue(vaddr_t v, PageTableLevel level, bool is_global_page, bool is_terminal);
 
+    // Add the invalidations of |other| to this one, and clear |other|.
+    void merge(PendingTlbInvalidation* other);
+
     // Clear the list of pending invalidations
     void clear();
 
@@ -87,6 +93,18 @@ public:
 
     zx_status_t QueryVaddr(vaddr_t vaddr, paddr_t* paddr, uint* mmu_flags);
 
+    // Defers the TLB invalidations of the changes the current thread makes to
+    // the page tables, and the freeing of page tables they empty, until the
+    // matching EndBatch(), so that the changes share one shootdown. Batches of
+    // one thread nest. Returns false, and defers nothing, if another thread
+    // has a batch open. A change made by another thread meanwhile flushes the
+    // batch along with its own invalidations.
+    bool BeginBatch();
+    void EndBatch();
+
+    // The number of TLB shootdowns issued for these page tables.
+    uint64_t shootdowns() const { return shootdowns_.load(); }
+
 protected:
     // Initialize an empty page table, assigning this given context to it.
     zx_status_t Init(void* ctx);
@@ -177,8 +195,23 @@ private:
     void UnmapEntry(ConsistencyManager* cm, PageTableLevel level, vaddr_t vaddr,
                     volatile pt_entry_t* pte, bool was_terminal) TA_REQ(lock_);
 
+    // Issues |pending|, along with any batch it flushes, and moves the page
+    // tables to free after it to |to_free|, or defers all of it to the batch of
+    // the current thread.
+    void FinishTlb(PendingTlbInvalidation* pending, list_node* to_free) TA_REQ(lock_);
+    void InvalidateTlb(PendingTlbInvalidation* pending) TA_REQ(lock_);
+
     fbl::Canary<fbl::magic("X86P")> canary_;
 
     // low lock to protect the mmu code
     fbl::Mutex lock_;
+
+    // The thread with a batch open, how deeply its batches nest, and the
+    // invalidations and page tables to free deferred to the end of the batch.
+    thread_t* batch_owner_ TA_GUARDED(lock_) = nullptr;
+    uint batch_depth_ TA_GUARDED(lock_) = 0;
+    PendingTlbInvalidation batch_tlb_ TA_GUARDED(lock_);
+    list_node batch_to_free_ TA_GUARDED(lock_) = LIST_INITIAL_VALUE(batch_to_free_);
+
+    fbl::atomic<uint64_t> shootdowns_{0};
 };
@@ -105,6 +105,22 @@ void PendingTlbInvalidation::enqueue(vaddr_t v, PageTableLevel level, bool is_gl
     count++;
 }
 
+void PendingTlbInvalidation::merge(PendingTlbInvalidation* other) {
+    contains_global |= other->contains_global;
+    if (other->full_shootdown || count + other->count > fbl::count_of(item)) {
+        full_shootdown = true;
+    }
+    if (!full_shootdown) {
+        for (uint i = 0; i < other->count; i++) {
+            item[count++] = other->item[i];
+        }
+    } else if (count == 0) {
+        // Keep a non-zero count so that the full shootdown is not skipped.
+        count = fbl::max(other->count, 1u);
+    }
+    other->clear();
+}
+
 void PendingTlbInvalidation::clear() {
     count = 0;
     full_shootdown = false;
@@ -227,10 +243,70 @@ void X86PageTableBase::ConsistencyManager::Finish() {
         // invalidations.
         mb();
     }
-    pt_->TlbInvalidate(&tlb_);
+    pt_->FinishTlb(&tlb_, &to_free_);
     pt_ = nullptr;
 }
 
+void X86PageTableBase::FinishTlb(PendingTlbInvalidation* pending, list_node* to_free) {
+    if (batch_depth_ > 0) {
+        // Moves every page table in |from| to the tail of |to|.
+        auto move_pages = [](list_node* from, list_node* to) {
+            list_node* node;
+            while ((node = list_remove_head(from)) != nullptr) {
+                list_add_tail(to, node);
+            }
+        };
+
+        if (batch_owner_ == get_current_thread()) {
+            batch_tlb_.merge(pending);
+            move_pages(to_free, &batch_to_free_);
+            return;
+        }
+
+        // Another thread's change may rely on entries the batch already
+        // cleared being gone from the TLBs, so flush the batch along with it.
+        pending->merge(&batch_tlb_);
+        move_pages(&batch_to_free_, to_free);
+    }
+    InvalidateTlb(pending);
+}
+
+void X86PageTableBase::InvalidateTlb(PendingTlbInvalidation* pending) {
+    if (pending->count > 0) {
+        shootdowns_.fetch_add(1);
+    }
+    TlbInvalidate(pending);
+}
+
+bool X86PageTableBase::BeginBatch() {
+    fbl::AutoLock a(&lock_);
+    thread_t* current = get_current_thread();
+    if (batch_depth_ > 0 && batch_owner_ != current) {
+        return false;
+    }
+    batch_owner_ = current;
+    batch_depth_++;
+    return true;
+}
+
+void X86PageTableBase::EndBatch() {
+    list_node to_free = LIST_INITIAL_VALUE(to_free);
+    {
+        fbl::AutoLock a(&lock_);
+        DEBUG_ASSERT(batch_depth_ > 0 && batch_owner_ == get_current_thread());
+        if (--batch_depth_ > 0) {
+            return;
+        }
+        batch_owner_ = nullptr;
+        InvalidateTlb(&batch_tlb_);
+        list_move(&batch_to_free_, &to_free);
+    }
+    // As in ConsistencyManager, free the page tables outside the lock.
+    if (!list_is_empty(&to_free)) {
+        pmm_free(&to_free);
+    }
+}
+
 struct X86PageTableBase::MappingCursor {
 public:
     /**
@@ -93,6 +93,11 @@ struct mp_state {
 
     /* lock for serializing CPU hotplug/unplug operations */
     mutex_t hotplug_lock;
+
+    /* cpus sharing a physical core (smt siblings) and the last level cache with
+     * each cpu. written by the arch layer during boot, read without locking afterwards */
+    cpu_mask_t smt_siblings[SMP_MAX_CPUS];
+    cpu_mask_t cache_siblings[SMP_MAX_CPUS];
 };
 
 extern struct mp_state mp;
@@ -100,6 +105,29 @@ extern struct mp_state mp;
 void mp_set_curr_cpu_online(bool online);
 void mp_set_curr_cpu_active(bool active);
 
+/* arch neutral cpu topology map.
+ * the arch layer reports, for each cpu, the set of cpus that share a physical core
+ * with it and the set that share its last level cache. architectures that never call
+ * mp_set_cpu_topology() leave every cpu sharing only with itself.
+ */
+void mp_set_cpu_topology(cpu_num_t cpu, cpu_mask_t smt_siblings, cpu_mask_t cache_siblings);
+
+/* returns the mask of cpus sharing a core with |cpu|, including |cpu| itself */
+static inline cpu_mask_t mp_get_smt_siblings(cpu_num_t cpu) {
+    if (!is_valid_cpu_num(cpu))
+        return 0;
+
+    return mp.smt_siblings[cpu] | cpu_num_to_mask(cpu);
+}
+
+/* returns the mask of cpus sharing the last level cache with |cpu|, including |cpu| itself */
+static inline cpu_mask_t mp_get_cache_siblings(cpu_num_t cpu) {
+    if (!is_valid_cpu_num(cpu))
+        return 0;
+
+    return mp.cache_siblings[cpu] | cpu_num_to_mask(cpu);
+}
+
 static inline int mp_is_cpu_active(cpu_num_t cpu) {
     return atomic_load((int*)&mp.active_cpus) & cpu_num_to_mask(cpu);
 }
@@ -29,6 +29,9 @@ typedef struct TA_CAP("mutex") mutex {
     uint32_t magic;
     uintptr_t val;
     wait_queue_t wait;
+#if ENABLE_LOCK_STATS
+    struct lock_class* lock_class;
+#endif
 } mutex_t;
 
 #define MUTEX_FLAG_QUEUED ((uintptr_t)1)
@@ -44,11 +47,18 @@ static inline thread_t* mutex_holder(const mutex_t* m) {
     return (thread_t*)(mutex_val(m) & ~MUTEX_FLAG_QUEUED);
 }
 
+#if ENABLE_LOCK_STATS
+#define MUTEX_LOCK_CLASS_INITIAL_VALUE .lock_class = NULL,
+#else
+#define MUTEX_LOCK_CLASS_INITIAL_VALUE
+#endif
+
 #define MUTEX_INITIAL_VALUE(m)                      \
     {                                               \
         .magic = MUTEX_MAGIC,                       \
         .val = 0,                                   \
         .wait = WAIT_QUEUE_INITIAL_VALUE((m).wait), \
+        MUTEX_LOCK_CLASS_INITIAL_VALUE              \
     }
 
 /* Rules for Mutexes:
@@ -63,6 +73,11 @@ void mutex_release(mutex_t* m) TA_REL(m);
 /* special version of the above with the thread lock held */
 void mutex_release_thread_locked(mutex_t* m, bool reschedule) TA_REL(m);
 
+/* set how long a contended mutex_acquire() may spin while the holder runs on another cpu
+ * before blocking, 0 to always block. returns the previous value. the initial value comes
+ * from kernel.mutex.spin-max-ns. */
+zx_duration_t mutex_set_spin_max(zx_duration_t spin_max);
+
 /* does the current thread hold the mutex? */
 static inline bool is_mutex_held(const mutex_t* m) {
     return (mutex_holder(m) == get_current_thread());
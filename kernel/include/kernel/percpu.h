@@ -18,16 +18,48 @@
 __BEGIN_CDECLS
 
 struct percpu {
-    /* per cpu timer queue */
-    struct list_node timer_queue;
+    /* per cpu timer queue: a treap of pending timers ordered by scheduled time, and its
+     * earliest entry. both are protected by timer_lock. */
+    spin_lock_t timer_lock;
+    struct timer* timer_tree;
+    struct timer* timer_first;
 
     /* per cpu preemption timer */
     timer_t preempt_timer;
 
-    /* per cpu run queue and bitmap to indicate which queues are non empty */
+    /* per cpu run queue and bitmap to indicate which queues are non empty.
+     * both are protected by run_queue_lock, which nests inside thread_lock but is also
+     * taken without it by cpus stealing work.
+     */
+    spin_lock_t run_queue_lock;
     struct list_node run_queue[NUM_PRIORITIES];
     uint32_t run_queue_bitmap;
 
+    /* the thread this cpu is switching away from, whose on_cpu is cleared once the
+     * switch is complete */
+    thread_t* switch_prev;
+
+    /* the thread this cpu is running or switching to, read without locks by other cpus
+     * that only compare it to a thread they know of and never dereference it */
+    thread_t* curr_thread;
+
+    /* run queue used instead of the above under the fair scheduling policy: a heap of
+     * ready threads ordered by virtual runtime, its length and its minimum virtual runtime.
+     * also protected by run_queue_lock.
+     */
+    thread_t* fair_queue;
+    uint32_t fair_queue_len;
+    uint64_t fair_min_vruntime;
+
+    /* ready threads in the deadline scheduling class, which run ahead of the queues above,
+     * and the next time a throttled one among them gets a new budget. also protected by
+     * run_queue_lock. deadline_density is the share of this cpu reserved by deadline
+     * threads pinned to it, protected by thread_lock.
+     */
+    struct list_node deadline_queue;
+    zx_time_t deadline_next_replenish;
+    uint32_t deadline_density;
+
     /* thread/cpu level statistics */
     struct cpu_stats stats;
 
@@ -24,6 +24,12 @@ void sched_preempt(void);
 void sched_reschedule(void);
 void sched_resched_internal(void);
 void sched_unblock_idle(thread_t* t);
+
+/* called by a thread that has just been switched to, with thread_lock still held */
+void sched_finish_switch(void);
+
+/* called from the idle loop, without thread_lock, to pull over work waiting on other cpus */
+void sched_idle_balance(void);
 void sched_migrate(thread_t* t);
 
 /* set the inherited priority of a thread and return if the caller should locally reschedule.
@@ -38,4 +44,11 @@ bool sched_unblock_list(struct list_node* list) __WARN_UNUSED_RESULT;
 
 void sched_transition_off_cpu(cpu_num_t old_cpu);
 
+/* admit a thread into the deadline scheduling class, or update its parameters */
+zx_status_t sched_set_deadline(thread_t* t, zx_duration_t runtime, zx_duration_t deadline,
+                               zx_duration_t period);
+
+/* take a thread out of the deadline scheduling class and give back its reservation */
+void sched_clear_deadline(thread_t* t);
+
 __END_CDECLS
@@ -0,0 +1,66 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+#pragma once
+
+#include <kernel/timer.h>
+#include <list.h>
+#include <stdbool.h>
+#include <zircon/compiler.h>
+#include <zircon/types.h>
+
+__BEGIN_CDECLS
+
+/* a cpu bandwidth group caps the cpu time used by a set of threads to |quota| in every
+ * |period|. groups form a tree: the time a thread uses is charged to its group and to
+ * every ancestor, and the thread is throttled while any of them is over its quota.
+ * throttled threads are parked on the group until a timer, armed when the group is
+ * throttled, starts its next period.
+ *
+ * all fields are protected by thread_lock.
+ */
+typedef struct sched_bandwidth {
+    struct sched_bandwidth* parent;
+
+    /* limit, quota is 0 if the group is unlimited */
+    zx_duration_t quota;
+    zx_duration_t period;
+
+    /* end of the current period, and the time used in it, which may run over the quota
+     * by the time it takes to notice */
+    zx_time_t period_end;
+    zx_duration_t usage;
+    bool throttled;
+    zx_time_t throttled_since;
+    struct list_node throttled_threads;
+    timer_t refill_timer;
+
+    /* statistics */
+    zx_duration_t total_runtime;
+    uint64_t throttled_count;
+    zx_duration_t throttled_time;
+} sched_bandwidth_t;
+
+typedef struct sched_bandwidth_info {
+    zx_duration_t quota;
+    zx_duration_t period;
+    zx_duration_t total_runtime;
+    zx_duration_t throttled_time;
+    uint64_t throttled_count;
+    bool throttled;
+} sched_bandwidth_info_t;
+
+/* set up a new, unlimited group under |parent|, which may be NULL */
+void sched_bandwidth_init(sched_bandwidth_t* b, sched_bandwidth_t* parent);
+
+/* tear down a group that no thread belongs to anymore */
+void sched_bandwidth_destroy(sched_bandwidth_t* b);
+
+/* limit the group to |quota| every |period|, or lift the limit if |quota| is 0 */
+zx_status_t sched_bandwidth_set(sched_bandwidth_t* b, zx_duration_t quota, zx_duration_t period);
+
+void sched_bandwidth_get_info(sched_bandwidth_t* b, sched_bandwidth_info_t* info);
+
+__END_CDECLS
@@ -12,12 +12,20 @@
 #include <zircon/compiler.h>
 #include <zircon/thread_annotations.h>
 
+#if ENABLE_LOCK_STATS
+#include <lib/lockstat.h>
+#endif
+
 __BEGIN_CDECLS
 
 /* interrupts should already be disabled */
 static inline void spin_lock(spin_lock_t* lock) TA_ACQ(lock) {
     DEBUG_ASSERT(arch_ints_disabled());
+#if ENABLE_LOCK_STATS
+    lockstat_spin_lock(lock);
+#else
     arch_spin_lock(lock);
+#endif
 }
 
 /* Returns 0 on success, non-0 on failure */
@@ -59,6 +59,7 @@ typedef void (*thread_tls_callback_t)(void* tls_value);
 #define THREAD_FLAG_REAL_TIME                (1 << 3)
 #define THREAD_FLAG_IDLE                     (1 << 4)
 #define THREAD_FLAG_DEBUG_STACK_BOUNDS_CHECK (1 << 5)
+#define THREAD_FLAG_DEADLINE                 (1 << 6)
 
 #define THREAD_SIGNAL_KILL                   (1 << 0)
 #define THREAD_SIGNAL_SUSPEND                (1 << 1)
@@ -77,6 +78,7 @@ typedef void (*thread_tls_callback_t)(void* tls_value);
 #define THREAD_MAX_TLS_ENTRY 2
 
 struct vmm_aspace;
+struct sched_bandwidth;
 
 typedef struct thread {
     int magic;
@@ -95,6 +97,9 @@ typedef struct thread {
      * left the scheduler. */
     zx_duration_t runtime_ns;
 
+    /* the last time the running thread was charged for its cpu time by the scheduler */
+    zx_time_t last_accounted;
+
     /* priority: in the range of [MIN_PRIORITY, MAX_PRIORITY], from low to high.
      * base_priority is set at creation time, and can be tuned with thread_set_priority().
      * priority_boost is a signed value that is moved around within a range by the scheduler.
@@ -108,11 +113,43 @@ typedef struct thread {
     int priority_boost;
     int inherited_priority;
 
-    /* current cpu the thread is either running on or in the ready queue, undefined otherwise */
+    /* fair scheduling policy state: weighted virtual runtime and its links in a cpu's
+     * run queue heap */
+    uint64_t fair_vruntime;
+    struct thread* fair_child;
+    struct thread* fair_sibling;
+    struct thread* fair_prev;
+
+    /* deadline scheduling class parameters and state, valid if THREAD_FLAG_DEADLINE is set.
+     * the thread is owed deadline_runtime of cpu time in each deadline_period, within
+     * deadline_relative of the start of the period. deadline_budget is what is left of
+     * it in the current period and deadline_density is the share of its cpu it reserves.
+     * the thread is pinned to that cpu; deadline_allowed_cpus keeps the affinity it had.
+     */
+    zx_duration_t deadline_runtime;
+    zx_duration_t deadline_relative;
+    zx_duration_t deadline_period;
+    zx_time_t deadline_period_start;
+    zx_time_t deadline_abs;
+    zx_duration_t deadline_budget;
+    uint32_t deadline_density;
+    cpu_mask_t deadline_allowed_cpus;
+
+    /* cpu bandwidth group the thread's time is charged to, if any, and the group it is
+     * parked on while that group or one of its ancestors is throttled */
+    struct sched_bandwidth* bandwidth;
+    struct sched_bandwidth* bandwidth_parked;
+
+    /* current cpu the thread is either running on or in the ready queue, undefined otherwise.
+     * while the thread is in a run queue, protected by that queue's run_queue_lock */
     cpu_num_t curr_cpu;
     cpu_num_t last_cpu;      /* last cpu the thread ran on, INVALID_CPU if it's never run */
     cpu_mask_t cpu_affinity; /* mask of cpus that this thread can run on */
 
+    /* set from the time the thread is picked to run until the cpu it ran on has finished
+     * switching away from it, so that no other cpu steals it while its context is live */
+    bool on_cpu;
+
     /* if blocked, a pointer to the wait queue */
     struct wait_queue* blocking_wait_queue;
 
@@ -241,6 +278,12 @@ zx_status_t thread_join(thread_t* t, int* retcode, zx_time_t deadline);
 zx_status_t thread_detach_and_resume(thread_t* t);
 zx_status_t thread_set_real_time(thread_t* t);
 
+/* move the thread into the deadline scheduling class, pinning it to a cpu that can
+ * accommodate |runtime| every |period| within |deadline|. returns ZX_ERR_NO_RESOURCES
+ * if no cpu in the thread's affinity mask has the capacity left. */
+zx_status_t thread_set_deadline(thread_t* t, zx_duration_t runtime, zx_duration_t deadline,
+                                zx_duration_t period);
+
 /* scheduler routines to be used by regular kernel code */
 void thread_yield(void);      /* give up the cpu and time slice voluntarily */
 void thread_preempt(void);    /* get preempted at irq time */
@@ -311,12 +354,31 @@ static inline bool thread_is_real_time_or_idle(thread_t* t) {
     return !!(t->flags & (THREAD_FLAG_REAL_TIME | THREAD_FLAG_IDLE));
 }
 
+static inline bool thread_is_deadline(thread_t* t) {
+    return !!(t->flags & THREAD_FLAG_DEADLINE);
+}
+
 /* the current thread */
 #include <arch/current_thread.h>
 thread_t* get_current_thread(void);
 void set_current_thread(thread_t*);
 
-/* scheduler lock */
+/* scheduler lock
+ *
+ * Lock ordering, outermost first:
+ *   thread_lock                 thread state, wait queues, priorities and affinity
+ *   percpu[cpu].run_queue_lock  that cpu's run_queue[] and run_queue_bitmap
+ *   percpu[cpu].timer_lock      that cpu's timer queue
+ *
+ * A thread's state and its membership in a wait queue only change with
+ * thread_lock held, so waking a thread up still takes thread_lock. The run
+ * queues themselves, and the curr_cpu of a thread waiting in one, are
+ * protected by the run queue locks alone: a cpu balancing its load moves ready
+ * threads between run queues without taking thread_lock, holding the locks of
+ * both queues, taken in increasing cpu order. Otherwise at most one run queue
+ * lock is held at a time. Timer locks of several cpus are taken in increasing
+ * cpu order.
+ */
 extern spin_lock_t thread_lock;
 
 #define THREAD_LOCK(state)         \
@@ -30,7 +30,13 @@ enum slack_mode {
 
 typedef struct timer {
     int magic;
-    struct list_node node;
+
+    /* links in the timer queue of queue_cpu, which is <0 if the timer is not queued */
+    struct timer* parent;
+    struct timer* left;
+    struct timer* right;
+    uint32_t priority;
+    volatile int queue_cpu;
 
     zx_time_t scheduled_time;
     int64_t slack; // Stores the applied slack adjustment from
@@ -45,7 +51,11 @@ typedef struct timer {
 #define TIMER_INITIAL_VALUE(t)              \
     {                                       \
         .magic = TIMER_MAGIC,               \
-        .node = LIST_INITIAL_CLEARED_VALUE, \
+        .parent = NULL,                     \
+        .left = NULL,                       \
+        .right = NULL,                      \
+        .priority = 0,                      \
+        .queue_cpu = -1,                    \
         .scheduled_time = 0,                \
         .slack = 0,                         \
         .callback = NULL,                   \
@@ -41,7 +41,8 @@ __BEGIN_CDECLS
 //  Don't. The counters are mantained in a per-cpu arena and
 //  atomic operations are never used to set their value so
 //  they are both imprecise and reflect only the operations
-//  on a particular core.
+//  on a particular core. The one exception is tests checking
+//  that something happened at all, see kcounter_get_total().
 
 struct k_counter_desc {
     const char* name;
@@ -93,4 +94,8 @@ static inline void kcounter_add(const struct k_counter_desc* var,
 #endif
 }
 
+// Approximate sum over all cores of the counter named |name|, or 0 if there
+// is no such counter. Only meant for tests.
+uint64_t kcounter_get_total(const char* name);
+
 __END_CDECLS
@@ -0,0 +1,100 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <arch/spinlock.h>
+#include <stdbool.h>
+#include <zircon/compiler.h>
+#include <zircon/thread_annotations.h>
+#include <zircon/types.h>
+
+__BEGIN_CDECLS
+
+// Lock statistics ("lockstat") record, for each class of lock, how often
+// it is acquired, how often the acquirer had to wait, and for how long.
+// A class is a name shared by one or more locks, e.g. every VMO lock is in
+// the "vm.vmo" class.
+//
+// Lockstat is only built with ENABLE_LOCK_STATS=1 (set ENABLE_LOCK_STATS=true
+// on the make command line). Otherwise the macros below expand to nothing and
+// spin_lock() and mutex_acquire() are not instrumented at all.
+//
+// Put a lock in a class before it is first used, or at least before the
+// acquisitions that matter:
+//      LOCK_CLASS_SPIN(&thread_lock, "kernel.thread_lock");
+//      LOCK_CLASS_MUTEX(arena_lock.GetInternal(), "vm.pmm_arena");
+//
+// Locks that are not in a class are not counted. Each expansion of the
+// macros defines its own class, so tag all locks of a class from one place.
+//
+// The results can be read with the 'k lockstat' console command, or from
+// userspace with the ZX_INFO_LOCK_STATS topic of zx_object_get_info().
+
+typedef struct lock_class {
+    const char* name;
+    struct lock_class* next;
+    bool registered;
+
+    // all times are in nanoseconds
+    uint64_t acquisitions;
+    uint64_t contentions;
+    uint64_t total_wait_time;
+    uint64_t max_wait_time;
+} lock_class_t;
+
+#define LOCK_CLASS_INITIAL_VALUE(_name) \
+    {                                   \
+        .name = (_name),                \
+        .next = NULL,                   \
+        .registered = false,            \
+        .acquisitions = 0,              \
+        .contentions = 0,               \
+        .total_wait_time = 0,           \
+        .max_wait_time = 0,             \
+    }
+
+#if ENABLE_LOCK_STATS
+
+struct mutex;
+
+void lockstat_set_spin_class(spin_lock_t* lock, lock_class_t* lock_class);
+void lockstat_set_mutex_class(struct mutex* m, lock_class_t* lock_class);
+
+// Instrumented version of arch_spin_lock(), used by spin_lock().
+void lockstat_spin_lock(spin_lock_t* lock) TA_ACQ(lock);
+
+// Count one acquisition of a lock in |lock_class|, which waited for |wait_time|
+// if |contended|.
+void lockstat_record(lock_class_t* lock_class, bool contended, zx_duration_t wait_time);
+
+// Call |func| on every class that has a lock in it. Classes are never removed.
+void lockstat_for_each_class(void (*func)(const lock_class_t* lock_class, void* arg), void* arg);
+
+#define LOCK_CLASS_SPIN(lock, name)                                             \
+    do {                                                                        \
+        static lock_class_t lockstat_class_ = LOCK_CLASS_INITIAL_VALUE(name);   \
+        lockstat_set_spin_class((lock), &lockstat_class_);                      \
+    } while (0)
+
+#define LOCK_CLASS_MUTEX(m, name)                                               \
+    do {                                                                        \
+        static lock_class_t lockstat_class_ = LOCK_CLASS_INITIAL_VALUE(name);   \
+        lockstat_set_mutex_class((m), &lockstat_class_);                        \
+    } while (0)
+
+#else // ENABLE_LOCK_STATS
+
+#define LOCK_CLASS_SPIN(lock, name) \
+    do {                            \
+    } while (0)
+#define LOCK_CLASS_MUTEX(m, name) \
+    do {                          \
+    } while (0)
+
+#endif // ENABLE_LOCK_STATS
+
+__END_CDECLS
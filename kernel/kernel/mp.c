@@ -47,6 +47,16 @@ void mp_init(void) {
     }
 }
 
+void mp_set_cpu_topology(cpu_num_t cpu, cpu_mask_t smt_siblings, cpu_mask_t cache_siblings) {
+    DEBUG_ASSERT(is_valid_cpu_num(cpu));
+
+    /* a core is always contained within its cache domain */
+    mp.smt_siblings[cpu] = smt_siblings;
+    mp.cache_siblings[cpu] = cache_siblings | smt_siblings;
+
+    LTRACEF("cpu %u smt %#x cache %#x\n", cpu, mp.smt_siblings[cpu], mp.cache_siblings[cpu]);
+}
+
 void mp_prepare_current_cpu_idle_state(bool idle) {
     arch_prepare_current_cpu_idle_state(idle);
 }
@@ -221,6 +231,7 @@ static void mp_unplug_trampoline(void) TA_REQ(thread_lock) __NO_RETURN;
 static void mp_unplug_trampoline(void) {
     /* We're still holding the thread lock from the reschedule that took us
      * here. */
+    sched_finish_switch();
 
     thread_t* ct = get_current_thread();
     event_t* unplug_done = ct->arg;
@@ -20,14 +20,55 @@
 #include <debug.h>
 #include <err.h>
 #include <inttypes.h>
+#include <kernel/cmdline.h>
+#include <kernel/mp.h>
+#include <kernel/percpu.h>
 #include <kernel/sched.h>
 #include <kernel/thread.h>
+#include <lib/counters.h>
 #include <lib/ktrace.h>
+#include <lib/lockstat.h>
+#include <lk/init.h>
+#include <platform.h>
 #include <trace.h>
 #include <zircon/types.h>
 
 #define LOCAL_TRACE 0
 
+/* default for how long a contended acquire spins while the holder is running on another cpu
+ * before blocking, overridable with kernel.mutex.spin-max-ns */
+#define MUTEX_SPIN_MAX_DEFAULT ZX_USEC(20)
+
+static zx_duration_t mutex_spin_max = MUTEX_SPIN_MAX_DEFAULT;
+
+// counts contended acquires that got the mutex by spinning.
+KCOUNTER(mutex_spin_acquired, "kernel.mutex.spin.acquired");
+// counts contended acquires that spun without getting the mutex.
+KCOUNTER(mutex_spin_failed, "kernel.mutex.spin.failed");
+// counts acquires that blocked on the wait queue.
+KCOUNTER(mutex_blocked, "kernel.mutex.blocked");
+
+#if ENABLE_LOCK_STATS
+/* when an acquire of |m| first found it held, 0 if it has not yet or |m| is not counted */
+static inline zx_time_t mutex_contention_start(const mutex_t* m, zx_time_t since) {
+    return (m->lock_class != NULL && since == 0) ? current_time() : since;
+}
+
+static inline void mutex_lockstat_record(const mutex_t* m, zx_time_t contended_since) {
+    if (m->lock_class != NULL) {
+        bool contended = (contended_since != 0);
+        lockstat_record(m->lock_class, contended, contended ? current_time() - contended_since : 0);
+    }
+}
+#else
+static inline zx_time_t mutex_contention_start(const mutex_t* m, zx_time_t since) {
+    return 0;
+}
+
+static inline void mutex_lockstat_record(const mutex_t* m, zx_time_t contended_since) {
+}
+#endif
+
 /**
  * @brief  Initialize a mutex_t
  */
@@ -59,6 +100,66 @@ void mutex_destroy(mutex_t* m) {
     wait_queue_destroy(&m->wait);
 }
 
+/* the cpu |t| is running on, or INVALID_CPU if it is not running. |t| may be exiting and
+ * is never dereferenced, only compared against what each cpu is running. */
+static cpu_num_t mutex_running_cpu(thread_t* t) {
+    cpu_mask_t cpus = mp_get_active_mask();
+    while (cpus) {
+        cpu_num_t cpu = lowest_cpu_set(cpus);
+        cpus &= ~cpu_num_to_mask(cpu);
+        if (__atomic_load_n(&percpu[cpu].curr_thread, __ATOMIC_RELAXED) == t)
+            return cpu;
+    }
+    return INVALID_CPU;
+}
+
+/* spin trying to take |m| for as long as it is held, without waiters, by a thread that is
+ * running on another cpu, up to mutex_spin_max. a holder that is running is likely to
+ * release the mutex in less time than it takes to block and be woken up again.
+ *
+ * the holder is only known by the pointer in m->val and may exit and be freed while we
+ * spin, so it is never dereferenced. whether it is running is decided by finding it in a
+ * cpu's curr_thread, and that answer only stands while m->val still names the same holder.
+ */
+static bool mutex_spin(mutex_t* m, thread_t* ct) {
+    zx_time_t deadline = ZX_TIME_INFINITE;
+    uintptr_t holder = 0;
+    cpu_num_t holder_cpu = INVALID_CPU;
+
+    for (;;) {
+        uintptr_t val = mutex_val(m);
+        if (val == 0) {
+            if (atomic_cmpxchg_u64(&m->val, &val, (uintptr_t)ct))
+                return true;
+            continue;
+        }
+
+        /* with waiters queued, a release hands the mutex straight to one of them */
+        if (val & MUTEX_FLAG_QUEUED)
+            return false;
+
+        /* the mutex changed hands, look for where the new holder is running */
+        if (val != holder) {
+            holder = val;
+            holder_cpu = mutex_running_cpu((thread_t*)holder);
+        }
+
+        if (holder_cpu == INVALID_CPU || ct->preempt_pending ||
+            __atomic_load_n(&percpu[holder_cpu].curr_thread, __ATOMIC_RELAXED) !=
+                (thread_t*)holder)
+            return false;
+
+        zx_time_t now = current_time();
+        if (deadline == ZX_TIME_INFINITE) {
+            deadline = now + mutex_spin_max;
+        } else if (now >= deadline) {
+            return false;
+        }
+
+        arch_spinloop_pause();
+    }
+}
+
 /**
  * @brief  Acquire the mutex
  */
@@ -68,6 +169,10 @@ void mutex_acquire(mutex_t* m) TA_NO_THREAD_SAFETY_ANALYSIS {
 
     thread_t* ct = get_current_thread();
     uintptr_t oldval;
+    zx_time_t contended_since = 0;
+    // only spin on the first contended attempt, so that each acquire spins at
+    // most once and counts once in the spin counters.
+    bool spun = false;
 
 retry:
     // fast path: assume its unheld, try to grab it
@@ -75,16 +180,31 @@ retry:
     if (likely(atomic_cmpxchg_u64(&m->val, &oldval, (uintptr_t)ct))) {
         // acquired it cleanly
         ct->mutexes_held++;
+        mutex_lockstat_record(m, contended_since);
         return;
     }
 
+    contended_since = mutex_contention_start(m, contended_since);
+
 #if LK_DEBUGLEVEL > 0
     if (unlikely(ct == mutex_holder(m)))
         panic("mutex_acquire: thread %p (%s) tried to acquire mutex %p it already owns.\n",
               ct, ct->name, m);
 #endif
 
-    // we contended with someone else, will probably need to block
+    // we contended with someone else, see if the holder lets go soon
+    if (mutex_spin_max > 0 && !spun) {
+        spun = true;
+        if (mutex_spin(m, ct)) {
+            kcounter_add(mutex_spin_acquired, 1u);
+            ct->mutexes_held++;
+            mutex_lockstat_record(m, contended_since);
+            return;
+        }
+        kcounter_add(mutex_spin_failed, 1u);
+    }
+
+    // will probably need to block
     THREAD_LOCK(state);
 
     // save the current state and check to see if it wasn't released in the interim
@@ -101,6 +221,8 @@ retry:
         goto retry;
     }
 
+    kcounter_add(mutex_blocked, 1u);
+
     // have the holder inherit our priority
     // discard the local reschedule flag because we're just about to block anyway
     bool unused;
@@ -122,6 +244,8 @@ retry:
     ct->mutexes_held++;
 
     THREAD_UNLOCK(state);
+
+    mutex_lockstat_record(m, contended_since);
 }
 
 // shared implementation of release
@@ -230,3 +354,15 @@ void mutex_release_thread_locked(mutex_t* m, bool reschedule) TA_NO_THREAD_SAFET
     // the thread_lock
     mutex_release_internal(m, reschedule, true);
 }
+
+zx_duration_t mutex_set_spin_max(zx_duration_t spin_max) {
+    zx_duration_t old = mutex_spin_max;
+    mutex_spin_max = spin_max;
+    return old;
+}
+
+static void mutex_spin_init(uint level) {
+    mutex_spin_max = cmdline_get_uint64("kernel.mutex.spin-max-ns", MUTEX_SPIN_MAX_DEFAULT);
+}
+
+LK_INIT_HOOK(mutex_spin, mutex_spin_init, LK_INIT_LEVEL_PLATFORM_EARLY);
@@ -15,6 +15,7 @@ MODULE_DEPS := \
 	kernel/lib/explicit-memory \
 	kernel/lib/heap \
 	kernel/lib/libc \
+	kernel/lib/lockstat \
 	kernel/lib/fbl \
 	kernel/vm
 
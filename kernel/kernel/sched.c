@@ -10,11 +10,15 @@
 #include <debug.h>
 #include <err.h>
 #include <inttypes.h>
+#include <kernel/cmdline.h>
 #include <kernel/mp.h>
 #include <kernel/percpu.h>
+#include <kernel/sched_bandwidth.h>
 #include <kernel/thread.h>
+#include <lib/counters.h>
 #include <lib/ktrace.h>
 #include <list.h>
+#include <lk/init.h>
 #include <platform.h>
 #include <printf.h>
 #include <string.h>
@@ -52,6 +56,25 @@
 /* threads get 10ms to run before they use up their time slice and the scheduler is invoked */
 #define THREAD_INITIAL_TIME_SLICE ZX_MSEC(10)
 
+// counts threads placed on a different cpu than the one they last ran on, whether
+// when they are made ready or when another cpu steals them.
+KCOUNTER(sched_migrations, "kernel.sched.migrations");
+// counts threads pulled out of another cpu's run queue by an idle cpu.
+KCOUNTER(sched_idle_steals, "kernel.sched.steal.idle");
+// counts threads pulled out of another cpu's run queue at time slice expiration.
+KCOUNTER(sched_periodic_steals, "kernel.sched.steal.periodic");
+// counts idle cpus kicked by a cpu with waiting threads.
+KCOUNTER(sched_idle_kicks, "kernel.sched.idle_kicks");
+// counts deadline threads that were still runnable when their deadline passed.
+KCOUNTER(sched_deadline_misses, "kernel.sched.deadline.missed");
+// counts deadline threads throttled for using up their runtime before the end of a period.
+KCOUNTER(sched_deadline_throttles, "kernel.sched.deadline.throttled");
+// counts cpu bandwidth groups throttled for running over their quota.
+KCOUNTER(sched_bandwidth_throttles, "kernel.sched.bandwidth.throttled");
+
+/* true if the fair scheduling policy was selected on the command line, see below */
+static bool sched_fair = false;
+
 static bool local_migrate_if_needed(thread_t* curr_thread);
 
 /* compute the effective priority of a thread */
@@ -67,7 +90,7 @@ static void compute_effec_priority(thread_t* t) {
 
 /* boost the priority of the thread by +1 */
 static void boost_thread(thread_t* t) {
-    if (NO_BOOST)
+    if (NO_BOOST || sched_fair)
         return;
 
     if (unlikely(thread_is_real_time_or_idle(t)))
@@ -85,7 +108,7 @@ static void boost_thread(thread_t* t) {
  * then allow the boost to go negative, otherwise only deboost to 0.
  */
 static void deboost_thread(thread_t* t, bool quantum_expiration) {
-    if (NO_BOOST)
+    if (NO_BOOST || sched_fair)
         return;
 
     if (unlikely(thread_is_real_time_or_idle(t)))
@@ -141,6 +164,46 @@ static cpu_mask_t rand_cpu(cpu_mask_t mask) {
     }
 }
 
+/* of the cpus in |idle_mask|, return the ones whose smt siblings are all idle too */
+static cpu_mask_t idle_core_mask(cpu_mask_t idle_mask) {
+    cpu_mask_t result = 0;
+    cpu_mask_t remaining = idle_mask;
+    while (remaining) {
+        cpu_num_t cpu = lowest_cpu_set(remaining);
+        cpu_mask_t siblings = mp_get_smt_siblings(cpu);
+        remaining &= ~siblings;
+
+        if ((siblings & ~idle_mask) == 0)
+            result |= siblings;
+    }
+    return result & idle_mask;
+}
+
+/* pick one of the idle cpus in |idle_cpu_mask| for |t|, in order of preference:
+ *  - a fully idle core sharing the last level cache with the waker or the thread's last cpu
+ *  - any idle cpu sharing the last level cache with the waker or the thread's last cpu
+ *  - a fully idle core anywhere, so we don't stack busy threads on smt siblings
+ *  - any idle cpu
+ */
+static cpu_mask_t find_idle_cpu_by_topology(thread_t* t, cpu_mask_t idle_cpu_mask) {
+    cpu_mask_t cache_mask = mp_get_cache_siblings(arch_curr_cpu_num()) |
+                            mp_get_cache_siblings(t->last_cpu);
+    cpu_mask_t idle_cores = idle_core_mask(idle_cpu_mask);
+
+    const cpu_mask_t preferences[] = {
+        idle_cores & cache_mask,
+        idle_cpu_mask & cache_mask,
+        idle_cores,
+    };
+    for (size_t i = 0; i < countof(preferences); i++) {
+        cpu_mask_t mask = rand_cpu(preferences[i]);
+        if (mask != 0)
+            return mask;
+    }
+
+    return rand_cpu(idle_cpu_mask);
+}
+
 /* find a cpu to wake up */
 static cpu_mask_t find_cpu_mask(thread_t* t) {
     /* get the last cpu the thread ran on */
@@ -171,9 +234,9 @@ static cpu_mask_t find_cpu_mask(thread_t* t) {
             return last_ran_cpu_mask;
         }
 
-        /* pick an idle_cpu */
+        /* pick an idle_cpu, using the topology to prefer one that stays warm */
         DEBUG_ASSERT((idle_cpu_mask & mp_get_active_mask()) == idle_cpu_mask);
-        return rand_cpu(idle_cpu_mask);
+        return find_idle_cpu_by_topology(t, idle_cpu_mask);
     }
 
     /* no idle cpus in our affinity mask */
@@ -200,37 +263,620 @@ static cpu_mask_t find_cpu_mask(thread_t* t) {
     return mask;
 }
 
-/* run queue manipulation */
-static void insert_in_run_queue_head(cpu_num_t cpu, thread_t* t) {
+/* return the highest priority with a non empty queue in the bitmap, or -1 if there is none */
+static int highest_run_queue_priority(uint32_t bitmap) {
+    if (bitmap == 0)
+        return -1;
+
+    return HIGHEST_PRIORITY - __builtin_clz(bitmap) -
+           (sizeof(bitmap) * CHAR_BIT - NUM_PRIORITIES);
+}
+
+/* fair scheduling policy
+ *
+ * selected with kernel.sched.policy=fair. instead of the priority indexed run queues,
+ * each cpu keeps its ready threads in a pairing heap ordered by virtual runtime: the
+ * time a thread has run, scaled down by a weight derived from its effective priority.
+ * the thread with the least virtual runtime runs next, so cpu time is shared between
+ * runnable threads in proportion to their weights. priority boosting is disabled in
+ * this mode. the heap gives O(1) insertion and amortized O(log n) removal.
+ *
+ * in this mode run_queue_bitmap is only used as a non zero marker for a non empty queue.
+ */
+/* weights for each priority; DEFAULT_PRIORITY is 1024 and each level is 1.25x the one below */
+static const uint32_t fair_prio_to_weight[NUM_PRIORITIES] = {
+    29, 36, 45, 56, 70, 88, 110, 137,
+    172, 215, 268, 336, 419, 524, 655, 819,
+    1024, 1280, 1600, 2000, 2500, 3125, 3906, 4883,
+    6104, 7629, 9537, 11921, 14901, 18626, 23283, 29104,
+};
+static_assert(NUM_PRIORITIES == 32, "fair_prio_to_weight needs updating");
+
+#define FAIR_WEIGHT_DEFAULT 1024u
+
+/* a thread that wakes up or moves between cpus is placed no further than this before the
+ * minimum virtual runtime of its new queue, so that sleeping does not bank unbounded credit */
+#define FAIR_PLACEMENT_CREDIT (THREAD_INITIAL_TIME_SLICE / 2)
+
+/* how many threads near the top of a remote heap a stealing cpu looks at */
+#define FAIR_STEAL_SCAN 8
+
+/* virtual runtimes are compared with wraparound */
+static inline bool fair_vruntime_before(uint64_t a, uint64_t b) {
+    return (int64_t)(a - b) < 0;
+}
+
+static thread_t* fair_meld(thread_t* a, thread_t* b) {
+    if (!a)
+        return b;
+    if (!b)
+        return a;
+
+    if (fair_vruntime_before(b->fair_vruntime, a->fair_vruntime)) {
+        thread_t* tmp = a;
+        a = b;
+        b = tmp;
+    }
+
+    /* b becomes the leftmost child of a */
+    b->fair_sibling = a->fair_child;
+    if (a->fair_child)
+        a->fair_child->fair_prev = b;
+    b->fair_prev = a;
+    a->fair_child = b;
+    a->fair_sibling = NULL;
+    a->fair_prev = NULL;
+    return a;
+}
+
+/* standard two pass pairing of a list of sibling subheaps into a single heap */
+static thread_t* fair_merge_pairs(thread_t* first) {
+    /* first pass, left to right: meld adjacent pairs, stacking the results */
+    thread_t* stack = NULL;
+    while (first) {
+        thread_t* a = first;
+        thread_t* b = a->fair_sibling;
+        first = b ? b->fair_sibling : NULL;
+
+        a->fair_sibling = a->fair_prev = NULL;
+        if (b)
+            b->fair_sibling = b->fair_prev = NULL;
+
+        thread_t* m = fair_meld(a, b);
+        m->fair_sibling = stack;
+        stack = m;
+    }
+
+    /* second pass, right to left: meld everything into the last result */
+    thread_t* root = NULL;
+    while (stack) {
+        thread_t* next = stack->fair_sibling;
+        stack->fair_sibling = NULL;
+        root = fair_meld(root, stack);
+        stack = next;
+    }
+    return root;
+}
+
+static void fair_enqueue(struct percpu* c, cpu_num_t cpu, thread_t* t) {
+    /* keep the thread within reach of the queue's current minimum */
+    uint64_t floor = c->fair_min_vruntime - FAIR_PLACEMENT_CREDIT;
+    if (fair_vruntime_before(t->fair_vruntime, floor)) {
+        t->fair_vruntime = floor;
+    } else if (t->last_cpu != cpu &&
+               fair_vruntime_before(c->fair_min_vruntime, t->fair_vruntime)) {
+        /* coming from another cpu whose clock ran ahead, don't penalize it here */
+        t->fair_vruntime = c->fair_min_vruntime;
+    }
+
+    t->fair_child = t->fair_sibling = t->fair_prev = NULL;
+    c->fair_queue = fair_meld(c->fair_queue, t);
+    c->fair_queue_len++;
+}
+
+static void fair_dequeue(struct percpu* c, thread_t* t) {
+    DEBUG_ASSERT(c->fair_queue_len > 0);
+
+    if (t == c->fair_queue) {
+        c->fair_queue = fair_merge_pairs(t->fair_child);
+    } else {
+        /* unlink t from its parent or left sibling, then fold its children back in */
+        DEBUG_ASSERT(t->fair_prev);
+        if (t->fair_prev->fair_child == t) {
+            t->fair_prev->fair_child = t->fair_sibling;
+        } else {
+            t->fair_prev->fair_sibling = t->fair_sibling;
+        }
+        if (t->fair_sibling)
+            t->fair_sibling->fair_prev = t->fair_prev;
+
+        c->fair_queue = fair_meld(c->fair_queue, fair_merge_pairs(t->fair_child));
+    }
+    t->fair_child = t->fair_sibling = t->fair_prev = NULL;
+    c->fair_queue_len--;
+}
+
+static thread_t* fair_pop(struct percpu* c) {
+    thread_t* t = c->fair_queue;
+    if (!t)
+        return NULL;
+
+    fair_dequeue(c, t);
+
+    /* the queue's clock only moves forward */
+    if (fair_vruntime_before(c->fair_min_vruntime, t->fair_vruntime))
+        c->fair_min_vruntime = t->fair_vruntime;
+    return t;
+}
+
+/* deadline scheduling class
+ *
+ * a thread given a deadline profile reserves |runtime| of cpu time in every |period|, to
+ * be delivered within |deadline| of the start of the period. admission control pins it
+ * to a cpu whose total reserved density (runtime / deadline) stays within
+ * DEADLINE_MAX_DENSITY, leaving the rest of that cpu for the normal classes. on each cpu,
+ * ready deadline threads run ahead of every priority band, earliest absolute deadline
+ * first. a thread that uses up its budget, or still has some left when its deadline
+ * passes, is throttled until its next period begins. deadline threads are expected to
+ * be few per cpu, so they sit in an unsorted list that is scanned on every pick.
+ */
+#define DEADLINE_DENSITY_SCALE (1u << 20)
+#define DEADLINE_MAX_DENSITY (DEADLINE_DENSITY_SCALE / 100 * 95)
+
+/* bounds the period so that density computations fit in 64 bits */
+#define DEADLINE_MAX_PERIOD ZX_SEC(10)
+
+static void deadline_new_period(thread_t* t, zx_time_t start) {
+    t->deadline_period_start = start;
+    t->deadline_abs = start + t->deadline_relative;
+    t->deadline_budget = t->deadline_runtime;
+}
+
+/* a deadline thread waking up after the end of its period starts a new one. one waking
+ * up past its deadline but within its period has nothing left to be owed in this period,
+ * so it waits for the next one.
+ */
+static void deadline_activate(thread_t* t) {
+    if (!thread_is_deadline(t))
+        return;
+
+    zx_time_t now = current_time();
+    if (now >= t->deadline_period_start + t->deadline_period) {
+        deadline_new_period(t, now);
+    } else if (now >= t->deadline_abs) {
+        t->deadline_budget = 0;
+    }
+}
+
+static void deadline_missed(thread_t* t, cpu_num_t cpu, zx_time_t now) {
+    zx_duration_t lateness = now - t->deadline_abs;
+
+    kcounter_add(sched_deadline_misses, 1u);
+    ktrace(TAG_DEADLINE_MISS, (uint32_t)t->user_tid, cpu,
+           (uint32_t)lateness, (uint32_t)(lateness >> 32));
+}
+
+/* charge the running deadline thread |t|. a thread still owed time when its deadline
+ * passes has overrun it: the rest of its budget lapses, and it is throttled until its
+ * next period like one that used it all up.
+ */
+static void deadline_charge(thread_t* t, zx_duration_t delta, zx_time_t now) {
+    if (t->deadline_budget <= 0)
+        return;
+
+    t->deadline_budget -= delta;
+    if (t->deadline_budget <= 0) {
+        kcounter_add(sched_deadline_throttles, 1u);
+    } else if (now >= t->deadline_abs) {
+        deadline_missed(t, arch_curr_cpu_num(), now);
+        t->deadline_budget = 0;
+    }
+}
+
+/* the time at which running deadline thread |t| runs out of budget or overruns its
+ * deadline, whichever comes first, if it keeps running from |since| */
+static zx_time_t deadline_budget_end(thread_t* t, zx_time_t since) {
+    return MIN(since + t->deadline_budget, t->deadline_abs);
+}
+
+/* choose the ready deadline thread with the earliest deadline on |c| and take it off the
+ * queue. along the way, throttle threads that overran their deadline while waiting, give
+ * throttled threads whose next period has begun a fresh budget, and note when the next
+ * throttled thread will be replenished. budgets are never handed out ahead of a thread's
+ * next period, so no thread gets more than it was admitted with. run_queue_lock must be
+ * held.
+ */
+static thread_t* deadline_pick_locked(struct percpu* c, cpu_num_t cpu, zx_time_t now) {
+    thread_t* best = NULL;
+    zx_time_t next_replenish = ZX_TIME_INFINITE;
+
+    thread_t* t;
+    list_for_every_entry (&c->deadline_queue, t, thread_t, queue_node) {
+        if (t->deadline_budget > 0 && t->deadline_abs <= now) {
+            deadline_missed(t, cpu, now);
+            t->deadline_budget = 0;
+        }
+
+        if (t->deadline_budget <= 0) {
+            zx_time_t next_period = t->deadline_period_start + t->deadline_period;
+            if (now < next_period) {
+                next_replenish = MIN(next_replenish, next_period);
+                continue;
+            }
+            /* start over from now if the whole of the next window has gone by already */
+            deadline_new_period(t, (now < next_period + t->deadline_relative) ? next_period : now);
+        }
+
+        if (!best || best->deadline_abs > t->deadline_abs)
+            best = t;
+    }
+
+    c->deadline_next_replenish = next_replenish;
+    if (best)
+        list_delete(&best->queue_node);
+    return best;
+}
+
+/* cpu bandwidth groups
+ *
+ * time is charged to a thread's groups whenever the scheduler charges the running thread,
+ * which is at least once per time slice. periods are moved on lazily, as time is charged.
+ * a group found over its quota is marked throttled and its threads are parked on it as
+ * they come up in a run queue; a thread still running elsewhere is stopped at its next
+ * preemption timer tick. only then is the group's timer armed, for the end of the
+ * period, to pay back the quota and put the parked threads back in the run queues, so
+ * groups that stay under their quota, or are idle, take no timer interrupts.
+ * idle, real time and deadline threads are never throttled.
+ */
+#define BANDWIDTH_MIN_PERIOD ZX_MSEC(1)
+#define BANDWIDTH_MAX_PERIOD ZX_SEC(1)
+
+static bool bandwidth_applies(thread_t* t) {
+    return t->bandwidth && !thread_is_real_time_or_idle(t) && !thread_is_deadline(t);
+}
+
+/* move limited group |b| on to the period |now| falls in, paying back its quota for every
+ * period that has ended. time used past the quota is paid back out of the new period.
+ */
+static void bandwidth_roll_period(sched_bandwidth_t* b, zx_time_t now) {
+    if (now < b->period_end)
+        return;
+
+    uint64_t periods = (uint64_t)(now - b->period_end) / (uint64_t)b->period + 1;
+    if (periods > (uint64_t)(b->usage / b->quota)) {
+        b->usage = 0;
+    } else {
+        b->usage -= (zx_duration_t)periods * b->quota;
+    }
+    b->period_end += (zx_duration_t)periods * b->period;
+}
+
+static void bandwidth_refill(timer_t* timer, zx_time_t now, void* arg);
+
+/* arm |b|'s timer for the end of its current period. a refill callback that has just
+ * ended an earlier throttling may still be finishing on another cpu, so cancel it first.
+ */
+static void bandwidth_arm_refill(sched_bandwidth_t* b) {
+    timer_cancel(&b->refill_timer);
+    timer_set_oneshot(&b->refill_timer, b->period_end, bandwidth_refill, b);
+}
+
+static void bandwidth_charge(thread_t* t, zx_duration_t delta, zx_time_t now) {
+    for (sched_bandwidth_t* b = t->bandwidth; b; b = b->parent) {
+        b->total_runtime += delta;
+        if (b->quota == 0)
+            continue;
+
+        bandwidth_roll_period(b, now);
+        b->usage += delta;
+        if (!b->throttled && b->usage >= b->quota) {
+            b->throttled = true;
+            b->throttled_since = now;
+            b->throttled_count++;
+            kcounter_add(sched_bandwidth_throttles, 1u);
+            bandwidth_arm_refill(b);
+        }
+    }
+}
+
+/* the innermost throttled group |t| belongs to, or NULL if it may run */
+static sched_bandwidth_t* bandwidth_throttled_group(thread_t* t) {
+    if (likely(!bandwidth_applies(t)))
+        return NULL;
+
+    for (sched_bandwidth_t* b = t->bandwidth; b; b = b->parent) {
+        if (b->throttled)
+            return b;
+    }
+    return NULL;
+}
+
+/* park ready thread |t|, just taken off a run queue, if one of its groups is throttled */
+static bool bandwidth_park_if_throttled(thread_t* t) {
+    sched_bandwidth_t* b = bandwidth_throttled_group(t);
+    if (likely(!b))
+        return false;
+
+    DEBUG_ASSERT(t->state == THREAD_READY);
+    t->bandwidth_parked = b;
+    list_add_tail(&b->throttled_threads, &t->queue_node);
+    return true;
+}
+
+static void find_cpu_and_insert(thread_t* t, bool* local_resched, cpu_mask_t* accum_cpu_mask);
+
+/* end the throttling of |b| and put its parked threads back in the run queues. threads
+ * that are still held back by another group get parked there the next time they are picked.
+ */
+static void bandwidth_unthrottle(sched_bandwidth_t* b, zx_time_t now, bool* local_resched) {
+    b->throttled = false;
+    b->throttled_time += now - b->throttled_since;
+
+    cpu_mask_t accum_cpu_mask = 0;
+    thread_t* t;
+    while ((t = list_remove_head_type(&b->throttled_threads, thread_t, queue_node)) != NULL) {
+        t->bandwidth_parked = NULL;
+        find_cpu_and_insert(t, local_resched, &accum_cpu_mask);
+    }
+
+    if (accum_cpu_mask)
+        mp_reschedule(accum_cpu_mask, 0);
+}
+
+/* the end of the period of a throttled group: unthrottle it, or wait for the end of the
+ * next period if it is still over its quota after the payback */
+static void bandwidth_refill(timer_t* timer, zx_time_t now, void* arg) TA_NO_THREAD_SAFETY_ANALYSIS {
+    sched_bandwidth_t* b = (sched_bandwidth_t*)arg;
+
+    /* sched_bandwidth_set() and bandwidth_arm_refill() may be cancelling this timer while
+     * holding the thread_lock */
+    if (timer_trylock_or_cancel(timer, &thread_lock))
+        return;
+
+    DEBUG_ASSERT(b->throttled);
+    bandwidth_roll_period(b, now);
+
+    bool local_resched = false;
+    if (b->usage < b->quota) {
+        bandwidth_unthrottle(b, now, &local_resched);
+    } else {
+        timer_set_oneshot(timer, b->period_end, bandwidth_refill, b);
+    }
+
+    if (local_resched)
+        sched_reschedule();
+
+    spin_unlock(&thread_lock);
+}
+
+void sched_bandwidth_init(sched_bandwidth_t* b, sched_bandwidth_t* parent) {
+    memset(b, 0, sizeof(*b));
+    b->parent = parent;
+    list_initialize(&b->throttled_threads);
+    timer_init(&b->refill_timer);
+}
+
+void sched_bandwidth_destroy(sched_bandwidth_t* b) {
+    THREAD_LOCK(state);
+
+    DEBUG_ASSERT(list_is_empty(&b->throttled_threads));
+    timer_cancel(&b->refill_timer);
+
+    THREAD_UNLOCK(state);
+}
+
+zx_status_t sched_bandwidth_set(sched_bandwidth_t* b, zx_duration_t quota, zx_duration_t period) {
+    if (quota < 0)
+        return ZX_ERR_INVALID_ARGS;
+    if (quota > 0) {
+        if (period < BANDWIDTH_MIN_PERIOD || period > BANDWIDTH_MAX_PERIOD)
+            return ZX_ERR_INVALID_ARGS;
+        /* more than one cpu's worth of time is fine, more than every cpu's is not */
+        if (quota > period * (zx_duration_t)arch_max_num_cpus())
+            return ZX_ERR_OUT_OF_RANGE;
+    } else {
+        period = 0;
+    }
+
+    THREAD_LOCK(state);
+
+    timer_cancel(&b->refill_timer);
+
+    zx_time_t now = current_time();
+    b->quota = quota;
+    b->period = period;
+    b->period_end = now + period;
+    b->usage = 0;
+
+    bool local_resched = false;
+    if (b->throttled)
+        bandwidth_unthrottle(b, now, &local_resched);
+
+    if (local_resched)
+        sched_reschedule();
+
+    THREAD_UNLOCK(state);
+
+    return ZX_OK;
+}
+
+void sched_bandwidth_get_info(sched_bandwidth_t* b, sched_bandwidth_info_t* info) {
+    THREAD_LOCK(state);
+
+    info->quota = b->quota;
+    info->period = b->period;
+    info->total_runtime = b->total_runtime;
+    info->throttled_time = b->throttled_time;
+    info->throttled_count = b->throttled_count;
+    info->throttled = b->throttled;
+    if (b->throttled)
+        info->throttled_time += current_time() - b->throttled_since;
+
+    THREAD_UNLOCK(state);
+}
+
+/* charge the running thread |t| for the time since it was last charged: to its virtual
+ * runtime under the fair policy, its deadline budget, and its cpu bandwidth groups
+ */
+static void sched_charge_current(thread_t* t) {
+    if (thread_is_idle(t))
+        return;
+
+    zx_time_t now = current_time();
+    DEBUG_ASSERT(now >= t->last_accounted);
+    zx_duration_t delta = now - t->last_accounted;
+    t->last_accounted = now;
+
+    if (sched_fair)
+        t->fair_vruntime += delta * FAIR_WEIGHT_DEFAULT / fair_prio_to_weight[t->effec_priority];
+    if (thread_is_deadline(t))
+        deadline_charge(t, delta, now);
+    if (t->bandwidth)
+        bandwidth_charge(t, delta, now);
+}
+
+/* run queue manipulation
+ *
+ * each cpu's run queue is protected by its own run_queue_lock. every access to a run
+ * queue goes through the routines below, which take the lock of the cpu owning the
+ * queue, whether or not that is the local cpu. while a thread waits in a run queue,
+ * its curr_cpu is only changed with that queue's lock held.
+ *
+ * the run queue locks only let work stealing and balancing move ready threads between
+ * queues holding just the two run queue locks involved. every other path, wakeups,
+ * blocking, rescheduling and migration, still runs under thread_lock, which also
+ * guards thread state and the wait queues, and takes the run queue lock nested inside
+ * it. so wakeups on different cpus still serialize on thread_lock, and each of those
+ * enqueues and dequeues pays for the extra run queue lock.
+ */
+static void insert_in_run_queue_locked(struct percpu* c, cpu_num_t cpu, thread_t* t, int pri,
+                                       bool head) {
+    DEBUG_ASSERT(spin_lock_held(&c->run_queue_lock));
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
 
-    list_add_head(&percpu[cpu].run_queue[t->effec_priority], &t->queue_node);
-    percpu[cpu].run_queue_bitmap |= (1u << t->effec_priority);
+    if (thread_is_deadline(t)) {
+        list_add_tail(&c->deadline_queue, &t->queue_node);
+    } else if (sched_fair) {
+        /* position in the queue is decided by virtual runtime alone */
+        fair_enqueue(c, cpu, t);
+        c->run_queue_bitmap = 1;
+    } else {
+        if (head) {
+            list_add_head(&c->run_queue[pri], &t->queue_node);
+        } else {
+            list_add_tail(&c->run_queue[pri], &t->queue_node);
+        }
+        c->run_queue_bitmap |= (1u << pri);
+    }
 
     /* mark the cpu as busy since the run queue now has at least one item in it */
     mp_set_cpu_busy(cpu);
 }
 
+static void insert_in_run_queue(cpu_num_t cpu, thread_t* t, bool head) {
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    struct percpu* c = &percpu[cpu];
+    spin_lock(&c->run_queue_lock);
+    insert_in_run_queue_locked(c, cpu, t, t->effec_priority, head);
+    spin_unlock(&c->run_queue_lock);
+}
+
+static void insert_in_run_queue_head(cpu_num_t cpu, thread_t* t) {
+    insert_in_run_queue(cpu, t, true);
+}
+
 static void insert_in_run_queue_tail(cpu_num_t cpu, thread_t* t) {
-    DEBUG_ASSERT(!list_in_list(&t->queue_node));
+    insert_in_run_queue(cpu, t, false);
+}
+
+/* lock the run queue ready thread |t| is waiting in. a stealing cpu may move the thread
+ * to its own queue while we wait for the lock, so check it is still there once held.
+ */
+static struct percpu* lock_thread_run_queue(thread_t* t) {
+    for (;;) {
+        cpu_num_t cpu = __atomic_load_n(&t->curr_cpu, __ATOMIC_RELAXED);
+        DEBUG_ASSERT(is_valid_cpu_num(cpu));
+
+        struct percpu* c = &percpu[cpu];
+        spin_lock(&c->run_queue_lock);
+        if (likely(t->curr_cpu == cpu))
+            return c;
+        spin_unlock(&c->run_queue_lock);
+    }
+}
 
-    list_add_tail(&percpu[cpu].run_queue[t->effec_priority], &t->queue_node);
-    percpu[cpu].run_queue_bitmap |= (1u << t->effec_priority);
+/* pull a ready thread out of the run queue of the cpu it is waiting on.
+ * |pri| is the priority the thread was queued at, which may differ from its
+ * current effective priority if it is in the middle of being changed.
+ */
+static void remove_from_run_queue(thread_t* t, int pri) {
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
 
-    /* mark the cpu as busy since the run queue now has at least one item in it */
-    mp_set_cpu_busy(cpu);
+    /* a parked thread is not in any run queue */
+    if (unlikely(t->bandwidth_parked)) {
+        list_delete(&t->queue_node);
+        t->bandwidth_parked = NULL;
+        return;
+    }
+
+    struct percpu* c = lock_thread_run_queue(t);
+
+    DEBUG_ASSERT_MSG(list_in_list(&t->queue_node) || (sched_fair && !thread_is_deadline(t)),
+                     "thread %p name %s curr_cpu %u\n", t, t->name, t->curr_cpu);
+
+    if (thread_is_deadline(t)) {
+        list_delete(&t->queue_node);
+    } else if (sched_fair) {
+        fair_dequeue(c, t);
+        if (c->fair_queue_len == 0)
+            c->run_queue_bitmap = 0;
+    } else {
+        list_delete(&t->queue_node);
+        if (list_is_empty(&c->run_queue[pri])) {
+            c->run_queue_bitmap &= ~(1u << pri);
+        }
+    }
+
+    spin_unlock(&c->run_queue_lock);
 }
 
 static thread_t* sched_get_top_thread(cpu_num_t cpu) {
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
     /* pop the head of the highest priority queue with any threads
-     * queued up on the passed in cpu.
+     * queued up on the passed in cpu, or the thread with the least
+     * virtual runtime under the fair policy.
      */
     struct percpu* c = &percpu[cpu];
-    if (likely(c->run_queue_bitmap)) {
-        uint highest_queue = HIGHEST_PRIORITY - __builtin_clz(c->run_queue_bitmap) -
-                             (sizeof(c->run_queue_bitmap) * CHAR_BIT - NUM_PRIORITIES);
+    spin_lock(&c->run_queue_lock);
+
+    /* deadline threads go first */
+    if (unlikely(!list_is_empty(&c->deadline_queue))) {
+        thread_t* newthread = deadline_pick_locked(c, cpu, current_time());
+        if (newthread) {
+            DEBUG_ASSERT(newthread->curr_cpu == cpu);
+            spin_unlock(&c->run_queue_lock);
+            return newthread;
+        }
+    } else {
+        c->deadline_next_replenish = ZX_TIME_INFINITE;
+    }
+
+    while (likely(c->run_queue_bitmap)) {
+        thread_t* newthread;
+        if (sched_fair) {
+            newthread = fair_pop(c);
+            if (c->fair_queue_len == 0)
+                c->run_queue_bitmap = 0;
+        } else {
+            uint highest_queue = highest_run_queue_priority(c->run_queue_bitmap);
+
+            newthread = list_remove_head_type(&c->run_queue[highest_queue], thread_t, queue_node);
 
-        thread_t* newthread = list_remove_head_type(&c->run_queue[highest_queue], thread_t, queue_node);
+            if (list_is_empty(&c->run_queue[highest_queue]))
+                c->run_queue_bitmap &= ~(1u << highest_queue);
+        }
 
         DEBUG_ASSERT(newthread);
         DEBUG_ASSERT_MSG(newthread->cpu_affinity & cpu_num_to_mask(cpu),
@@ -238,18 +884,217 @@ static thread_t* sched_get_top_thread(cpu_num_t cpu) {
                          newthread->cpu_affinity, cpu);
         DEBUG_ASSERT(newthread->curr_cpu == cpu);
 
-        if (list_is_empty(&c->run_queue[highest_queue]))
-            c->run_queue_bitmap &= ~(1u << highest_queue);
+        if (unlikely(bandwidth_park_if_throttled(newthread)))
+            continue;
+
+        spin_unlock(&c->run_queue_lock);
 
         LOCAL_KTRACE2("sched_get_top", newthread->priority_boost, newthread->base_priority);
 
         return newthread;
     }
+    spin_unlock(&c->run_queue_lock);
 
     /* no threads to run, select the idle thread for this cpu */
     return &c->idle_thread;
 }
 
+/* work stealing
+ *
+ * a cpu about to go idle, or one whose running thread just used up its time slice,
+ * looks at the other cpus' run queues and pulls over the highest priority waiting
+ * thread that is allowed to run locally, provided it is of higher priority than
+ * anything already queued on the local cpu. none of this takes thread_lock: the remote
+ * run queue bitmaps are read without their locks to pick a victim, and the thread is
+ * then chosen and moved with both run queue locks held.
+ *
+ * a cpu puts its current thread back on a run queue before switching away from it, so
+ * threads still marked on_cpu are left alone.
+ */
+static void lock_run_queue_pair(cpu_num_t a, cpu_num_t b) {
+    DEBUG_ASSERT(a != b);
+    spin_lock(&percpu[MIN(a, b)].run_queue_lock);
+    spin_lock(&percpu[MAX(a, b)].run_queue_lock);
+}
+
+static void unlock_run_queue_pair(cpu_num_t a, cpu_num_t b) {
+    spin_unlock(&percpu[MAX(a, b)].run_queue_lock);
+    spin_unlock(&percpu[MIN(a, b)].run_queue_lock);
+}
+
+static bool can_steal(thread_t* t, cpu_mask_t cpu_mask) {
+    return (t->cpu_affinity & cpu_mask) && !__atomic_load_n(&t->on_cpu, __ATOMIC_ACQUIRE);
+}
+
+/* move |t|, taken off |victim|'s queue where it was queued at |pri|, to the local queue.
+ * both run queue locks are held.
+ */
+static void steal_to_local(cpu_num_t cpu, cpu_num_t victim, thread_t* t, int pri) {
+    DEBUG_ASSERT(t->state == THREAD_READY);
+    DEBUG_ASSERT(!thread_is_idle(t));
+
+    if (t->last_cpu != INVALID_CPU && t->last_cpu != cpu)
+        kcounter_add(sched_migrations, 1u);
+
+    __atomic_store_n(&t->curr_cpu, cpu, __ATOMIC_RELAXED);
+    insert_in_run_queue_locked(&percpu[cpu], cpu, t, pri, t->remaining_time_slice > 0);
+    LOCAL_KTRACE2("sched_steal", victim, (uint32_t)t->user_tid);
+}
+
+static bool steal_thread(cpu_num_t cpu, int min_pri) {
+    const cpu_mask_t cpu_mask = cpu_num_to_mask(cpu);
+
+    /* find the cpu with the highest priority thread waiting in its run queue */
+    cpu_num_t victim = INVALID_CPU;
+    int victim_pri = min_pri;
+    cpu_mask_t candidates = mp_get_active_mask() & ~cpu_mask;
+    while (candidates) {
+        cpu_num_t i = lowest_cpu_set(candidates);
+        candidates &= ~cpu_num_to_mask(i);
+
+        int pri = highest_run_queue_priority(
+            __atomic_load_n(&percpu[i].run_queue_bitmap, __ATOMIC_RELAXED));
+        if (pri > victim_pri) {
+            victim = i;
+            victim_pri = pri;
+        }
+    }
+    if (victim == INVALID_CPU)
+        return false;
+
+    /* walk the victim's queues from the top looking for a thread that may run here */
+    struct percpu* c = &percpu[victim];
+    thread_t* t = NULL;
+    lock_run_queue_pair(cpu, victim);
+    for (int pri = highest_run_queue_priority(c->run_queue_bitmap); pri > min_pri; pri--) {
+        thread_t* candidate;
+        list_for_every_entry (&c->run_queue[pri], candidate, thread_t, queue_node) {
+            if (can_steal(candidate, cpu_mask)) {
+                t = candidate;
+                break;
+            }
+        }
+        if (t) {
+            list_delete(&t->queue_node);
+            if (list_is_empty(&c->run_queue[pri]))
+                c->run_queue_bitmap &= ~(1u << pri);
+            steal_to_local(cpu, victim, t, pri);
+            break;
+        }
+    }
+    unlock_run_queue_pair(cpu, victim);
+
+    return t != NULL;
+}
+
+/* under the fair policy, priorities are folded into the weights, so balance on queue
+ * length instead: pull from the longest queue if it is longer than the local one by
+ * more than one thread, or has anything at all when the local cpu is about to go idle.
+ */
+static bool fair_steal_thread(cpu_num_t cpu) {
+    const cpu_mask_t cpu_mask = cpu_num_to_mask(cpu);
+    const uint32_t local_len = __atomic_load_n(&percpu[cpu].fair_queue_len, __ATOMIC_RELAXED);
+
+    cpu_num_t victim = INVALID_CPU;
+    uint32_t victim_len = local_len + (local_len ? 1 : 0);
+    cpu_mask_t candidates = mp_get_active_mask() & ~cpu_mask;
+    while (candidates) {
+        cpu_num_t i = lowest_cpu_set(candidates);
+        candidates &= ~cpu_num_to_mask(i);
+
+        uint32_t len = __atomic_load_n(&percpu[i].fair_queue_len, __ATOMIC_RELAXED);
+        if (len > victim_len) {
+            victim = i;
+            victim_len = len;
+        }
+    }
+    if (victim == INVALID_CPU)
+        return false;
+
+    /* look at the root of the victim's heap and the first few of its children, which are
+     * the threads due to run soonest there */
+    struct percpu* c = &percpu[victim];
+    thread_t* t = NULL;
+    lock_run_queue_pair(cpu, victim);
+    thread_t* candidate = c->fair_queue;
+    if (candidate && !can_steal(candidate, cpu_mask)) {
+        candidate = candidate->fair_child;
+        for (int i = 0; candidate && i < FAIR_STEAL_SCAN; i++) {
+            if (can_steal(candidate, cpu_mask))
+                break;
+            candidate = candidate->fair_sibling;
+        }
+    }
+    if (candidate && can_steal(candidate, cpu_mask)) {
+        t = candidate;
+        fair_dequeue(c, t);
+        if (c->fair_queue_len == 0)
+            c->run_queue_bitmap = 0;
+        steal_to_local(cpu, victim, t, t->effec_priority);
+    }
+    unlock_run_queue_pair(cpu, victim);
+
+    return t != NULL;
+}
+
+/* try to pull a thread of higher priority than anything queued locally onto this cpu.
+ * runs with interrupts disabled and without thread_lock. returns true if a thread was
+ * stolen.
+ */
+static bool sched_balance(cpu_num_t cpu, bool idle) {
+    DEBUG_ASSERT(arch_ints_disabled());
+    DEBUG_ASSERT(!spin_lock_held(&thread_lock));
+
+    bool stolen;
+    if (sched_fair) {
+        stolen = fair_steal_thread(cpu);
+    } else {
+        int min_pri = highest_run_queue_priority(
+            __atomic_load_n(&percpu[cpu].run_queue_bitmap, __ATOMIC_RELAXED));
+        stolen = steal_thread(cpu, min_pri);
+    }
+    if (!stolen)
+        return false;
+
+    if (idle) {
+        kcounter_add(sched_idle_steals, 1u);
+    } else {
+        kcounter_add(sched_periodic_steals, 1u);
+    }
+    return true;
+}
+
+/* called on time slice expiration: rebalance with the other cpus. if threads are still
+ * waiting locally afterwards and there are idle cpus around, kick one of them so it
+ * gets a chance to steal.
+ */
+static void sched_balance_periodic(cpu_num_t cpu) {
+    sched_balance(cpu, false);
+
+    if (__atomic_load_n(&percpu[cpu].run_queue_bitmap, __ATOMIC_RELAXED) == 0)
+        return;
+
+    cpu_mask_t idle_mask = mp_get_idle_mask() & mp_get_active_mask() & ~cpu_num_to_mask(cpu);
+    if (idle_mask == 0)
+        return;
+
+    kcounter_add(sched_idle_kicks, 1u);
+    mp_reschedule(cpu_num_to_mask(lowest_cpu_set(idle_mask)), 0);
+}
+
+void sched_idle_balance(void) {
+    DEBUG_ASSERT(thread_is_idle(get_current_thread()));
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, ARCH_DEFAULT_SPIN_LOCK_FLAG_INTERRUPTS);
+    cpu_num_t cpu = arch_curr_cpu_num();
+    bool stolen = mp_is_cpu_active(cpu) && sched_balance(cpu, true);
+    arch_interrupt_restore(state, ARCH_DEFAULT_SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (stolen)
+        thread_reschedule();
+}
+
 void sched_init_thread(thread_t* t, int priority) {
     t->base_priority = priority;
     t->priority_boost = 0;
@@ -267,6 +1112,8 @@ void sched_block(void) {
 
     LOCAL_KTRACE0("sched_block");
 
+    sched_charge_current(current_thread);
+
     /* we are blocking on something. the blocking code should have already stuck us on a queue */
     sched_resched_internal();
 }
@@ -288,6 +1135,9 @@ static void find_cpu_and_insert(thread_t* t, bool* local_resched, cpu_mask_t* ac
         *accum_cpu_mask |= cpu_num_to_mask(cpu_num);
     }
 
+    if (t->last_cpu != INVALID_CPU && t->last_cpu != cpu_num)
+        kcounter_add(sched_migrations, 1u);
+
     t->curr_cpu = cpu_num;
     if (t->remaining_time_slice > 0) {
         insert_in_run_queue_head(cpu_num, t);
@@ -305,6 +1155,7 @@ bool sched_unblock(thread_t* t) {
 
     /* thread is being woken up, boost its priority */
     boost_thread(t);
+    deadline_activate(t);
 
     /* stuff the new thread in the run queue */
     t->state = THREAD_READY;
@@ -334,6 +1185,7 @@ bool sched_unblock_list(struct list_node* list) {
 
         /* thread is being woken up, boost its priority */
         boost_thread(t);
+        deadline_activate(t);
 
         /* stuff the new thread in the run queue */
         t->state = THREAD_READY;
@@ -371,6 +1223,8 @@ void sched_yield(void) {
 
     LOCAL_KTRACE0("sched_yield");
 
+    sched_charge_current(current_thread);
+
     /* consume the rest of the time slice, deboost ourself, and go to the end of a queue */
     current_thread->remaining_time_slice = 0;
     deboost_thread(current_thread, false);
@@ -395,6 +1249,8 @@ void sched_preempt(void) {
     DEBUG_ASSERT(current_thread->last_cpu == current_thread->curr_cpu);
     LOCAL_KTRACE0("sched_preempt");
 
+    sched_charge_current(current_thread);
+
     current_thread->state = THREAD_READY;
 
     /* idle thread doesn't go in the run queue */
@@ -433,6 +1289,8 @@ void sched_reschedule(void) {
     DEBUG_ASSERT(current_thread->last_cpu == current_thread->curr_cpu);
     LOCAL_KTRACE0("sched_reschedule");
 
+    sched_charge_current(current_thread);
+
     current_thread->state = THREAD_READY;
 
     /* idle thread doesn't go in the run queue */
@@ -459,6 +1317,8 @@ static void migrate_current_thread(thread_t* current_thread) {
     bool local_resched = false;
     cpu_mask_t accum_cpu_mask = 0;
 
+    sched_charge_current(current_thread);
+
     // current thread, so just shove ourself into another cpu's queue and reschedule locally
     current_thread->state = THREAD_READY;
     find_cpu_and_insert(current_thread, &local_resched, &accum_cpu_mask);
@@ -542,26 +1402,23 @@ void sched_migrate(thread_t* t) {
             accum_cpu_mask = cpu_num_to_mask(t->curr_cpu);
         }
         break;
-    case THREAD_READY:
-        if (t->cpu_affinity & cpu_num_to_mask(t->curr_cpu)) {
+    case THREAD_READY: {
+        // look under the run queue lock, since a stealing cpu may be moving the thread
+        struct percpu* c = lock_thread_run_queue(t);
+        bool allowed = t->cpu_affinity & cpu_num_to_mask(t->curr_cpu);
+        spin_unlock(&c->run_queue_lock);
+        if (allowed) {
             // it's ready and the new mask contains the core it's already waiting on, nothing to do.
             //TRACEF("t %p nomigrate\n", t);
             return;
         }
 
         // it's sitting in a run queue somewhere, so pull it out of that one and find a new home
-        DEBUG_ASSERT_MSG(list_in_list(&t->queue_node), "thread %p name %s curr_cpu %u\n", t, t->name, t->curr_cpu);
-        list_delete(&t->queue_node);
-
-        DEBUG_ASSERT(is_valid_cpu_num(t->curr_cpu));
-
-        struct percpu* c = &percpu[t->curr_cpu];
-        if (list_is_empty(&c->run_queue[t->effec_priority])) {
-            c->run_queue_bitmap &= ~(1u << t->effec_priority);
-        }
+        remove_from_run_queue(t, t->effec_priority);
 
         find_cpu_and_insert(t, &local_resched, &accum_cpu_mask);
         break;
+    }
     default:
         // the other states do not matter, exit
         return;
@@ -576,6 +1433,114 @@ void sched_migrate(thread_t* t) {
     }
 }
 
+/* release the share of its cpu reserved by deadline thread |t| */
+static void deadline_release(thread_t* t) {
+    cpu_num_t cpu = lowest_cpu_set(t->cpu_affinity);
+
+    DEBUG_ASSERT(percpu[cpu].deadline_density >= t->deadline_density);
+    percpu[cpu].deadline_density -= t->deadline_density;
+    t->deadline_density = 0;
+}
+
+zx_status_t sched_set_deadline(thread_t* t, zx_duration_t runtime, zx_duration_t deadline,
+                               zx_duration_t period) {
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    if (runtime <= 0 || runtime > deadline || deadline > period || period > DEADLINE_MAX_PERIOD)
+        return ZX_ERR_INVALID_ARGS;
+    if (thread_is_idle(t))
+        return ZX_ERR_NOT_SUPPORTED;
+
+    uint32_t density = (uint32_t)(((uint64_t)runtime * DEADLINE_DENSITY_SCALE) / (uint64_t)deadline);
+
+    /* the thread's current reservation, if any, doesn't count against it */
+    cpu_num_t old_cpu = INVALID_CPU;
+    uint32_t old_density = 0;
+    if (thread_is_deadline(t)) {
+        old_cpu = lowest_cpu_set(t->cpu_affinity);
+        old_density = t->deadline_density;
+    }
+
+    /* admission: the active cpu allowed by the thread's affinity with the most room left */
+    cpu_mask_t candidates = t->cpu_affinity & mp_get_active_mask();
+    if (thread_is_deadline(t))
+        candidates = t->deadline_allowed_cpus & mp_get_active_mask();
+    cpu_num_t target = INVALID_CPU;
+    uint32_t target_density = 0;
+    for (cpu_num_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (!(candidates & cpu_num_to_mask(cpu)))
+            continue;
+        uint32_t reserved = percpu[cpu].deadline_density - (cpu == old_cpu ? old_density : 0);
+        if (reserved + density > DEADLINE_MAX_DENSITY)
+            continue;
+        if (target == INVALID_CPU || reserved < target_density) {
+            target = cpu;
+            target_density = reserved;
+        }
+    }
+    if (target == INVALID_CPU)
+        return ZX_ERR_NO_RESOURCES;
+
+    /* take a ready thread off its queue while its class changes */
+    bool was_ready = t->state == THREAD_READY;
+    if (was_ready)
+        remove_from_run_queue(t, t->effec_priority);
+
+    if (thread_is_deadline(t)) {
+        deadline_release(t);
+    } else {
+        t->deadline_allowed_cpus = t->cpu_affinity;
+    }
+
+    percpu[target].deadline_density += density;
+    t->deadline_density = density;
+    t->deadline_runtime = runtime;
+    t->deadline_relative = deadline;
+    t->deadline_period = period;
+    t->flags |= THREAD_FLAG_DEADLINE;
+    t->cpu_affinity = cpu_num_to_mask(target);
+    deadline_new_period(t, current_time());
+
+    if (was_ready) {
+        bool local_resched = false;
+        cpu_mask_t accum_cpu_mask = 0;
+        find_cpu_and_insert(t, &local_resched, &accum_cpu_mask);
+        if (accum_cpu_mask)
+            mp_reschedule(accum_cpu_mask, 0);
+        if (local_resched)
+            sched_reschedule();
+    } else if (t->state == THREAD_RUNNING) {
+        /* have the cpu it is running on move it if needed and rearm its preemption timer */
+        t->last_accounted = current_time();
+        if (t == get_current_thread()) {
+            sched_reschedule();
+        } else {
+            mp_reschedule(cpu_num_to_mask(t->curr_cpu), 0);
+        }
+    }
+
+    return ZX_OK;
+}
+
+void sched_clear_deadline(thread_t* t) {
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    if (!thread_is_deadline(t))
+        return;
+
+    /* a ready thread has to move to the queues of its new class */
+    bool was_ready = t->state == THREAD_READY;
+    if (was_ready)
+        remove_from_run_queue(t, t->effec_priority);
+
+    deadline_release(t);
+    t->flags &= ~THREAD_FLAG_DEADLINE;
+    t->cpu_affinity = t->deadline_allowed_cpus;
+
+    if (was_ready)
+        insert_in_run_queue_tail(t->curr_cpu, t);
+}
+
 /* set the priority to the higher value of what it was before and the newly inherited value */
 /* pri < 0 disables priority inheritance and goes back to the naturally computed values */
 void sched_inherit_priority(thread_t* t, int pri, bool *local_resched) {
@@ -612,15 +1577,7 @@ void sched_inherit_priority(thread_t* t, int pri, bool *local_resched) {
         break;
     case THREAD_READY:
         // it's sitting in a run queue somewhere, remove and add back to the proper queue on that cpu
-        DEBUG_ASSERT_MSG(list_in_list(&t->queue_node), "thread %p name %s curr_cpu %u\n", t, t->name, t->curr_cpu);
-        list_delete(&t->queue_node);
-
-        DEBUG_ASSERT(is_valid_cpu_num(t->curr_cpu));
-
-        struct percpu* c = &percpu[t->curr_cpu];
-        if (list_is_empty(&c->run_queue[old_ep])) {
-            c->run_queue_bitmap &= ~(1u << old_ep);
-        }
+        remove_from_run_queue(t, old_ep);
 
         if (t->effec_priority > old_ep) {
             insert_in_run_queue_head(t->curr_cpu, t);
@@ -647,8 +1604,39 @@ void sched_inherit_priority(thread_t* t, int pri, bool *local_resched) {
 
 /* preemption timer that is set whenever a thread is scheduled */
 static void sched_timer_tick(timer_t* t, zx_time_t now, void* arg) {
-    /* if the preemption timer went off on the idle or a real time thread, ignore it */
     thread_t* current_thread = get_current_thread();
+    struct percpu* c = &percpu[arch_curr_cpu_num()];
+
+    /* charge the thread's bandwidth groups and stop it if one of them is out of quota */
+    if (unlikely(bandwidth_applies(current_thread))) {
+        spin_lock(&thread_lock);
+        sched_charge_current(current_thread);
+        bool throttled = bandwidth_throttled_group(current_thread) != NULL;
+        spin_unlock(&thread_lock);
+
+        if (throttled) {
+            thread_preempt_set_pending();
+            return;
+        }
+    }
+
+    /* a throttled deadline thread is due a new budget, or the running one is out of it */
+    if (unlikely(thread_is_deadline(current_thread) || c->deadline_next_replenish <= now)) {
+        zx_time_t budget_end = ZX_TIME_INFINITE;
+        if (thread_is_deadline(current_thread)) {
+            budget_end = deadline_budget_end(current_thread, current_thread->last_accounted);
+        }
+
+        zx_time_t next = MIN(budget_end, c->deadline_next_replenish);
+        if (next <= now) {
+            thread_preempt_set_pending();
+        } else {
+            timer_set_oneshot(t, next, sched_timer_tick, NULL);
+        }
+        return;
+    }
+
+    /* if the preemption timer went off on the idle or a real time thread, ignore it */
     if (unlikely(thread_is_real_time_or_idle(current_thread)))
         return;
 
@@ -664,16 +1652,46 @@ static void sched_timer_tick(timer_t* t, zx_time_t now, void* arg) {
         /* set a timer to go off on the time slice interval from now */
         timer_set_oneshot(t, now + THREAD_INITIAL_TIME_SLICE, sched_timer_tick, NULL);
 
+        /* the end of a time slice is a convenient periodic point to rebalance */
+        sched_balance_periodic(arch_curr_cpu_num());
+
         /* Mark a reschedule as pending.  The irq handler will call back
          * into us with sched_preempt(). */
         thread_preempt_set_pending();
     } else {
         /* the timer tick must have fired early, reschedule and continue */
-        timer_set_oneshot(t, current_thread->last_started_running + current_thread->remaining_time_slice,
+        timer_set_oneshot(t, MIN(current_thread->last_started_running + current_thread->remaining_time_slice,
+                                 c->deadline_next_replenish),
                           sched_timer_tick, NULL);
     }
 }
 
+/* arm the preemption timer for |t|, which is about to run on |cpu|, when deadline threads
+ * are involved: it goes off when a deadline thread's budget runs out or when a throttled
+ * one on this cpu is due a new budget, whichever comes first.
+ */
+static void deadline_set_preempt_timer(cpu_num_t cpu, thread_t* t, zx_time_t now) {
+    struct percpu* c = &percpu[cpu];
+    zx_time_t expire;
+
+    if (thread_is_deadline(t)) {
+        DEBUG_ASSERT(t->deadline_budget > 0);
+        expire = deadline_budget_end(t, now);
+    } else if (thread_is_real_time_or_idle(t)) {
+        expire = ZX_TIME_INFINITE;
+    } else {
+        expire = now + (t->remaining_time_slice > 0 ? t->remaining_time_slice
+                                                    : THREAD_INITIAL_TIME_SLICE);
+    }
+    expire = MIN(expire, c->deadline_next_replenish);
+
+    if (expire == ZX_TIME_INFINITE) {
+        timer_cancel(&c->preempt_timer);
+    } else {
+        timer_reset_oneshot_local(&c->preempt_timer, expire, sched_timer_tick, NULL);
+    }
+}
+
 // On ARM64 with safe-stack, it's no longer possible to use the unsafe-sp
 // after set_current_thread (we'd now see newthread's unsafe-sp instead!).
 // Hence this function and everything it calls between this point and the
@@ -702,12 +1720,15 @@ void sched_resched_internal(void) {
 
     CPU_STATS_INC(reschedules);
 
+    sched_charge_current(current_thread);
+
     /* pick a new thread to run */
     thread_t* newthread = sched_get_top_thread(cpu);
 
     DEBUG_ASSERT(newthread);
 
     newthread->state = THREAD_RUNNING;
+    newthread->on_cpu = true;
 
     thread_t* oldthread = current_thread;
     oldthread->preempt_pending = false;
@@ -719,9 +1740,15 @@ void sched_resched_internal(void) {
      * core rescheduled us but the work disappeared before we got to run. */
     mp_prepare_current_cpu_idle_state(thread_is_idle(newthread));
 
+    bool deadline_timer = thread_is_deadline(newthread) ||
+                          percpu[cpu].deadline_next_replenish != ZX_TIME_INFINITE;
+
     /* if it's the same thread as we're already running, exit */
-    if (newthread == oldthread)
+    if (newthread == oldthread) {
+        if (unlikely(deadline_timer))
+            deadline_set_preempt_timer(cpu, newthread, current_time());
         return;
+    }
 
     zx_time_t now = current_time();
 
@@ -737,6 +1764,7 @@ void sched_resched_internal(void) {
     }
 
     newthread->last_started_running = now;
+    newthread->last_accounted = now;
 
     /* mark the cpu ownership of the threads */
     if (oldthread->state != THREAD_READY)
@@ -768,7 +1796,9 @@ void sched_resched_internal(void) {
     ktrace(TAG_CONTEXT_SWITCH, (uint32_t)newthread->user_tid, cpu | (oldthread->state << 16),
            (uint32_t)(uintptr_t)oldthread, (uint32_t)(uintptr_t)newthread);
 
-    if (thread_is_real_time_or_idle(newthread)) {
+    if (unlikely(deadline_timer)) {
+        deadline_set_preempt_timer(cpu, newthread, now);
+    } else if (thread_is_real_time_or_idle(newthread)) {
         if (!thread_is_real_time_or_idle(oldthread)) {
             /* if we're switching from a non real time to a real time, cancel
              * the preemption timer. */
@@ -832,12 +1862,71 @@ void sched_resched_internal(void) {
     }
 
     /* do the low level context switch */
+    percpu[cpu].switch_prev = oldthread;
+    __atomic_store_n(&percpu[cpu].curr_thread, newthread, __ATOMIC_RELAXED);
     final_context_switch(oldthread, newthread);
+    sched_finish_switch();
+}
+
+void sched_finish_switch(void) {
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    struct percpu* c = get_local_percpu();
+    thread_t* prev = c->switch_prev;
+    if (prev) {
+        c->switch_prev = NULL;
+        /* its context is saved, other cpus may now take it off our run queue */
+        __atomic_store_n(&prev->on_cpu, false, __ATOMIC_RELEASE);
+    }
+}
+
+/* switch to the fair policy if it was asked for. the command line is not available
+ * yet when sched_init_early() runs, so the few threads already queued by then are moved
+ * over from the priority queues here.
+ */
+static void sched_policy_init(uint level) {
+    const char* policy = cmdline_get("kernel.sched.policy");
+    if (!policy || strcmp(policy, "fair") != 0)
+        return;
+
+    THREAD_LOCK(state);
+
+    /* collect every queued thread, highest priority first */
+    list_node_t threads = LIST_INITIAL_VALUE(threads);
+    for (cpu_num_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        struct percpu* c = &percpu[cpu];
+        spin_lock(&c->run_queue_lock);
+        for (int pri = HIGHEST_PRIORITY; pri >= LOWEST_PRIORITY; pri--) {
+            thread_t* t;
+            while ((t = list_remove_head_type(&c->run_queue[pri], thread_t, queue_node)) != NULL) {
+                list_add_tail(&threads, &t->queue_node);
+            }
+        }
+        c->run_queue_bitmap = 0;
+        spin_unlock(&c->run_queue_lock);
+    }
+
+    sched_fair = true;
+
+    thread_t* t;
+    while ((t = list_remove_head_type(&threads, thread_t, queue_node)) != NULL) {
+        insert_in_run_queue_tail(t->curr_cpu, t);
+    }
+
+    THREAD_UNLOCK(state);
+
+    dprintf(INFO, "sched: using the fair scheduling policy\n");
 }
 
+LK_INIT_HOOK(sched_policy, sched_policy_init, LK_INIT_LEVEL_PLATFORM_EARLY);
+
 void sched_init_early(void) {
     /* initialize the run queues */
-    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++)
+    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        spin_lock_init(&percpu[cpu].run_queue_lock);
         for (unsigned int i = 0; i < NUM_PRIORITIES; i++)
             list_initialize(&percpu[cpu].run_queue[i]);
+        list_initialize(&percpu[cpu].deadline_queue);
+        percpu[cpu].deadline_next_replenish = ZX_TIME_INFINITE;
+    }
 }
@@ -34,6 +34,7 @@
 #include <lib/counters.h>
 #include <lib/heap.h>
 #include <lib/ktrace.h>
+#include <lib/lockstat.h>
 
 #include <list.h>
 #include <malloc.h>
@@ -79,6 +80,7 @@ static void initial_thread_func(void) {
     int ret;
 
     /* release the thread lock that was implicitly held across the reschedule */
+    sched_finish_switch();
     spin_unlock(&thread_lock);
     arch_enable_ints();
 
@@ -487,6 +489,11 @@ __NO_RETURN static void thread_exit_locked(thread_t* current_thread, int retcode
      */
     dpc_t free_dpc;
 
+    /* give back any cpu time reserved for the thread, and stop charging it to a job
+     * that may go away once the thread is gone */
+    sched_clear_deadline(current_thread);
+    current_thread->bandwidth = NULL;
+
     /* enter the dead state */
     current_thread->state = THREAD_DEATH;
     current_thread->retcode = retcode;
@@ -643,7 +650,12 @@ void thread_set_cpu_affinity(thread_t* t, cpu_mask_t affinity) {
     THREAD_LOCK(state);
 
     // make sure the passed in mask is valid and at least one cpu can run the thread
-    if (affinity & mp_get_active_mask()) {
+    if (unlikely(thread_is_deadline(t))) {
+        // a deadline thread stays on the cpu it was admitted to, the new mask applies
+        // once it leaves the deadline class
+        if (affinity & mp_get_active_mask())
+            t->deadline_allowed_cpus = affinity;
+    } else if (affinity & mp_get_active_mask()) {
         // set the affinity mask
         t->cpu_affinity = affinity;
 
@@ -654,6 +666,17 @@ void thread_set_cpu_affinity(thread_t* t, cpu_mask_t affinity) {
     THREAD_UNLOCK(state);
 }
 
+zx_status_t thread_set_deadline(thread_t* t, zx_duration_t runtime, zx_duration_t deadline,
+                                zx_duration_t period) {
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+
+    THREAD_LOCK(state);
+    zx_status_t status = sched_set_deadline(t, runtime, deadline, period);
+    THREAD_UNLOCK(state);
+
+    return status;
+}
+
 void thread_migrate_to_cpu(const cpu_num_t target_cpu) {
     thread_set_cpu_affinity(get_current_thread(), cpu_num_to_mask(target_cpu));
 }
@@ -990,12 +1013,14 @@ void thread_construct_first(thread_t* t, const char* name) {
     t->curr_cpu = cpu;
     t->last_cpu = cpu;
     t->cpu_affinity = cpu_num_to_mask(cpu);
+    t->on_cpu = true;
 
     arch_thread_construct_first(t);
 
     THREAD_LOCK(state);
     list_add_head(&thread_list, &t->thread_list_node);
     set_current_thread(t);
+    __atomic_store_n(&percpu[cpu].curr_thread, t, __ATOMIC_RELAXED);
     THREAD_UNLOCK(state);
 }
 
@@ -1007,6 +1032,8 @@ void thread_construct_first(thread_t* t, const char* name) {
 void thread_init_early(void) {
     DEBUG_ASSERT(arch_curr_cpu_num() == 0);
 
+    LOCK_CLASS_SPIN(&thread_lock, "kernel.thread_lock");
+
     /* create a thread to cover the current running state */
     thread_t* t = &percpu[0].idle_thread;
     thread_construct_first(t, "bootstrap");
@@ -28,6 +28,7 @@
 #include <kernel/stats.h>
 #include <kernel/thread.h>
 #include <kernel/timer.h>
+#include <lib/lockstat.h>
 #include <list.h>
 #include <malloc.h>
 #include <platform.h>
@@ -37,12 +38,118 @@
 
 #define LOCAL_TRACE 0
 
-static spin_lock_t timer_lock;
+// Each cpu keeps its pending timers in a treap ordered by scheduled_time and protected
+// by percpu[cpu].timer_lock. A treap is a binary search tree whose shape is kept balanced
+// by giving every node a pseudo random priority and keeping the priorities heap ordered,
+// so insertion and removal are O(log n) on average. Unlike a heap or a timer wheel it also
+// finds the timers scheduled just before and just after a new one in O(log n), which is
+// what slack coalescing needs. The earliest timer is cached in percpu[cpu].timer_first.
+//
+// When two timer locks are held at once, the one of the lower numbered cpu is taken first.
 
 void timer_init(timer_t* timer) {
     *timer = (timer_t)TIMER_INITIAL_VALUE(*timer);
 }
 
+static uint32_t timer_tree_priority(const timer_t* timer) {
+    uint64_t x = (uint64_t)(uintptr_t)timer ^ (uint64_t)timer->scheduled_time;
+    x *= 0x9e3779b97f4a7c15ull;
+    return (uint32_t)(x >> 32);
+}
+
+// Make |child| take the place of |old| below |parent|, or at the root.
+static void timer_tree_replace(struct percpu* c, timer_t* parent, timer_t* old, timer_t* child) {
+    if (parent == NULL) {
+        c->timer_tree = child;
+    } else if (parent->left == old) {
+        parent->left = child;
+    } else {
+        parent->right = child;
+    }
+    if (child != NULL)
+        child->parent = parent;
+}
+
+// Rotate |timer| above its parent, preserving the in-order sequence.
+static void timer_tree_rotate_up(struct percpu* c, timer_t* timer) {
+    timer_t* parent = timer->parent;
+
+    timer_tree_replace(c, parent->parent, parent, timer);
+    if (parent->left == timer) {
+        parent->left = timer->right;
+        if (parent->left != NULL)
+            parent->left->parent = parent;
+        timer->right = parent;
+    } else {
+        parent->right = timer->left;
+        if (parent->right != NULL)
+            parent->right->parent = parent;
+        timer->left = parent;
+    }
+    parent->parent = timer;
+}
+
+static timer_t* timer_tree_next(timer_t* timer) {
+    if (timer->right != NULL) {
+        timer = timer->right;
+        while (timer->left != NULL)
+            timer = timer->left;
+        return timer;
+    }
+    while (timer->parent != NULL && timer->parent->right == timer)
+        timer = timer->parent;
+    return timer->parent;
+}
+
+static void timer_tree_insert(uint cpu, timer_t* timer) {
+    struct percpu* c = &percpu[cpu];
+
+    // Timers with equal deadlines fire in the order they were queued, so ties go right.
+    timer_t* parent = NULL;
+    timer_t** link = &c->timer_tree;
+    while (*link != NULL) {
+        parent = *link;
+        link = (timer->scheduled_time < parent->scheduled_time) ? &parent->left : &parent->right;
+    }
+
+    timer->parent = parent;
+    timer->left = NULL;
+    timer->right = NULL;
+    timer->priority = timer_tree_priority(timer);
+    *link = timer;
+
+    while (timer->parent != NULL && timer->parent->priority < timer->priority)
+        timer_tree_rotate_up(c, timer);
+
+    if (c->timer_first == NULL || timer->scheduled_time < c->timer_first->scheduled_time)
+        c->timer_first = timer;
+
+    timer->queue_cpu = (int)cpu;
+}
+
+static void timer_tree_remove(uint cpu, timer_t* timer) {
+    struct percpu* c = &percpu[cpu];
+
+    DEBUG_ASSERT(timer->queue_cpu == (int)cpu);
+
+    if (c->timer_first == timer)
+        c->timer_first = timer_tree_next(timer);
+
+    // Rotate the timer down until it has at most one child, then splice it out.
+    while (timer->left != NULL && timer->right != NULL) {
+        timer_t* child = (timer->left->priority > timer->right->priority) ? timer->left
+                                                                           : timer->right;
+        timer_tree_rotate_up(c, child);
+    }
+    timer_tree_replace(c, timer->parent, timer,
+                       (timer->left != NULL) ? timer->left : timer->right);
+
+    timer->parent = NULL;
+    timer->left = NULL;
+    timer->right = NULL;
+    timer->queue_cpu = -1;
+}
+
 static void insert_timer_in_queue(uint cpu, timer_t* timer,
                                   uint64_t early_slack, uint64_t late_slack) {
 
@@ -52,109 +159,53 @@ static void insert_timer_in_queue(uint cpu, timer_t* timer,
     zx_time_t earliest_deadline = timer->scheduled_time - early_slack;
     zx_time_t latest_deadline = timer->scheduled_time + late_slack;
 
-    // For inserting the timer we consider several cases. In general we
-    // want to coalesce with the current timer unless we can prove that
-    // either that:
-    //  1- there is no slack overlap with current timer OR
-    //  2- the next timer is a better fit.
+    // We coalesce with one of the two timers that neighbour the new one, if any.
     //
     // In diagrams that follow
-    // - Let |e| be the current (existing) timer deadline
     // - Let |t| be the deadline of the timer we are inserting
-    // - Let |n| be the next timer deadline if any
-    // - Let |x| be the end of the list (not a timer)
+    // - Let |p| be the latest timer deadline before |t|
+    // - Let |n| be the earliest timer deadline at or after |t|
     // - Let |(| and |)| the earliest_deadline and latest_deadline.
     //
-    timer_t* entry;
-
-    list_for_every_entry (&percpu[cpu].timer_queue, entry, timer_t, node) {
-        if (entry->scheduled_time > latest_deadline) {
-            // New timer latest is earlier than the current timer.
-            // Just add upfront as is, without slack.
-            //
-            //   ---------t---)--e-------------------------------> time
-            //
-            timer->slack = 0ull;
-            list_add_before(&entry->node, &timer->node);
-            return;
-        }
-
-        if (entry->scheduled_time >= timer->scheduled_time) {
-            //  New timer slack overlaps and is to the left (or equal). We
-            //  coalesce with current by scheduling late.
-            //
-            //  --------(----t---e-)----------------------------> time
-            //
-            timer->slack = entry->scheduled_time - timer->scheduled_time;
-            timer->scheduled_time = entry->scheduled_time;
-            list_add_after(&entry->node, &timer->node);
-            return;
-        }
-
-        if (entry->scheduled_time < earliest_deadline) {
-            // new timer earliest is later than the current timer. This case
-            // is handled in a future iteration.
-            //
-            //   ----------------e--(---t-----------------------> time
-            //
-            continue;
+    //  --------------(-p---t---n-)-----------------------> time
+    //
+    timer_t* prev = NULL;
+    timer_t* next = NULL;
+    for (timer_t* entry = percpu[cpu].timer_tree; entry != NULL;) {
+        if (entry->scheduled_time < timer->scheduled_time) {
+            prev = entry;
+            entry = entry->right;
+        } else {
+            next = entry;
+            entry = entry->left;
         }
+    }
 
-        // New timer is to the right of current timer and there is overlap
-        // with the current timer, but could the next timer (if any) be
-        // a better fit?
-        //
-        //  -------------(--e---t-----?-------------------> time
-        //
-
-        const timer_t* next =
-            list_next_type(&percpu[cpu].timer_queue, &entry->node, timer_t, node);
-
-        if (next != NULL) {
-            if (next->scheduled_time <= timer->scheduled_time) {
-                // The new timer is to the right of the next timer. There is no
-                // chance the current timer is a better fit.
-                //
-                //  -------------(--e---n---t----------------------> time
-                //
-                continue;
-            }
-
-            if (next->scheduled_time < latest_deadline) {
-                // There is slack overlap with the next timer, and also with the
-                // current timer. Which coalescing is a better match?
-                //
-                //  --------------(-e---t---n-)-----------------------> time
-                //
-                zx_duration_t delta_entry = timer->scheduled_time - entry->scheduled_time;
-                zx_duration_t delta_next = next->scheduled_time - timer->scheduled_time;
-                if (delta_next < delta_entry) {
-                    // New timer is closer to the next timer, handle it in the
-                    // next iteration.
-                    continue;
-                }
-            }
-        }
+    if (prev != NULL && prev->scheduled_time < earliest_deadline)
+        prev = NULL;
+    if (next != NULL && next->scheduled_time > latest_deadline)
+        next = NULL;
+
+    timer_t* target;
+    if (prev != NULL && next != NULL) {
+        // There is slack overlap with both. Coalesce late only if the next timer is
+        // strictly inside the slack and strictly closer, otherwise coalesce early.
+        zx_duration_t delta_prev = timer->scheduled_time - prev->scheduled_time;
+        zx_duration_t delta_next = next->scheduled_time - timer->scheduled_time;
+        target = (next->scheduled_time < latest_deadline && delta_next < delta_prev) ? next : prev;
+    } else {
+        target = (prev != NULL) ? prev : next;
+    }
 
-        // Handles the remaining cases, note that there is overlap with
-        // the current timer.
-        //
-        //  1- this is the last timer (next == NULL) or
-        //  2- there is no overlap with the next timer, or
-        //  3- there is overlap with both current and next but
-        //     current is closer.
-        //
-        //  So we coalesce by scheduling early.
-        //
-        timer->slack = entry->scheduled_time - timer->scheduled_time;
-        timer->scheduled_time = entry->scheduled_time;
-        list_add_after(&entry->node, &timer->node);
-        return;
+    if (target != NULL) {
+        timer->slack = target->scheduled_time - timer->scheduled_time;
+        timer->scheduled_time = target->scheduled_time;
+    } else {
+        // No slack overlap with any timer, add as is.
+        timer->slack = 0ull;
     }
 
-    // Walked off the end of the list and there was no overlap.
-    timer->slack = 0ull;
-    list_add_tail(&percpu[cpu].timer_queue, &timer->node);
+    timer_tree_insert(cpu, timer);
 }
 
 void timer_set(timer_t* timer, zx_time_t deadline,
@@ -166,8 +217,8 @@ void timer_set(timer_t* timer, zx_time_t deadline,
     DEBUG_ASSERT(timer->magic == TIMER_MAGIC);
     DEBUG_ASSERT(mode <= TIMER_SLACK_EARLY);
 
-    if (list_in_list(&timer->node)) {
-        panic("timer %p already in list\n", timer);
+    if (timer->queue_cpu >= 0) {
+        panic("timer %p already in queue\n", timer);
     }
 
     zx_duration_t late_slack;
@@ -196,9 +247,10 @@ void timer_set(timer_t* timer, zx_time_t deadline,
     }
 
     spin_lock_saved_state_t state;
-    spin_lock_irqsave(&timer_lock, state);
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
 
     uint cpu = arch_curr_cpu_num();
+    spin_lock(&percpu[cpu].timer_lock);
 
     bool currently_active = (timer->active_cpu == (int)cpu);
     if (unlikely(currently_active)) {
@@ -220,14 +272,14 @@ void timer_set(timer_t* timer, zx_time_t deadline,
 
     insert_timer_in_queue(cpu, timer, early_slack, late_slack);
 
-    if (list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node) == timer) {
+    if (percpu[cpu].timer_first == timer) {
         /* we just modified the head of the timer queue */
         LTRACEF("setting new timer for %" PRIu64 " nsecs\n", deadline);
         platform_set_oneshot_timer(deadline);
     }
 
 out:
-    spin_unlock_irqrestore(&timer_lock, state);
+    spin_unlock_irqrestore(&percpu[cpu].timer_lock, state);
 }
 
 /* similar to timer_set_oneshot, with additional features/constraints:
@@ -245,15 +297,17 @@ void timer_reset_oneshot_local(timer_t* timer, zx_time_t deadline, timer_callbac
     uint cpu = arch_curr_cpu_num();
 
     /* no need to disable interrupts when acquiring this lock */
-    spin_lock(&timer_lock);
+    spin_lock(&percpu[cpu].timer_lock);
 
     if (unlikely(timer->active_cpu >= 0)) {
         panic("timer %p currently active\n", timer);
     }
 
     /* remove it from the queue if it was present */
-    if (list_in_list(&timer->node))
-        list_delete(&timer->node);
+    if (timer->queue_cpu >= 0) {
+        DEBUG_ASSERT(timer->queue_cpu == (int)cpu);
+        timer_tree_remove(cpu, timer);
+    }
 
     /* set up the structure */
     timer->scheduled_time = deadline;
@@ -267,20 +321,66 @@ void timer_reset_oneshot_local(timer_t* timer, zx_time_t deadline, timer_callbac
 
     insert_timer_in_queue(cpu, timer, 0u, 0u);
 
-    if (list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node) == timer) {
+    if (percpu[cpu].timer_first == timer) {
         /* we just modified the head of the timer queue */
         LTRACEF("setting new timer for %" PRIu64 " nsecs\n", deadline);
         platform_set_oneshot_timer(deadline);
     }
 
-    spin_unlock(&timer_lock);
+    spin_unlock(&percpu[cpu].timer_lock);
+}
+
+/* take the timer off whichever queue it is on, returns false if it was not queued.
+ * interrupts must be disabled. */
+static bool timer_dequeue(timer_t* timer) {
+    DEBUG_ASSERT(arch_ints_disabled());
+
+    uint cpu = arch_curr_cpu_num();
+
+    for (;;) {
+        int queue_cpu = timer->queue_cpu;
+        if (queue_cpu < 0)
+            return false;
+
+        struct percpu* c = &percpu[queue_cpu];
+        spin_lock(&c->timer_lock);
+
+        /* the timer may have fired or moved while we were acquiring the lock */
+        if (unlikely(timer->queue_cpu != queue_cpu)) {
+            spin_unlock(&c->timer_lock);
+            continue;
+        }
+
+        timer_t* oldhead = c->timer_first;
+        timer_tree_remove(queue_cpu, timer);
+
+        /* TODO(cpu): if  after removing |timer| there is one other single timer with
+           the same scheduled_time and slack non-zero then it is possible to return
+           that timer to the ideal scheduled_time */
+
+        /* see if we've just modified the head of this cpu's timer queue */
+        /* if we modified another cpu's queue, we'll just let it fire and sort itself out */
+        if (unlikely(oldhead == timer && queue_cpu == (int)cpu)) {
+            timer_t* newhead = c->timer_first;
+            if (newhead) {
+                LTRACEF("setting new timer to %" PRIu64 "\n", newhead->scheduled_time);
+                platform_set_oneshot_timer(newhead->scheduled_time);
+            } else {
+                LTRACEF("clearing old hw timer, nothing in the queue\n");
+                platform_stop_timer();
+            }
+        }
+
+        spin_unlock(&c->timer_lock);
+        return true;
+    }
 }
 
 bool timer_cancel(timer_t* timer) {
     DEBUG_ASSERT(timer->magic == TIMER_MAGIC);
 
     spin_lock_saved_state_t state;
-    spin_lock_irqsave(&timer_lock, state);
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
 
     uint cpu = arch_curr_cpu_num();
 
@@ -298,48 +398,28 @@ bool timer_cancel(timer_t* timer) {
         timer->arg = NULL;
 
         /* we're done, so return back to the callback */
-        spin_unlock_irqrestore(&timer_lock, state);
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
         return false;
     }
 
-    bool callback_not_running;
-
     /* if the timer is in a queue, remove it and adjust hardware timers if needed */
-    if (list_in_list(&timer->node)) {
-        callback_not_running = true;
-
-        /* save a copy of the old head of the queue */
-        timer_t* oldhead = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
-
-        /* remove our timer from the queue */
-        list_delete(&timer->node);
+    bool callback_not_running = timer_dequeue(timer);
 
-        /* TODO(cpu): if  after removing |timer| there is one other single timer with
-           the same scheduled_time and slack non-zero then it is possible to return
-           that timer to the ideal scheduled_time */
-
-        /* see if we've just modified the head of this cpu's timer queue */
-        /* if we modified another cpu's queue, we'll just let it fire and sort itself out */
-        if (unlikely(oldhead == timer)) {
-            timer_t* newhead = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
-            if (newhead) {
-                LTRACEF("setting new timer to %" PRIu64 "\n", newhead->scheduled_time);
-                platform_set_oneshot_timer(newhead->scheduled_time);
-            } else {
-                LTRACEF("clearing old hw timer, nothing in the queue\n");
-                platform_stop_timer();
-            }
-        }
-    } else {
-        callback_not_running = false;
-    }
-
-    spin_unlock_irqrestore(&timer_lock, state);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 
     /* wait for the timer to become un-busy in case a callback is currently active on another cpu */
     while (timer->active_cpu >= 0) {
         arch_spinloop_pause();
     }
+    smp_mb();
+
+    /* a callback running on another cpu may have requeued the timer before it saw the
+     * cancel flag, take it back off */
+    if (unlikely(timer->queue_cpu >= 0)) {
+        arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+        timer_dequeue(timer);
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    }
 
     /* zero it out */
     timer->callback = NULL;
@@ -357,14 +437,15 @@ void timer_tick(zx_time_t now) {
     CPU_STATS_INC(timer_ints);
 
     uint cpu = arch_curr_cpu_num();
+    struct percpu* c = &percpu[cpu];
 
     LTRACEF("cpu %u now %" PRIu64 ", sp %p\n", cpu, now, __GET_FRAME());
 
-    spin_lock(&timer_lock);
+    spin_lock(&c->timer_lock);
 
     for (;;) {
         /* see if there's an event to process */
-        timer = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+        timer = c->timer_first;
         if (likely(timer == 0))
             break;
         LTRACEF("next item on timer queue %p at %" PRIu64 " now %" PRIu64 " (%p, arg %p)\n",
@@ -377,14 +458,15 @@ void timer_tick(zx_time_t now) {
         DEBUG_ASSERT_MSG(timer && timer->magic == TIMER_MAGIC,
                          "ASSERT: timer failed magic check: timer %p, magic 0x%x\n",
                          timer, (uint)timer->magic);
-        list_delete(&timer->node);
 
-        /* mark the timer busy */
+        /* mark the timer busy before it leaves the queue, so a racing timer_cancel
+         * that sees it dequeued also sees it active */
         timer->active_cpu = cpu;
-        /* spinlock below acts as a memory barrier */
+        smp_mb();
+        timer_tree_remove(cpu, timer);
 
-        /* we pulled it off the list, release the list lock to handle it */
-        spin_unlock(&timer_lock);
+        /* we pulled it off the queue, release the queue lock to handle it */
+        spin_unlock(&c->timer_lock);
 
         LTRACEF("dequeued timer %p, scheduled %" PRIu64 "\n", timer, timer->scheduled_time);
 
@@ -395,7 +477,7 @@ void timer_tick(zx_time_t now) {
 
         DEBUG_ASSERT(arch_ints_disabled());
         /* it may have been requeued, grab the lock so we can safely inspect it */
-        spin_lock(&timer_lock);
+        spin_lock(&c->timer_lock);
 
         /* mark it not busy */
         timer->active_cpu = -1;
@@ -406,7 +488,7 @@ void timer_tick(zx_time_t now) {
     }
 
     /* reset the timer to the next event */
-    timer = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+    timer = c->timer_first;
     if (timer) {
         /* has to be the case or it would have fired already */
         DEBUG_ASSERT(timer->scheduled_time > now);
@@ -417,7 +499,7 @@ void timer_tick(zx_time_t now) {
     }
 
     /* we're done manipulating the timer queue */
-    spin_unlock(&timer_lock);
+    spin_unlock(&c->timer_lock);
 }
 
 zx_status_t timer_trylock_or_cancel(timer_t* t, spin_lock_t* lock) {
@@ -439,50 +521,62 @@ zx_status_t timer_trylock_or_cancel(timer_t* t, spin_lock_t* lock) {
 
 void timer_transition_off_cpu(uint old_cpu) {
     spin_lock_saved_state_t state;
-    spin_lock_irqsave(&timer_lock, state);
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
     uint cpu = arch_curr_cpu_num();
 
-    timer_t* old_head = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+    DEBUG_ASSERT(old_cpu != cpu);
+
+    /* take both queue locks, lowest cpu first */
+    spin_lock_t* first_lock = &percpu[(cpu < old_cpu) ? cpu : old_cpu].timer_lock;
+    spin_lock_t* second_lock = &percpu[(cpu < old_cpu) ? old_cpu : cpu].timer_lock;
+    spin_lock(first_lock);
+    spin_lock(second_lock);
+
+    timer_t* old_head = percpu[cpu].timer_first;
 
-    timer_t *entry = NULL, *tmp_entry = NULL;
     /* Move all timers from old_cpu to this cpu */
-    list_for_every_entry_safe (&percpu[old_cpu].timer_queue, entry, tmp_entry, timer_t, node) {
-        list_delete(&entry->node);
+    timer_t* entry;
+    while ((entry = percpu[old_cpu].timer_first) != NULL) {
+        timer_tree_remove(old_cpu, entry);
         // We lost the original asymmetric slack information so when we combine them
         // with the other timer queue they are not coalesced again.
         // TODO(cpu): figure how important this case is.
         insert_timer_in_queue(cpu, entry, 0u, 0u);
     }
 
-    timer_t* new_head = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+    timer_t* new_head = percpu[cpu].timer_first;
     if (new_head != NULL && new_head != old_head) {
         /* we just modified the head of the timer queue */
         LTRACEF("setting new timer for %" PRIu64 " nsecs\n", new_head->scheduled_time);
         platform_set_oneshot_timer(new_head->scheduled_time);
     }
 
-    spin_unlock_irqrestore(&timer_lock, state);
+    spin_unlock(second_lock);
+    spin_unlock(first_lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 }
 
 void timer_thaw_percpu(void) {
     DEBUG_ASSERT(arch_ints_disabled());
-    spin_lock(&timer_lock);
 
     uint cpu = arch_curr_cpu_num();
+    spin_lock(&percpu[cpu].timer_lock);
 
-    timer_t* t = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
+    timer_t* t = percpu[cpu].timer_first;
     if (t) {
         LTRACEF("rescheduling timer for %" PRIu64 " nsecs\n", t->scheduled_time);
         platform_set_oneshot_timer(t->scheduled_time);
     }
 
-    spin_unlock(&timer_lock);
+    spin_unlock(&percpu[cpu].timer_lock);
 }
 
 void timer_queue_init(void) {
-    timer_lock = SPIN_LOCK_INITIAL_VALUE;
     for (uint i = 0; i < SMP_MAX_CPUS; i++) {
-        list_initialize(&percpu[i].timer_queue);
+        spin_lock_init(&percpu[i].timer_lock);
+        LOCK_CLASS_SPIN(&percpu[i].timer_lock, "kernel.timer_lock");
+        percpu[i].timer_tree = NULL;
+        percpu[i].timer_first = NULL;
     }
 }
 
@@ -492,15 +586,16 @@ static void dump_timer_queues(char* buf, size_t len) {
     zx_time_t now = current_time();
 
     spin_lock_saved_state_t state;
-    spin_lock_irqsave(&timer_lock, state);
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
 
     for (uint i = 0; i < SMP_MAX_CPUS; i++) {
         if (mp_is_cpu_online(i)) {
+            spin_lock(&percpu[i].timer_lock);
+
             ptr += snprintf(buf + ptr, len - ptr, "cpu %u:\n", i);
 
-            timer_t* t;
             zx_time_t last = now;
-            list_for_every_entry (&percpu[i].timer_queue, t, timer_t, node) {
+            for (timer_t* t = percpu[i].timer_first; t != NULL; t = timer_tree_next(t)) {
                 zx_duration_t delta_now = (t->scheduled_time > now) ? (t->scheduled_time - now) : 0;
                 zx_duration_t delta_last = (t->scheduled_time > last) ? (t->scheduled_time - last) : 0;
                 ptr += snprintf(buf + ptr, len - ptr,
@@ -508,10 +603,12 @@ static void dump_timer_queues(char* buf, size_t len) {
                                 t->scheduled_time, delta_now, delta_last, t->callback, t->arg);
                 last = t->scheduled_time;
             }
+
+            spin_unlock(&percpu[i].timer_lock);
         }
     }
 
-    spin_unlock_irqrestore(&timer_lock, state);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 }
 
 #if WITH_LIB_CONSOLE
@@ -77,6 +77,23 @@ static void counters_init(unsigned level) {
     }
 }
 
+static uint64_t get_counter_total(const k_counter_desc* desc) {
+    size_t counter_index = kcounter_index(desc);
+
+    uint64_t sum = 0;
+    for (size_t ix = 0; ix != SMP_MAX_CPUS; ++ix) {
+        sum += percpu[ix].counters[counter_index];
+    }
+    return sum;
+}
+
+uint64_t kcounter_get_total(const char* name) {
+    auto desc = upper_bound(name, kcountdesc_begin, kcountdesc_end);
+    if (desc == kcountdesc_end || strcmp(desc->name, name) != 0)
+        return 0;
+    return get_counter_total(desc);
+}
+
 static void dump_counter(const k_counter_desc* desc) {
     size_t counter_index = kcounter_index(desc);
 
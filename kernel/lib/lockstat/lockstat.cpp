@@ -0,0 +1,191 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <lib/lockstat.h>
+
+#if ENABLE_LOCK_STATS
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <arch/ops.h>
+#include <kernel/atomic.h>
+#include <kernel/mutex.h>
+#include <kernel/spinlock.h>
+#include <platform.h>
+
+#include <lib/console.h>
+
+// Spinlocks are plain words, so the class of a spinlock is looked up by its
+// address in a small open addressed table. Entries are only ever added, at
+// init time, and are published lock pointer last so that lockstat_spin_lock()
+// can search the table without a lock.
+static constexpr size_t kSpinClassTableSize = 128;
+
+struct spin_class_entry {
+    spin_lock_t* volatile lock;
+    lock_class_t* lock_class;
+};
+
+static spin_class_entry spin_class_table[kSpinClassTableSize];
+
+// Protects spin_class_table insertion and the class list. It is taken with
+// arch_spin_lock() directly so that it is never counted itself.
+static spin_lock_t lockstat_lock = SPIN_LOCK_INITIAL_VALUE;
+static lock_class_t* lock_classes;
+
+static size_t spin_class_hash(const spin_lock_t* lock) {
+    return (((uintptr_t)lock >> 3) * 0x9e3779b97f4a7c15ull) >> 57;
+}
+static_assert(kSpinClassTableSize == (1u << 7), "hash must cover the table");
+
+static lock_class_t* spin_class_lookup(const spin_lock_t* lock) {
+    size_t i = spin_class_hash(lock);
+    for (size_t probe = 0; probe < kSpinClassTableSize; probe++) {
+        const spin_class_entry& e = spin_class_table[(i + probe) % kSpinClassTableSize];
+        spin_lock_t* entry_lock = e.lock;
+        if (entry_lock == lock)
+            return e.lock_class;
+        if (entry_lock == nullptr)
+            return nullptr;
+    }
+    return nullptr;
+}
+
+// lockstat_lock must be held.
+static void register_class_locked(lock_class_t* lock_class) {
+    if (!lock_class->registered) {
+        lock_class->next = lock_classes;
+        smp_mb();
+        lock_classes = lock_class;
+        lock_class->registered = true;
+    }
+}
+
+void lockstat_set_spin_class(spin_lock_t* lock, lock_class_t* lock_class) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    arch_spin_lock(&lockstat_lock);
+
+    register_class_locked(lock_class);
+
+    size_t i = spin_class_hash(lock);
+    size_t probe;
+    for (probe = 0; probe < kSpinClassTableSize; probe++) {
+        spin_class_entry& e = spin_class_table[(i + probe) % kSpinClassTableSize];
+        if (e.lock == lock) {
+            e.lock_class = lock_class;
+            break;
+        }
+        if (e.lock == nullptr) {
+            e.lock_class = lock_class;
+            smp_mb();
+            e.lock = lock;
+            break;
+        }
+    }
+
+    arch_spin_unlock(&lockstat_lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (probe == kSpinClassTableSize)
+        printf("lockstat: no room to track spinlock %p (%s)\n", lock, lock_class->name);
+}
+
+void lockstat_set_mutex_class(mutex_t* m, lock_class_t* lock_class) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    arch_spin_lock(&lockstat_lock);
+
+    register_class_locked(lock_class);
+
+    arch_spin_unlock(&lockstat_lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    m->lock_class = lock_class;
+}
+
+void lockstat_spin_lock(spin_lock_t* lock) TA_NO_THREAD_SAFETY_ANALYSIS {
+    lock_class_t* lock_class = spin_class_lookup(lock);
+    if (lock_class == nullptr) {
+        arch_spin_lock(lock);
+        return;
+    }
+
+    // arch_spin_trylock() returns 0 on success
+    if (likely(arch_spin_trylock(lock) == 0)) {
+        lockstat_record(lock_class, false, 0);
+        return;
+    }
+
+    zx_time_t start = current_time();
+    arch_spin_lock(lock);
+    lockstat_record(lock_class, true, current_time() - start);
+}
+
+void lockstat_record(lock_class_t* lock_class, bool contended, zx_duration_t wait_time) {
+    atomic_add_u64_relaxed(&lock_class->acquisitions, 1);
+    if (!contended)
+        return;
+
+    atomic_add_u64_relaxed(&lock_class->contentions, 1);
+    atomic_add_u64_relaxed(&lock_class->total_wait_time, wait_time);
+
+    uint64_t max = atomic_load_u64_relaxed(&lock_class->max_wait_time);
+    while (wait_time > max) {
+        if (atomic_cmpxchg_u64(&lock_class->max_wait_time, &max, wait_time))
+            break;
+    }
+}
+
+void lockstat_for_each_class(void (*func)(const lock_class_t* lock_class, void* arg), void* arg) {
+    // The list only ever grows at the head, so walk a snapshot of it without the lock.
+    lock_class_t* head = (lock_class_t*)atomic_load_u64((uint64_t*)&lock_classes);
+    for (lock_class_t* c = head; c != nullptr; c = c->next) {
+        func(c, arg);
+    }
+}
+
+static void lockstat_reset() {
+    for (lock_class_t* c = lock_classes; c != nullptr; c = c->next) {
+        atomic_store_u64(&c->acquisitions, 0);
+        atomic_store_u64(&c->contentions, 0);
+        atomic_store_u64(&c->total_wait_time, 0);
+        atomic_store_u64(&c->max_wait_time, 0);
+    }
+}
+
+static void dump_class(const lock_class_t* c, void* arg) {
+    uint64_t contentions = c->contentions;
+    printf("%-24s %14" PRIu64 " %12" PRIu64 " %14" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n",
+           c->name, c->acquisitions, contentions, c->total_wait_time,
+           contentions ? c->total_wait_time / contentions : 0, c->max_wait_time);
+}
+
+static int cmd_lockstat(int argc, const cmd_args* argv, uint32_t flags) {
+    if (argc > 1) {
+        if (!strcmp(argv[1].str, "reset")) {
+            lockstat_reset();
+            return 0;
+        }
+        printf("usage:\n"
+               "%s        : dump lock statistics, times are in ns\n"
+               "%s reset  : zero lock statistics\n",
+               argv[0].str, argv[0].str);
+        return ZX_ERR_INVALID_ARGS;
+    }
+
+    printf("%-24s %14s %12s %14s %10s %10s\n",
+           "class", "acquisitions", "contentions", "total wait", "avg wait", "max wait");
+    lockstat_for_each_class(&dump_class, nullptr);
+    return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("lockstat", "lock contention statistics", &cmd_lockstat)
+STATIC_COMMAND_END(lockstat);
+
+#endif // ENABLE_LOCK_STATS
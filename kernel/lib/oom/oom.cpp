@@ -106,6 +106,9 @@ static int oom_loop(void* arg) {
         last_free_bytes = free_bytes;
 
         if (lowmem) {
+            // Cached pages are already counted as free, but hand them back to
+            // the arenas where any cpu can use them.
+            pmm_drain_page_caches();
             lowmem_callback(shortfall_bytes);
         }
 
@@ -163,8 +163,9 @@ static zx_status_t make_bootstrap_channel(
     if (status != ZX_OK)
         return status;
 
-    zx_handle_t hv = process->MapHandleToValue(user_channel_handle);
-    process->AddHandle(fbl::move(user_channel_handle));
+    zx_handle_t hv = process->AddHandle(fbl::move(user_channel_handle));
+    if (hv == ZX_HANDLE_INVALID)
+        return ZX_ERR_NO_MEMORY;
 
     *out = hv;
     return ZX_OK;
@@ -139,6 +139,7 @@ void ChannelDispatcher::OnPeerZeroHandlesLocked() TA_NO_THREAD_SAFETY_ANALYSIS {
 
 zx_status_t ChannelDispatcher::Read(uint32_t* msg_size,
                                     uint32_t* msg_handle_count,
+                                    uint32_t reserved_handle_count,
                                     fbl::unique_ptr<MessagePacket>* msg,
                                     bool may_discard) {
     canary_.Assert();
@@ -158,6 +159,8 @@ zx_status_t ChannelDispatcher::Read(uint32_t* msg_size,
         if (!may_discard)
             return ZX_ERR_BUFFER_TOO_SMALL;
         rv = ZX_ERR_BUFFER_TOO_SMALL;
+    } else if (*msg_handle_count > reserved_handle_count) {
+        return ZX_ERR_NEXT;
     }
 
     *msg = messages_.pop_front();
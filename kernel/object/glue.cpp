@@ -21,6 +21,8 @@
 
 #include <lib/oom.h>
 
+#include <vm/scanner.h>
+
 #include <object/diagnostics.h>
 #include <object/excp_port.h>
 #include <object/job_dispatcher.h>
@@ -115,6 +117,22 @@ private:
 // Called from a dedicated kernel thread when the system is low on memory.
 static void oom_lowmem(size_t shortfall_bytes) {
     printf("OOM: oom_lowmem(shortfall_bytes=%zu) called\n", shortfall_bytes);
+
+    // Pages that only hold zeros can be given back without killing anyone.
+    const size_t shortfall_pages = ROUNDUP(shortfall_bytes, PAGE_SIZE) / PAGE_SIZE;
+    const size_t reclaimed_pages = scanner_reclaim_zero_pages(shortfall_pages);
+    printf("OOM: reclaimed %zu zero pages\n", reclaimed_pages);
+    if (reclaimed_pages >= shortfall_pages) {
+        return;
+    }
+
+    // Then compressing the pages that are left.
+    const size_t compressed_pages = scanner_compress_pages(shortfall_pages - reclaimed_pages);
+    printf("OOM: freed %zu pages by compression\n", compressed_pages);
+    if (reclaimed_pages + compressed_pages >= shortfall_pages) {
+        return;
+    }
+
     printf("OOM: Process mapped committed bytes:\n");
     DumpProcessMemoryUsage("OOM:   ", /*min_pages=*/8 * MB / PAGE_SIZE);
     printf("OOM: Finding a job to kill...\n");
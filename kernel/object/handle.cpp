@@ -10,8 +10,12 @@
 #include <fbl/arena.h>
 #include <fbl/auto_lock.h>
 #include <fbl/mutex.h>
+#include <kernel/align.h>
+#include <kernel/mp.h>
+#include <kernel/spinlock.h>
 #include <lib/counters.h>
-#include <pow2.h>
+#include <lib/lockstat.h>
+#include <string.h>
 
 using fbl::AutoLock;
 
@@ -24,32 +28,76 @@ constexpr size_t kMaxHandleCount = 256 * 1024u;
 // there are this many outstanding handles.
 constexpr size_t kHighHandleCount = (kMaxHandleCount * 7) / 8;
 
+// Each cpu caches up to this many free handles, and moves half of that at a
+// time from and to the arena.
+constexpr size_t kCacheMax = 64;
+constexpr size_t kCacheBatch = kCacheMax / 2;
+
 KCOUNTER(handle_count_new, "kernel.handles.new");
 KCOUNTER(handle_count_duped, "kernel.handles.duped");
 KCOUNTER(handle_count_freed, "kernel.handles.freed");
+KCOUNTER(handle_cache_misses, "kernel.handles.cache_misses");
+
+// Free handles in the caches are linked through their first word.
+struct FreeHandle {
+    FreeHandle* next;
+};
+
+struct HandleCache {
+    SpinLock lock;
+    FreeHandle* handles TA_GUARDED(lock) = nullptr;
+    size_t count TA_GUARDED(lock) = 0;
+} __CPU_ALIGN;
+
+HandleCache handle_caches[SMP_MAX_CPUS];
+
+// Pushes the |count| handles of |list|, which ends at |tail|, on the cache of
+// the current cpu. Returns a batch of handles for the arena if that takes the
+// cache over kCacheMax.
+FreeHandle* CachePush(FreeHandle* list, FreeHandle* tail, size_t count) {
+    FreeHandle* overflow = nullptr;
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    HandleCache& cache = handle_caches[arch_curr_cpu_num()];
+
+    cache.lock.Acquire();
+    tail->next = cache.handles;
+    cache.handles = list;
+    cache.count += count;
+    if (cache.count > kCacheMax) {
+        for (size_t i = 0; i < kCacheBatch; i++) {
+            FreeHandle* excess = cache.handles;
+            cache.handles = excess->next;
+            excess->next = overflow;
+            overflow = excess;
+        }
+        cache.count -= kCacheBatch;
+    }
+    cache.lock.Release();
 
-// Masks for building a Handle's base_value, which ProcessDispatcher
-// uses to create zx_handle_t values.
-//
-// base_value bit fields:
-//   [31..30]: Must be zero
-//   [29..kHandleGenerationShift]: Generation number
-//                                 Masked by kHandleGenerationMask
-//   [kHandleGenerationShift-1..0]: Index into handle_arena
-//                                  Masked by kHandleIndexMask
-constexpr uint32_t kHandleIndexMask = kMaxHandleCount - 1;
-static_assert((kHandleIndexMask & kMaxHandleCount) == 0,
-              "kMaxHandleCount must be a power of 2");
-constexpr uint32_t kHandleGenerationMask = ~kHandleIndexMask & ~(3 << 30);
-constexpr uint32_t kHandleGenerationShift = log2_uint_floor(kMaxHandleCount);
-static_assert(((3 << (kHandleGenerationShift - 1)) & kHandleGenerationMask) ==
-                  1 << kHandleGenerationShift,
-              "Shift is wrong");
-static_assert((kHandleGenerationMask >> kHandleGenerationShift) >= 255,
-              "Not enough room for a useful generation count");
-static_assert(((3 << 30) ^ kHandleGenerationMask ^ kHandleIndexMask) ==
-                  0xffffffffu,
-              "Masks do not agree");
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return overflow;
+}
+
+// Pops a handle from the cache of the current cpu, or returns null if it is
+// empty.
+void* CachePop() {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    HandleCache& cache = handle_caches[arch_curr_cpu_num()];
+
+    cache.lock.Acquire();
+    FreeHandle* handle = cache.handles;
+    if (handle) {
+        cache.handles = handle->next;
+        cache.count--;
+    }
+    cache.lock.Release();
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return handle;
+}
 
 }  // namespace
 
@@ -58,51 +106,62 @@ fbl::Arena Handle::arena_;
 
 void Handle::Init() TA_NO_THREAD_SAFETY_ANALYSIS {
     arena_.Init("handles", sizeof(Handle), kMaxHandleCount);
+    LOCK_CLASS_MUTEX(mutex_.GetInternal(), "object.handle_lock");
 }
 
-// Returns a new |base_value| based on the value stored in the free
-// arena slot pointed to by |addr|. The new value will be different
-// from the last |base_value| used by this slot.
-uint32_t Handle::GetNewBaseValue(void* addr) TA_REQ(mutex_) {
-    // Get the index of this slot within the arena.
-    uint32_t handle_index = HandleToIndex(reinterpret_cast<Handle*>(addr));
-    DEBUG_ASSERT((handle_index & ~kHandleIndexMask) == 0);
-
-    // Check the free memory for a stashed base_value.
-    uint32_t v = *reinterpret_cast<uint32_t*>(addr);
-    uint32_t old_gen = 0;
-    if (v != 0) {
-        // This slot has been used before.
-        DEBUG_ASSERT((v & kHandleIndexMask) == handle_index);
-        old_gen = (v & kHandleGenerationMask) >> kHandleGenerationShift;
-    }
-    uint32_t new_gen =
-        (((old_gen + 1) << kHandleGenerationShift) & kHandleGenerationMask);
-    return (handle_index | new_gen);
-}
+// Refills the cache of the current cpu with a batch of handles from the arena,
+// and returns one more of them. Falls back to taking a handle from another
+// cpu's cache if the arena is exhausted.
+void* Handle::AllocFromArena(const char* what) {
+    kcounter_add(handle_cache_misses, 1u);
 
-// Allocate space for a Handle from the arena, but don't instantiate the
-// object.  |base_value| gets the value for Handle::base_value_.  |what|
-// says whether this is allocation or duplication, for the error message.
-void* Handle::Alloc(const fbl::RefPtr<Dispatcher>& dispatcher,
-                    const char* what, uint32_t* base_value) {
+    FreeHandle* list = nullptr;
+    FreeHandle* tail = nullptr;
+    size_t taken = 0;
     size_t outstanding_handles;
     {
         AutoLock lock(&mutex_);
-        void* addr = arena_.Alloc();
+        while (taken <= kCacheBatch) {
+            auto handle = static_cast<FreeHandle*>(arena_.Alloc());
+            if (!handle)
+                break;
+            handle->next = list;
+            list = handle;
+            if (!tail)
+                tail = handle;
+            taken++;
+        }
+        // This counts the handles cached on each cpu as outstanding.
         outstanding_handles = arena_.DiagnosticCount();
-        if (likely(addr)) {
-            if (outstanding_handles > kHighHandleCount) {
-                // TODO: Avoid calling this for every handle after
-                // kHighHandleCount; printfs are slow and we're
-                // holding the mutex.
-                printf("WARNING: High handle count: %zu handles\n",
-                       outstanding_handles);
-            }
-            dispatcher->increment_handle_count();
-            *base_value = GetNewBaseValue(addr);
-            return addr;
+    }
+
+    if (outstanding_handles > kHighHandleCount) {
+        printf("WARNING: High handle count: %zu handles\n",
+               outstanding_handles);
+    }
+
+    if (list) {
+        FreeHandle* handle = list;
+        list = list->next;
+        if (list) {
+            FreeHandle* overflow = CachePush(list, tail, taken - 1);
+            if (overflow)
+                FreeToArena(overflow);
         }
+        return handle;
+    }
+
+    for (HandleCache& cache : handle_caches) {
+        spin_lock_saved_state_t state;
+        cache.lock.AcquireIrqSave(state);
+        FreeHandle* handle = cache.handles;
+        if (handle) {
+            cache.handles = handle->next;
+            cache.count--;
+        }
+        cache.lock.ReleaseIrqRestore(state);
+        if (handle)
+            return handle;
     }
 
     printf("WARNING: Could not allocate %s handle (%zu outstanding)\n",
@@ -110,67 +169,93 @@ void* Handle::Alloc(const fbl::RefPtr<Dispatcher>& dispatcher,
     return nullptr;
 }
 
+// Allocate space for a Handle, but don't instantiate the object. |what| says
+// whether this is allocation or duplication, for the error message.
+void* Handle::Alloc(const fbl::RefPtr<Dispatcher>& dispatcher, const char* what) {
+    void* addr = CachePop();
+    if (unlikely(!addr)) {
+        addr = AllocFromArena(what);
+        if (!addr)
+            return nullptr;
+    }
+    dispatcher->increment_handle_count();
+    return addr;
+}
+
+// Returns the space of a Handle to the cache of the current cpu.
+void Handle::Free(void* addr) {
+    auto handle = static_cast<FreeHandle*>(addr);
+    FreeHandle* overflow = CachePush(handle, handle, 1);
+    if (overflow)
+        FreeToArena(overflow);
+}
+
+// Returns a list of handle spaces linked by FreeHandle to the arena.
+void Handle::FreeToArena(void* list) {
+    auto overflow = static_cast<FreeHandle*>(list);
+    AutoLock lock(&mutex_);
+    while (overflow) {
+        FreeHandle* excess = overflow;
+        overflow = excess->next;
+        arena_.Free(excess);
+    }
+}
+
+size_t Handle::CachedHandles() {
+    size_t cached = 0;
+    for (HandleCache& cache : handle_caches) {
+        spin_lock_saved_state_t state;
+        cache.lock.AcquireIrqSave(state);
+        cached += cache.count;
+        cache.lock.ReleaseIrqRestore(state);
+    }
+    return cached;
+}
+
 HandleOwner Handle::Make(fbl::RefPtr<Dispatcher> dispatcher,
                          zx_rights_t rights) {
-    uint32_t base_value;
-    void* addr = Alloc(dispatcher, "new", &base_value);
+    void* addr = Alloc(dispatcher, "new");
     if (unlikely(!addr))
         return nullptr;
     kcounter_add(handle_count_new, 1u);
-    return HandleOwner(new (addr) Handle(fbl::move(dispatcher),
-                                         rights, base_value));
+    return HandleOwner(new (addr) Handle(fbl::move(dispatcher), rights));
 }
 
 // Called only by Make.
-Handle::Handle(fbl::RefPtr<Dispatcher> dispatcher, zx_rights_t rights,
-               uint32_t base_value)
+Handle::Handle(fbl::RefPtr<Dispatcher> dispatcher, zx_rights_t rights)
     : process_id_(0u),
       dispatcher_(fbl::move(dispatcher)),
       rights_(rights),
-      base_value_(base_value) {
+      base_value_(0u) {
 }
 
 HandleOwner Handle::Dup(Handle* source, zx_rights_t rights) {
-    uint32_t base_value;
-    void* addr = Alloc(source->dispatcher(), "duplicate", &base_value);
+    void* addr = Alloc(source->dispatcher(), "duplicate");
     if (unlikely(!addr))
         return nullptr;
     kcounter_add(handle_count_duped, 1u);
-    return HandleOwner(new (addr) Handle(source, rights, base_value));
+    return HandleOwner(new (addr) Handle(source, rights));
 }
 
 // Called only by Dup.
-Handle::Handle(Handle* rhs, zx_rights_t rights, uint32_t base_value)
+Handle::Handle(Handle* rhs, zx_rights_t rights)
     : process_id_(rhs->process_id()),
       dispatcher_(rhs->dispatcher_),
       rights_(rights),
-      base_value_(base_value) {
+      base_value_(0u) {
 }
 
 // Destroys, but does not free, the Handle, and fixes up its memory to protect
-// against stale pointers to it. Also stashes the Handle's base_value for reuse
-// the next time this slot is allocated.
+// against stale pointers to it.
 void Handle::TearDown() TA_EXCL(mutex_) {
-    uint32_t old_base_value = base_value();
-
     // Calling the handle dtor can cause many things to happen, so it is
     // important to call it outside the lock.
     this->~Handle();
 
-    // There may be stale pointers to this slot. Zero out most of its fields
-    // to ensure that the Handle does not appear to belong to any process
-    // or point to any Dispatcher.
+    // There may be stale pointers to this slot. Zero out its fields to ensure
+    // that the Handle does not appear to belong to any process or point to
+    // any Dispatcher.
     memset(this, 0, sizeof(*this));
-
-    // Hold onto the base_value for the next user of this slot, stashing
-    // it at the beginning of the free slot.
-    *reinterpret_cast<uint32_t*>(this) = old_base_value;
-
-    // Double-check that the process_id field is zero, ensuring that
-    // no process can refer to this slot while it's free. This isn't
-    // completely legal since |handle| points to unconstructed memory,
-    // but it should be safe enough for an assertion.
-    DEBUG_ASSERT(process_id() == 0);
 }
 
 void Handle::Delete() {
@@ -181,12 +266,8 @@ void Handle::Delete() {
 
     TearDown();
 
-    bool zero_handles = false;
-    {
-        AutoLock lock(&mutex_);
-        zero_handles = disp->decrement_handle_count();
-        arena_.Free(this);
-    }
+    bool zero_handles = disp->decrement_handle_count();
+    Free(this);
 
     if (zero_handles)
         disp->on_zero_handles();
@@ -196,28 +277,21 @@ void Handle::Delete() {
     kcounter_add(handle_count_freed, 1u);
 }
 
-Handle* Handle::FromU32(uint32_t value) TA_NO_THREAD_SAFETY_ANALYSIS {
-    Handle* handle = IndexToHandle(value & kHandleIndexMask);
-    {
-        AutoLock lock(&mutex_);
-        if (unlikely(!arena_.in_range(handle)))
-            return nullptr;
-    }
-    return likely(handle->base_value() == value) ? handle : nullptr;
-}
-
 uint32_t Handle::Count(const fbl::RefPtr<const Dispatcher>& dispatcher) {
-    // Handle::mutex_ also guards Dispatcher::handle_count_.
-    AutoLock lock(&mutex_);
     return dispatcher->current_handle_count();
 }
 
 size_t Handle::diagnostics::OutstandingHandles() {
+    // The caches are read one at a time while handles move between them and
+    // the arena, so the sum may briefly exceed what the arena counts.
+    size_t cached = CachedHandles();
     AutoLock lock(&mutex_);
-    return arena_.DiagnosticCount();
+    size_t allocated = arena_.DiagnosticCount();
+    return allocated > cached ? allocated - cached : 0u;
 }
 
 void Handle::diagnostics::DumpTableInfo() {
+    printf("%zu free handles cached on cpus\n", CachedHandles());
     AutoLock lock(&mutex_);
     arena_.Dump();
 }
@@ -0,0 +1,177 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <object/handle_table.h>
+
+#include <assert.h>
+#include <fbl/alloc_checker.h>
+#include <object/handle.h>
+#include <string.h>
+
+HandleTable::~HandleTable() {
+    DEBUG_ASSERT(count_ == 0);
+}
+
+bool HandleTable::Add(Handle* handle) {
+    if (free_head_ == kNoSlot && !Grow())
+        return false;
+
+    uint32_t index = free_head_;
+    Slot& slot = slots_[index];
+    DEBUG_ASSERT(slot.handle == nullptr && !slot.reserved);
+    free_head_ = slot.next_free;
+
+    slot.handle = handle;
+    count_++;
+    handle->set_base_value(index | (slot.generation << kGenerationShift));
+    return true;
+}
+
+HandleTable::Slot* HandleTable::Find(uint32_t base_value, bool reserved) const {
+    // The high bits are not masked off by IndexOf() or GenerationOf(), so a
+    // value with them set would otherwise alias a valid one.
+    if (!IsValid(base_value))
+        return nullptr;
+
+    uint32_t index = IndexOf(base_value);
+    if (index >= slots_.size())
+        return nullptr;
+
+    // Only reserved slots may be without a handle; free slots never are
+    // reserved.
+    Slot* slot = &slots_[index];
+    if (slot->reserved != reserved || (!reserved && slot->handle == nullptr) ||
+        slot->generation != GenerationOf(base_value))
+        return nullptr;
+    return slot;
+}
+
+Handle* HandleTable::Get(uint32_t base_value) const {
+    Slot* slot = Find(base_value, false);
+    return slot ? slot->handle : nullptr;
+}
+
+Handle* HandleTable::Remove(uint32_t base_value) {
+    Slot* slot = Find(base_value, false);
+    if (!slot)
+        return nullptr;
+
+    Handle* handle = slot->handle;
+    FreeSlot(IndexOf(base_value));
+    count_--;
+    return handle;
+}
+
+Handle* HandleTable::Reserve(uint32_t base_value) {
+    Slot* slot = Find(base_value, false);
+    if (!slot)
+        return nullptr;
+
+    slot->reserved = true;
+    count_--;
+    return slot->handle;
+}
+
+Handle* HandleTable::Restore(uint32_t base_value) {
+    Slot* slot = Find(base_value, true);
+    DEBUG_ASSERT(slot && slot->handle);
+    if (!slot || !slot->handle)
+        return nullptr;
+
+    slot->reserved = false;
+    count_++;
+    return slot->handle;
+}
+
+bool HandleTable::ReserveFree(uint32_t* base_value) {
+    if (free_head_ == kNoSlot && !Grow())
+        return false;
+
+    uint32_t index = free_head_;
+    Slot& slot = slots_[index];
+    DEBUG_ASSERT(slot.handle == nullptr && !slot.reserved);
+    free_head_ = slot.next_free;
+
+    slot.reserved = true;
+    *base_value = index | (slot.generation << kGenerationShift);
+    return true;
+}
+
+bool HandleTable::Publish(uint32_t base_value, Handle* handle) {
+    Slot* slot = Find(base_value, true);
+    DEBUG_ASSERT(slot && !slot->handle);
+    if (!slot || slot->handle)
+        return false;
+
+    slot->handle = handle;
+    slot->reserved = false;
+    count_++;
+    handle->set_base_value(base_value);
+    return true;
+}
+
+void HandleTable::Release(uint32_t base_value) {
+    Slot* slot = Find(base_value, true);
+    DEBUG_ASSERT(slot);
+    if (!slot)
+        return;
+    FreeSlot(IndexOf(base_value));
+}
+
+void HandleTable::Unreserve(uint32_t base_value) {
+    Slot* slot = Find(base_value, true);
+    DEBUG_ASSERT(slot && !slot->handle);
+    if (!slot || slot->handle)
+        return;
+    FreeSlot(IndexOf(base_value), false);
+}
+
+void HandleTable::swap(HandleTable& other) {
+    slots_.swap(other.slots_);
+    uint32_t free_head = free_head_;
+    free_head_ = other.free_head_;
+    other.free_head_ = free_head;
+    size_t count = count_;
+    count_ = other.count_;
+    other.count_ = count;
+}
+
+void HandleTable::FreeSlot(uint32_t index, bool stale) {
+    Slot& slot = slots_[index];
+    slot.handle = nullptr;
+    slot.reserved = false;
+    if (stale)
+        slot.generation = (slot.generation + 1) & kGenerationMask;
+    slot.next_free = free_head_;
+    free_head_ = index;
+}
+
+bool HandleTable::Grow() {
+    size_t old_size = slots_.size();
+    size_t new_size = old_size ? old_size * 2 : kInitialSlots;
+    if (new_size > kMaxSlots)
+        return false;
+
+    fbl::AllocChecker ac;
+    Slot* slots = new (&ac) Slot[new_size];
+    if (!ac.check())
+        return false;
+
+    if (old_size)
+        memcpy(slots, slots_.get(), old_size * sizeof(Slot));
+
+    // Chain the new slots so that the lowest index is used first.
+    for (size_t i = old_size; i < new_size; i++) {
+        slots[i].handle = nullptr;
+        slots[i].next_free = (i + 1 < new_size) ? static_cast<uint32_t>(i + 1) : free_head_;
+        slots[i].generation = 0;
+        slots[i].reserved = false;
+    }
+    free_head_ = static_cast<uint32_t>(old_size);
+
+    slots_.reset(slots, new_size);
+    return true;
+}
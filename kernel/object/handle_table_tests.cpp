@@ -0,0 +1,215 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <object/handle_table.h>
+
+#include <lib/counters.h>
+#include <object/event_dispatcher.h>
+#include <object/handle.h>
+#include <unittest.h>
+
+namespace {
+
+constexpr size_t kCount = 100;
+
+static HandleOwner make_handle() {
+    fbl::RefPtr<Dispatcher> dispatcher;
+    zx_rights_t rights;
+    if (EventDispatcher::Create(0u, &dispatcher, &rights) != ZX_OK)
+        return nullptr;
+    return Handle::Make(fbl::move(dispatcher), rights);
+}
+
+// Takes every handle out of |table| and destroys them.
+static void clear_table(HandleTable* table) {
+    table->RemoveAll([](Handle* handle) {
+        HandleOwner ho(handle);
+    });
+}
+
+// Tests adding enough handles to grow the table, and finding and removing
+// them by their base values.
+static bool table_add_remove() {
+    BEGIN_TEST;
+    HandleTable table;
+    static Handle* handles[kCount];
+    static uint32_t values[kCount];
+
+    for (size_t i = 0; i < kCount; i++) {
+        HandleOwner handle = make_handle();
+        ASSERT_TRUE(handle, "");
+        ASSERT_TRUE(table.Add(handle.get()), "");
+        handles[i] = handle.release();
+        values[i] = handles[i]->base_value();
+    }
+    EXPECT_EQ(kCount, table.count(), "");
+
+    for (size_t i = 0; i < kCount; i++) {
+        EXPECT_EQ(handles[i], table.Get(values[i]), "");
+    }
+
+    HandleOwner removed(table.Remove(values[7]));
+    EXPECT_EQ(handles[7], removed.get(), "");
+    EXPECT_NULL(table.Get(values[7]), "");
+    EXPECT_NULL(table.Remove(values[7]), "");
+    EXPECT_EQ(kCount - 1, table.count(), "");
+
+    // The freed slot is used again, but with a new generation, so the old
+    // value does not find the new handle.
+    HandleOwner handle = make_handle();
+    ASSERT_TRUE(handle, "");
+    ASSERT_TRUE(table.Add(handle.get()), "");
+    uint32_t value = handle->base_value();
+    EXPECT_NE(values[7], value, "");
+    EXPECT_NULL(table.Get(values[7]), "");
+    EXPECT_EQ(handle.get(), table.Get(value), "");
+    handle.release();
+
+    // Bits above the generation are not ignored.
+    EXPECT_NULL(table.Get(value | 0x40000000), "");
+    EXPECT_NULL(table.Get(value | 0x80000000), "");
+
+    int found = 0;
+    table.ForEach([&found](Handle* handle) {
+        found++;
+        return ZX_OK;
+    });
+    EXPECT_EQ(static_cast<int>(kCount), found, "");
+
+    clear_table(&table);
+    EXPECT_EQ(0u, table.count(), "");
+    EXPECT_NULL(table.Get(value), "");
+    END_TEST;
+}
+
+// Tests that a reserved slot is not found nor used again until it is released,
+// and that restoring its handle puts it back at the same value.
+static bool table_reserve() {
+    BEGIN_TEST;
+    HandleTable table;
+
+    HandleOwner handle = make_handle();
+    ASSERT_TRUE(handle, "");
+    ASSERT_TRUE(table.Add(handle.get()), "");
+    Handle* reserved = handle.release();
+    uint32_t value = reserved->base_value();
+
+    EXPECT_EQ(reserved, table.Reserve(value), "");
+    EXPECT_NULL(table.Get(value), "");
+    EXPECT_EQ(0u, table.count(), "");
+
+    handle = make_handle();
+    ASSERT_TRUE(handle, "");
+    ASSERT_TRUE(table.Add(handle.get()), "");
+    EXPECT_NE(value, handle->base_value(), "");
+    HandleOwner other(table.Remove(handle.release()->base_value()));
+
+    EXPECT_EQ(reserved, table.Restore(value), "");
+    EXPECT_EQ(reserved, table.Get(value), "");
+    EXPECT_EQ(1u, table.count(), "");
+
+    // Once released, the slot is used again with a new generation.
+    EXPECT_EQ(reserved, table.Reserve(value), "");
+    table.Release(value);
+    HandleOwner released(reserved);
+
+    handle = make_handle();
+    ASSERT_TRUE(handle, "");
+    ASSERT_TRUE(table.Add(handle.get()), "");
+    EXPECT_NE(value, handle->base_value(), "");
+    EXPECT_NULL(table.Get(value), "");
+    handle.release();
+
+    clear_table(&table);
+    END_TEST;
+}
+
+// Tests that a slot reserved by ReserveFree() holds no handle until one is
+// published in it, and that releasing it instead frees it.
+static bool table_reserve_free() {
+    BEGIN_TEST;
+    HandleTable table;
+
+    uint32_t value;
+    ASSERT_TRUE(table.ReserveFree(&value), "");
+    EXPECT_NULL(table.Get(value), "");
+    EXPECT_EQ(0u, table.count(), "");
+
+    // The reserved slot is not handed out again.
+    HandleOwner handle = make_handle();
+    ASSERT_TRUE(handle, "");
+    ASSERT_TRUE(table.Add(handle.get()), "");
+    EXPECT_NE(value, handle->base_value(), "");
+    handle.release();
+
+    handle = make_handle();
+    ASSERT_TRUE(handle, "");
+    ASSERT_TRUE(table.Publish(value, handle.get()), "");
+    EXPECT_EQ(value, handle->base_value(), "");
+    EXPECT_EQ(handle.get(), table.Get(value), "");
+    EXPECT_EQ(2u, table.count(), "");
+    handle.release();
+
+    // A released slot is used again with a new generation.
+    uint32_t released;
+    ASSERT_TRUE(table.ReserveFree(&released), "");
+    table.Release(released);
+    handle = make_handle();
+    ASSERT_TRUE(handle, "");
+    ASSERT_TRUE(table.Add(handle.get()), "");
+    EXPECT_NE(released, handle->base_value(), "");
+    EXPECT_NULL(table.Get(released), "");
+    handle.release();
+
+    // An unreserved slot keeps its generation, since its value was never
+    // handed out.
+    uint32_t unreserved;
+    ASSERT_TRUE(table.ReserveFree(&unreserved), "");
+    table.Unreserve(unreserved);
+    uint32_t again;
+    ASSERT_TRUE(table.ReserveFree(&again), "");
+    EXPECT_EQ(unreserved, again, "");
+    table.Unreserve(again);
+
+    clear_table(&table);
+    END_TEST;
+}
+
+// Tests that many handles at once, which take handles through the per-cpu
+// caches and the arena, do not overlap, and that most of them come from the
+// caches.
+static bool handle_alloc_many() {
+    BEGIN_TEST;
+    constexpr size_t kMany = 1024;
+    static Handle* handles[kMany];
+    static Dispatcher* dispatchers[kMany];
+
+    // Each miss refills the cache with a batch of handles, so the misses are
+    // far fewer than the handles even counting those of other threads.
+    const uint64_t misses = kcounter_get_total("kernel.handles.cache_misses");
+    for (size_t i = 0; i < kMany; i++) {
+        HandleOwner handle = make_handle();
+        ASSERT_TRUE(handle, "");
+        dispatchers[i] = handle->dispatcher().get();
+        handles[i] = handle.release();
+    }
+    EXPECT_LT(kcounter_get_total("kernel.handles.cache_misses") - misses, kMany / 4,
+              "handles not taken from the per-cpu caches");
+    for (size_t i = 0; i < kMany; i++) {
+        EXPECT_EQ(dispatchers[i], handles[i]->dispatcher().get(), "");
+        HandleOwner handle(handles[i]);
+    }
+    END_TEST;
+}
+
+}  // namespace
+
+UNITTEST_START_TESTCASE(handle_table_tests)
+UNITTEST("table_add_remove", table_add_remove)
+UNITTEST("table_reserve", table_reserve)
+UNITTEST("table_reserve_free", table_reserve_free)
+UNITTEST("handle_alloc_many", handle_alloc_many)
+UNITTEST_END_TESTCASE(handle_table_tests, "handles", "Handle table tests");
@@ -0,0 +1,46 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <stdint.h>
+
+#include <fbl/macros.h>
+#include <fbl/ref_counted.h>
+#include <object/queued_counter.h>
+#include <zircon/syscalls/object.h>
+
+// The kernel memory held by the channel messages a process wrote that have
+// not been read or discarded yet. Each message keeps a reference to the
+// account of its writer, so the charge outlives the process if the message
+// does.
+class ChannelAccount : public fbl::RefCounted<ChannelAccount> {
+public:
+    ChannelAccount() = default;
+    DISALLOW_COPY_ASSIGN_AND_MOVE(ChannelAccount);
+
+    void Charge(size_t bytes) {
+        messages_.Add(1);
+        bytes_.Add(bytes);
+    }
+
+    void Uncharge(size_t bytes) {
+        messages_.Remove(1);
+        bytes_.Remove(bytes);
+    }
+
+    void GetStats(zx_info_process_channel_stats_t* stats) const {
+        stats->queued_messages = messages_.queued();
+        stats->queued_bytes = bytes_.queued();
+        stats->peak_queued_bytes = bytes_.peak();
+        stats->total_messages = messages_.total();
+        stats->total_bytes = bytes_.total();
+    }
+
+private:
+    QueuedCounter messages_;
+    QueuedCounter bytes_;
+};
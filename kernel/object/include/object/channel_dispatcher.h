@@ -36,11 +36,14 @@ public:
 
     // Read from this endpoint's message queue.
     // |msg_size| and |msg_handle_count| are in-out parameters. As input, they specify the maximum
-    // size and handle count, respectively. On ZX_OK or ZX_ERR_BUFFER_TOO_SMALL, they specify the
-    // actual size and handle count of the next message. The next message is returned in |*msg| on
-    // ZX_OK and also on ZX_ERR_BUFFER_TOO_SMALL when |may_discard| is set.
+    // size and handle count, respectively. On ZX_OK, ZX_ERR_BUFFER_TOO_SMALL or ZX_ERR_NEXT, they
+    // specify the actual size and handle count of the next message. The next message is returned
+    // in |*msg| on ZX_OK and also on ZX_ERR_BUFFER_TOO_SMALL when |may_discard| is set.
+    // If the next message fits but carries more than |reserved_handle_count| handles, it stays in
+    // the queue and ZX_ERR_NEXT is returned, so that the caller can make room for its handles.
     zx_status_t Read(uint32_t* msg_size,
                      uint32_t* msg_handle_count,
+                     uint32_t reserved_handle_count,
                      fbl::unique_ptr<MessagePacket>* msg,
                      bool may_disard);
 
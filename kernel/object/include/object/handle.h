@@ -8,7 +8,6 @@
 
 #include <fbl/arena.h>
 #include <fbl/atomic.h>
-#include <fbl/intrusive_double_list.h>
 #include <fbl/macros.h>
 #include <fbl/mutex.h>
 #include <fbl/ref_ptr.h>
@@ -17,6 +16,7 @@
 
 class Dispatcher;
 class Handle;
+class HandleTable;
 
 // HandleOwner wraps a Handle in a unique_ptr-like object that has single
 // ownership of the Handle and deletes it whenever it falls out of scope.
@@ -76,7 +76,7 @@ private:
 };
 
 // A Handle is how a specific process refers to a specific Dispatcher.
-class Handle final : public fbl::DoublyLinkedListable<Handle*> {
+class Handle final {
 public:
     // Returns the Dispatcher to which this instance points.
     const fbl::RefPtr<Dispatcher>& dispatcher() const { return dispatcher_; }
@@ -103,9 +103,10 @@ public:
         return (rights_ & desired) == desired;
     }
 
-    // Returns a value that can be decoded by Handle::FromU32() to derive a
-    // pointer to this instance.  ProcessDispatcher will XOR this with its
-    // |handle_rand_| to create the zx_handle_t value that user space sees.
+    // Returns the index and generation of the slot of this instance in the
+    // HandleTable of its process, as set when it was last added to one.
+    // ProcessDispatcher will XOR this with its |handle_rand_| to create the
+    // zx_handle_t value that user space sees.
     uint32_t base_value() const {
         return base_value_;
     }
@@ -113,9 +114,6 @@ public:
     // To be called once during bringup.
     static void Init();
 
-    // Maps an integer obtained by Handle::base_value() back to a Handle.
-    static Handle* FromU32(uint32_t value);
-
     // Get the number of outstanding handles for a given dispatcher.
     static uint32_t Count(const fbl::RefPtr<const Dispatcher>&);
 
@@ -137,15 +135,18 @@ private:
     DISALLOW_COPY_ASSIGN_AND_MOVE(Handle);
 
     // Called only by Make.
-    Handle(fbl::RefPtr<Dispatcher> dispatcher,
-           zx_rights_t rights, uint32_t base_value);
+    Handle(fbl::RefPtr<Dispatcher> dispatcher, zx_rights_t rights);
     // Called only by Dup.
-    Handle(Handle* rhs, zx_rights_t rights, uint32_t base_value);
+    Handle(Handle* rhs, zx_rights_t rights);
 
-    // Private subroutines of Make and Dup.
-    static void* Alloc(const fbl::RefPtr<Dispatcher>&, const char* what,
-                       uint32_t* base_value);
-    static uint32_t GetNewBaseValue(void* addr);
+    // Private subroutines of Make, Dup and Delete. Free handles are cached
+    // on each cpu, so these take |mutex_| only to move a batch of them from
+    // or to the arena.
+    static void* Alloc(const fbl::RefPtr<Dispatcher>&, const char* what);
+    static void Free(void* addr);
+    static void FreeToArena(void* list);
+    static void* AllocFromArena(const char* what);
+    static size_t CachedHandles();
 
     // Handle should never be destroyed by anything other than Delete,
     // which uses TearDown to do the actual destruction.
@@ -156,28 +157,23 @@ private:
     // Only HandleOwner is allowed to call Delete.
     friend class HandleOwner;
 
+    // Only HandleTable sets base_value_.
+    friend class HandleTable;
+    void set_base_value(uint32_t base_value) {
+        base_value_ = base_value;
+    }
+
     // process_id_ is atomic because threads from different processes can
     // access it concurrently, while holding different instances of
     // handle_table_lock_.
     fbl::atomic<zx_koid_t> process_id_;
     fbl::RefPtr<Dispatcher> dispatcher_;
     const zx_rights_t rights_;
-    const uint32_t base_value_;
+    uint32_t base_value_;
 
-    // The handle arena and its mutex; also guards Dispatcher::handle_count_.
+    // The handle arena and its mutex.
     static fbl::Mutex mutex_;
     static fbl::Arena TA_GUARDED(mutex_) arena_;
-
-    // NOTE! This can return an invalid pointer.
-    // It must be checked against the arena bounds before being used.
-    static Handle* IndexToHandle(uint32_t index) TA_NO_THREAD_SAFETY_ANALYSIS {
-        return reinterpret_cast<Handle*>(arena_.start()) + index;
-    }
-
-    static uint32_t HandleToIndex(Handle* handle) TA_NO_THREAD_SAFETY_ANALYSIS {
-        return static_cast<uint32_t>(
-            handle - reinterpret_cast<Handle*>(arena_.start()));
-    }
 };
 
 // This can't be defined direclty in the HandleOwner class definition
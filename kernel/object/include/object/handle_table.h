@@ -0,0 +1,160 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <stdint.h>
+
+#include <fbl/array.h>
+#include <fbl/macros.h>
+#include <zircon/types.h>
+
+class Handle;
+
+// The handles of a process, in an array of slots indexed by the values the
+// process knows them by. A handle's base_value() holds the index of its slot
+// and the generation of the slot, which changes every time the slot is freed
+// after its value was handed out, so that a stale value does not find the
+// next handle put in the slot. Free
+// slots are kept on a list, so adding, finding and removing a handle take
+// constant time.
+//
+// A slot can also be reserved for a handle that was removed to be given to
+// another process, so that the handle can be put back at the same value if
+// giving it away fails, or for a handle the process is about to receive, so
+// that its value can be known before the handle can be used.
+//
+// HandleTable does no locking of its own; ProcessDispatcher guards it with
+// its handle_table_lock_.
+class HandleTable {
+public:
+    // base_value() bit fields:
+    //   [31..30]: Must be zero
+    //   [29..kIndexBits]: Generation number of the slot
+    //   [kIndexBits-1..0]: Index of the slot
+    static constexpr uint32_t kIndexBits = 18;
+    static constexpr uint32_t kMaxSlots = 1u << kIndexBits;
+
+    HandleTable() = default;
+    ~HandleTable();
+    DISALLOW_COPY_ASSIGN_AND_MOVE(HandleTable);
+
+    // Returns the number of handles in the table, not counting reserved
+    // slots.
+    size_t count() const { return count_; }
+
+    // Puts |handle| in a free slot, growing the table if there is none, and
+    // sets its base_value(). Returns false if the table cannot grow.
+    bool Add(Handle* handle);
+
+    // Returns the handle with the given base_value(), or null if there is
+    // none in the table.
+    Handle* Get(uint32_t base_value) const;
+
+    // Takes the handle with the given base_value() out of the table and frees
+    // its slot. Returns null if there is no such handle.
+    Handle* Remove(uint32_t base_value);
+
+    // Takes the handle with the given base_value() out of the table but keeps
+    // its slot reserved until either Restore() or Release(). Returns null if
+    // there is no such handle.
+    Handle* Reserve(uint32_t base_value);
+
+    // Puts the handle taken out by Reserve() back in its slot, and returns it.
+    Handle* Restore(uint32_t base_value);
+
+    // Reserves a free slot, growing the table if there is none, for a handle
+    // to be put in by Publish(), and returns its base_value() in
+    // |*base_value|. Returns false if the table cannot grow.
+    bool ReserveFree(uint32_t* base_value);
+
+    // Puts |handle| in the slot reserved by ReserveFree() and sets its
+    // base_value(). Returns false if there is no such slot.
+    bool Publish(uint32_t base_value, Handle* handle);
+
+    // Frees the slot reserved by Reserve() or ReserveFree().
+    void Release(uint32_t base_value);
+
+    // Frees the slot reserved by ReserveFree() for a value that was never
+    // handed out. The slot keeps its generation, since no stale copy of the
+    // value can be around.
+    void Unreserve(uint32_t base_value);
+
+    // Calls |func(Handle*)| on every handle in the table. Stops if |func|
+    // returns an error, returning the error value.
+    template <typename T>
+    zx_status_t ForEach(T func) const {
+        for (size_t i = 0; i < slots_.size(); i++) {
+            const Slot& slot = slots_[i];
+            if (slot.handle == nullptr || slot.reserved)
+                continue;
+            zx_status_t status = func(slot.handle);
+            if (status != ZX_OK)
+                return status;
+        }
+        return ZX_OK;
+    }
+
+    // Takes every handle out of the table, calling |func(Handle*)| on each
+    // after freeing its slot.
+    template <typename T>
+    void RemoveAll(T func) {
+        for (size_t i = 0; i < slots_.size(); i++) {
+            Slot& slot = slots_[i];
+            if (slot.handle == nullptr || slot.reserved)
+                continue;
+            Handle* handle = slot.handle;
+            FreeSlot(static_cast<uint32_t>(i));
+            count_--;
+            func(handle);
+        }
+    }
+
+    // Exchanges the contents of two tables.
+    void swap(HandleTable& other);
+
+private:
+    static constexpr uint32_t kGenerationShift = kIndexBits;
+    static constexpr uint32_t kIndexMask = kMaxSlots - 1;
+    static constexpr uint32_t kGenerationMask = (1u << (30 - kGenerationShift)) - 1;
+    static constexpr uint32_t kNoSlot = UINT32_MAX;
+
+    // The table starts with this many slots and doubles when full.
+    static constexpr size_t kInitialSlots = 32;
+
+    struct Slot {
+        // The handle in the slot, or the one it is reserved for; null if the
+        // slot is free or reserved by ReserveFree().
+        Handle* handle;
+        // The next free slot, while this one is free.
+        uint32_t next_free;
+        uint32_t generation;
+        bool reserved;
+    };
+
+    static bool IsValid(uint32_t base_value) {
+        return (base_value & ~(kIndexMask | (kGenerationMask << kGenerationShift))) == 0;
+    }
+    static uint32_t IndexOf(uint32_t base_value) {
+        return base_value & kIndexMask;
+    }
+    static uint32_t GenerationOf(uint32_t base_value) {
+        return (base_value >> kGenerationShift) & kGenerationMask;
+    }
+
+    // Returns the slot with the given base_value() if it holds a handle, or
+    // is reserved when |reserved| is true.
+    Slot* Find(uint32_t base_value, bool reserved) const;
+
+    // Frees the slot at |index|, giving it a new generation if |stale|
+    // copies of its value may be around.
+    void FreeSlot(uint32_t index, bool stale = true);
+    bool Grow();
+
+    fbl::Array<Slot> slots_;
+    uint32_t free_head_ = kNoSlot;
+    size_t count_ = 0;
+};
@@ -8,11 +8,13 @@
 
 #include <stdint.h>
 
+#include <kernel/sched_bandwidth.h>
 #include <object/dispatcher.h>
 #include <object/excp_port.h>
 #include <object/policy_manager.h>
 #include <object/process_dispatcher.h>
 
+#include <zircon/syscalls/object.h>
 #include <zircon/types.h>
 #include <fbl/array.h>
 #include <fbl/auto_lock.h>
@@ -97,6 +99,15 @@ public:
     zx_status_t SetPolicy(uint32_t mode, const zx_policy_basic* in_policy, size_t policy_count);
     pol_cookie_t GetPolicy();
 
+    // Limits threads in this job and its descendants to |quota| of cpu time in
+    // every |period|. A |quota| of 0 lifts the limit. Unlike SetPolicy(), this
+    // can be done while the job has children.
+    zx_status_t SetCpuBandwidth(zx_duration_t quota, zx_duration_t period);
+    void GetInfo(zx_info_job_t* info);
+
+    // The cpu bandwidth group the threads of this job's processes are charged to.
+    sched_bandwidth_t* bandwidth() { return &bandwidth_; }
+
     // Updates a partial ordering between jobs so that this job will be killed
     // after |other| in low-resource situations. If |other| is null, then this
     // job becomes the least-important job in the system.
@@ -197,6 +208,9 @@ private:
 
     fbl::RefPtr<ExceptionPort> exception_port_ TA_GUARDED(get_lock());
 
+    // Protected by the thread_lock.
+    sched_bandwidth_t bandwidth_;
+
     // Global list of JobDispatchers, ordered by relative importance. Used to
     // find victims in low-resource situations.
     fbl::DoublyLinkedListNodeState<JobDispatcher*> dll_importance_;
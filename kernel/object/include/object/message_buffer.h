@@ -0,0 +1,26 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <stddef.h>
+
+// Buffers for channel messages.
+//
+// Buffers of up to a page come from power of two size classes carved out of
+// pages that the pool takes from the pmm for only this purpose, so channel
+// memory is accounted apart from the kernel heap (as VM_PAGE_STATE_IPC pages)
+// and allocating it does not take the heap lock. Each cpu keeps a cache of free
+// buffers of every class. Bigger buffers come from the heap.
+
+// Returns a buffer of at least |size| bytes, or nullptr if out of memory.
+void* AllocMessageBuffer(size_t size);
+
+// Frees a buffer returned by AllocMessageBuffer().
+void FreeMessageBuffer(void* ptr);
+
+// Returns how much memory AllocMessageBuffer(|size|) takes up.
+size_t MessageBufferSize(size_t size);
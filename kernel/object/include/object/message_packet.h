@@ -6,11 +6,14 @@
 
 #pragma once
 
+#include <list.h>
 #include <stdint.h>
 
 #include <lib/user_copy/user_ptr.h>
+#include <object/channel_account.h>
 #include <zircon/types.h>
 #include <fbl/intrusive_double_list.h>
+#include <fbl/ref_ptr.h>
 #include <fbl/unique_ptr.h>
 
 constexpr uint32_t kMaxMessageSize = 65536u;
@@ -27,8 +30,13 @@ public:
     // Creates a message packet containing the provided data and space for
     // |num_handles| handles. The handles array is uninitialized and must
     // be completely overwritten by clients.
+    //
+    // Packets created from user data are charged to the channel account of
+    // the current process until they are destroyed. If |move_pages| is true,
+    // large enough data is kept in pages, and the whole pages of a page
+    // aligned |data| may be moved out of the current process instead of copied.
     static zx_status_t Create(user_in_ptr<const void> data, uint32_t data_size,
-                              uint32_t num_handles,
+                              uint32_t num_handles, bool move_pages,
                               fbl::unique_ptr<MessagePacket>* msg);
     static zx_status_t Create(const void* data, uint32_t data_size,
                               uint32_t num_handles,
@@ -38,9 +46,11 @@ public:
 
     // Copies the packet's |data_size()| bytes to |buf|.
     // Returns an error if |buf| points to a bad user address.
-    zx_status_t CopyDataTo(user_out_ptr<void> buf) const {
-        return buf.copy_array_to_user(data(), data_size_);
-    }
+    //
+    // If |move_pages| is true, the whole pages of a paged payload are moved
+    // into a page aligned |buf| where possible, after which this can't be
+    // called again.
+    zx_status_t CopyDataTo(user_out_ptr<void> buf, bool move_pages);
 
     uint32_t num_handles() const { return num_handles_; }
     Handle* const* handles() const { return handles_; }
@@ -59,26 +69,45 @@ public:
     }
 
 private:
-    MessagePacket(uint32_t data_size, uint32_t num_handles, Handle** handles);
+    MessagePacket(uint32_t data_size, uint32_t num_handles, bool paged, Handle** handles);
     ~MessagePacket();
 
     // Allocates a new packet that can hold the specified amount of
-    // data/handles.
-    static zx_status_t NewPacket(uint32_t data_size, uint32_t num_handles,
+    // data/handles. The data of a |paged| packet is not in the packet's
+    // buffer but in |data_pages_|, which the caller fills.
+    static zx_status_t NewPacket(uint32_t data_size, uint32_t num_handles, bool paged,
                                  fbl::unique_ptr<MessagePacket>* msg);
 
-    // Create() uses malloc(), so we must delete using free().
-    static void operator delete(void* ptr) {
-        free(ptr);
-    }
+    // Fills |data_pages_| with |data|.
+    zx_status_t CopyPagesFrom(user_in_ptr<const void> data);
+
+    // Create() uses AllocMessageBuffer(), so we must delete using
+    // FreeMessageBuffer().
+    static void operator delete(void* ptr);
     friend class fbl::unique_ptr<MessagePacket>;
 
     // Handles and data are stored in the same buffer: num_handles_ Handle*
-    // entries first, then the data buffer.
-    void* data() const { return static_cast<void*>(handles_ + num_handles_); }
+    // entries first, then the data buffer. For a paged packet, returns the
+    // first page of the data instead.
+    void* data() const;
+
+    // The size of that buffer, including the MessagePacket itself.
+    static size_t BufferSize(uint32_t data_size, uint32_t num_handles) {
+        return sizeof(MessagePacket) + num_handles * sizeof(Handle*) + data_size;
+    }
+
+    // The memory the packet was charged for.
+    size_t ChargedSize() const;
+
+    // The account this packet is charged to, if any.
+    fbl::RefPtr<ChannelAccount> account_;
+
+    // The pages of a paged packet's data, in order.
+    list_node data_pages_;
 
     Handle** const handles_;
     const uint32_t data_size_;
     const uint16_t num_handles_;
+    const bool paged_;
     bool owns_handles_;
 };
@@ -0,0 +1,51 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <stdint.h>
+
+#include <fbl/atomic.h>
+#include <fbl/macros.h>
+#include <fbl/ref_counted.h>
+#include <object/queued_counter.h>
+#include <zircon/syscalls/object.h>
+
+// The user packets a process queued with zx_port_queue() that no waiter has
+// dequeued yet, and how often its quota of them turned packets away. Packets
+// are charged to the process that queues them rather than to the owner of the
+// port, so the quota bounds the kernel memory any one process can tie up in
+// packets, whichever ports it queues them on. A packet holds a reference to
+// the account until it is freed, which can be after the process is gone.
+class PortAccount : public fbl::RefCounted<PortAccount> {
+public:
+    PortAccount() = default;
+    DISALLOW_COPY_ASSIGN_AND_MOVE(PortAccount);
+
+    // Charges a packet unless the process already has |max_pending| queued.
+    bool Charge(uint64_t max_pending) {
+        if (!packets_.Add(1, max_pending)) {
+            quota_failures_.fetch_add(1, fbl::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    void Uncharge() {
+        packets_.Remove(1);
+    }
+
+    void GetStats(zx_info_process_port_stats_t* stats) const {
+        stats->pending_packets = packets_.queued();
+        stats->peak_pending_packets = packets_.peak();
+        stats->total_packets = packets_.total();
+        stats->quota_failures = quota_failures_.load(fbl::memory_order_relaxed);
+    }
+
+private:
+    QueuedCounter packets_;
+    fbl::atomic<uint64_t> quota_failures_{0};
+};
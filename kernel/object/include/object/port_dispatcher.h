@@ -7,9 +7,11 @@
 #pragma once
 
 #include <object/dispatcher.h>
+#include <object/port_account.h>
 #include <object/semaphore.h>
 #include <object/state_observer.h>
 
+#include <zircon/syscalls/object.h>
 #include <zircon/syscalls/port.h>
 #include <zircon/types.h>
 #include <fbl/canary.h>
@@ -91,6 +93,9 @@ struct PortPacket final : public fbl::DoublyLinkedListable<PortPacket*> {
     const void* const handle;
     PortObserver* observer;
     PortAllocator* const allocator;
+    // The account of the process that queued the packet, if it is charged to
+    // one. The allocator uncharges it when the packet is freed.
+    fbl::RefPtr<PortAccount> account;
 
     PortPacket(const void* handle, PortAllocator* allocator);
     PortPacket(const PortPacket&) = delete;
@@ -140,6 +145,8 @@ class PortDispatcher final : public SoloDispatcher {
 public:
     static void Init();
     static PortAllocator* DefaultPortAllocator();
+    static void GetPacketStats(zx_info_port_packet_stats_t* stats);
+    static uint64_t MaxPendingPacketsPerProcess();
     static zx_status_t Create(uint32_t options, fbl::RefPtr<Dispatcher>* dispatcher,
                               zx_rights_t* rights);
 
@@ -150,7 +157,15 @@ public:
 
     zx_status_t Queue(PortPacket* port_packet, zx_signals_t observed, uint64_t count);
     zx_status_t QueueUser(const zx_port_packet_t& packet);
-    zx_status_t Dequeue(zx_time_t deadline, zx_port_packet_t* packet);
+    zx_status_t Dequeue(zx_time_t deadline, zx_port_packet_t* packet) {
+        size_t actual;
+        return Dequeue(deadline, packet, 1u, &actual);
+    }
+
+    // Dequeues up to |count| packets into |packets|, waiting until |deadline|
+    // for the first one, and returns how many in |actual|.
+    zx_status_t Dequeue(zx_time_t deadline, zx_port_packet_t* packets, size_t count,
+                        size_t* actual);
 
     // Decides who is going to destroy the observer. If it returns |true| it
     // is the duty of the caller. If it is false it is the duty of the port.
@@ -9,10 +9,13 @@
 #include <kernel/event.h>
 #include <kernel/thread.h>
 #include <vm/vm_aspace.h>
+#include <object/channel_account.h>
 #include <object/dispatcher.h>
 #include <object/futex_context.h>
 #include <object/handle.h>
+#include <object/handle_table.h>
 #include <object/policy_manager.h>
+#include <object/port_account.h>
 #include <object/thread_dispatcher.h>
 
 #include <zircon/syscalls/object.h>
@@ -78,29 +81,58 @@ public:
     // If this fails, then the object is invalid and should be deleted
     zx_status_t Initialize();
 
-    // Maps a |handle| to an integer which can be given to usermode as a
-    // handle value. Uses Handle->base_value() plus additional mixing.
+    // Maps a |handle| in this process handle table to an integer which can
+    // be given to usermode as a handle value. Uses Handle->base_value() plus
+    // additional mixing.
     zx_handle_t MapHandleToValue(const Handle* handle) const;
-    zx_handle_t MapHandleToValue(const HandleOwner& handle) const;
 
     // Maps a handle value into a Handle as long we can verify that
     // it belongs to this process.
     Handle* GetHandleLocked(zx_handle_t handle_value) TA_REQ(handle_table_lock_);
 
-    // Adds |handle| to this process handle list. The handle->process_id() is
-    // set to this process id().
-    void AddHandle(HandleOwner handle);
-    void AddHandleLocked(HandleOwner handle) TA_REQ(handle_table_lock_);
+    // Adds |handle| to this process handle table and returns its value. The
+    // handle->process_id() is set to this process id(). Returns
+    // ZX_HANDLE_INVALID and destroys the handle if the table is full.
+    zx_handle_t AddHandle(HandleOwner handle);
+    // As above, but leaves |*handle| to the caller to destroy, outside the
+    // lock, if it cannot be added.
+    zx_handle_t AddHandleLocked(HandleOwner* handle) TA_REQ(handle_table_lock_);
 
     // Removes the Handle corresponding to |handle_value| from this process
-    // handle list.
+    // handle table.
     HandleOwner RemoveHandle(zx_handle_t handle_value);
     HandleOwner RemoveHandleLocked(zx_handle_t handle_value) TA_REQ(handle_table_lock_);
 
+    // Removes the Handle corresponding to |handle_value| to give it to another
+    // process. The slot of the handle in the table stays reserved, so that
+    // UndoRemoveHandleLocked() can put the handle back at the same value,
+    // until FinishRemoveHandles() frees it.
+    HandleOwner RemoveHandleForTransferLocked(zx_handle_t handle_value)
+        TA_REQ(handle_table_lock_);
+
     // Puts back the |handle_value| which has not yet been given to another process
     // back into this process.
     void UndoRemoveHandleLocked(zx_handle_t handle_value) TA_REQ(handle_table_lock_);
 
+    // Frees the slots of the |count| handles removed by
+    // RemoveHandleForTransferLocked() once they have been given away.
+    void FinishRemoveHandles(const zx_handle_t* handle_values, size_t count);
+
+    // Reserves slots for |count| handles that this process is about to
+    // receive and returns their values in |handle_values|, so that the values
+    // can be given out before anything in the process can use the handles.
+    // Returns ZX_ERR_NO_MEMORY and reserves nothing if the table is full.
+    zx_status_t ReserveHandleValues(zx_handle_t* handle_values, size_t count);
+
+    // Puts |handle| at the value reserved by ReserveHandleValues(), and sets
+    // handle->process_id() to this process id().
+    void PublishHandle(zx_handle_t handle_value, HandleOwner handle);
+
+    // Frees the slots of the |count| values reserved by ReserveHandleValues()
+    // that no handle was put at. Unless the values were |handed_out| to
+    // userspace, they can be reserved again as they are.
+    void UnreserveHandleValues(const zx_handle_t* handle_values, size_t count, bool handed_out);
+
     // Get the dispatcher corresponding to this handle value.
     template <typename T>
     zx_status_t GetDispatcher(zx_handle_t handle_value,
@@ -164,15 +196,10 @@ public:
     template <typename T>
     zx_status_t ForEachHandle(T func) const {
         fbl::AutoLock lock(&handle_table_lock_);
-        for (const auto& handle : handles_) {
-            const Dispatcher* dispatcher = handle.dispatcher().get();
-            zx_status_t s = func(MapHandleToValue(&handle), handle.rights(),
-                                 dispatcher);
-            if (s != ZX_OK) {
-                return s;
-            }
-        }
-        return ZX_OK;
+        return handle_table_.ForEach([&](const Handle* handle) {
+            const Dispatcher* dispatcher = handle->dispatcher().get();
+            return func(MapHandleToValue(handle), handle->rights(), dispatcher);
+        });
     }
 
     // accessors
@@ -180,6 +207,8 @@ public:
     FutexContext* futex_context() { return &futex_context_; }
     State state() const;
     fbl::RefPtr<VmAspace> aspace() { return aspace_; }
+    const fbl::RefPtr<ChannelAccount>& channel_account() const { return channel_account_; }
+    const fbl::RefPtr<PortAccount>& port_account() const { return port_account_; }
     fbl::RefPtr<JobDispatcher> job();
 
     void get_name(char out_name[ZX_MAX_NAME_LEN]) const final;
@@ -261,7 +290,9 @@ private:
     friend void KillProcess(zx_koid_t id);
     friend void DumpProcessMemoryUsage(const char* prefix, size_t min_pages);
 
-    ProcessDispatcher(fbl::RefPtr<JobDispatcher> job, fbl::StringPiece name, uint32_t flags);
+    ProcessDispatcher(fbl::RefPtr<JobDispatcher> job, fbl::StringPiece name, uint32_t flags,
+                      fbl::RefPtr<ChannelAccount> channel_account,
+                      fbl::RefPtr<PortAccount> port_account);
 
     ProcessDispatcher(const ProcessDispatcher&) = delete;
     ProcessDispatcher& operator=(const ProcessDispatcher&) = delete;
@@ -307,12 +338,18 @@ private:
     // our address space
     fbl::RefPtr<VmAspace> aspace_;
 
-    // our list of handles
-    mutable fbl::Mutex handle_table_lock_; // protects |handles_|.
-    fbl::DoublyLinkedList<Handle*> handles_ TA_GUARDED(handle_table_lock_);
+    // our handles
+    mutable fbl::Mutex handle_table_lock_; // protects |handle_table_|.
+    HandleTable handle_table_ TA_GUARDED(handle_table_lock_);
 
     FutexContext futex_context_;
 
+    // the channel messages written by this process
+    const fbl::RefPtr<ChannelAccount> channel_account_;
+
+    // the packets queued by this process with zx_port_queue()
+    const fbl::RefPtr<PortAccount> port_account_;
+
     // our state
     State state_ TA_GUARDED(state_lock_) = State::INITIAL;
     mutable fbl::Mutex state_lock_;
@@ -0,0 +1,51 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <stdint.h>
+
+#include <fbl/atomic.h>
+#include <fbl/macros.h>
+
+// Counts what a process has queued in the kernel and not had taken off the
+// queue yet, along with the most it ever had queued and all it ever queued.
+// The counts are only statistics, so they are updated without ordering.
+class QueuedCounter {
+public:
+    QueuedCounter() = default;
+    DISALLOW_COPY_ASSIGN_AND_MOVE(QueuedCounter);
+
+    // Queues |n| more unless that would take the queued count past |max|.
+    bool Add(uint64_t n, uint64_t max = UINT64_MAX) {
+        uint64_t queued = queued_.fetch_add(n, fbl::memory_order_relaxed) + n;
+        if (queued > max) {
+            queued_.fetch_sub(n, fbl::memory_order_relaxed);
+            return false;
+        }
+        total_.fetch_add(n, fbl::memory_order_relaxed);
+
+        uint64_t peak = peak_.load(fbl::memory_order_relaxed);
+        while (queued > peak &&
+               !peak_.compare_exchange_weak(&peak, queued, fbl::memory_order_relaxed,
+                                            fbl::memory_order_relaxed)) {
+        }
+        return true;
+    }
+
+    void Remove(uint64_t n) {
+        queued_.fetch_sub(n, fbl::memory_order_relaxed);
+    }
+
+    uint64_t queued() const { return queued_.load(fbl::memory_order_relaxed); }
+    uint64_t peak() const { return peak_.load(fbl::memory_order_relaxed); }
+    uint64_t total() const { return total_.load(fbl::memory_order_relaxed); }
+
+private:
+    fbl::atomic<uint64_t> queued_{0};
+    fbl::atomic<uint64_t> peak_{0};
+    fbl::atomic<uint64_t> total_{0};
+};
@@ -105,6 +105,9 @@ public:
     zx_status_t Suspend();
     zx_status_t Resume();
 
+    // Moves the thread into the deadline scheduling class.
+    zx_status_t SetDeadline(zx_duration_t runtime, zx_duration_t deadline, zx_duration_t period);
+
     // accessors
     ProcessDispatcher* process() const { return process_.get(); }
 
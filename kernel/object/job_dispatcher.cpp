@@ -11,6 +11,7 @@
 #include <err.h>
 
 #include <zircon/rights.h>
+#include <zircon/syscalls/object.h>
 #include <zircon/syscalls/policy.h>
 
 #include <fbl/alloc_checker.h>
@@ -154,6 +155,8 @@ JobDispatcher::JobDispatcher(uint32_t /*flags*/,
                       : ZX_JOB_IMPORTANCE_MAX),
       policy_(policy) {
 
+    sched_bandwidth_init(&bandwidth_, parent_ ? parent_->bandwidth() : nullptr);
+
     // Set the initial relative importance.
     // Tries to make older jobs closer to the root more important.
     if (parent_ == nullptr) {
@@ -190,6 +193,8 @@ JobDispatcher::JobDispatcher(uint32_t /*flags*/,
 }
 
 JobDispatcher::~JobDispatcher() {
+    sched_bandwidth_destroy(&bandwidth_);
+
     if (parent_)
         parent_->RemoveChildJob(this);
 
@@ -368,6 +373,26 @@ zx_status_t JobDispatcher::SetPolicy(
     return ZX_OK;
 }
 
+zx_status_t JobDispatcher::SetCpuBandwidth(zx_duration_t quota, zx_duration_t period) {
+    canary_.Assert();
+
+    return sched_bandwidth_set(&bandwidth_, quota, period);
+}
+
+void JobDispatcher::GetInfo(zx_info_job_t* info) {
+    canary_.Assert();
+
+    sched_bandwidth_info_t bw;
+    sched_bandwidth_get_info(&bandwidth_, &bw);
+
+    info->cpu_quota = bw.quota;
+    info->cpu_period = bw.period;
+    info->cpu_runtime = bw.total_runtime;
+    info->cpu_throttled_time = bw.throttled_time;
+    info->cpu_throttled_count = bw.throttled_count;
+    info->cpu_throttled = bw.throttled;
+}
+
 bool JobDispatcher::EnumerateChildren(JobEnumerator* je, bool recurse) {
     canary_.Assert();
 
@@ -0,0 +1,296 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <object/message_buffer.h>
+
+#include <assert.h>
+#include <fbl/auto_lock.h>
+#include <fbl/mutex.h>
+#include <kernel/align.h>
+#include <kernel/mp.h>
+#include <kernel/spinlock.h>
+#include <lib/counters.h>
+#include <list.h>
+#include <pow2.h>
+#include <stdlib.h>
+#include <vm/physmap.h>
+#include <vm/pmm.h>
+#include <zircon/thread_annotations.h>
+
+KCOUNTER(buffer_cache_misses, "kernel.channel.buffer.cache_misses");
+KCOUNTER(buffer_large_allocs, "kernel.channel.buffer.large_allocs");
+KCOUNTER(buffer_pages_allocated, "kernel.channel.buffer.pages_allocated");
+KCOUNTER(buffer_pages_freed, "kernel.channel.buffer.pages_freed");
+
+namespace {
+
+// Size classes go from 64 bytes to a page.
+constexpr uint kMinClassShift = 6;
+constexpr uint kNumClasses = PAGE_SIZE_SHIFT - kMinClassShift + 1;
+
+// Each cpu caches up to this many bytes worth of free buffers of each class,
+// and moves half of that at a time from and to the pages of the class.
+constexpr size_t kCacheBytes = 16 * 1024;
+static_assert(kCacheBytes >= 2 * PAGE_SIZE, "");
+
+// Each class keeps up to this many pages with no buffers in use, the rest go
+// back to the pmm.
+constexpr size_t kMaxEmptyPages = 4;
+
+constexpr size_t ClassSize(uint size_class) {
+    return size_t(1) << (size_class + kMinClassShift);
+}
+
+uint ClassFor(size_t size) {
+    DEBUG_ASSERT(size <= PAGE_SIZE);
+    uint shift = log2_uint_ceil(static_cast<uint>(size));
+    return (shift > kMinClassShift) ? shift - kMinClassShift : 0;
+}
+
+constexpr size_t CacheMax(uint size_class) {
+    return kCacheBytes / ClassSize(size_class);
+}
+
+constexpr size_t CacheBatch(uint size_class) {
+    return CacheMax(size_class) / 2;
+}
+
+// Free buffers in the cpu caches, and on their way between the caches and
+// the pages, are linked through their first word. Free buffers in a page are
+// linked by the page offset of the next one in their first two bytes.
+struct FreeBuffer {
+    FreeBuffer* next;
+};
+
+struct BufferCache {
+    SpinLock lock;
+    FreeBuffer* buffers[kNumClasses] TA_GUARDED(lock) = {};
+    size_t count[kNumClasses] TA_GUARDED(lock) = {};
+} __CPU_ALIGN;
+
+// The pages of a size class that have free buffers are on its list, the ones
+// with the most buffers in use first so that the others get a chance to empty.
+// Full pages are on no list.
+struct SizeClass {
+    SizeClass() { list_initialize(&pages); }
+
+    fbl::Mutex lock;
+    list_node pages TA_GUARDED(lock);
+    size_t empty_pages TA_GUARDED(lock) = 0;
+};
+
+BufferCache buffer_caches[SMP_MAX_CPUS];
+SizeClass size_classes[kNumClasses];
+
+uint16_t* InPageLink(char* base, uint16_t offset) {
+    return reinterpret_cast<uint16_t*>(base + offset);
+}
+
+vm_page_t* NewPage(uint size_class) {
+    paddr_t pa;
+    vm_page_t* page;
+    char* base = static_cast<char*>(pmm_alloc_kpage(&pa, &page));
+    if (!base)
+        return nullptr;
+    kcounter_add(buffer_pages_allocated, 1);
+
+    page->state = VM_PAGE_STATE_IPC;
+    page->ipc.size_class = static_cast<uint8_t>(size_class);
+    page->ipc.in_use = 0;
+    page->ipc.free_head = 0;
+
+    const size_t size = ClassSize(size_class);
+    for (size_t offset = 0; offset < PAGE_SIZE; offset += size) {
+        size_t next = offset + size;
+        *InPageLink(base, static_cast<uint16_t>(offset)) =
+            (next < PAGE_SIZE) ? static_cast<uint16_t>(next) : VM_PAGE_IPC_NO_BUFFER;
+    }
+    return page;
+}
+
+vm_page_t* BufferPage(const void* buffer) {
+    if (!is_physmap_addr(buffer))
+        return nullptr;
+    return paddr_to_vm_page(physmap_to_paddr(buffer));
+}
+
+// Takes up to |count| buffers from the pages of |size_class|, allocating pages
+// as needed, and links them onto |list|. Returns how many it took.
+size_t ClassTake(uint size_class, size_t count, FreeBuffer** list) {
+    SizeClass& sc = size_classes[size_class];
+
+    size_t taken = 0;
+    fbl::AutoLock lock(&sc.lock);
+    while (taken < count) {
+        vm_page_t* page = list_peek_head_type(&sc.pages, vm_page_t, ipc.node);
+        if (!page) {
+            page = NewPage(size_class);
+            if (!page)
+                break;
+            list_add_head(&sc.pages, &page->ipc.node);
+        } else if (page->ipc.in_use == 0) {
+            sc.empty_pages--;
+        }
+
+        char* base = static_cast<char*>(paddr_to_physmap(vm_page_to_paddr(page)));
+        while (taken < count && page->ipc.free_head != VM_PAGE_IPC_NO_BUFFER) {
+            uint16_t* link = InPageLink(base, page->ipc.free_head);
+            page->ipc.free_head = *link;
+            page->ipc.in_use++;
+
+            auto buffer = reinterpret_cast<FreeBuffer*>(link);
+            buffer->next = *list;
+            *list = buffer;
+            taken++;
+        }
+        if (page->ipc.free_head == VM_PAGE_IPC_NO_BUFFER)
+            list_delete(&page->ipc.node);
+    }
+    return taken;
+}
+
+// Gives the buffers on |list|, all of |size_class|, back to their pages, and
+// frees the pages left empty beyond kMaxEmptyPages.
+void ClassGive(uint size_class, FreeBuffer* list) {
+    SizeClass& sc = size_classes[size_class];
+    list_node free_pages = LIST_INITIAL_VALUE(free_pages);
+    size_t freed = 0;
+
+    {
+        fbl::AutoLock lock(&sc.lock);
+        while (list) {
+            FreeBuffer* buffer = list;
+            list = buffer->next;
+
+            vm_page_t* page = BufferPage(buffer);
+            DEBUG_ASSERT(page && page->state == VM_PAGE_STATE_IPC);
+            DEBUG_ASSERT(page->ipc.size_class == size_class && page->ipc.in_use > 0);
+
+            const bool was_full = (page->ipc.free_head == VM_PAGE_IPC_NO_BUFFER);
+            auto offset = static_cast<uint16_t>(reinterpret_cast<uintptr_t>(buffer) &
+                                                (PAGE_SIZE - 1));
+            *reinterpret_cast<uint16_t*>(buffer) = page->ipc.free_head;
+            page->ipc.free_head = offset;
+            page->ipc.in_use--;
+
+            if (page->ipc.in_use == 0) {
+                if (!was_full)
+                    list_delete(&page->ipc.node);
+                if (sc.empty_pages < kMaxEmptyPages) {
+                    list_add_tail(&sc.pages, &page->ipc.node);
+                    sc.empty_pages++;
+                } else {
+                    page->state = VM_PAGE_STATE_ALLOC;
+                    list_add_tail(&free_pages, &page->free.node);
+                    freed++;
+                }
+            } else if (was_full) {
+                list_add_head(&sc.pages, &page->ipc.node);
+            }
+        }
+    }
+
+    if (freed > 0) {
+        kcounter_add(buffer_pages_freed, freed);
+        pmm_free(&free_pages);
+    }
+}
+
+// Takes a buffer of |size_class| from the current cpu's cache.
+FreeBuffer* CacheTake(uint size_class) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    BufferCache& cache = buffer_caches[arch_curr_cpu_num()];
+
+    cache.lock.Acquire();
+    FreeBuffer* buffer = cache.buffers[size_class];
+    if (buffer) {
+        cache.buffers[size_class] = buffer->next;
+        cache.count[size_class]--;
+    }
+    cache.lock.Release();
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return buffer;
+}
+
+// Puts the buffers on |list| in the current cpu's cache. If the cache grows
+// past its limit, returns a batch of buffers for the caller to give back to the
+// pages of the class.
+FreeBuffer* CacheGive(uint size_class, FreeBuffer* list) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    BufferCache& cache = buffer_caches[arch_curr_cpu_num()];
+
+    FreeBuffer* overflow = nullptr;
+    cache.lock.Acquire();
+    while (list) {
+        FreeBuffer* buffer = list;
+        list = buffer->next;
+        buffer->next = cache.buffers[size_class];
+        cache.buffers[size_class] = buffer;
+        cache.count[size_class]++;
+    }
+    if (cache.count[size_class] > CacheMax(size_class)) {
+        for (size_t i = 0; i < CacheBatch(size_class); i++) {
+            FreeBuffer* buffer = cache.buffers[size_class];
+            cache.buffers[size_class] = buffer->next;
+            buffer->next = overflow;
+            overflow = buffer;
+        }
+        cache.count[size_class] -= CacheBatch(size_class);
+    }
+    cache.lock.Release();
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return overflow;
+}
+
+} // namespace
+
+void* AllocMessageBuffer(size_t size) {
+    if (size > PAGE_SIZE) {
+        kcounter_add(buffer_large_allocs, 1);
+        return malloc(size);
+    }
+
+    const uint size_class = ClassFor(size);
+    FreeBuffer* buffer = CacheTake(size_class);
+    if (buffer)
+        return buffer;
+
+    // refill the cache with a batch, keeping the first buffer
+    kcounter_add(buffer_cache_misses, 1);
+    FreeBuffer* list = nullptr;
+    if (ClassTake(size_class, CacheBatch(size_class), &list) == 0)
+        return nullptr;
+    buffer = list;
+    list = list->next;
+    FreeBuffer* overflow = CacheGive(size_class, list);
+    if (overflow)
+        ClassGive(size_class, overflow);
+    return buffer;
+}
+
+void FreeMessageBuffer(void* ptr) {
+    vm_page_t* page = BufferPage(ptr);
+    if (!page || page->state != VM_PAGE_STATE_IPC) {
+        free(ptr);
+        return;
+    }
+
+    // the page cannot go away while |ptr| is in use, so its class is stable
+    const uint size_class = page->ipc.size_class;
+    auto buffer = static_cast<FreeBuffer*>(ptr);
+    buffer->next = nullptr;
+    FreeBuffer* overflow = CacheGive(size_class, buffer);
+    if (overflow)
+        ClassGive(size_class, overflow);
+}
+
+size_t MessageBufferSize(size_t size) {
+    return (size > PAGE_SIZE) ? size : ClassSize(ClassFor(size));
+}
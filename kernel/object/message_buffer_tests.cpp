@@ -0,0 +1,77 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <object/message_buffer.h>
+
+#include <string.h>
+#include <unittest.h>
+#include <vm/physmap.h>
+#include <vm/pmm.h>
+
+namespace {
+
+static vm_page_t* buffer_page(void* buffer) {
+    return paddr_to_vm_page(physmap_to_paddr(buffer));
+}
+
+// Tests the sizes buffers are rounded up to.
+static bool buffer_sizes() {
+    BEGIN_TEST;
+    EXPECT_EQ(64U, MessageBufferSize(1), "");
+    EXPECT_EQ(64U, MessageBufferSize(64), "");
+    EXPECT_EQ(128U, MessageBufferSize(65), "");
+    EXPECT_EQ(2048U, MessageBufferSize(1500), "");
+    EXPECT_EQ(PAGE_SIZE, MessageBufferSize(PAGE_SIZE), "");
+    EXPECT_EQ(PAGE_SIZE + 1, MessageBufferSize(PAGE_SIZE + 1), "");
+    END_TEST;
+}
+
+// Tests that small buffers come from ipc pages and big ones from the heap.
+static bool buffer_pages() {
+    BEGIN_TEST;
+    void* small = AllocMessageBuffer(100);
+    ASSERT_NONNULL(small, "");
+    EXPECT_EQ(VM_PAGE_STATE_IPC, buffer_page(small)->state, "");
+
+    void* big = AllocMessageBuffer(PAGE_SIZE * 2);
+    ASSERT_NONNULL(big, "");
+    EXPECT_TRUE(!is_physmap_addr(big) || buffer_page(big)->state != VM_PAGE_STATE_IPC, "");
+
+    FreeMessageBuffer(small);
+    FreeMessageBuffer(big);
+    END_TEST;
+}
+
+// Tests that many buffers of each class at once do not overlap, which takes
+// them through the per-cpu caches and the pages of the class.
+static bool buffer_many() {
+    BEGIN_TEST;
+    constexpr size_t kCount = 256;
+    static void* buffers[kCount];
+
+    for (size_t size = 64; size <= PAGE_SIZE; size *= 2) {
+        for (size_t i = 0; i < kCount; i++) {
+            buffers[i] = AllocMessageBuffer(size);
+            ASSERT_NONNULL(buffers[i], "");
+            memset(buffers[i], static_cast<int>(i), size);
+        }
+        for (size_t i = 0; i < kCount; i++) {
+            auto bytes = static_cast<uint8_t*>(buffers[i]);
+            EXPECT_EQ(static_cast<uint8_t>(i), bytes[0], "");
+            EXPECT_EQ(static_cast<uint8_t>(i), bytes[size - 1], "");
+            FreeMessageBuffer(buffers[i]);
+        }
+    }
+    END_TEST;
+}
+
+}  // namespace
+
+UNITTEST_START_TESTCASE(message_buffer_tests)
+UNITTEST("buffer_sizes", buffer_sizes)
+UNITTEST("buffer_pages", buffer_pages)
+UNITTEST("buffer_many", buffer_many)
+UNITTEST_END_TESTCASE(message_buffer_tests, "msgbuf", "Message buffer test");
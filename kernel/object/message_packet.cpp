@@ -10,11 +10,51 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <fbl/algorithm.h>
+#include <kernel/cmdline.h>
+#include <lk/init.h>
+#include <vm/physmap.h>
+#include <vm/pmm.h>
+#include <vm/vm_aspace.h>
 #include <zxcpp/new.h>
 #include <object/handle.h>
+#include <object/message_buffer.h>
+#include <object/process_dispatcher.h>
+
+// User payloads of at least this many bytes, written with their pages up for
+// moving, are kept in whole pages instead of the packet's buffer, so that they
+// can be moved between address spaces rather than copied. 0 keeps every payload
+// in the buffer.
+static uint32_t page_transfer_min = 16 * 1024;
+
+static void message_packet_init(uint level) {
+    page_transfer_min = cmdline_get_uint32("kernel.channel.page-transfer-min",
+                                           page_transfer_min);
+}
+
+LK_INIT_HOOK(message_packet, &message_packet_init, LK_INIT_LEVEL_KERNEL);
+
+static size_t payload_pages(uint32_t data_size) {
+    return ROUNDUP(data_size, PAGE_SIZE) / PAGE_SIZE;
+}
+
+static void* page_data(vm_page_t* page) {
+    return paddr_to_physmap(vm_page_to_paddr(page));
+}
+
+// Payload pages are accounted as ipc memory while in a packet, and have to be
+// back in the allocated state to be freed or given to a VMO.
+static void set_pages_state(list_node* pages, size_t count, vm_page_state state) {
+    vm_page_t* page;
+    list_for_every_entry (pages, page, vm_page_t, free.node) {
+        if (count-- == 0)
+            break;
+        page->state = state;
+    }
+}
 
 // static
-zx_status_t MessagePacket::NewPacket(uint32_t data_size, uint32_t num_handles,
+zx_status_t MessagePacket::NewPacket(uint32_t data_size, uint32_t num_handles, bool paged,
                                      fbl::unique_ptr<MessagePacket>* msg) {
     // Although the API uses uint32_t, we pack the handle count into a smaller
     // field internally. Make sure it fits.
@@ -25,12 +65,8 @@ zx_status_t MessagePacket::NewPacket(uint32_t data_size, uint32_t num_handles,
 
     // Allocate space for the MessagePacket object followed by num_handles
     // Handle*s followed by data_size bytes.
-    // TODO(dbort): Use mbuf-style memory for data_size, ideally allocating from
-    // somewhere other than the heap. Lets us better track and isolate channel
-    // memory usage.
-    char* ptr = static_cast<char*>(malloc(sizeof(MessagePacket) +
-                                          num_handles * sizeof(Handle*) +
-                                          data_size));
+    char* ptr = static_cast<char*>(
+        AllocMessageBuffer(BufferSize(paged ? 0 : data_size, num_handles)));
     if (ptr == nullptr) {
         return ZX_ERR_NO_MEMORY;
     }
@@ -40,25 +76,73 @@ zx_status_t MessagePacket::NewPacket(uint32_t data_size, uint32_t num_handles,
     // _call, and userboot) fill that array immediately after creation
     // of the object.
     msg->reset(new (ptr) MessagePacket(
-        data_size, num_handles,
+        data_size, num_handles, paged,
         reinterpret_cast<Handle**>(ptr + sizeof(MessagePacket))));
     return ZX_OK;
 }
 
+zx_status_t MessagePacket::CopyPagesFrom(user_in_ptr<const void> data) {
+    DEBUG_ASSERT(paged_ && list_is_empty(&data_pages_));
+
+    // Whole pages of the writer's buffer are moved, the rest is copied.
+    const size_t count = payload_pages(data_size_);
+    size_t moved = 0;
+    const size_t whole = data_size_ / PAGE_SIZE;
+    const auto va = reinterpret_cast<vaddr_t>(data.get());
+    if (whole > 0 && IS_PAGE_ALIGNED(va)) {
+        auto aspace = ProcessDispatcher::GetCurrent()->aspace();
+        if (aspace->TakeUserPages(va, whole * PAGE_SIZE, &data_pages_) == ZX_OK)
+            moved = whole;
+    }
+
+    list_node pages = LIST_INITIAL_VALUE(pages);
+    if (pmm_alloc_pages(count - moved, PMM_ALLOC_FLAG_KMAP, &pages) != count - moved) {
+        pmm_free(&pages);
+        return ZX_ERR_NO_MEMORY;
+    }
+    while (vm_page_t* page = list_remove_head_type(&pages, vm_page_t, free.node)) {
+        list_add_tail(&data_pages_, &page->free.node);
+    }
+    set_pages_state(&data_pages_, count, VM_PAGE_STATE_IPC);
+
+    size_t index = 0;
+    vm_page_t* page;
+    list_for_every_entry (&data_pages_, page, vm_page_t, free.node) {
+        if (index >= moved) {
+            const size_t offset = index * PAGE_SIZE;
+            const size_t len = fbl::min<size_t>(PAGE_SIZE, data_size_ - offset);
+            if (data.byte_offset(offset).copy_array_from_user(page_data(page), len) != ZX_OK)
+                return ZX_ERR_INVALID_ARGS;
+        }
+        index++;
+    }
+    return ZX_OK;
+}
+
 // static
 zx_status_t MessagePacket::Create(user_in_ptr<const void> data, uint32_t data_size,
-                                  uint32_t num_handles,
+                                  uint32_t num_handles, bool move_pages,
                                   fbl::unique_ptr<MessagePacket>* msg) {
-    zx_status_t status = NewPacket(data_size, num_handles, msg);
+    const bool paged = move_pages && page_transfer_min > 0 && data_size >= page_transfer_min;
+    zx_status_t status = NewPacket(data_size, num_handles, paged, msg);
     if (status != ZX_OK) {
         return status;
     }
-    if (data_size > 0u) {
+    if (paged) {
+        status = (*msg)->CopyPagesFrom(data);
+        if (status != ZX_OK) {
+            msg->reset();
+            return status;
+        }
+    } else if (data_size > 0u) {
         if (data.copy_array_from_user((*msg)->data(), data_size) != ZX_OK) {
             msg->reset();
             return ZX_ERR_INVALID_ARGS;
         }
     }
+
+    (*msg)->account_ = ProcessDispatcher::GetCurrent()->channel_account();
+    (*msg)->account_->Charge((*msg)->ChargedSize());
     return ZX_OK;
 }
 
@@ -66,7 +150,7 @@ zx_status_t MessagePacket::Create(user_in_ptr<const void> data, uint32_t data_si
 zx_status_t MessagePacket::Create(const void* data, uint32_t data_size,
                                   uint32_t num_handles,
                                   fbl::unique_ptr<MessagePacket>* msg) {
-    zx_status_t status = NewPacket(data_size, num_handles, msg);
+    zx_status_t status = NewPacket(data_size, num_handles, false, msg);
     if (status != ZX_OK) {
         return status;
     }
@@ -83,11 +167,68 @@ MessagePacket::~MessagePacket() {
             HandleOwner ho(handles_[ix]);
         }
     }
+    if (account_)
+        account_->Uncharge(ChargedSize());
+    if (!list_is_empty(&data_pages_)) {
+        set_pages_state(&data_pages_, SIZE_MAX, VM_PAGE_STATE_ALLOC);
+        pmm_free(&data_pages_);
+    }
+}
+
+zx_status_t MessagePacket::CopyDataTo(user_out_ptr<void> buf, bool move_pages) {
+    if (!paged_)
+        return buf.copy_array_to_user(data(), data_size_);
+
+    // Whole pages go straight into a page aligned reader buffer if the reader
+    // asked for that and its VMO takes them. Whatever is left is copied.
+    size_t index = 0;
+    const size_t whole = data_size_ / PAGE_SIZE;
+    const auto va = reinterpret_cast<vaddr_t>(buf.get());
+    if (move_pages && whole > 0 && IS_PAGE_ALIGNED(va)) {
+        const size_t count = list_length(&data_pages_);
+        set_pages_state(&data_pages_, whole, VM_PAGE_STATE_ALLOC);
+        ProcessDispatcher::GetCurrent()->aspace()->SupplyUserPages(va, whole * PAGE_SIZE,
+                                                                   &data_pages_);
+        index = count - list_length(&data_pages_);
+        set_pages_state(&data_pages_, whole - index, VM_PAGE_STATE_IPC);
+    }
+
+    vm_page_t* page;
+    list_for_every_entry (&data_pages_, page, vm_page_t, free.node) {
+        const size_t offset = index * PAGE_SIZE;
+        const size_t len = fbl::min<size_t>(PAGE_SIZE, data_size_ - offset);
+        zx_status_t status = buf.byte_offset(offset).copy_array_to_user(page_data(page), len);
+        if (status != ZX_OK)
+            return status;
+        index++;
+    }
+    return ZX_OK;
+}
+
+void* MessagePacket::data() const {
+    if (paged_) {
+        if (data_pages_.next == &data_pages_)
+            return nullptr;
+        return page_data(containerof(data_pages_.next, vm_page_t, free.node));
+    }
+    return static_cast<void*>(handles_ + num_handles_);
+}
+
+size_t MessagePacket::ChargedSize() const {
+    size_t size = MessageBufferSize(BufferSize(paged_ ? 0 : data_size_, num_handles_));
+    if (paged_)
+        size += payload_pages(data_size_) * PAGE_SIZE;
+    return size;
+}
+
+// static
+void MessagePacket::operator delete(void* ptr) {
+    FreeMessageBuffer(ptr);
 }
 
 MessagePacket::MessagePacket(uint32_t data_size,
-                             uint32_t num_handles, Handle** handles)
-    : handles_(handles), data_size_(data_size),
+                             uint32_t num_handles, bool paged, Handle** handles)
+    : data_pages_(LIST_INITIAL_VALUE(data_pages_)), handles_(handles), data_size_(data_size),
       // NewPacket ensures that num_handles fits in 16 bits.
-      num_handles_(static_cast<uint16_t>(num_handles)), owns_handles_(false) {
+      num_handles_(static_cast<uint16_t>(num_handles)), paged_(paged), owns_handles_(false) {
 }
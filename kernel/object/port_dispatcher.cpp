@@ -14,8 +14,14 @@
 #include <fbl/alloc_checker.h>
 #include <fbl/arena.h>
 #include <fbl/auto_lock.h>
+#include <fbl/mutex.h>
+#include <kernel/align.h>
+#include <kernel/cmdline.h>
+#include <kernel/mp.h>
+#include <kernel/spinlock.h>
 #include <object/excp_port.h>
 #include <object/handle.h>
+#include <object/process_dispatcher.h>
 #include <zircon/compiler.h>
 #include <zircon/rights.h>
 #include <zircon/syscalls/port.h>
@@ -34,6 +40,8 @@ static_assert(sizeof(zx_packet_guest_io_t) == sizeof(zx_packet_user_t),
 static_assert(sizeof(zx_packet_guest_vcpu_t) == sizeof(zx_packet_user_t),
               "size of zx_packet_guest_vcpu_t must match zx_packet_user_t");
 
+// Packets come from an arena, through a cache of free packets on each cpu so
+// that allocating and freeing them mostly does not take the arena lock.
 class ArenaPortAllocator final : public PortAllocator {
 public:
     zx_status_t Init();
@@ -42,38 +50,204 @@ public:
     virtual PortPacket* Alloc();
     virtual void Free(PortPacket* port_packet);
 
-    size_t DiagnosticCount() const {
-        return arena_.DiagnosticCount();
-    }
+    size_t DiagnosticCount() const;
+    void GetStats(zx_info_port_packet_stats_t* stats) const;
 
 private:
-    fbl::TypedArena<PortPacket, fbl::Mutex> arena_;
+    // Free packets in the caches are linked through their first word.
+    struct FreeSlot {
+        FreeSlot* next;
+    };
+
+    struct Cache {
+        mutable SpinLock lock;
+        FreeSlot* slots TA_GUARDED(lock) = nullptr;
+        size_t count TA_GUARDED(lock) = 0;
+        uint64_t allocations TA_GUARDED(lock) = 0;
+        uint64_t misses TA_GUARDED(lock) = 0;
+    } __CPU_ALIGN;
+
+    // Each cpu caches up to this many free packets, and moves half of that
+    // at a time from and to the arena.
+    static constexpr size_t kCacheMax = 64;
+    static constexpr size_t kCacheBatch = kCacheMax / 2;
+
+    // Takes a slot from the cache of the current cpu, refilling the cache
+    // from the arena, or from other cpus' caches if the arena is exhausted.
+    void* TakeSlot();
+    void* StealSlot();
+
+    mutable fbl::Mutex lock_;
+    fbl::Arena arena_ TA_GUARDED(lock_);
+    Cache caches_[SMP_MAX_CPUS];
 };
 
 namespace {
 constexpr size_t kMaxPendingPacketCount = 16 * 1024u;
 ArenaPortAllocator port_allocator;
+
+// The most packets queued with zx_port_queue() by a single process that may be
+// pending at once, so that a few processes cannot take all of the packets.
+uint64_t max_pending_packets_per_process = kMaxPendingPacketCount / 16;
 }  // namespace.
 
 zx_status_t ArenaPortAllocator::Init() {
-    return arena_.Init("packets", kMaxPendingPacketCount);
+    AutoLock al(&lock_);
+    return arena_.Init("packets", sizeof(PortPacket), kMaxPendingPacketCount);
+}
+
+void* ArenaPortAllocator::TakeSlot() {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    Cache& cache = caches_[arch_curr_cpu_num()];
+
+    cache.lock.Acquire();
+    cache.allocations++;
+    FreeSlot* slot = cache.slots;
+    if (slot) {
+        cache.slots = slot->next;
+        cache.count--;
+    } else {
+        cache.misses++;
+    }
+    cache.lock.Release();
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    if (slot)
+        return slot;
+
+    // Refill the cache with a batch, keeping the first slot. The cache may
+    // have been refilled meanwhile, or we may be on another cpu by now, in
+    // which case that cache overflows a little.
+    FreeSlot* list = nullptr;
+    size_t taken = 0;
+    {
+        AutoLock al(&lock_);
+        while (taken < kCacheBatch) {
+            auto free_slot = static_cast<FreeSlot*>(arena_.Alloc());
+            if (!free_slot)
+                break;
+            free_slot->next = list;
+            list = free_slot;
+            taken++;
+        }
+    }
+    if (!list)
+        return StealSlot();
+
+    slot = list;
+    list = list->next;
+    taken--;
+    if (list) {
+        FreeSlot* tail = list;
+        while (tail->next)
+            tail = tail->next;
+
+        arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+        Cache& refill = caches_[arch_curr_cpu_num()];
+        refill.lock.Acquire();
+        tail->next = refill.slots;
+        refill.slots = list;
+        refill.count += taken;
+        refill.lock.Release();
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    }
+    return slot;
+}
+
+void* ArenaPortAllocator::StealSlot() {
+    for (Cache& cache : caches_) {
+        spin_lock_saved_state_t state;
+        cache.lock.AcquireIrqSave(state);
+        FreeSlot* slot = cache.slots;
+        if (slot) {
+            cache.slots = slot->next;
+            cache.count--;
+        }
+        cache.lock.ReleaseIrqRestore(state);
+        if (slot)
+            return slot;
+    }
+    return nullptr;
 }
 
 PortPacket* ArenaPortAllocator::Alloc() {
-    PortPacket* packet = arena_.New(nullptr, this);
-    if (packet == nullptr) {
+    void* slot = TakeSlot();
+    if (slot == nullptr) {
         printf("WARNING: Could not allocate new port packet\n");
         return nullptr;
     }
-    return packet;
+    return new (slot) PortPacket(nullptr, this);
 }
 
 void ArenaPortAllocator::Free(PortPacket* port_packet) {
-    arena_.Delete(port_packet);
+    if (port_packet->account)
+        port_packet->account->Uncharge();
+    port_packet->~PortPacket();
+
+    auto slot = reinterpret_cast<FreeSlot*>(port_packet);
+    FreeSlot* overflow = nullptr;
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    Cache& cache = caches_[arch_curr_cpu_num()];
+
+    cache.lock.Acquire();
+    slot->next = cache.slots;
+    cache.slots = slot;
+    cache.count++;
+    if (cache.count > kCacheMax) {
+        for (size_t i = 0; i < kCacheBatch; i++) {
+            FreeSlot* excess = cache.slots;
+            cache.slots = excess->next;
+            excess->next = overflow;
+            overflow = excess;
+        }
+        cache.count -= kCacheBatch;
+    }
+    cache.lock.Release();
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (overflow) {
+        AutoLock al(&lock_);
+        while (overflow) {
+            FreeSlot* excess = overflow;
+            overflow = excess->next;
+            arena_.Free(excess);
+        }
+    }
+}
+
+size_t ArenaPortAllocator::DiagnosticCount() const {
+    zx_info_port_packet_stats_t stats;
+    GetStats(&stats);
+    return stats.allocated_packets;
+}
+
+void ArenaPortAllocator::GetStats(zx_info_port_packet_stats_t* stats) const {
+    *stats = {};
+    stats->max_packets = kMaxPendingPacketCount;
+    for (const Cache& cache : caches_) {
+        spin_lock_saved_state_t state;
+        cache.lock.AcquireIrqSave(state);
+        stats->cached_packets += cache.count;
+        stats->allocations += cache.allocations;
+        stats->cache_misses += cache.misses;
+        cache.lock.ReleaseIrqRestore(state);
+    }
+
+    // The arena counts the cached packets as allocated. The caches are read
+    // one at a time while packets move between them and the arena, so the
+    // sum may briefly exceed what the arena counts.
+    AutoLock al(&lock_);
+    size_t arena_count = arena_.DiagnosticCount();
+    stats->allocated_packets =
+        arena_count > stats->cached_packets ? arena_count - stats->cached_packets : 0u;
 }
 
 PortPacket::PortPacket(const void* handle, PortAllocator* allocator)
-    : packet{}, handle(handle), observer(nullptr), allocator(allocator) {
+    : packet{}, handle(handle), observer(nullptr), allocator(allocator), account(nullptr) {
     // Note that packet is initialized to zeros.
     if (handle) {
         // Currently |handle| is only valid if the packets are not ephemeral
@@ -158,6 +332,19 @@ StateObserver::Flags PortObserver::MaybeQueue(zx_signals_t new_state, uint64_t c
 
 void PortDispatcher::Init() {
     port_allocator.Init();
+    max_pending_packets_per_process = MIN(
+        cmdline_get_uint64("kernel.port.max-pending-packets", max_pending_packets_per_process),
+        kMaxPendingPacketCount);
+}
+
+// static
+void PortDispatcher::GetPacketStats(zx_info_port_packet_stats_t* stats) {
+    port_allocator.GetStats(stats);
+}
+
+// static
+uint64_t PortDispatcher::MaxPendingPacketsPerProcess() {
+    return max_pending_packets_per_process;
 }
 
 PortAllocator* PortDispatcher::DefaultPortAllocator() {
@@ -208,9 +395,16 @@ void PortDispatcher::on_zero_handles() {
 zx_status_t PortDispatcher::QueueUser(const zx_port_packet_t& packet) {
     canary_.Assert();
 
+    const fbl::RefPtr<PortAccount>& account = ProcessDispatcher::GetCurrent()->port_account();
+    if (!account->Charge(max_pending_packets_per_process))
+        return ZX_ERR_SHOULD_WAIT;
+
     auto port_packet = port_allocator.Alloc();
-    if (!port_packet)
+    if (!port_packet) {
+        account->Uncharge();
         return ZX_ERR_NO_MEMORY;
+    }
+    port_packet->account = account;
 
     port_packet->packet = packet;
     port_packet->packet.type = ZX_PKT_TYPE_USER;
@@ -250,36 +444,44 @@ zx_status_t PortDispatcher::Queue(PortPacket* port_packet, zx_signals_t observed
     return ZX_OK;
 }
 
-zx_status_t PortDispatcher::Dequeue(zx_time_t deadline, zx_port_packet_t* out_packet) {
+zx_status_t PortDispatcher::Dequeue(zx_time_t deadline, zx_port_packet_t* out_packets,
+                                    size_t count, size_t* actual) {
     canary_.Assert();
+    DEBUG_ASSERT(count > 0u);
 
     while (true) {
+        size_t dequeued = 0u;
         {
             AutoLock al(get_lock());
 
-            PortPacket* port_packet = packets_.pop_front();
-            if (port_packet == nullptr)
-                goto wait;
-
-            if (out_packet != nullptr)
-                *out_packet = port_packet->packet;
-
-            PortObserver* observer = port_packet->observer;
-
-            if (observer) {
-                // Deleting the observer under the lock is fine because
-                // the reference that holds to this PortDispatcher is by
-                // construction not the last one. We need to do this under
-                // the lock because another thread can call CanReap().
-                delete observer;
-            } else if (port_packet->is_ephemeral()) {
-                port_packet->Free();
+            while (dequeued < count) {
+                PortPacket* port_packet = packets_.pop_front();
+                if (port_packet == nullptr)
+                    break;
+
+                if (out_packets != nullptr)
+                    out_packets[dequeued] = port_packet->packet;
+                dequeued++;
+
+                PortObserver* observer = port_packet->observer;
+
+                if (observer) {
+                    // Deleting the observer under the lock is fine because
+                    // the reference that holds to this PortDispatcher is by
+                    // construction not the last one. We need to do this under
+                    // the lock because another thread can call CanReap().
+                    delete observer;
+                } else if (port_packet->is_ephemeral()) {
+                    port_packet->Free();
+                }
             }
         }
 
-        return ZX_OK;
+        if (dequeued > 0u) {
+            *actual = dequeued;
+            return ZX_OK;
+        }
 
-wait:
         zx_status_t st = sema_.Wait(deadline, nullptr);
         if (st != ZX_OK)
             return st;
@@ -40,20 +40,23 @@ using fbl::AutoLock;
 
 #define LOCAL_TRACE 0
 
-static zx_handle_t map_handle_to_value(const Handle* handle, uint32_t mixer) {
+static zx_handle_t map_base_value_to_value(uint32_t base_value, uint32_t mixer) {
     // Ensure that the last bit of the result is not zero, and make sure
     // we don't lose any base_value bits or make the result negative
     // when shifting.
     DEBUG_ASSERT((mixer & ((1<<31) | 0x1)) == 0);
-    DEBUG_ASSERT((handle->base_value() & 0xc0000000) == 0);
+    DEBUG_ASSERT((base_value & 0xc0000000) == 0);
 
-    auto handle_id = (handle->base_value() << 1) | 0x1;
+    auto handle_id = (base_value << 1) | 0x1;
     return static_cast<zx_handle_t>(mixer ^ handle_id);
 }
 
-static Handle* map_value_to_handle(zx_handle_t value, uint32_t mixer) {
-    auto handle_id = (static_cast<uint32_t>(value) ^ mixer) >> 1;
-    return Handle::FromU32(handle_id);
+static zx_handle_t map_handle_to_value(const Handle* handle, uint32_t mixer) {
+    return map_base_value_to_value(handle->base_value(), mixer);
+}
+
+static uint32_t map_value_to_base_value(zx_handle_t value, uint32_t mixer) {
+    return (static_cast<uint32_t>(value) ^ mixer) >> 1;
 }
 
 zx_status_t ProcessDispatcher::Create(
@@ -62,7 +65,17 @@ zx_status_t ProcessDispatcher::Create(
     fbl::RefPtr<VmAddressRegionDispatcher>* root_vmar_disp,
     zx_rights_t* root_vmar_rights) {
     fbl::AllocChecker ac;
-    fbl::unique_ptr<ProcessDispatcher> process(new (&ac) ProcessDispatcher(job, name, flags));
+    fbl::RefPtr<ChannelAccount> channel_account = fbl::AdoptRef(new (&ac) ChannelAccount());
+    if (!ac.check())
+        return ZX_ERR_NO_MEMORY;
+
+    fbl::RefPtr<PortAccount> port_account = fbl::AdoptRef(new (&ac) PortAccount());
+    if (!ac.check())
+        return ZX_ERR_NO_MEMORY;
+
+    fbl::unique_ptr<ProcessDispatcher> process(
+        new (&ac) ProcessDispatcher(job, name, flags, fbl::move(channel_account),
+                                    fbl::move(port_account)));
     if (!ac.check())
         return ZX_ERR_NO_MEMORY;
 
@@ -93,8 +106,12 @@ zx_status_t ProcessDispatcher::Create(
 
 ProcessDispatcher::ProcessDispatcher(fbl::RefPtr<JobDispatcher> job,
                                      fbl::StringPiece name,
-                                     uint32_t flags)
+                                     uint32_t flags,
+                                     fbl::RefPtr<ChannelAccount> channel_account,
+                                     fbl::RefPtr<PortAccount> port_account)
   : job_(fbl::move(job)), policy_(job_->GetPolicy()),
+    channel_account_(fbl::move(channel_account)),
+    port_account_(fbl::move(port_account)),
     name_(name.data(), name.length()) {
     LTRACE_ENTRY_OBJ;
 
@@ -113,7 +130,7 @@ ProcessDispatcher::~ProcessDispatcher() {
     DEBUG_ASSERT(state_ == State::INITIAL || state_ == State::DEAD);
 
     // Assert that the -> DEAD transition cleaned up what it should have.
-    DEBUG_ASSERT(handles_.is_empty());
+    DEBUG_ASSERT(handle_table_.count() == 0);
     DEBUG_ASSERT(exception_port_ == nullptr);
     DEBUG_ASSERT(debugger_exception_port_ == nullptr);
 
@@ -340,23 +357,21 @@ void ProcessDispatcher::FinishDeadTransition() {
     // clean up the handle table
     LTRACEF_LEVEL(2, "cleaning up handle table on proc %p\n", this);
 
-    fbl::DoublyLinkedList<Handle*> to_clean;
+    HandleTable to_clean;
     {
         AutoLock lock(&handle_table_lock_);
-        for (auto& handle : handles_) {
-            handle.set_process_id(0u);
-        }
-        to_clean.swap(handles_);
+        to_clean.swap(handle_table_);
     }
 
     // zx-1544: Here is where if we're the last holder of a handle of one of
     // our exception ports then ResetExceptionPort will get called (by
     // ExceptionPort::OnPortZeroHandles) and will need to grab |state_lock_|.
     // This needs to be done outside of |state_lock_|.
-    while (!to_clean.is_empty()) {
+    to_clean.RemoveAll([](Handle* handle) {
+        handle->set_process_id(0u);
         // Delete handle via HandleOwner dtor.
-        HandleOwner ho(to_clean.pop_front());
-    }
+        HandleOwner ho(handle);
+    });
 
     LTRACEF_LEVEL(2, "done cleaning up handle table on proc %p\n", this);
 
@@ -389,14 +404,12 @@ zx_handle_t ProcessDispatcher::MapHandleToValue(const Handle* handle) const {
     return map_handle_to_value(handle, handle_rand_);
 }
 
-zx_handle_t ProcessDispatcher::MapHandleToValue(const HandleOwner& handle) const {
-    return map_handle_to_value(handle.get(), handle_rand_);
-}
-
 Handle* ProcessDispatcher::GetHandleLocked(zx_handle_t handle_value) {
-    auto handle = map_value_to_handle(handle_value, handle_rand_);
-    if (handle && handle->process_id() == get_koid())
+    auto handle = handle_table_.Get(map_value_to_base_value(handle_value, handle_rand_));
+    if (handle) {
+        DEBUG_ASSERT(handle->process_id() == get_koid());
         return handle;
+    }
 
     // Handle lookup failed.  We potentially generate an exception,
     // depending on the job policy.  Note that we don't use the return
@@ -406,14 +419,26 @@ Handle* ProcessDispatcher::GetHandleLocked(zx_handle_t handle_value) {
     return nullptr;
 }
 
-void ProcessDispatcher::AddHandle(HandleOwner handle) {
-    AutoLock lock(&handle_table_lock_);
-    AddHandleLocked(fbl::move(handle));
+zx_handle_t ProcessDispatcher::AddHandle(HandleOwner handle) {
+    zx_handle_t handle_value;
+    {
+        AutoLock lock(&handle_table_lock_);
+        handle_value = AddHandleLocked(&handle);
+    }
+    // If it could not be added, |handle| is destroyed outside the lock.
+    return handle_value;
 }
 
-void ProcessDispatcher::AddHandleLocked(HandleOwner handle) {
-    handle->set_process_id(get_koid());
-    handles_.push_front(handle.release());
+zx_handle_t ProcessDispatcher::AddHandleLocked(HandleOwner* handle) {
+    if (!handle_table_.Add(handle->get())) {
+        printf("WARNING: Could not add handle to process %" PRIu64 " (%zu handles)\n",
+               get_koid(), handle_table_.count());
+        return ZX_HANDLE_INVALID;
+    }
+
+    Handle* added = handle->release();
+    added->set_process_id(get_koid());
+    return MapHandleToValue(added);
 }
 
 HandleOwner ProcessDispatcher::RemoveHandle(zx_handle_t handle_value) {
@@ -422,19 +447,81 @@ HandleOwner ProcessDispatcher::RemoveHandle(zx_handle_t handle_value) {
 }
 
 HandleOwner ProcessDispatcher::RemoveHandleLocked(zx_handle_t handle_value) {
-    auto handle = GetHandleLocked(handle_value);
-    if (!handle)
+    if (!GetHandleLocked(handle_value))
         return nullptr;
 
+    auto handle = handle_table_.Remove(map_value_to_base_value(handle_value, handle_rand_));
     handle->set_process_id(0u);
-    handles_.erase(*handle);
+    return HandleOwner(handle);
+}
+
+HandleOwner ProcessDispatcher::RemoveHandleForTransferLocked(zx_handle_t handle_value) {
+    if (!GetHandleLocked(handle_value))
+        return nullptr;
 
+    auto handle = handle_table_.Reserve(map_value_to_base_value(handle_value, handle_rand_));
+    handle->set_process_id(0u);
     return HandleOwner(handle);
 }
 
 void ProcessDispatcher::UndoRemoveHandleLocked(zx_handle_t handle_value) {
-    auto handle = map_value_to_handle(handle_value, handle_rand_);
-    AddHandleLocked(HandleOwner(handle));
+    auto handle = handle_table_.Restore(map_value_to_base_value(handle_value, handle_rand_));
+    if (handle)
+        handle->set_process_id(get_koid());
+}
+
+void ProcessDispatcher::FinishRemoveHandles(const zx_handle_t* handle_values, size_t count) {
+    AutoLock lock(&handle_table_lock_);
+    for (size_t ix = 0; ix != count; ++ix) {
+        handle_table_.Release(map_value_to_base_value(handle_values[ix], handle_rand_));
+    }
+}
+
+zx_status_t ProcessDispatcher::ReserveHandleValues(zx_handle_t* handle_values, size_t count) {
+    if (count == 0)
+        return ZX_OK;
+
+    AutoLock lock(&handle_table_lock_);
+    for (size_t ix = 0; ix != count; ++ix) {
+        uint32_t base_value;
+        if (!handle_table_.ReserveFree(&base_value)) {
+            printf("WARNING: Could not reserve %zu handles in process %" PRIu64
+                   " (%zu handles)\n", count, get_koid(), handle_table_.count());
+            for (size_t idx = 0; idx < ix; ++idx) {
+                handle_table_.Unreserve(map_value_to_base_value(handle_values[idx], handle_rand_));
+            }
+            return ZX_ERR_NO_MEMORY;
+        }
+        handle_values[ix] = map_base_value_to_value(base_value, handle_rand_);
+    }
+    return ZX_OK;
+}
+
+void ProcessDispatcher::PublishHandle(zx_handle_t handle_value, HandleOwner handle) {
+    {
+        AutoLock lock(&handle_table_lock_);
+        if (handle_table_.Publish(map_value_to_base_value(handle_value, handle_rand_),
+                                  handle.get())) {
+            handle.release()->set_process_id(get_koid());
+        }
+    }
+    // If the slot was gone, |handle| is destroyed outside the lock.
+}
+
+void ProcessDispatcher::UnreserveHandleValues(const zx_handle_t* handle_values, size_t count,
+                                              bool handed_out) {
+    if (count == 0)
+        return;
+
+    AutoLock lock(&handle_table_lock_);
+    for (size_t ix = 0; ix != count; ++ix) {
+        uint32_t base_value = map_value_to_base_value(handle_values[ix], handle_rand_);
+        if (handed_out) {
+            handle_table_.Release(base_value);
+        } else {
+            handle_table_.Unreserve(base_value);
+        }
+    }
 }
 
 zx_koid_t ProcessDispatcher::GetKoidForHandle(zx_handle_t handle_value) {
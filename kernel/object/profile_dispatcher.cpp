@@ -14,8 +14,18 @@
 zx_status_t ProfileDispatcher::Create(const zx_profile_info_t& info,
                                       fbl::RefPtr<Dispatcher>* dispatcher,
                                       zx_rights_t* rights) {
-    if (info.type != ZX_PROFILE_INFO_SCHEDULER)
+    switch (info.type) {
+    case ZX_PROFILE_INFO_SCHEDULER:
+        break;
+    case ZX_PROFILE_INFO_DEADLINE:
+        if (info.deadline.runtime <= 0 ||
+            info.deadline.runtime > info.deadline.deadline ||
+            info.deadline.deadline > info.deadline.period)
+            return ZX_ERR_INVALID_ARGS;
+        break;
+    default:
         return ZX_ERR_NOT_SUPPORTED;
+    }
 
     fbl::AllocChecker ac;
     auto disp = new (&ac) ProfileDispatcher(info);
@@ -30,7 +40,4 @@ zx_status_t ProfileDispatcher::Create(const zx_profile_info_t& info,
 ProfileDispatcher::ProfileDispatcher(const zx_profile_info_t& info)
     : info_(info) {}
 
-ProfileDispatcher::~ProfileDispatcher() {
-    // TODO(cpu): this silences clang "unused info_" nag. Remove.
-    (void) info_.scheduler.priority;
-}
+ProfileDispatcher::~ProfileDispatcher() {}
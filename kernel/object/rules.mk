@@ -24,12 +24,14 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/glue.cpp \
     $(LOCAL_DIR)/guest_dispatcher.cpp \
     $(LOCAL_DIR)/handle.cpp \
+    $(LOCAL_DIR)/handle_table.cpp \
     $(LOCAL_DIR)/interrupt_dispatcher.cpp \
     $(LOCAL_DIR)/interrupt_event_dispatcher.cpp \
     $(LOCAL_DIR)/iommu_dispatcher.cpp \
     $(LOCAL_DIR)/job_dispatcher.cpp \
     $(LOCAL_DIR)/log_dispatcher.cpp \
     $(LOCAL_DIR)/mbuf.cpp \
+    $(LOCAL_DIR)/message_buffer.cpp \
     $(LOCAL_DIR)/message_packet.cpp \
     $(LOCAL_DIR)/pci_device_dispatcher.cpp \
     $(LOCAL_DIR)/pci_interrupt_dispatcher.cpp \
@@ -51,7 +53,9 @@ MODULE_SRCS := \
 
 # Tests
 MODULE_SRCS += \
+    $(LOCAL_DIR)/handle_table_tests.cpp \
     $(LOCAL_DIR)/mbuf_tests.cpp \
+    $(LOCAL_DIR)/message_buffer_tests.cpp \
     $(LOCAL_DIR)/state_tracker_tests.cpp \
 
 MODULE_DEPS := \
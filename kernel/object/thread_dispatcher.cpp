@@ -29,6 +29,7 @@
 #include <object/c_user_thread.h>
 #include <object/excp_port.h>
 #include <object/handle.h>
+#include <object/job_dispatcher.h>
 #include <object/process_dispatcher.h>
 
 #include <fbl/algorithm.h>
@@ -235,6 +236,9 @@ zx_status_t ThreadDispatcher::Initialize(const char* name, size_t len) {
     // associate the proc's address space with this thread
     process_->aspace()->AttachToThread(lkthread);
 
+    // charge the thread's cpu time to its job
+    lkthread->bandwidth = process_->job()->bandwidth();
+
     // we've entered the initialized state
     SetStateLocked(State::INITIALIZED);
 
@@ -370,6 +374,18 @@ zx_status_t ThreadDispatcher::Suspend() {
     return thread_suspend(&thread_);
 }
 
+zx_status_t ThreadDispatcher::SetDeadline(zx_duration_t runtime, zx_duration_t deadline,
+                                          zx_duration_t period) {
+    canary_.Assert();
+
+    AutoLock lock(get_lock());
+
+    if (state_ == State::DYING || state_ == State::DEAD)
+        return ZX_ERR_BAD_STATE;
+
+    return thread_set_deadline(&thread_, runtime, deadline, period);
+}
+
 zx_status_t ThreadDispatcher::Resume() {
     canary_.Assert();
 
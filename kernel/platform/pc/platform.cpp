@@ -749,6 +749,9 @@ void platform_mexec(mexec_asm_func mexec_assembly, memmov_ops_t* ops,
 
     ptl4[0] = vaddr_to_paddr((void*)ptl3) | X86_KERNEL_PD_FLAGS;
 
+    // The next kernel does not expect PCIDs to be enabled.
+    x86_set_cr4(x86_get_cr4() & ~X86_CR4_PCIDE);
+
     mexec_assembly((uintptr_t)new_bootimage_addr, vaddr_to_paddr((void*)ptl4),
                    entry64_addr, 0, ops, 0);
 }
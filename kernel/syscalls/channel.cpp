@@ -19,6 +19,7 @@
 #include <zircon/types.h>
 
 #include <fbl/algorithm.h>
+#include <fbl/auto_call.h>
 #include <fbl/auto_lock.h>
 #include <fbl/ref_ptr.h>
 
@@ -78,39 +79,45 @@ zx_status_t sys_channel_create(uint32_t options,
     return result;
 }
 
-static void MapHandleToValue(
-    ProcessDispatcher* up, const Handle* handle, uint32_t* out) {
-    *out = up->MapHandleToValue(handle);
+static void GetHandleInfo(const Handle* handle, uint32_t* out) {
 }
 
-static void MapHandleToValue(
-    ProcessDispatcher* up, const Handle* handle, zx_handle_info_t* out) {
-    out->handle = up->MapHandleToValue(handle);
+static void GetHandleInfo(const Handle* handle, zx_handle_info_t* out) {
     out->type = handle->dispatcher()->get_type();
     out->rights = handle->rights();
     out->unused = 0;
 }
 
+static void SetHandleValue(zx_handle_t value, uint32_t* out) {
+    *out = value;
+}
+
+static void SetHandleValue(zx_handle_t value, zx_handle_info_t* out) {
+    out->handle = value;
+}
+
+// Puts the handles of |msg| at the |values| reserved for them by
+// ReserveHandleValues().
 template <typename HandleT>
-static void msg_get_handles(ProcessDispatcher* up, MessagePacket* msg,
+static void msg_get_handles(ProcessDispatcher* up, MessagePacket* msg, const zx_handle_t* values,
                             user_out_ptr<HandleT> handles, uint32_t num_handles) {
     Handle* const* handle_list = msg->handles();
     msg->set_owns_handles(false);
 
+    // Once published, a handle may be closed by another thread, so anything
+    // else about it is read before.
     HandleT hvs[kMaxMessageHandles];
-    for (size_t i = 0; i < num_handles; ++i) {
-        MapHandleToValue(up, handle_list[i], &hvs[i]);
-    }
-
-    handles.copy_array_to_user(hvs, num_handles);
-
     for (size_t i = 0; i < num_handles; ++i) {
         if (handle_list[i]->dispatcher()->has_state_tracker())
             handle_list[i]->dispatcher()->Cancel(handle_list[i]);
+        GetHandleInfo(handle_list[i], &hvs[i]);
+        SetHandleValue(values[i], &hvs[i]);
         HandleOwner handle(handle_list[i]);
         // TODO(ZX-969): This takes a lock per call. Consider doing these in a batch.
-        up->AddHandle(fbl::move(handle));
+        up->PublishHandle(values[i], fbl::move(handle));
     }
+
+    handles.copy_array_to_user(hvs, num_handles);
 }
 
 template <typename HandleInfoT>
@@ -129,13 +136,37 @@ static zx_status_t channel_read(zx_handle_t handle_value, uint32_t options,
     if (result != ZX_OK)
         return result;
 
-    // Currently MAY_DISCARD is the only allowable option.
-    if (options & ~ZX_CHANNEL_READ_MAY_DISCARD)
+    if (options & ~(ZX_CHANNEL_READ_MAY_DISCARD | ZX_CHANNEL_READ_MOVE_PAGES))
         return ZX_ERR_NOT_SUPPORTED;
 
+    // Slots for the handles of the next message are reserved before it is
+    // taken from the channel, so that if the handle table is full the message
+    // stays in the channel rather than losing its handles. Read() says how
+    // many it needs, and another reader may have taken the message by the time
+    // there is room, so this repeats until the message read fits what is
+    // reserved. Messages without handles need no slots.
+    zx_handle_t values[kMaxMessageHandles];
+    uint32_t num_reserved = 0;
+    auto reserved_cleanup = fbl::MakeAutoCall([&]() {
+        up->UnreserveHandleValues(values, num_reserved, false);
+    });
+
+    const uint32_t max_bytes = num_bytes;
+    const uint32_t max_handles = num_handles;
     fbl::unique_ptr<MessagePacket> msg;
-    result = channel->Read(&num_bytes, &num_handles, &msg,
-                           options & ZX_CHANNEL_READ_MAY_DISCARD);
+    for (;;) {
+        num_bytes = max_bytes;
+        num_handles = max_handles;
+        result = channel->Read(&num_bytes, &num_handles, num_reserved, &msg,
+                               options & ZX_CHANNEL_READ_MAY_DISCARD);
+        if (result != ZX_ERR_NEXT)
+            break;
+        DEBUG_ASSERT(num_handles > num_reserved && num_handles <= kMaxMessageHandles);
+        result = up->ReserveHandleValues(values + num_reserved, num_handles - num_reserved);
+        if (result != ZX_OK)
+            return result;
+        num_reserved = num_handles;
+    }
     if (result != ZX_OK && result != ZX_ERR_BUFFER_TOO_SMALL)
         return result;
 
@@ -156,14 +187,17 @@ static zx_status_t channel_read(zx_handle_t handle_value, uint32_t options,
         return result;
 
     if (num_bytes > 0u) {
-        if (msg->CopyDataTo(bytes) != ZX_OK)
+        if (msg->CopyDataTo(bytes, options & ZX_CHANNEL_READ_MOVE_PAGES) != ZX_OK)
             return ZX_ERR_INVALID_ARGS;
     }
 
     // The documented public API states that that writing to the handles buffer
     // must happen after writing to the data buffer.
     if (num_handles > 0u) {
-        msg_get_handles(up, msg.get(), handles, num_handles);
+        DEBUG_ASSERT(num_handles <= num_reserved);
+        reserved_cleanup.cancel();
+        up->UnreserveHandleValues(values + num_handles, num_reserved - num_handles, false);
+        msg_get_handles(up, msg.get(), values, handles, num_handles);
     }
 
     record_recv_msg_sz(num_bytes);
@@ -211,13 +245,20 @@ static zx_status_t channel_read_out(ProcessDispatcher* up,
         return status;
 
     if (num_bytes > 0u) {
-        if (reply->CopyDataTo(make_user_out_ptr(args->rd_bytes)) != ZX_OK) {
+        if (reply->CopyDataTo(make_user_out_ptr(args->rd_bytes), false) != ZX_OK) {
             return ZX_ERR_INVALID_ARGS;
         }
     }
 
     if (num_handles > 0u) {
-        msg_get_handles(up, reply.get(), make_user_out_ptr(args->rd_handles), num_handles);
+        // Unlike a read, the reply cannot be left in the channel if the
+        // handle table is full, so the call fails and the handles are closed.
+        zx_handle_t values[kMaxMessageHandles];
+        status = up->ReserveHandleValues(values, num_handles);
+        if (status != ZX_OK)
+            return status;
+        msg_get_handles(up, reply.get(), values, make_user_out_ptr(args->rd_handles),
+                        num_handles);
     }
     return ZX_OK;
 }
@@ -282,7 +323,7 @@ static zx_status_t msg_put_handles(ProcessDispatcher* up, MessagePacket* msg, zx
         }
 
         for (size_t ix = 0; ix != num_user_handles; ++ix) {
-            auto handle = up->RemoveHandleLocked(handles[ix]).release();
+            auto handle = up->RemoveHandleForTransferLocked(handles[ix]).release();
             // Passing duplicate handles is not allowed.
             // If we've already seen this handle flag an error.
             if (!handle) {
@@ -307,7 +348,7 @@ zx_status_t sys_channel_write(zx_handle_t handle_value, uint32_t options,
     LTRACEF("handle %x bytes %p num_bytes %u handles %p num_handles %u options 0x%x\n",
             handle_value, user_bytes.get(), num_bytes, user_handles.get(), num_handles, options);
 
-    if (options)
+    if (options & ~ZX_CHANNEL_WRITE_MOVE_PAGES)
         return ZX_ERR_INVALID_ARGS;
 
     auto up = ProcessDispatcher::GetCurrent();
@@ -319,7 +360,8 @@ zx_status_t sys_channel_write(zx_handle_t handle_value, uint32_t options,
 
 
     fbl::unique_ptr<MessagePacket> msg;
-    result = MessagePacket::Create(user_bytes, num_bytes, num_handles, &msg);
+    result = MessagePacket::Create(user_bytes, num_bytes, num_handles,
+                                   options & ZX_CHANNEL_WRITE_MOVE_PAGES, &msg);
     if (result != ZX_OK)
         return result;
 
@@ -341,6 +383,9 @@ zx_status_t sys_channel_write(zx_handle_t handle_value, uint32_t options,
         return result;
     }
 
+    if (num_handles > 0u)
+        up->FinishRemoveHandles(handles, num_handles);
+
     ktrace(TAG_CHANNEL_WRITE, (uint32_t)channel->get_koid(), num_bytes, num_handles, 0);
     return ZX_OK;
 }
@@ -374,7 +419,7 @@ zx_status_t sys_channel_call_noretry(zx_handle_t handle_value, uint32_t options,
     // Prepare a MessagePacket for writing
     fbl::unique_ptr<MessagePacket> msg;
     result = MessagePacket::Create(make_user_in_ptr(args.wr_bytes),
-                                   num_bytes, num_handles, &msg);
+                                   num_bytes, num_handles, false, &msg);
     if (result != ZX_OK)
         return result;
 
@@ -406,6 +451,9 @@ zx_status_t sys_channel_call_noretry(zx_handle_t handle_value, uint32_t options,
             return result;
         }
     }
+    if (num_handles > 0u)
+        up->FinishRemoveHandles(handles, num_handles);
+
     return channel_call_epilogue(up, fbl::move(reply), &args, result,
                                  actual_bytes, actual_handles, read_status);
 }
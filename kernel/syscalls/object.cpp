@@ -6,12 +6,14 @@
 
 #include <err.h>
 #include <inttypes.h>
+#include <string.h>
 #include <trace.h>
 
 #include <kernel/mp.h>
 #include <kernel/stats.h>
 #include <vm/pmm.h>
 #include <lib/heap.h>
+#include <lib/lockstat.h>
 #include <platform.h>
 #include <zircon/types.h>
 
@@ -19,12 +21,14 @@
 #include <object/handle.h>
 #include <object/bus_transaction_initiator_dispatcher.h>
 #include <object/job_dispatcher.h>
+#include <object/port_dispatcher.h>
 #include <object/process_dispatcher.h>
 #include <object/resource_dispatcher.h>
 #include <object/resources.h>
 #include <object/socket_dispatcher.h>
 #include <object/thread_dispatcher.h>
 #include <object/vm_address_region_dispatcher.h>
+#include <object/vm_object_dispatcher.h>
 
 #include <fbl/ref_ptr.h>
 
@@ -80,6 +84,37 @@ private:
     size_t avail_ = 0;
 };
 
+#if ENABLE_LOCK_STATS
+// Copies out lock class statistics as zx_info_lock_stats_t records.
+struct LockStatsCopier {
+    user_out_ptr<zx_info_lock_stats_t> ptr;
+    size_t max;
+    size_t count;
+    size_t avail;
+    zx_status_t status;
+
+    static void OnClass(const lock_class_t* lock_class, void* arg) {
+        auto copier = static_cast<LockStatsCopier*>(arg);
+        copier->avail++;
+        if (copier->status != ZX_OK || copier->count >= copier->max)
+            return;
+
+        zx_info_lock_stats_t stats = {};
+        strlcpy(stats.name, lock_class->name, sizeof(stats.name));
+        stats.acquisitions = lock_class->acquisitions;
+        stats.contentions = lock_class->contentions;
+        stats.total_wait_time = lock_class->total_wait_time;
+        stats.max_wait_time = lock_class->max_wait_time;
+
+        if (copier->ptr.copy_array_to_user(&stats, 1, copier->count) != ZX_OK) {
+            copier->status = ZX_ERR_INVALID_ARGS;
+            return;
+        }
+        copier->count++;
+    }
+};
+#endif
+
 zx_status_t single_record_result(user_out_ptr<void> _buffer, size_t buffer_size,
                                  user_out_ptr<size_t> _actual,
                                  user_out_ptr<size_t> _avail,
@@ -240,6 +275,18 @@ zx_status_t sys_object_get_info(zx_handle_t handle, uint32_t topic,
             }
             return ZX_OK;
         }
+        case ZX_INFO_JOB: {
+            fbl::RefPtr<JobDispatcher> job;
+            auto error = up->GetDispatcherWithRights(handle, ZX_RIGHT_READ, &job);
+            if (error < 0)
+                return error;
+
+            zx_info_job_t info = {};
+            job->GetInfo(&info);
+
+            return single_record_result(
+                _buffer, buffer_size, _actual, _avail, &info, sizeof(info));
+        }
         case ZX_INFO_THREAD: {
             // TODO(ZX-458): Handle forward/backward compatibility issues
             // with changes to the struct.
@@ -493,7 +540,8 @@ zx_status_t sys_object_get_info(zx_handle_t handle, uint32_t topic,
             stats.total_bytes = total * PAGE_SIZE;
             size_t other_bytes = stats.total_bytes;
 
-            stats.free_bytes = state_count[VM_PAGE_STATE_FREE] * PAGE_SIZE;
+            stats.free_bytes = (state_count[VM_PAGE_STATE_FREE] +
+                                state_count[VM_PAGE_STATE_CACHED]) * PAGE_SIZE;
             other_bytes -= stats.free_bytes;
 
             stats.wired_bytes = state_count[VM_PAGE_STATE_WIRED] * PAGE_SIZE;
@@ -509,11 +557,52 @@ zx_status_t sys_object_get_info(zx_handle_t handle, uint32_t topic,
             stats.mmu_overhead_bytes = state_count[VM_PAGE_STATE_MMU] * PAGE_SIZE;
             other_bytes -= stats.mmu_overhead_bytes;
 
+            // Callers built before |ipc_bytes| was added pass a buffer that
+            // ends before it. They get the fields they know about, with the
+            // channel buffers still counted in |other_bytes|.
+            constexpr size_t kSizeWithoutIpc = offsetof(zx_info_kmem_stats_t, ipc_bytes);
+            size_t record_size = sizeof(stats);
+            if (buffer_size >= kSizeWithoutIpc && buffer_size < sizeof(stats)) {
+                record_size = kSizeWithoutIpc;
+            } else {
+                stats.ipc_bytes = state_count[VM_PAGE_STATE_IPC] * PAGE_SIZE;
+                other_bytes -= stats.ipc_bytes;
+            }
+
             // All other VM_PAGE_STATE_* counts get lumped into other_bytes.
             stats.other_bytes = other_bytes;
 
             return single_record_result(
-                _buffer, buffer_size, _actual, _avail, &stats, sizeof(stats));
+                _buffer, buffer_size, _actual, _avail, &stats, record_size);
+        }
+        case ZX_INFO_LOCK_STATS: {
+            auto status = validate_resource(handle, ZX_RSRC_KIND_ROOT);
+            if (status != ZX_OK)
+                return status;
+
+#if ENABLE_LOCK_STATS
+            LockStatsCopier copier = {
+                _buffer.reinterpret<zx_info_lock_stats_t>(),
+                buffer_size / sizeof(zx_info_lock_stats_t), 0, 0, ZX_OK};
+            lockstat_for_each_class(&LockStatsCopier::OnClass, &copier);
+            if (copier.status != ZX_OK)
+                return copier.status;
+
+            if (_actual) {
+                zx_status_t status = _actual.copy_to_user(copier.count);
+                if (status != ZX_OK)
+                    return status;
+            }
+            if (_avail) {
+                zx_status_t status = _avail.copy_to_user(copier.avail);
+                if (status != ZX_OK)
+                    return status;
+            }
+            return ZX_OK;
+#else
+            // The kernel was built without ENABLE_LOCK_STATS.
+            return ZX_ERR_NOT_SUPPORTED;
+#endif
         }
         case ZX_INFO_RESOURCE: {
             // grab a reference to the dispatcher
@@ -576,6 +665,39 @@ zx_status_t sys_object_get_info(zx_handle_t handle, uint32_t topic,
             return single_record_result(
                 _buffer, buffer_size, _actual, _avail, &info, sizeof(info));
         }
+        case ZX_INFO_PROCESS_CHANNEL_STATS: {
+            fbl::RefPtr<ProcessDispatcher> process;
+            auto status = up->GetDispatcherWithRights(handle, ZX_RIGHT_READ, &process);
+            if (status != ZX_OK)
+                return status;
+
+            zx_info_process_channel_stats_t info = {};
+            process->channel_account()->GetStats(&info);
+            return single_record_result(
+                _buffer, buffer_size, _actual, _avail, &info, sizeof(info));
+        }
+        case ZX_INFO_PROCESS_PORT_STATS: {
+            fbl::RefPtr<ProcessDispatcher> process;
+            auto status = up->GetDispatcherWithRights(handle, ZX_RIGHT_READ, &process);
+            if (status != ZX_OK)
+                return status;
+
+            zx_info_process_port_stats_t info = {};
+            process->port_account()->GetStats(&info);
+            info.max_pending_packets = PortDispatcher::MaxPendingPacketsPerProcess();
+            return single_record_result(
+                _buffer, buffer_size, _actual, _avail, &info, sizeof(info));
+        }
+        case ZX_INFO_PORT_PACKET_STATS: {
+            auto status = validate_resource(handle, ZX_RSRC_KIND_ROOT);
+            if (status != ZX_OK)
+                return status;
+
+            zx_info_port_packet_stats_t info;
+            PortDispatcher::GetPacketStats(&info);
+            return single_record_result(
+                _buffer, buffer_size, _actual, _avail, &info, sizeof(info));
+        }
 
         default:
             return ZX_ERR_NOT_SUPPORTED;
@@ -690,6 +812,27 @@ zx_status_t sys_object_get_property(zx_handle_t handle_value, uint32_t property,
                 return status;
             return ZX_OK;
         }
+        case ZX_PROP_VMO_FAULT_AROUND: {
+            if (size < sizeof(uint32_t))
+                return ZX_ERR_BUFFER_TOO_SMALL;
+            auto vmo = DownCastDispatcher<VmObjectDispatcher>(&dispatcher);
+            if (!vmo)
+                return ZX_ERR_WRONG_TYPE;
+            uint32_t value = vmo->vmo()->fault_around_pages();
+            return _value.reinterpret<uint32_t>().copy_to_user(value);
+        }
+        case ZX_PROP_VMO_LARGE_PAGES: {
+            if (size < sizeof(uint32_t))
+                return ZX_ERR_BUFFER_TOO_SMALL;
+            auto vmo = DownCastDispatcher<VmObjectDispatcher>(&dispatcher);
+            if (!vmo)
+                return ZX_ERR_WRONG_TYPE;
+            uint32_t value;
+            zx_status_t status = vmo->vmo()->GetLargePagePolicy(&value);
+            if (status != ZX_OK)
+                return status;
+            return _value.reinterpret<uint32_t>().copy_to_user(value);
+        }
         default:
             return ZX_ERR_INVALID_ARGS;
     }
@@ -770,6 +913,30 @@ zx_status_t sys_object_set_property(zx_handle_t handle_value, uint32_t property,
             return job->set_importance(
                 static_cast<zx_job_importance_t>(value));
         }
+        case ZX_PROP_VMO_FAULT_AROUND: {
+            if (size < sizeof(uint32_t))
+                return ZX_ERR_BUFFER_TOO_SMALL;
+            auto vmo = DownCastDispatcher<VmObjectDispatcher>(&dispatcher);
+            if (!vmo)
+                return ZX_ERR_WRONG_TYPE;
+            uint32_t value = 0;
+            zx_status_t status = _value.reinterpret<const uint32_t>().copy_from_user(&value);
+            if (status != ZX_OK)
+                return status;
+            return vmo->vmo()->set_fault_around_pages(value);
+        }
+        case ZX_PROP_VMO_LARGE_PAGES: {
+            if (size < sizeof(uint32_t))
+                return ZX_ERR_BUFFER_TOO_SMALL;
+            auto vmo = DownCastDispatcher<VmObjectDispatcher>(&dispatcher);
+            if (!vmo)
+                return ZX_ERR_WRONG_TYPE;
+            uint32_t value = 0;
+            zx_status_t status = _value.reinterpret<const uint32_t>().copy_from_user(&value);
+            if (status != ZX_OK)
+                return status;
+            return vmo->vmo()->SetLargePagePolicy(value);
+        }
     }
 
     return ZX_ERR_INVALID_ARGS;
@@ -13,6 +13,7 @@
 #include <object/port_dispatcher.h>
 #include <object/process_dispatcher.h>
 
+#include <fbl/algorithm.h>
 #include <fbl/alloc_checker.h>
 #include <fbl/auto_lock.h>
 #include <fbl/ref_ptr.h>
@@ -73,13 +74,17 @@ zx_status_t sys_port_queue(zx_handle_t handle, user_in_ptr<const zx_port_packet_
     return port->QueueUser(packet);
 }
 
+// sys_port_wait() dequeues packets this many at a time into a buffer on the
+// stack before copying them out.
+static constexpr size_t kPortWaitBatch = 16u;
+
 zx_status_t sys_port_wait(zx_handle_t handle, zx_time_t deadline,
-                          user_out_ptr<zx_port_packet_t> packet_out, size_t count) {
-    LTRACEF("handle %x\n", handle);
+                          user_out_ptr<zx_port_packet_t> packets_out, size_t count) {
+    LTRACEF("handle %x count %zu\n", handle, count);
 
     // TODO(ZX-1291) Disallow 0u here.
-    if (count != 0u && count != 1u)
-        return ZX_ERR_INVALID_ARGS;
+    if (count == 0u)
+        count = 1u;
 
     auto up = ProcessDispatcher::GetCurrent();
 
@@ -90,17 +95,38 @@ zx_status_t sys_port_wait(zx_handle_t handle, zx_time_t deadline,
 
     ktrace(TAG_PORT_WAIT, (uint32_t)port->get_koid(), 0, 0, 0);
 
-    zx_port_packet_t pp;
-    zx_status_t st = port->Dequeue(deadline, &pp);
+    // Only the first batch waits, the rest take what is already queued.
+    zx_port_packet_t pp[kPortWaitBatch];
+    size_t total = 0u;
+    zx_status_t st = ZX_OK;
+    while (total < count) {
+        const size_t batch = fbl::min(count - total, kPortWaitBatch);
+        size_t actual;
+        st = port->Dequeue(total == 0u ? deadline : 0ull, pp, batch, &actual);
+        if (st != ZX_OK)
+            break;
+
+        status = packets_out.element_offset(total).copy_array_to_user(pp, actual);
+        if (status != ZX_OK)
+            return status;
+        total += actual;
+
+        if (actual < batch)
+            break;
+    }
 
-    ktrace(TAG_PORT_WAIT_DONE, (uint32_t)port->get_koid(), st, 0, 0);
+    ktrace(TAG_PORT_WAIT_DONE, (uint32_t)port->get_koid(), st, (uint32_t)total, 0);
 
-    if (st != ZX_OK)
+    if (total == 0u)
         return st;
 
-    status = packet_out.copy_to_user(pp);
-    if (status != ZX_OK)
-        return status;
+    if (total < count) {
+        zx_port_packet_t none = {};
+        none.type = ZX_PKT_TYPE_NONE;
+        status = packets_out.element_offset(total).copy_to_user(none);
+        if (status != ZX_OK)
+            return status;
+    }
 
     return ZX_OK;
 }
@@ -46,18 +46,36 @@ public:
     // These methods are called by the abigen-generated wrapper_* functions
     // (syscall-kernel-wrappers.inc).  See KernelWrapperGenerator::syscall.
 
-    bool begin_copyout(ProcessDispatcher* current_process,
-                       user_out_ptr<zx_handle_t> out) const {
-        if (h_)
-            return out.copy_to_user(current_process->MapHandleToValue(h_));
-        return false;
+    // The handle only gets its value when it is added to the process, so a
+    // slot is reserved for it here and its value copied out. The handle is
+    // only put in the slot by finish_copyout(), once the copyout of every
+    // handle of the syscall succeeded, so that no other thread can use or
+    // close it before then. Otherwise the destructor frees the slot.
+    zx_status_t begin_copyout(ProcessDispatcher* current_process,
+                              user_out_ptr<zx_handle_t> out) {
+        if (!h_)
+            return ZX_OK;
+        zx_status_t status = current_process->ReserveHandleValues(&value_, 1u);
+        if (status != ZX_OK)
+            return status;
+        process_ = current_process;
+        return out.copy_to_user(value_) != ZX_OK ? ZX_ERR_INVALID_ARGS : ZX_OK;
     }
 
     void finish_copyout(ProcessDispatcher* current_process) {
-        if (h_)
-            current_process->AddHandle(fbl::move(h_));
+        if (process_) {
+            current_process->PublishHandle(value_, fbl::move(h_));
+            process_ = nullptr;
+        }
+    }
+
+    ~user_out_handle() {
+        if (process_)
+            process_->UnreserveHandleValues(&value_, 1u, true);
     }
 
 private:
     HandleOwner h_;
+    ProcessDispatcher* process_ = nullptr;
+    zx_handle_t value_ = ZX_HANDLE_INVALID;
 };
@@ -6,6 +6,7 @@
 
 #include <err.h>
 #include <inttypes.h>
+#include <stddef.h>
 
 #include <lib/counters.h>
 #include <lib/ktrace.h>
@@ -25,6 +26,11 @@
 
 using fbl::AutoLock;
 
+// See the ABI note on zx_profile_info_t.
+static_assert(sizeof(zx_profile_info_t) == 32, "");
+static_assert(offsetof(zx_profile_info_t, scheduler) == 8, "");
+static_assert(offsetof(zx_profile_info_t, deadline) == 8, "");
+
 KCOUNTER(profile_create, "kernel.profile.create");
 KCOUNTER(profile_set,    "kernel.profile.set");
 
@@ -57,7 +63,7 @@ zx_status_t sys_object_set_profile(zx_handle_t handle,
                                    uint32_t options) {
     auto up = ProcessDispatcher::GetCurrent();
 
-    // TODO(cpu): support more than thread objects, and actually do something.
+    // TODO(cpu): support more than thread objects.
 
     fbl::RefPtr<ThreadDispatcher> dispatcher;
     auto status = up->GetDispatcherWithRights(handle, ZX_RIGHT_MANAGE_THREAD, &dispatcher);
@@ -70,6 +76,20 @@ zx_status_t sys_object_set_profile(zx_handle_t handle,
     if (result != ZX_OK)
         return result;
 
-    return ZX_OK;
+    const zx_profile_info_t& info = profile->info();
+    switch (info.type) {
+    case ZX_PROFILE_INFO_DEADLINE:
+        result = dispatcher->SetDeadline(info.deadline.runtime, info.deadline.deadline,
+                                         info.deadline.period);
+        break;
+    default:
+        // TODO(cpu): apply scheduler profiles.
+        result = ZX_OK;
+        break;
+    }
+
+    if (result == ZX_OK)
+        kcounter_add(profile_set, 1u);
+    return result;
 }
 
@@ -141,7 +141,13 @@ zx_status_t sys_socket_share(zx_handle_t handle, zx_handle_t other) {
     if (status != ZX_OK)
         return status;
 
-    Handle* h = up->RemoveHandle(other).release();
+    Handle* h;
+    {
+        AutoLock lock(up->handle_table_lock());
+        h = up->RemoveHandleForTransferLocked(other).release();
+    }
+    if (!h)
+        return ZX_ERR_BAD_HANDLE;
 
     status = socket->Share(h);
 
@@ -151,6 +157,8 @@ zx_status_t sys_socket_share(zx_handle_t handle, zx_handle_t other) {
         return status;
     }
 
+    up->FinishRemoveHandles(&other, 1);
+
     return ZX_OK;
 }
 
@@ -383,20 +383,38 @@ zx_status_t sys_process_start(zx_handle_t process_handle, zx_handle_t thread_han
             return ZX_ERR_BAD_HANDLE;
         if (!handle->HasRights(ZX_RIGHT_TRANSFER))
             return ZX_ERR_ACCESS_DENIED;
-        arg_handle = up->RemoveHandleLocked(arg_handle_value);
+        arg_handle = up->RemoveHandleForTransferLocked(arg_handle_value);
     }
 
-    auto arg_nhv = process->MapHandleToValue(arg_handle);
-    process->AddHandle(fbl::move(arg_handle));
+    zx_handle_t arg_nhv;
+    {
+        fbl::AutoLock lock(process->handle_table_lock());
+        arg_nhv = process->AddHandleLocked(&arg_handle);
+    }
+    if (arg_nhv == ZX_HANDLE_INVALID) {
+        // Put back the |arg_handle| into the calling process.
+        fbl::AutoLock lock(up->handle_table_lock());
+        arg_handle.release();
+        up->UndoRemoveHandleLocked(arg_handle_value);
+        return ZX_ERR_NO_MEMORY;
+    }
 
     status = thread->Start(pc, sp, static_cast<uintptr_t>(arg_nhv),
                            arg2, /* initial_thread */ true);
     if (status != ZX_OK) {
-        // Put back the |arg_handle| into the calling process.
+        // Put back the |arg_handle| into the calling process, at the value
+        // it had there.
         auto handle = process->RemoveHandle(arg_nhv);
-        up->AddHandle(fbl::move(handle));
+        if (!handle) {
+            up->FinishRemoveHandles(&arg_handle_value, 1);
+            return status;
+        }
+        fbl::AutoLock lock(up->handle_table_lock());
+        handle.release();
+        up->UndoRemoveHandleLocked(arg_handle_value);
         return status;
     }
+    up->FinishRemoveHandles(&arg_handle_value, 1);
 
     ktrace(TAG_PROC_START, (uint32_t)thread->get_koid(),
            (uint32_t)process->get_koid(), 0, 0);
@@ -602,6 +620,27 @@ zx_status_t sys_job_create(zx_handle_t parent_job, uint32_t options,
     return status;
 }
 
+static zx_status_t job_set_cpu_bandwidth(zx_handle_t job_handle,
+                                         user_in_ptr<const zx_policy_cpu_bandwidth_t> _policy,
+                                         uint32_t count) {
+    if (count != 1u)
+        return ZX_ERR_INVALID_ARGS;
+
+    zx_policy_cpu_bandwidth_t policy;
+    auto status = _policy.copy_from_user(&policy);
+    if (status != ZX_OK)
+        return ZX_ERR_INVALID_ARGS;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    fbl::RefPtr<JobDispatcher> job;
+    status = up->GetDispatcherWithRights(job_handle, ZX_RIGHT_SET_POLICY, &job);
+    if (status != ZX_OK)
+        return status;
+
+    return job->SetCpuBandwidth(policy.quota, policy.period);
+}
+
 zx_status_t sys_job_set_policy(zx_handle_t job_handle, uint32_t options,
                                uint32_t topic, user_in_ptr<const void> _policy,
                                uint32_t count) {
@@ -611,6 +650,10 @@ zx_status_t sys_job_set_policy(zx_handle_t job_handle, uint32_t options,
     if (!_policy || (count == 0u))
         return ZX_ERR_INVALID_ARGS;
 
+    if (topic == ZX_JOB_POL_CPU_BANDWIDTH)
+        return job_set_cpu_bandwidth(job_handle, _policy.reinterpret<const zx_policy_cpu_bandwidth_t>(),
+                                     count);
+
     if (topic != ZX_JOB_POL_BASIC)
         return ZX_ERR_INVALID_ARGS;
 
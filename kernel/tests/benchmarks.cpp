@@ -9,17 +9,25 @@
 
 #include <arch/ops.h>
 #include <err.h>
+#include <fbl/algorithm.h>
 #include <inttypes.h>
 #include <kernel/mp.h>
 #include <kernel/mutex.h>
 #include <kernel/spinlock.h>
 #include <kernel/thread.h>
+#include <kernel/timer.h>
+#include <object/event_dispatcher.h>
+#include <object/handle.h>
 #include <platform.h>
 #include <rand.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <vm/pmm.h>
+#include <vm/vm_address_region.h>
+#include <vm/vm_aspace.h>
+#include <vm/vm_object_paged.h>
 
 const size_t BUFSIZE = (8 * 1024 * 1024);
 const size_t ITER = (1UL * 1024 * 1024 * 1024 / BUFSIZE); // enough iterations to have to copy/set 1GB of memory
@@ -241,6 +249,251 @@ __NO_INLINE static void bench_mutex() {
     printf("%" PRIu64 " cycles to acquire/release uncontended mutex %u times (%" PRIu64 " cycles per)\n", c, count, c / count);
 }
 
+namespace {
+
+constexpr uint kMaxThreads = 8;
+constexpr uint kContendedIters = 256 * 1024;
+
+struct ContentionWorker {
+    void (*op)(void* arg, uint thread);
+    void* arg;
+    uint thread;
+};
+
+int contention_worker(void* arg) {
+    auto* w = static_cast<ContentionWorker*>(arg);
+    for (uint i = 0; i < kContendedIters; i++) {
+        w->op(w->arg, w->thread);
+    }
+    return 0;
+}
+
+zx_duration_t run_contended(void (*op)(void*, uint), void* arg, uint num_threads) {
+    ContentionWorker workers[kMaxThreads];
+    thread_t* threads[kMaxThreads];
+
+    zx_time_t start = current_time();
+    for (uint i = 0; i < num_threads; i++) {
+        workers[i] = {op, arg, i};
+        threads[i] = thread_create("mutex bench", &contention_worker, &workers[i],
+                                   DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        thread_resume(threads[i]);
+    }
+    for (uint i = 0; i < num_threads; i++) {
+        thread_join(threads[i], nullptr, ZX_TIME_INFINITE);
+    }
+    return current_time() - start;
+}
+
+// Runs |op| on one thread per cpu (up to kMaxThreads) at once so that they contend
+// on the mutex inside it, first with mutex spinning disabled and then with the
+// configured spin limit.
+void bench_contended(const char* name, void (*op)(void*, uint), void* arg) {
+    uint num_threads = fbl::min<uint>(arch_max_num_cpus(), kMaxThreads);
+
+    zx_duration_t spin_max = mutex_set_spin_max(0);
+    zx_duration_t blocking = run_contended(op, arg, num_threads);
+    mutex_set_spin_max(spin_max);
+    zx_duration_t spinning = run_contended(op, arg, num_threads);
+
+    uint64_t ops = (uint64_t)num_threads * kContendedIters;
+    printf("%s, %u threads: %" PRIu64 " ns per op blocking, %" PRIu64 " ns per op spinning "
+           "up to %" PRIu64 " ns\n",
+           name, num_threads, blocking / ops, spinning / ops, spin_max);
+}
+
+// Small writes to a VmObject all serialize on its lock.
+void vmo_write_op(void* arg, uint thread) {
+    auto* vmo = static_cast<VmObject*>(arg);
+    uint64_t val = thread;
+    vmo->Write(&val, thread * PAGE_SIZE, sizeof(val));
+}
+
+struct HandleOpArgs {
+    fbl::RefPtr<Dispatcher> dispatcher;
+    zx_rights_t rights;
+};
+
+// Creating and destroying a handle takes the handle table lock twice.
+void handle_op(void* arg, uint thread) {
+    auto* args = static_cast<HandleOpArgs*>(arg);
+    HandleOwner handle = Handle::Make(args->dispatcher, args->rights);
+}
+
+// Committing and decommitting a page of a private VmObject is the page fault
+// path minus the mapping: it only shares the pmm with the other threads.
+void page_fault_op(void* arg, uint thread) {
+    auto* vmos = static_cast<fbl::RefPtr<VmObject>*>(arg);
+    vmos[thread]->CommitRange(0, PAGE_SIZE, nullptr);
+    vmos[thread]->DecommitRange(0, PAGE_SIZE, nullptr);
+}
+
+} // namespace
+
+__NO_INLINE static void bench_mutex_contended() {
+    fbl::RefPtr<VmObject> vmo;
+    if (VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, kMaxThreads * PAGE_SIZE, &vmo) == ZX_OK &&
+        vmo->CommitRange(0, kMaxThreads * PAGE_SIZE, nullptr) == ZX_OK) {
+        bench_contended("vmo write", &vmo_write_op, vmo.get());
+    }
+
+    HandleOpArgs handle_args;
+    if (EventDispatcher::Create(0u, &handle_args.dispatcher, &handle_args.rights) == ZX_OK) {
+        bench_contended("handle create/destroy", &handle_op, &handle_args);
+    }
+}
+
+// Reports how page fault throughput scales with the number of cpus faulting at once.
+__NO_INLINE static void bench_page_fault_scaling() {
+    fbl::RefPtr<VmObject> vmos[kMaxThreads];
+    for (auto& vmo : vmos) {
+        if (VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, PAGE_SIZE, &vmo) != ZX_OK)
+            return;
+    }
+
+    uint max_threads = fbl::min<uint>(arch_max_num_cpus(), kMaxThreads);
+    for (uint num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+        zx_duration_t t = run_contended(&page_fault_op, vmos, num_threads);
+        uint64_t ops = (uint64_t)num_threads * kContendedIters;
+        printf("page fault, %u threads: %" PRIu64 " ns per fault, %" PRIu64 " faults per sec\n",
+               num_threads, t / ops, ops * ZX_SEC(1) / t);
+    }
+}
+
+static zx_status_t bench_lookup_cb(void* context, size_t offset, size_t index, paddr_t pa) {
+    return ZX_OK;
+}
+
+// Times committing a multi-GB VmObject, looking its pages up directly and through a
+// clone, whose lookups go to its parent's page list, and decommitting it.
+__NO_INLINE static void bench_vmo_page_list() {
+    static const uint64_t kSize = 2 * GB;
+    static const size_t kPages = kSize / PAGE_SIZE;
+
+    if (pmm_count_free_pages() < kPages + kPages / 4) {
+        printf("not enough free memory for a %" PRIu64 "MB vmo, skipping\n", kSize / MB);
+        return;
+    }
+
+    fbl::RefPtr<VmObject> vmo;
+    if (VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, kSize, &vmo) != ZX_OK)
+        return;
+    vmo->SetLargePagePolicy(ZX_VMO_LARGE_PAGES_NEVER);
+
+    zx_time_t t = current_time();
+    if (vmo->CommitRange(0, kSize, nullptr) != ZX_OK)
+        return;
+    zx_duration_t commit = current_time() - t;
+
+    t = current_time();
+    vmo->Lookup(0, kSize, 0, &bench_lookup_cb, nullptr);
+    zx_duration_t lookup = current_time() - t;
+
+    fbl::RefPtr<VmObject> clone;
+    t = current_time();
+    if (vmo->CloneCOW(0, kSize, false, &clone) != ZX_OK)
+        return;
+    clone->Lookup(0, kSize, 0, &bench_lookup_cb, nullptr);
+    zx_duration_t clone_lookup = current_time() - t;
+    clone.reset();
+
+    t = current_time();
+    vmo->DecommitRange(0, kSize, nullptr);
+    zx_duration_t decommit = current_time() - t;
+
+    printf("vmo of %" PRIu64 "MB: %" PRIu64 " ns per page to commit, %" PRIu64
+           " ns to look up, %" PRIu64 " ns to look up through a clone, %" PRIu64
+           " ns to decommit\n",
+           kSize / MB, commit / kPages, lookup / kPages, clone_lookup / kPages,
+           decommit / kPages);
+}
+
+// Times mapping 100k single page regions into one user address space, where
+// each mapping has to find a gap between all of the ones before it, and then
+// unmapping them all by destroying the address space.
+__NO_INLINE static void bench_vmar_map() {
+    static const size_t kMappings = 100000;
+    static const size_t kReportEvery = 10000;
+
+    fbl::RefPtr<VmObject> vmo;
+    if (VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, PAGE_SIZE, &vmo) != ZX_OK)
+        return;
+    fbl::RefPtr<VmAspace> aspace = VmAspace::Create(VmAspace::TYPE_USER, "bench vmar map");
+    if (!aspace)
+        return;
+    fbl::RefPtr<VmAddressRegion> vmar = aspace->RootVmar();
+
+    zx_duration_t total = 0;
+    zx_time_t t = current_time();
+    for (size_t i = 1; i <= kMappings; i++) {
+        fbl::RefPtr<VmMapping> mapping;
+        zx_status_t status = vmar->CreateVmMapping(0, PAGE_SIZE, 0, VMAR_FLAG_CAN_MAP_READ, vmo, 0,
+                                                   ARCH_MMU_FLAG_PERM_USER |
+                                                       ARCH_MMU_FLAG_PERM_READ,
+                                                   "bench", &mapping);
+        if (status != ZX_OK) {
+            printf("mapping region %zu failed: %d\n", i, status);
+            break;
+        }
+
+        if (i % kReportEvery == 0) {
+            zx_duration_t batch = current_time() - t;
+            total += batch;
+            printf("vmar map (aslr %s): %" PRIu64 " ns per map with %zu to %zu regions\n",
+                   aspace->is_aslr_enabled() ? "on" : "off", batch / kReportEvery,
+                   i - kReportEvery, i);
+            t = current_time();
+        }
+    }
+
+    t = current_time();
+    aspace->Destroy();
+    zx_duration_t destroy = current_time() - t;
+
+    printf("vmar map: %" PRIu64 " ns per map on average, %" PRIu64 " ns per unmap\n",
+           total / kMappings, destroy / kMappings);
+}
+
+static void bench_timer_cb(timer_t* timer, zx_time_t now, void* arg) {
+}
+
+__NO_INLINE static void bench_timers() {
+    static const uint counts[] = {1000, 10000, 100000};
+
+    for (uint count : counts) {
+        timer_t* timers = (timer_t*)malloc(sizeof(timer_t) * count);
+        if (!timers)
+            return;
+
+        // Far enough out that none of them fire while we measure, spread over a second
+        // with slack so that some of them coalesce.
+        zx_time_t base = current_time() + ZX_SEC(60);
+        for (uint i = 0; i < count; i++) {
+            timer_init(&timers[i]);
+        }
+
+        uint64_t c = arch_cycle_count();
+        for (uint i = 0; i < count; i++) {
+            zx_time_t deadline = base + (rand() % ZX_SEC(1));
+            timer_set(&timers[i], deadline, TIMER_SLACK_CENTER, rand() % ZX_USEC(100),
+                      &bench_timer_cb, nullptr);
+        }
+        uint64_t set = arch_cycle_count() - c;
+
+        c = arch_cycle_count();
+        for (uint i = 0; i < count; i++) {
+            timer_cancel(&timers[i]);
+        }
+        uint64_t cancel = arch_cycle_count() - c;
+
+        printf("%" PRIu64 " cycles to set %u timers (%" PRIu64 " cycles per), "
+               "%" PRIu64 " cycles to cancel them (%" PRIu64 " cycles per)\n",
+               set, count, set / count, cancel, cancel / count);
+
+        free(timers);
+    }
+}
+
 void benchmarks() {
     bench_set_overhead();
     bench_memcpy();
@@ -257,4 +510,9 @@ void benchmarks() {
 
     bench_spinlock();
     bench_mutex();
+    bench_mutex_contended();
+    bench_page_fault_scaling();
+    bench_vmo_page_list();
+    bench_vmar_map();
+    bench_timers();
 }
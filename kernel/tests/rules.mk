@@ -18,6 +18,7 @@ MODULE_SRCS += \
     $(LOCAL_DIR)/mem_tests.cpp \
     $(LOCAL_DIR)/preempt_disable_tests.cpp \
     $(LOCAL_DIR)/printf_tests.cpp \
+    $(LOCAL_DIR)/sched_tests.cpp \
     $(LOCAL_DIR)/sleep_tests.cpp \
     $(LOCAL_DIR)/string_tests.c \
     $(LOCAL_DIR)/sync_ipi_tests.cpp \
@@ -32,6 +33,7 @@ MODULE_DEPS += \
     kernel/lib/header_tests \
     kernel/lib/fbl \
     kernel/lib/unittest \
+    kernel/object \
 
 MODULE_COMPILEFLAGS += -fno-builtin
 
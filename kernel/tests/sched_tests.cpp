@@ -0,0 +1,79 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <kernel/thread.h>
+#include <platform.h>
+#include <unittest.h>
+
+struct spin_args {
+    zx_time_t until;
+    zx_duration_t runtime;
+};
+
+// Spins until |until|, then records how much cpu time it got.
+static int spin_until(void* arg) {
+    spin_args* args = static_cast<spin_args*>(arg);
+    while (current_time() < args->until) {
+    }
+    args->runtime = thread_runtime(get_current_thread());
+    return 0;
+}
+
+// Test that deadline parameters are checked and that no thread can reserve a
+// whole cpu.
+static bool deadline_admission() {
+    BEGIN_TEST;
+
+    spin_args args = {};
+    thread_t* t = thread_create("deadline admission", spin_until, &args,
+                                DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+    ASSERT_NONNULL(t, "");
+
+    EXPECT_EQ(ZX_ERR_INVALID_ARGS,
+              thread_set_deadline(t, ZX_MSEC(2), ZX_MSEC(1), ZX_MSEC(10)), "");
+    EXPECT_EQ(ZX_ERR_INVALID_ARGS,
+              thread_set_deadline(t, ZX_MSEC(1), ZX_MSEC(20), ZX_MSEC(10)), "");
+    EXPECT_EQ(ZX_ERR_NO_RESOURCES,
+              thread_set_deadline(t, ZX_MSEC(10), ZX_MSEC(10), ZX_MSEC(10)), "");
+    EXPECT_EQ(ZX_OK, thread_set_deadline(t, ZX_MSEC(1), ZX_MSEC(10), ZX_MSEC(10)), "");
+
+    thread_resume(t);
+    EXPECT_EQ(ZX_OK, thread_join(t, nullptr, ZX_TIME_INFINITE), "");
+
+    END_TEST;
+}
+
+// Test that a deadline thread that never blocks is throttled to its runtime
+// in every period, rather than handed fresh budgets early.
+static bool deadline_throttle() {
+    BEGIN_TEST;
+
+    constexpr zx_duration_t kRuntime = ZX_MSEC(2);
+    constexpr zx_duration_t kPeriod = ZX_MSEC(10);
+    constexpr int kPeriods = 20;
+
+    spin_args args = {};
+    thread_t* t = thread_create("deadline spinner", spin_until, &args,
+                                DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+    ASSERT_NONNULL(t, "");
+    ASSERT_EQ(ZX_OK, thread_set_deadline(t, kRuntime, kPeriod, kPeriod), "");
+
+    args.until = current_time() + kPeriod * kPeriods;
+    thread_resume(t);
+    EXPECT_EQ(ZX_OK, thread_join(t, nullptr, ZX_TIME_INFINITE), "");
+
+    // It gets its runtime in every period it spins through, give or take the
+    // periods at either end, and no more.
+    EXPECT_LE(args.runtime, kRuntime * (kPeriods + 2), "");
+    EXPECT_GE(args.runtime, kRuntime * (kPeriods / 2), "");
+
+    END_TEST;
+}
+
+UNITTEST_START_TESTCASE(sched_tests)
+UNITTEST("deadline_admission", deadline_admission)
+UNITTEST("deadline_throttle", deadline_throttle)
+UNITTEST_END_TESTCASE(sched_tests, "sched", "Scheduler tests");
@@ -10,6 +10,7 @@
 #include <inttypes.h>
 #include <malloc.h>
 #include <platform.h>
+#include <rand.h>
 #include <stdio.h>
 
 #include <kernel/event.h>
@@ -170,6 +171,46 @@ static void timer_test_coalescing_early(void) {
         TIMER_SLACK_EARLY, slack, deadline, expected_adj, countof(deadline));
 }
 
+static void timer_cb_check_deadline(timer_t* timer, zx_time_t now, void* arg) {
+    int* fired_count = (int*)arg;
+    if (now < timer->scheduled_time) {
+        printf("\n!! timer fired %" PRIu64 " ns early\n", timer->scheduled_time - now);
+    }
+    atomic_add(fired_count, 1);
+}
+
+// Queue a few thousand timers in random order and check that they all fire, and none
+// of them before its (coalesced) deadline.
+static void timer_test_many(void) {
+    const int count = 5000;
+    int fired = 0;
+
+    timer_t* timer = (timer_t*)malloc(sizeof(timer_t) * count);
+    if (!timer)
+        return;
+
+    zx_time_t when = current_time() + ZX_MSEC(10);
+    for (int ix = 0; ix != count; ++ix) {
+        timer_init(&timer[ix]);
+        timer_set(&timer[ix], when + (rand() % ZX_MSEC(50)), TIMER_SLACK_CENTER,
+                  rand() % ZX_USEC(500), timer_cb_check_deadline, &fired);
+    }
+
+    // Cancel every tenth one.
+    int canceled = 0;
+    for (int ix = 0; ix < count; ix += 10) {
+        if (timer_cancel(&timer[ix]))
+            canceled++;
+    }
+
+    while (atomic_load(&fired) + canceled != count) {
+        thread_sleep(current_time() + ZX_MSEC(5));
+    }
+    printf("%d timers fired, %d canceled\n", fired, canceled);
+
+    free(timer);
+}
+
 static void timer_far_deadline(void) {
     event_t event;
     timer_t timer;
@@ -192,6 +233,7 @@ void timer_tests(void) {
     timer_test_coalescing_center();
     timer_test_coalescing_late();
     timer_test_coalescing_early();
+    timer_test_many();
     timer_test_all_cpus();
     timer_far_deadline();
 }
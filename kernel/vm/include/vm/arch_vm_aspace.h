@@ -67,4 +67,48 @@ public:
     // This should be treated as an opaque value outside of
     // architecture-specific components.
     virtual paddr_t arch_table_phys() const = 0;
+
+    // Defer the TLB invalidations of the changes the calling thread makes until
+    // the matching EndBatch(), so that they share one shootdown. Returns false
+    // if the changes are invalidated as they are made instead, in which case
+    // EndBatch() must not be called. Architectures whose invalidations do not
+    // interrupt other CPUs don't batch.
+    virtual bool BeginBatch() { return false; }
+    virtual void EndBatch() {}
+};
+
+// Batches the TLB invalidations of the changes the calling thread makes to a
+// few aspaces, until End() is called or the batch goes out of scope. Pages
+// unmapped in the batch must not be freed before then.
+class ArchVmAspaceBatch {
+public:
+    ArchVmAspaceBatch() = default;
+    ~ArchVmAspaceBatch() { End(); }
+
+    // Add |aspace| to the batch. Aspaces past the first kMaxAspaces, or that
+    // another thread is batching, are invalidated as they change.
+    void Add(ArchVmAspaceInterface* aspace) {
+        for (size_t i = 0; i < count_; i++) {
+            if (aspaces_[i] == aspace) {
+                return;
+            }
+        }
+        if (count_ < kMaxAspaces && aspace->BeginBatch()) {
+            aspaces_[count_++] = aspace;
+        }
+    }
+
+    void End() {
+        while (count_ > 0) {
+            aspaces_[--count_]->EndBatch();
+        }
+    }
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(ArchVmAspaceBatch);
+
+private:
+    static constexpr size_t kMaxAspaces = 8;
+
+    ArchVmAspaceInterface* aspaces_[kMaxAspaces];
+    size_t count_ = 0;
 };
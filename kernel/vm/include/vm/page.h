@@ -17,6 +17,10 @@ class VmObject;
 #define VM_PAGE_OBJECT_PIN_COUNT_BITS 5
 #define VM_PAGE_OBJECT_MAX_PIN_COUNT ((1ul << VM_PAGE_OBJECT_PIN_COUNT_BITS) - 1)
 
+#define VM_PAGE_NOT_BLOCK_HEAD 0xff
+
+#define VM_PAGE_IPC_NO_BUFFER 0xffff
+
 // core per page structure
 typedef struct vm_page {
     struct {
@@ -29,6 +33,9 @@ typedef struct vm_page {
         struct {
             // in allocated/just freed state, use a linked list to hold the page in a queue
             struct list_node node;
+            // in the free state, the order of the pmm arena free block this page
+            // is the first page of, or VM_PAGE_NOT_BLOCK_HEAD
+            uint8_t order;
         } free;
         struct {
             // attached to a vm object
@@ -39,7 +46,23 @@ typedef struct vm_page {
             // If true, one pin slot is used by the VmObject to keep a run
             // contiguous.
             bool contiguous_pin : 1;
+            // If true, the page was committed explicitly, and the zero page
+            // scanner leaves it alone.
+            bool committed : 1;
+            // Number of page scanner passes since the page was last faulted on,
+            // see VmObject::ScanPages().
+            uint8_t age;
         } object;
+        struct {
+            // in a size class of the channel message buffer pool, on its list of
+            // pages with free buffers
+            struct list_node node;
+            // page offset of the first free buffer, or VM_PAGE_IPC_NO_BUFFER
+            uint16_t free_head;
+            // number of buffers handed out
+            uint16_t in_use;
+            uint8_t size_class;
+        } ipc;
 
         uint8_t pad[24]; // pad out to 32 bytes
     };
@@ -56,9 +79,12 @@ enum vm_page_state {
     VM_PAGE_STATE_HEAP,
     VM_PAGE_STATE_OBJECT,
     VM_PAGE_STATE_MMU, /* allocated to serve arch-specific mmu purposes */
+    VM_PAGE_STATE_CACHED, /* free, but held in a per-cpu pmm page cache or the zero pool */
+    VM_PAGE_STATE_IPC, /* carved into channel message buffers */
 
     _VM_PAGE_STATE_COUNT
 };
+static_assert(_VM_PAGE_STATE_COUNT <= (1 << 3), "vm_page_t state field is too small");
 
 // helpers
 static inline bool page_is_free(const vm_page_t* page) {
@@ -40,6 +40,10 @@ size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) _
 // Allocate a single page of physical memory.
 vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa);
 
+// Allocate a single page of physical memory that is filled with zeros, preferably
+// one zeroed ahead of time in the background.
+vm_page_t* pmm_alloc_zeroed_page(uint alloc_flags, paddr_t* pa);
+
 // Allocate a specific range of physical pages, adding to the tail of the passed list.
 // Returns the number of pages allocated.
 size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list);
@@ -60,6 +64,10 @@ size_t pmm_free_page(vm_page_t* page) __NONNULL((1));
 // Return count of unallocated physical pages in system
 size_t pmm_count_free_pages(void);
 
+// Return the pages held by the per-cpu page caches to the arenas, so that they
+// can satisfy contiguous allocations. Returns the number of pages.
+size_t pmm_drain_page_caches(void);
+
 // Return amount of physical memory in system, in bytes.
 size_t pmm_count_total_bytes(void);
 
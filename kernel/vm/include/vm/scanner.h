@@ -0,0 +1,27 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <sys/types.h>
+
+// The page scanner frees committed pages of VMOs that only contain zeros, so
+// that they read as the shared zero page again and are only committed anew when
+// written. A background thread scans all VMOs at the rate given by the
+// kernel.vm.zero-scan-pages-per-sec command line option.
+//
+// While free memory is below kernel.vm.compress-free-mb the thread also ages
+// pages, and LZ4 compresses the ones that were not touched for a few scans into
+// the kernel heap. They are decompressed when they are faulted on again.
+
+// Scans right away, without the rate limit, until |target_pages| pages were
+// freed or every VMO was looked at. Returns the number of pages freed.
+size_t scanner_reclaim_zero_pages(size_t target_pages);
+
+// Like scanner_reclaim_zero_pages(), but also compresses every page it can,
+// whatever its age. Returns the number of pages freed, net of the memory taken
+// up by the compressed pages.
+size_t scanner_compress_pages(size_t target_pages);
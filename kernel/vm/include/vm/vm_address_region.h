@@ -197,6 +197,26 @@ protected:
 
     // node for element in list of parent's children.
     fbl::WAVLTreeNodeState<fbl::RefPtr<VmAddressRegionOrMapping>, bool> subregion_list_node_;
+
+    // Recomputes the subtree_* state below from this region and its children
+    // in the parent's list.  |aspace()->lock()| must be held.
+    void UpdateSubtree();
+
+    // utility so the WAVL tree keeps the subtree_* state up to date
+    struct WAVLTreeObserver : public fbl::tests::intrusive_containers::DefaultWAVLTreeObserver {
+        static constexpr bool kAugmented = true;
+        static void RecordSubtreeChanged(VmAddressRegionOrMapping* node) { node->UpdateSubtree(); }
+    };
+
+    // State of the subtree under this region in the parent's list of
+    // children, which lets the allocators skip subtrees without a big enough
+    // gap.  The gaps of a subtree are the unused ranges between two of the
+    // regions in it.
+    vaddr_t subtree_first_ = 0;    // first byte of the lowest region
+    vaddr_t subtree_last_ = 0;     // last byte of the highest region
+    size_t subtree_max_gap_ = 0;   // size of the largest gap
+    size_t subtree_gap_bytes_ = 0; // total size of the gaps
+    size_t subtree_gaps_ = 0;      // number of gaps
 };
 
 // A representation of a contiguous range of virtual address space
@@ -253,13 +273,15 @@ protected:
     friend class VmMapping;
     // Remove *region* from the subregion list
     void RemoveSubregion(VmAddressRegionOrMapping* region);
+    // Update the subregion list after *region* changed size in place
+    void SubregionResized(VmAddressRegionOrMapping* region);
 
     friend fbl::RefPtr<VmAddressRegion>;
 
 private:
     using ChildList = fbl::WAVLTree<vaddr_t, fbl::RefPtr<VmAddressRegionOrMapping>,
                                     fbl::DefaultKeyedObjectTraits<vaddr_t, VmAddressRegionOrMapping>,
-                                    WAVLTreeTraits>;
+                                    WAVLTreeTraits, WAVLTreeObserver>;
 
     DISALLOW_COPY_ASSIGN_AND_MOVE(VmAddressRegion);
 
@@ -296,6 +318,11 @@ private:
     // the aspace lock.
     zx_status_t UnmapInternalLocked(vaddr_t base, size_t size, bool can_destroy_regions);
 
+    // Removes [base, base+size), except for the vDSO code mapping, from the
+    // page tables before the mappings in it are unmapped or destroyed one by
+    // one, so that they share a single TLB shootdown.
+    void UnmapArchRangeLocked(vaddr_t base, size_t size);
+
     // internal utilities for interacting with the children list
 
     // returns true if it would be valid to create a child in the
@@ -322,9 +349,34 @@ private:
     // Utility for allocators for iterating over gaps between allocations
     // F should have a signature of bool func(vaddr_t gap_base, size_t gap_size).
     // If func returns false, the iteration stops.  gap_base will be aligned in
-    // accordance with align_pow2.
+    // accordance with align_pow2.  Gaps shorter than min_size before alignment
+    // are skipped, along with every subtree of subregions_ that has none of
+    // the others, so this takes O(log n) time per gap reported.
+    template <typename F>
+    void ForEachGap(F func, uint8_t align_pow2, size_t min_size);
+
+    // Version of ForEachGap() that does not align the gaps, and also passes func
+    // the subregion right after each gap (nullptr for the gap at the end):
+    // bool func(vaddr_t gap_base, size_t gap_size, VmAddressRegionOrMapping* next)
     template <typename F>
-    void ForEachGap(F func, uint8_t align_pow2);
+    void ForEachUnalignedGap(F func, size_t min_size);
+
+    // Helper for ForEachUnalignedGap() which reports the gaps in the subtree at
+    // *node*, and the one between it and gap_base.  Returns false if func
+    // stopped the iteration.
+    template <typename F>
+    bool ForEachUnalignedGapInSubtree(F& func, VmAddressRegionOrMapping* node, vaddr_t gap_base,
+                                      size_t min_size);
+
+    // Returns the root of subregions_, which has the state of all of its gaps,
+    // or nullptr if there are no subregions.
+    VmAddressRegionOrMapping* SubregionRootLocked();
+
+    // Tries to pick a spot uniformly at random from the ones that could satisfy
+    // an allocation, in O(log n) time.  Returns false if the random draw did
+    // not land on such a spot, which is more likely the smaller the gaps are
+    // compared to *size*.
+    bool SampleRandomSpotLocked(size_t size, uint8_t align_pow2, vaddr_t* spot);
 
     // list of subregions, indexed by base address
     ChildList subregions_;
@@ -472,6 +524,17 @@ private:
 
     void Activate() override;
 
+    // Maps the large page of the object containing the faulting page at |va| with
+    // a single large page table entry, if the object has one there and the mapping
+    // covers it. Returns false if the fault should map the single page instead.
+    // Should be annotated TA_REQ(object_->lock()), see ActivateLocked().
+    bool MapLargePageLocked(vaddr_t va, uint64_t vmo_offset);
+
+    // Maps the already committed pages of the object around the page at |va|,
+    // which was just faulted in. Should be annotated TA_REQ(object_->lock()),
+    // see ActivateLocked().
+    void FaultAroundLocked(vaddr_t va);
+
     // Version of Activate that does not take the object_ lock.
     // Should be annotated TA_REQ(object_->lock()), but due to limitations
     // in Clang around capability aliasing, we need to relax the analysis.
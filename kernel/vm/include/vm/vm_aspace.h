@@ -116,6 +116,16 @@ public:
     // VMAR in the tree that includes *va*.
     fbl::RefPtr<VmAddressRegionOrMapping> FindRegion(vaddr_t va);
 
+    // Moves the pages of the page aligned user range [va, va + len) to the tail of
+    // |pages|, see VmObject::TakePages(). The range has to be in a single mapping
+    // that can be read and written.
+    zx_status_t TakeUserPages(vaddr_t va, size_t len, list_node* pages);
+
+    // Replaces the pages of the page aligned user range [va, va + len) with the
+    // ones at the head of |pages|, see VmObject::SupplyPages(). The range has to be
+    // in a single writable mapping.
+    zx_status_t SupplyUserPages(vaddr_t va, size_t len, list_node* pages);
+
     // For region creation routines
     static const uint VMM_FLAG_VALLOC_SPECIFIC = (1u << 0); // allocate at specific address
     static const uint VMM_FLAG_COMMIT = (1u << 1);          // commit memory up front (no demand paging)
@@ -177,6 +187,11 @@ private:
 
     void InitializeAslr();
 
+    // Finds the object and offset that back the page aligned user range
+    // [va, va + len), which has to be in a single mapping with |arch_mmu_flags|.
+    zx_status_t FindUserRange(vaddr_t va, size_t len, uint arch_mmu_flags,
+                              fbl::RefPtr<VmObject>* vmo, uint64_t* offset);
+
     // magic
     fbl::Canary<fbl::magic("VMAS")> canary_;
 
@@ -0,0 +1,45 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <fbl/intrusive_wavl_tree.h>
+#include <fbl/macros.h>
+#include <fbl/unique_ptr.h>
+#include <vm/vm.h>
+#include <zircon/types.h>
+
+// The LZ4 compressed contents of a page that a VmObjectPaged gave back to the
+// pmm, kept in the object at the page's offset until it is faulted on again.
+class VmCompressedPage final : public fbl::WAVLTreeContainable<fbl::unique_ptr<VmCompressedPage>> {
+public:
+    // Pages that do not compress to at least half their size are not worth keeping
+    // this way.
+    static constexpr size_t kMaxSize = PAGE_SIZE / 2;
+
+    // Compresses the page at |pa|. Returns nullptr if it does not compress well
+    // enough or there is no memory for the result.
+    static fbl::unique_ptr<VmCompressedPage> Create(uint64_t offset, paddr_t pa);
+
+    ~VmCompressedPage();
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(VmCompressedPage);
+
+    // accessors
+    uint64_t offset() const { return offset_; }
+    uint64_t GetKey() const { return offset_; }
+    size_t size() const { return size_; }
+
+    // Writes the original contents to the page at |pa|.
+    void Decompress(paddr_t pa) const;
+
+private:
+    VmCompressedPage(uint64_t offset, fbl::unique_ptr<uint8_t[]> data, size_t size);
+
+    const uint64_t offset_;
+    const fbl::unique_ptr<uint8_t[]> data_;
+    const size_t size_;
+};
@@ -113,6 +113,20 @@ public:
         return ZX_ERR_NOT_SUPPORTED;
     }
 
+    // move the pages of the page aligned range to the tail of |pages|, leaving the
+    // range uncommitted. Fails without moving any unless every page of the range is
+    // committed in the object itself and can be given away.
+    virtual zx_status_t TakePages(uint64_t offset, uint64_t len, list_node* pages) {
+        return ZX_ERR_NOT_SUPPORTED;
+    }
+
+    // replace the pages of the page aligned range with pages from the head of
+    // |pages|, which must hold enough of them, freeing the ones the object had.
+    // On failure the pages already placed stay in the object and the rest on |pages|.
+    virtual zx_status_t SupplyPages(uint64_t offset, uint64_t len, list_node* pages) {
+        return ZX_ERR_NOT_SUPPORTED;
+    }
+
     // translate a range of the vmo to physical addresses and store in the buffer
     virtual zx_status_t LookupUser(uint64_t offset, uint64_t len, user_inout_ptr<paddr_t> buffer,
                                    size_t buffer_size) {
@@ -165,6 +179,14 @@ public:
         return ZX_ERR_NOT_SUPPORTED;
     }
 
+    // get/set whether the object is backed by large pages, one of ZX_VMO_LARGE_PAGES_*
+    virtual zx_status_t GetLargePagePolicy(uint32_t* policy) {
+        return ZX_ERR_NOT_SUPPORTED;
+    }
+    virtual zx_status_t SetLargePagePolicy(uint32_t policy) {
+        return ZX_ERR_NOT_SUPPORTED;
+    }
+
     // create a copy-on-write clone vmo at the page-aligned offset and length
     // note: it's okay to start or extend past the size of the parent
     virtual zx_status_t CloneCOW(uint64_t offset, uint64_t size, bool copy_name,
@@ -184,6 +206,23 @@ public:
         return ZX_ERR_NOT_SUPPORTED;
     }
 
+    // returns true if the page at |offset| is committed in this object itself, as opposed
+    // to being shared with a parent, so that it can be mapped writable without a fault.
+    virtual bool HasOwnPageLocked(uint64_t offset) TA_REQ(lock_) { return false; }
+
+    // returns true if the large page sized and aligned range at |offset| is committed in this
+    // object itself with physically contiguous pages that start at an aligned address |pa|,
+    // so that it can be mapped as one large page.
+    virtual bool IsLargePageLocked(uint64_t offset, paddr_t* pa) TA_REQ(lock_) { return false; }
+
+    // How many pages around a faulting page to map at the same time, if they are
+    // already committed. kFaultAroundDefault selects the kernel.vm.fault-around-pages
+    // default, and 0 turns fault-around off.
+    static constexpr uint32_t kFaultAroundDefault = UINT32_MAX;
+    static constexpr uint32_t kFaultAroundMaxPages = 32;
+    uint32_t fault_around_pages() const;
+    zx_status_t set_fault_around_pages(uint32_t pages);
+
     fbl::Mutex* lock() TA_RET_CAP(lock_) { return &lock_; }
     fbl::Mutex& lock_ref() TA_RET_CAP(lock_) { return lock_; }
 
@@ -203,6 +242,45 @@ public:
     void RemoveChildLocked(VmObject* r) TA_REQ(lock_);
     uint32_t num_children() const;
 
+    // What ScanPages() does with the committed pages it looks at. Pages that contain
+    // only zeros are always freed, so that reading them maps the shared zero page again.
+    enum class ScanAction {
+        // only free zero pages
+        kReclaimZero,
+        // unmap the pages so that the next access faults and makes them young again,
+        // and compress the ones that were not faulted on for kCompressAge scans
+        kAge,
+        // compress every page
+        kCompress,
+    };
+
+    // Pages are compressed once they have gone this many kAge scans without a fault.
+    static constexpr uint8_t kCompressAge = 3;
+
+    struct ScanStats {
+        // pages looked at
+        size_t scanned;
+        // zero pages freed
+        size_t zero;
+        // pages compressed, and the bytes they take up now
+        size_t compressed;
+        size_t compressed_bytes;
+    };
+
+    // Applies |action| to the committed pages at or after |*offset|. Looks at no more
+    // than |max_pages| pages and advances |*offset| past them, to UINT64_MAX once there
+    // are none left. Adds what it did to |*stats|.
+    virtual void ScanPages(ScanAction action, uint64_t* offset, size_t max_pages,
+                           ScanStats* stats) {
+        *offset = UINT64_MAX;
+    }
+
+    // Calls ScanPages() on the VMOs in the system, oldest to newest, picking up where
+    // the previous call left off, until |max_pages| pages were looked at. Sets
+    // |*wrapped| if it got to the end of the list.
+    static void ScanAllPages(ScanAction action, size_t max_pages, ScanStats* stats,
+                             bool* wrapped);
+
     // Calls the provided |func(const VmObject&)| on every VMO in the system,
     // from oldest to newest. Stops if |func| returns an error, returning the
     // error value.
@@ -265,6 +343,10 @@ protected:
 
     uint64_t user_id_ TA_GUARDED(lock_) = 0;
 
+    // Fault-around hint, see fault_around_pages(). Read without the lock, as it
+    // is only a hint.
+    uint32_t fault_around_pages_ = kFaultAroundDefault;
+
     // The user-friendly VMO name. For debug purposes only. That
     // is, there is no mechanism to get access to a VMO via this name.
     fbl::Name<ZX_MAX_NAME_LEN> name_;
@@ -286,4 +368,10 @@ private:
     using GlobalList = fbl::DoublyLinkedList<VmObject*, GlobalListTraits>;
     static fbl::Mutex all_vmos_lock_;
     static GlobalList all_vmos_ TA_GUARDED(all_vmos_lock_);
+
+    // Where ScanAllPages() left off. Holding a reference keeps the VMO in the
+    // global list.
+    static fbl::Mutex page_scan_lock_;
+    static fbl::RefPtr<VmObject> page_scan_cursor_ TA_GUARDED(page_scan_lock_);
+    static uint64_t page_scan_offset_ TA_GUARDED(page_scan_lock_);
 };
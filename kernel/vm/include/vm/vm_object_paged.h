@@ -20,6 +20,7 @@
 #include <vm/pmm.h>
 #include <vm/vm.h>
 #include <vm/vm_aspace.h>
+#include <vm/vm_compressed_page.h>
 #include <vm/vm_object.h>
 #include <vm/vm_page_list.h>
 #include <zircon/thread_annotations.h>
@@ -55,9 +56,15 @@ public:
     zx_status_t Lookup(uint64_t offset, uint64_t len, uint pf_flags,
                        vmo_lookup_fn_t lookup_fn, void* context) override;
 
+    zx_status_t TakePages(uint64_t offset, uint64_t len, list_node* pages) override;
+    zx_status_t SupplyPages(uint64_t offset, uint64_t len, list_node* pages) override;
+
     zx_status_t ReadUser(user_out_ptr<void> ptr, uint64_t offset, size_t len) override;
     zx_status_t WriteUser(user_in_ptr<const void> ptr, uint64_t offset, size_t len) override;
 
+    void ScanPages(ScanAction action, uint64_t* offset, size_t max_pages,
+                   ScanStats* stats) override;
+
     zx_status_t LookupUser(uint64_t offset, uint64_t len, user_inout_ptr<paddr_t> buffer,
                            size_t buffer_size) override;
 
@@ -73,6 +80,11 @@ public:
         // Calls a Locked method of the parent, which confuses analysis.
         TA_NO_THREAD_SAFETY_ANALYSIS;
 
+    bool HasOwnPageLocked(uint64_t offset) override TA_REQ(lock_) {
+        return page_list_.GetPage(offset) != nullptr;
+    }
+    bool IsLargePageLocked(uint64_t offset, paddr_t* pa) override TA_REQ(lock_);
+
     zx_status_t CloneCOW(uint64_t offset, uint64_t size, bool copy_name,
                          fbl::RefPtr<VmObject>* clone_vmo) override
         // Calls a Locked method of the child, which confuses analysis.
@@ -85,6 +97,9 @@ public:
     zx_status_t GetMappingCachePolicy(uint32_t* cache_policy) override;
     zx_status_t SetMappingCachePolicy(const uint32_t cache_policy) override;
 
+    zx_status_t GetLargePagePolicy(uint32_t* policy) override;
+    zx_status_t SetLargePagePolicy(uint32_t policy) override;
+
     // maximum size of a VMO is one page less than the full 64bit range
     static const uint64_t MAX_SIZE = ROUNDDOWN(UINT64_MAX, PAGE_SIZE);
 
@@ -125,12 +140,37 @@ private:
     // set our offset within our parent
     zx_status_t SetParentOffsetLocked(uint64_t o) TA_REQ(lock_);
 
+    // whether to commit whole large pages at once, given the large page policy and size
+    bool UseLargePagesLocked() const TA_REQ(lock_);
+
+    // commit the empty large page at |offset| with one physically contiguous run of pages
+    zx_status_t CommitLargePageLocked(uint64_t offset) TA_REQ(lock_);
+
+    // compress the unmapped page at |offset| and free it, returns the compressed size
+    // or 0 if it did not compress
+    size_t CompressPageLocked(uint64_t offset) TA_REQ(lock_);
+
+    // decompress the compressed pages in [start, end)
+    zx_status_t DecompressPagesLocked(uint64_t start, uint64_t end) TA_REQ(lock_);
+
+    // drop the compressed pages in [start, end)
+    void DiscardCompressedPagesLocked(uint64_t start, uint64_t end) TA_REQ(lock_);
+
     // members
     uint64_t size_ TA_GUARDED(lock_) = 0;
     uint64_t parent_offset_ TA_GUARDED(lock_) = 0;
     uint32_t pmm_alloc_flags_ TA_GUARDED(lock_) = PMM_ALLOC_FLAG_ANY;
     uint32_t cache_policy_ TA_GUARDED(lock_) = ARCH_MMU_FLAG_CACHED;
+    uint32_t large_page_policy_ TA_GUARDED(lock_) = ZX_VMO_LARGE_PAGES_DEFAULT;
+
+    // set once userspace has looked up the physical addresses of the pages, which
+    // must then not be freed behind its back
+    bool user_lookup_done_ TA_GUARDED(lock_) = false;
 
     // a tree of pages
     VmPageList page_list_ TA_GUARDED(lock_);
+
+    // pages that were compressed by the page scanner, by offset, which are not in
+    // page_list_ until they are faulted on again
+    fbl::WAVLTree<uint64_t, fbl::unique_ptr<VmCompressedPage>> compressed_pages_ TA_GUARDED(lock_);
 };
@@ -7,99 +7,51 @@
 #pragma once
 
 #include <err.h>
+#include <fbl/algorithm.h>
 #include <fbl/canary.h>
-#include <fbl/intrusive_wavl_tree.h>
 #include <fbl/macros.h>
-#include <fbl/unique_ptr.h>
 #include <vm/vm.h>
 #include <zircon/types.h>
 
 struct vm_page;
 
-class VmPageListNode final : public fbl::WAVLTreeContainable<fbl::unique_ptr<VmPageListNode>> {
+// One node of the VmPageList radix tree. Leaves hold pages, inner nodes hold the
+// nodes of the level below.
+class VmPageListNode final {
 public:
-    explicit VmPageListNode(uint64_t offset);
+    static constexpr uint kFanOutShift = 6;
+    static constexpr size_t kFanOut = 1u << kFanOutShift;
+
+    VmPageListNode();
     ~VmPageListNode();
 
     DISALLOW_COPY_ASSIGN_AND_MOVE(VmPageListNode);
 
-    static const size_t kPageFanOut = 16;
-
-    // accessors
-    uint64_t offset() const { return obj_offset_; }
-    uint64_t GetKey() const { return obj_offset_; }
-
-    // for every valid page in the node call the passed in function
-    template <typename T>
-    zx_status_t ForEveryPage(T func, uint64_t start_offset, uint64_t end_offset) {
-        DEBUG_ASSERT(IS_PAGE_ALIGNED(start_offset) && IS_PAGE_ALIGNED(end_offset));
-        size_t start = 0;
-        size_t end = kPageFanOut;
-        if (start_offset > obj_offset_) {
-            start = (start_offset - obj_offset_) / PAGE_SIZE;
-        }
-        if (end_offset < obj_offset_) {
-            return ZX_ERR_NEXT;
-        }
-        if (end_offset < obj_offset_ + kPageFanOut * PAGE_SIZE) {
-            end = (end_offset - obj_offset_) / PAGE_SIZE;
-        }
-        for (size_t i = start; i < end; i++) {
-            if (pages_[i]) {
-                zx_status_t status = func(pages_[i], obj_offset_ + i * PAGE_SIZE);
-                if (unlikely(status != ZX_ERR_NEXT)) {
-                    return status;
-                }
-            }
-        }
-        return ZX_ERR_NEXT;
-    }
+private:
+    friend class VmPageList;
 
-    // for every valid page in the node call the passed in function
-    template <typename T>
-    zx_status_t ForEveryPage(T func, uint64_t start_offset, uint64_t end_offset) const {
-        DEBUG_ASSERT(IS_PAGE_ALIGNED(start_offset) && IS_PAGE_ALIGNED(end_offset));
-        size_t start = 0;
-        size_t end = kPageFanOut;
-        if (start_offset > obj_offset_) {
-            start = (start_offset - obj_offset_) / PAGE_SIZE;
-        }
-        if (end_offset < obj_offset_) {
-            return ZX_ERR_NEXT;
-        }
-        if (end_offset < obj_offset_ + kPageFanOut * PAGE_SIZE) {
-            end = (end_offset - obj_offset_) / PAGE_SIZE;
-        }
-        for (size_t i = start; i < end; i++) {
-            if (pages_[i]) {
-                zx_status_t status = func(pages_[i], obj_offset_ + i * PAGE_SIZE);
-                if (unlikely(status != ZX_ERR_NEXT)) {
-                    return status;
-                }
-            }
-        }
-        return ZX_ERR_NEXT;
+    // the slot that holds page |index| in a node at |level|, 0 being the leaves
+    static size_t SlotIndex(uint64_t index, uint level) {
+        return (index >> (level * kFanOutShift)) & (kFanOut - 1);
     }
 
-    vm_page* GetPage(size_t index);
-    vm_page* RemovePage(size_t index);
-    zx_status_t AddPage(vm_page* p, size_t index);
+    union Slot {
+        VmPageListNode* node;
+        vm_page* page;
+    };
 
-    bool IsEmpty() const {
-        for (const auto p : pages_) {
-            if (p)
-                return false;
-        }
-        return true;
-    }
-
-private:
     fbl::Canary<fbl::magic("PLST")> canary_;
 
-    uint64_t obj_offset_ = 0;
-    vm_page* pages_[kPageFanOut] = {};
+    // number of slots in use, the node is freed when it drops to 0
+    uint32_t count_ = 0;
+    Slot slots_[kFanOut] = {};
 };
 
+// The pages of a VmObjectPaged, by offset.
+//
+// Pages are kept in a radix tree of kFanOut wide nodes, indexed by page number.
+// The tree is only as tall as the highest offset in it needs, so a lookup takes
+// one load per level: two levels cover 16MB worth of pages, four cover 64GB.
 class VmPageList final {
 public:
     VmPageList();
@@ -107,92 +59,114 @@ public:
 
     DISALLOW_COPY_ASSIGN_AND_MOVE(VmPageList);
 
-    // walk the page tree, calling the passed in function on every tree node
+    // walk the page tree, calling the passed in function on every page
     template <typename T>
     zx_status_t ForEveryPage(T per_page_func) {
-        for (auto& pl : list_) {
-            zx_status_t status = pl.ForEveryPage(per_page_func, pl.offset(),
-                                                 pl.offset() + pl.kPageFanOut * PAGE_SIZE);
-            if (unlikely(status != ZX_ERR_NEXT)) {
-                if (status == ZX_ERR_STOP) {
-                    break;
-                }
-                return status;
-            }
-        }
-        return ZX_OK;
+        return ForEveryPageInTree(root_, height_, 0, UINT64_MAX, per_page_func);
     }
 
-    // walk the page tree, calling the passed in function on every tree node
+    // walk the page tree, calling the passed in function on every page
     template <typename T>
     zx_status_t ForEveryPage(T per_page_func) const {
-        for (auto& pl : list_) {
-            zx_status_t status = pl.ForEveryPage(per_page_func, pl.offset(),
-                                                 pl.offset() + pl.kPageFanOut * PAGE_SIZE);
-            if (unlikely(status != ZX_ERR_NEXT)) {
-                if (status == ZX_ERR_STOP) {
-                    break;
-                }
-                return status;
-            }
-        }
-        return ZX_OK;
+        return ForEveryPageInTree<const VmPageListNode>(root_, height_, 0, UINT64_MAX,
+                                                        per_page_func);
     }
 
-    // walk the page tree, calling the passed in function on every tree node
+    // walk the page tree, calling the passed in function on every page in the range
     template <typename T>
     zx_status_t ForEveryPageInRange(T per_page_func, uint64_t start_offset, uint64_t end_offset) {
         DEBUG_ASSERT(IS_PAGE_ALIGNED(start_offset) && IS_PAGE_ALIGNED(end_offset));
-        // Find the first node with a start after start_offset; if start_offset
-        // is in a node, it'll be in the one before it.
-        auto start = --list_.upper_bound(start_offset);
-        if (!start.IsValid()) {
-            start = list_.begin();
-        }
-        const auto end = list_.lower_bound(end_offset);
-        for (auto itr = start; itr != end; ++itr) {
-            auto& pl = *itr;
-            zx_status_t status = pl.ForEveryPage(per_page_func, start_offset, end_offset);
-            if (unlikely(status != ZX_ERR_NEXT)) {
-                if (status == ZX_ERR_STOP) {
-                    break;
-                }
-                return status;
-            }
-        }
-        return ZX_OK;
+        return ForEveryPageInTree(root_, height_, start_offset >> PAGE_SIZE_SHIFT,
+                                  end_offset >> PAGE_SIZE_SHIFT, per_page_func);
     }
 
     template <typename T>
     zx_status_t ForEveryPageInRange(T per_page_func, uint64_t start_offset,
                                     uint64_t end_offset) const {
         DEBUG_ASSERT(IS_PAGE_ALIGNED(start_offset) && IS_PAGE_ALIGNED(end_offset));
-        // Find the first node with a start after start_offset; if start_offset
-        // is in a node, it'll be in the one before it.
-        auto start = --list_.upper_bound(start_offset);
-        if (!start.IsValid()) {
-            start = list_.begin();
-        }
-        const auto end = list_.lower_bound(end_offset);
-        for (auto itr = start; itr != end; ++itr) {
-            auto& pl = *itr;
-            zx_status_t status = pl.ForEveryPage(per_page_func, start_offset, end_offset);
-            if (unlikely(status != ZX_ERR_NEXT)) {
-                if (status == ZX_ERR_STOP) {
-                    break;
-                }
-                return status;
-            }
-        }
-        return ZX_OK;
+        return ForEveryPageInTree<const VmPageListNode>(root_, height_,
+                                                        start_offset >> PAGE_SIZE_SHIFT,
+                                                        end_offset >> PAGE_SIZE_SHIFT,
+                                                        per_page_func);
     }
 
     zx_status_t AddPage(vm_page*, uint64_t offset);
     vm_page* GetPage(uint64_t offset);
     zx_status_t FreePage(uint64_t offset);
+    // removes the page at |offset| without freeing it, returns nullptr if there is none
+    vm_page* TakePage(uint64_t offset) { return RemovePage(offset >> PAGE_SIZE_SHIFT); }
     size_t FreeAllPages();
     bool IsEmpty();
 
 private:
-    fbl::WAVLTree<uint64_t, fbl::unique_ptr<VmPageListNode>> list_;
+    using Node = VmPageListNode;
+
+    // enough levels for every page of a 64 bit address space
+    static constexpr uint kMaxHeight =
+        (64 - PAGE_SIZE_SHIFT + Node::kFanOutShift - 1) / Node::kFanOutShift;
+
+    // the number of levels needed to hold page |index|
+    static uint HeightFor(uint64_t index) {
+        uint height = 1;
+        while (height < kMaxHeight && (index >> (height * Node::kFanOutShift)) != 0) {
+            height++;
+        }
+        return height;
+    }
+
+    // calls |func| on the pages with an index in [start, end) in the tree of |height|
+    // levels at |root|, translating the ZX_ERR_NEXT and ZX_ERR_STOP of the last call
+    // to ZX_OK
+    template <typename N, typename T>
+    static zx_status_t ForEveryPageInTree(N* root, uint height, uint64_t start, uint64_t end,
+                                          T& func) {
+        if (!root)
+            return ZX_OK;
+        end = fbl::min(end, uint64_t(1) << (height * Node::kFanOutShift));
+        if (start >= end)
+            return ZX_OK;
+
+        zx_status_t status = ForEveryPageInNode(root, height - 1, 0, start, end, func);
+        return (status == ZX_ERR_NEXT || status == ZX_ERR_STOP) ? ZX_OK : status;
+    }
+
+    // calls |func| on the pages in [start, end) under |node|, which is at |level| and
+    // covers the pages from |base| on
+    template <typename N, typename T>
+    static zx_status_t ForEveryPageInNode(N* node, uint level, uint64_t base, uint64_t start,
+                                          uint64_t end, T& func) {
+        const uint shift = level * Node::kFanOutShift;
+        const size_t first = (start > base) ? static_cast<size_t>((start - base) >> shift) : 0;
+        size_t last = Node::kFanOut;
+        if (((end - 1 - base) >> shift) < last)
+            last = static_cast<size_t>((end - 1 - base) >> shift) + 1;
+        for (size_t i = first; i < last; i++) {
+            zx_status_t status;
+            if (level == 0) {
+                if (!node->slots_[i].page)
+                    continue;
+                status = func(node->slots_[i].page, (base + i) << PAGE_SIZE_SHIFT);
+            } else {
+                N* child = node->slots_[i].node;
+                if (!child)
+                    continue;
+                status = ForEveryPageInNode(child, level - 1, base + (uint64_t(i) << shift),
+                                            start, end, func);
+            }
+            if (unlikely(status != ZX_ERR_NEXT))
+                return status;
+        }
+        return ZX_ERR_NEXT;
+    }
+
+    // clears the slot of page |index| and frees the nodes on the way to it that are
+    // left empty, returns the page that was in the slot
+    vm_page* RemovePage(uint64_t index);
+
+    // frees |node| at |level| and all the nodes under it
+    static void FreeNodes(Node* node, uint level);
+
+    Node* root_ = nullptr;
+    // number of levels in the tree, 0 if and only if there is no root
+    uint height_ = 0;
 };
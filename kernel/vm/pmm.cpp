@@ -10,9 +10,16 @@
 #include <assert.h>
 #include <err.h>
 #include <inttypes.h>
+#include <kernel/align.h>
+#include <kernel/cmdline.h>
+#include <kernel/event.h>
 #include <kernel/mp.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
 #include <kernel/timer.h>
 #include <lib/console.h>
+#include <lib/counters.h>
+#include <lib/lockstat.h>
 #include <lk/init.h>
 #include <platform.h>
 #include <pow2.h>
@@ -42,6 +49,75 @@ static fbl::Mutex arena_lock;
 static fbl::DoublyLinkedList<PmmArena*> arena_list TA_GUARDED(arena_lock);
 static size_t arena_cumulative_size TA_GUARDED(arena_lock);
 
+// Per-cpu caches of free pages.
+//
+// Allocating or freeing a page takes arena_lock, which serializes page faults
+// on all cpus. Instead, single pages and small runs are taken from and given
+// back to a cache of the current cpu, which only takes a spinlock that is
+// uncontended unless the caches are being drained. A cache refills from the
+// arenas in batches of kPageCacheBatch pages when it runs dry, and when it
+// grows past kPageCacheMax pages gives a batch back.
+//
+// Cached pages are in VM_PAGE_STATE_CACHED, so the arenas do not consider them
+// free. They still count as free memory. When the arenas cannot satisfy a
+// request, and when the system is low on memory, all of the caches are
+// drained back to the arenas.
+//
+// Any cached page must be able to satisfy a PMM_ALLOC_FLAG_KMAP request, so
+// the caches are only used while all arenas are KMAP.
+static constexpr size_t kPageCacheBatch = 32;
+static constexpr size_t kPageCacheMax = 4 * kPageCacheBatch;
+
+namespace {
+struct PageCache {
+    PageCache() { list_initialize(&pages); }
+
+    SpinLock lock;
+    list_node pages TA_GUARDED(lock);
+    size_t count TA_GUARDED(lock) = 0;
+} __CPU_ALIGN;
+} // namespace
+
+static PageCache page_caches[SMP_MAX_CPUS];
+static bool page_cache_enabled = true;
+
+// Pool of pre-zeroed free pages.
+//
+// Pages committed to VMOs have to be zeroed, which on the page fault path
+// costs the faulting thread a page worth of stores and evicts useful lines
+// from its cpu's cache. Instead, a thread running just above idle priority
+// takes free pages from the arenas, zeroes them with non-temporal stores and
+// keeps them in this pool, and pmm_alloc_zeroed_page() hands them out first.
+// When an allocation takes the pool below the low watermark, the thread
+// refills it up to the high watermark, but only while the arenas have plenty
+// of free pages left.
+//
+// Like cached pages, pooled pages are in VM_PAGE_STATE_CACHED, count as free
+// memory and are drained back to the arenas along with the page caches. The
+// pool is only used while the page caches are.
+static constexpr size_t kZeroPoolBatch = kPageCacheBatch;
+
+namespace {
+struct ZeroPool {
+    ZeroPool() { list_initialize(&pages); }
+
+    SpinLock lock;
+    list_node pages TA_GUARDED(lock);
+    size_t count TA_GUARDED(lock) = 0;
+};
+} // namespace
+
+static ZeroPool zero_pool;
+static size_t zero_pool_high_watermark = 2048;
+static size_t zero_pool_low_watermark = 1024;
+static bool zero_pool_enabled = false;
+static event_t zero_pool_event = EVENT_INITIAL_VALUE(zero_pool_event, false,
+                                                     EVENT_FLAG_AUTOUNSIGNAL);
+
+KCOUNTER(pmm_zero_pool_hits, "kernel.pmm.zero_pool.hits");
+KCOUNTER(pmm_zero_pool_misses, "kernel.pmm.zero_pool.misses");
+KCOUNTER(pmm_zero_pool_zeroed, "kernel.pmm.zero_pool.zeroed");
+
 #if PMM_ENABLE_FREE_FILL
 static void pmm_enforce_fill(uint level) {
     for (auto& a : arena_list) {
@@ -90,6 +166,12 @@ zx_status_t pmm_add_arena(const pmm_arena_info_t* info) TA_NO_THREAD_SAFETY_ANAL
     DEBUG_ASSERT(IS_PAGE_ALIGNED(info->size));
     DEBUG_ASSERT((info->base + info->size) > info->base);
 
+    LOCK_CLASS_MUTEX(arena_lock.GetInternal(), "vm.pmm_arena_lock");
+
+    if (!(info->flags & PMM_ARENA_FLAG_KMAP)) {
+        page_cache_enabled = false;
+    }
+
     // allocate a c++ arena object
     PmmArena* arena = new (boot_alloc_mem(sizeof(PmmArena))) PmmArena();
 
@@ -119,7 +201,295 @@ done_add:
     return ZX_OK;
 }
 
+static size_t pmm_alloc_pages_locked(size_t count, uint alloc_flags, list_node* list)
+    TA_REQ(arena_lock) {
+    /* walk the arenas in order, allocating as many pages as we can from each */
+    size_t allocated = 0;
+    for (auto& a : arena_list) {
+        DEBUG_ASSERT(count > allocated);
+
+        /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
+        if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
+            if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
+                continue;
+        }
+
+        // ask the arena to allocate some pages
+        allocated += a.AllocPages(count - allocated, list);
+        DEBUG_ASSERT(allocated <= count);
+        if (allocated == count)
+            break;
+    }
+
+    return allocated;
+}
+
+static size_t pmm_free_locked(list_node* list) TA_REQ(arena_lock) {
+    size_t count = 0;
+    while (!list_is_empty(list)) {
+        vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
+
+        DEBUG_ASSERT_MSG(!page_is_free(page), "page %p state %u\n", page, page->state);
+
+        /* see which arena this page belongs to and add it */
+        for (auto& a : arena_list) {
+            if (a.FreePage(page) >= 0) {
+                count++;
+                break;
+            }
+        }
+    }
+
+    return count;
+}
+
+static size_t pmm_count_free_pages_locked() TA_REQ(arena_lock) {
+    size_t free = 0u;
+    for (const auto& a : arena_list) {
+        free += a.free_count();
+    }
+    return free;
+}
+
+// Moves up to |count| pages from the current cpu's cache to the tail of |list|.
+static size_t page_cache_take(size_t count, list_node* list) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    PageCache& cache = page_caches[arch_curr_cpu_num()];
+
+    size_t taken = 0;
+    cache.lock.Acquire();
+    while (taken < count) {
+        vm_page_t* page = list_remove_head_type(&cache.pages, vm_page_t, free.node);
+        if (!page)
+            break;
+        DEBUG_ASSERT(page->state == VM_PAGE_STATE_CACHED);
+        page->state = VM_PAGE_STATE_ALLOC;
+        list_add_tail(list, &page->free.node);
+        taken++;
+    }
+    cache.count -= taken;
+    cache.lock.Release();
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return taken;
+}
+
+// Moves pages from |list| into the current cpu's cache, and returns how many.
+// If the cache fills up while pages are left over, a batch of cached pages is
+// moved to |overflow| for the caller to free to the arenas along with the rest.
+static size_t page_cache_give(list_node* list, list_node* overflow) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    PageCache& cache = page_caches[arch_curr_cpu_num()];
+
+    size_t given = 0;
+    cache.lock.Acquire();
+    while (cache.count < kPageCacheMax) {
+        vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
+        if (!page)
+            break;
+        DEBUG_ASSERT_MSG(!page_is_free(page), "page %p state %u\n", page, page->state);
+        DEBUG_ASSERT(page->state != VM_PAGE_STATE_OBJECT || page->object.pin_count == 0);
+        page->state = VM_PAGE_STATE_CACHED;
+        list_add_head(&cache.pages, &page->free.node);
+        cache.count++;
+        given++;
+    }
+    if (!list_is_empty(list)) {
+        // the cache is full, make room for later frees
+        for (size_t i = 0; i < kPageCacheBatch; i++) {
+            vm_page_t* page = list_remove_tail_type(&cache.pages, vm_page_t, free.node);
+            page->state = VM_PAGE_STATE_ALLOC;
+            list_add_tail(overflow, &page->free.node);
+        }
+        cache.count -= kPageCacheBatch;
+    }
+    cache.lock.Release();
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return given;
+}
+
+// Takes a page from the current cpu's cache, refilling the cache from the arenas
+// if it is empty.
+static vm_page_t* page_cache_alloc() {
+    list_node list = LIST_INITIAL_VALUE(list);
+
+    if (page_cache_take(1, &list) == 0) {
+        {
+            AutoLock al(&arena_lock);
+            pmm_alloc_pages_locked(kPageCacheBatch, PMM_ALLOC_FLAG_ANY, &list);
+        }
+        if (list_is_empty(&list))
+            return nullptr;
+
+        // keep the first page and cache the rest
+        vm_page_t* page = list_remove_head_type(&list, vm_page_t, free.node);
+        list_node overflow = LIST_INITIAL_VALUE(overflow);
+        page_cache_give(&list, &overflow);
+        if (!list_is_empty(&list) || !list_is_empty(&overflow)) {
+            AutoLock al(&arena_lock);
+            pmm_free_locked(&list);
+            pmm_free_locked(&overflow);
+        }
+        return page;
+    }
+
+    return list_remove_head_type(&list, vm_page_t, free.node);
+}
+
+// Racy, only for statistics.
+static size_t page_cache_count() TA_NO_THREAD_SAFETY_ANALYSIS {
+    size_t count = 0;
+    for (const auto& cache : page_caches) {
+        count += cache.count;
+    }
+    return count;
+}
+
+// Racy, only for statistics.
+static size_t zero_pool_count() TA_NO_THREAD_SAFETY_ANALYSIS {
+    return zero_pool.count;
+}
+
+// Takes a page from the zero pool, and wakes up the zeroing thread if the pool
+// runs low.
+static vm_page_t* zero_pool_take() {
+    spin_lock_saved_state_t state;
+    zero_pool.lock.AcquireIrqSave(state);
+    vm_page_t* page = list_remove_head_type(&zero_pool.pages, vm_page_t, free.node);
+    if (page) {
+        DEBUG_ASSERT(page->state == VM_PAGE_STATE_CACHED);
+        page->state = VM_PAGE_STATE_ALLOC;
+        zero_pool.count--;
+    }
+    bool refill = zero_pool.count < zero_pool_low_watermark;
+    zero_pool.lock.ReleaseIrqRestore(state);
+
+    if (refill && !event_signaled(&zero_pool_event))
+        event_signal(&zero_pool_event, false);
+    return page;
+}
+
+// Zeroes free pages into the pool until it reaches the high watermark, or the
+// arenas run low.
+static void zero_pool_fill() {
+    for (;;) {
+        size_t want;
+        {
+            spin_lock_saved_state_t state;
+            zero_pool.lock.AcquireIrqSave(state);
+            want = zero_pool.count < zero_pool_high_watermark
+                       ? MIN(kZeroPoolBatch, zero_pool_high_watermark - zero_pool.count)
+                       : 0;
+            zero_pool.lock.ReleaseIrqRestore(state);
+        }
+        if (want == 0)
+            return;
+
+        list_node list = LIST_INITIAL_VALUE(list);
+        size_t allocated;
+        {
+            AutoLock al(&arena_lock);
+            // leave the arenas at least twice the pool size for everyone else
+            if (pmm_count_free_pages_locked() < want + 2 * zero_pool_high_watermark)
+                return;
+            allocated = pmm_alloc_pages_locked(want, PMM_ALLOC_FLAG_ANY, &list);
+        }
+        if (allocated == 0)
+            return;
+
+        vm_page_t* page;
+        list_for_every_entry (&list, page, vm_page_t, free.node) {
+            arch_zero_page_nontemporal(paddr_to_physmap(vm_page_to_paddr(page)));
+            page->state = VM_PAGE_STATE_CACHED;
+        }
+        kcounter_add(pmm_zero_pool_zeroed, allocated);
+
+        spin_lock_saved_state_t state;
+        zero_pool.lock.AcquireIrqSave(state);
+        while ((page = list_remove_head_type(&list, vm_page_t, free.node)) != nullptr) {
+            list_add_tail(&zero_pool.pages, &page->free.node);
+        }
+        zero_pool.count += allocated;
+        zero_pool.lock.ReleaseIrqRestore(state);
+    }
+}
+
+static int zero_pool_thread(void*) {
+    for (;;) {
+        event_wait(&zero_pool_event);
+        zero_pool_fill();
+    }
+    return 0;
+}
+
+static void zero_pool_init(uint level) {
+    zero_pool_high_watermark =
+        cmdline_get_uint64("kernel.pmm.zero-pool-pages", zero_pool_high_watermark);
+    zero_pool_low_watermark =
+        MIN(cmdline_get_uint64("kernel.pmm.zero-pool-low-pages", zero_pool_high_watermark / 2),
+            zero_pool_high_watermark);
+    if (!page_cache_enabled || zero_pool_high_watermark == 0)
+        return;
+
+    thread_t* t = thread_create("pmm-zero", &zero_pool_thread, nullptr, LOWEST_PRIORITY + 1,
+                                DEFAULT_STACK_SIZE);
+    if (!t)
+        return;
+    zero_pool_enabled = true;
+    thread_detach_and_resume(t);
+    event_signal(&zero_pool_event, false);
+}
+
+LK_INIT_HOOK(pmm_zero_pool, &zero_pool_init, LK_INIT_LEVEL_THREADING);
+
+size_t pmm_drain_page_caches() {
+    if (!page_cache_enabled)
+        return 0;
+
+    list_node list = LIST_INITIAL_VALUE(list);
+    {
+        spin_lock_saved_state_t state;
+        zero_pool.lock.AcquireIrqSave(state);
+        vm_page_t* page;
+        while ((page = list_remove_head_type(&zero_pool.pages, vm_page_t, free.node)) != nullptr) {
+            page->state = VM_PAGE_STATE_ALLOC;
+            list_add_tail(&list, &page->free.node);
+        }
+        zero_pool.count = 0;
+        zero_pool.lock.ReleaseIrqRestore(state);
+    }
+    for (auto& cache : page_caches) {
+        spin_lock_saved_state_t state;
+        cache.lock.AcquireIrqSave(state);
+        vm_page_t* page;
+        while ((page = list_remove_head_type(&cache.pages, vm_page_t, free.node)) != nullptr) {
+            page->state = VM_PAGE_STATE_ALLOC;
+            list_add_tail(&list, &page->free.node);
+        }
+        cache.count = 0;
+        cache.lock.ReleaseIrqRestore(state);
+    }
+
+    AutoLock al(&arena_lock);
+    return pmm_free_locked(&list);
+}
+
 vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
+    if (page_cache_enabled) {
+        vm_page_t* page = page_cache_alloc();
+        if (page) {
+            if (pa)
+                *pa = vm_page_to_paddr(page);
+            return page;
+        }
+
+        // the arenas are empty, but other cpus may have pages cached
+        pmm_drain_page_caches();
+    }
+
     AutoLock al(&arena_lock);
 
     /* walk the arenas in order until we find one with a free page */
@@ -140,6 +510,29 @@ vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
     return nullptr;
 }
 
+vm_page_t* pmm_alloc_zeroed_page(uint alloc_flags, paddr_t* pa) {
+    if (zero_pool_enabled) {
+        vm_page_t* page = zero_pool_take();
+        if (page) {
+            kcounter_add(pmm_zero_pool_hits, 1);
+            if (pa)
+                *pa = vm_page_to_paddr(page);
+            return page;
+        }
+        kcounter_add(pmm_zero_pool_misses, 1);
+    }
+
+    paddr_t page_pa;
+    vm_page_t* page = pmm_alloc_page(alloc_flags, &page_pa);
+    if (!page)
+        return nullptr;
+
+    arch_zero_page(paddr_to_physmap(page_pa));
+    if (pa)
+        *pa = page_pa;
+    return page;
+}
+
 size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
     LTRACEF("count %zu\n", count);
 
@@ -149,24 +542,21 @@ size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
     if (count == 0)
         return 0;
 
-    AutoLock al(&arena_lock);
-
-    /* walk the arenas in order, allocating as many pages as we can from each */
     size_t allocated = 0;
-    for (auto& a : arena_list) {
-        DEBUG_ASSERT(count > allocated);
+    if (page_cache_enabled && count <= kPageCacheBatch) {
+        allocated = page_cache_take(count, list);
+        if (allocated == count)
+            return allocated;
+    }
 
-        /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
-        if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
-            if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
-                continue;
-        }
+    {
+        AutoLock al(&arena_lock);
+        allocated += pmm_alloc_pages_locked(count - allocated, alloc_flags, list);
+    }
 
-        // ask the arena to allocate some pages
-        allocated += a.AllocPages(count - allocated, list);
-        DEBUG_ASSERT(allocated <= count);
-        if (allocated == count)
-            break;
+    if (allocated < count && page_cache_enabled && pmm_drain_page_caches() > 0) {
+        AutoLock al(&arena_lock);
+        allocated += pmm_alloc_pages_locked(count - allocated, alloc_flags, list);
     }
 
     return allocated;
@@ -181,24 +571,31 @@ size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
 
     address = ROUNDDOWN(address, PAGE_SIZE);
 
-    AutoLock al(&arena_lock);
+    // pages in the range may be sitting in a cache, so if the walk stops short, put cached
+    // pages back in the arenas and carry on from where it stopped
+    for (int attempt = 0; attempt < 2 && allocated < count; attempt++) {
+        if (attempt > 0 && pmm_drain_page_caches() == 0)
+            break;
 
-    /* walk through the arenas, looking to see if the physical page belongs to it */
-    for (auto& a : arena_list) {
-        while (allocated < count && a.address_in_arena(address)) {
-            vm_page_t* page = a.AllocSpecific(address);
-            if (!page)
-                break;
+        AutoLock al(&arena_lock);
 
-            if (list)
-                list_add_tail(list, &page->free.node);
+        /* walk through the arenas, looking to see if the physical page belongs to it */
+        for (auto& a : arena_list) {
+            while (allocated < count && a.address_in_arena(address)) {
+                vm_page_t* page = a.AllocSpecific(address);
+                if (!page)
+                    break;
 
-            allocated++;
-            address += PAGE_SIZE;
-        }
+                if (list)
+                    list_add_tail(list, &page->free.node);
 
-        if (allocated == count)
-            break;
+                allocated++;
+                address += PAGE_SIZE;
+            }
+
+            if (allocated == count)
+                break;
+        }
     }
 
     return allocated;
@@ -223,19 +620,25 @@ size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_lo
         return 1;
     }
 
-    AutoLock al(&arena_lock);
+    // if no run is found, try again once cached pages have been put back in the arenas
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (attempt > 0 && pmm_drain_page_caches() == 0)
+            break;
 
-    for (auto& a : arena_list) {
-        /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
-        if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
-            if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
-                continue;
-        }
+        AutoLock al(&arena_lock);
 
-        size_t allocated = a.AllocContiguous(count, alignment_log2, pa, list);
-        if (allocated > 0) {
-            DEBUG_ASSERT(allocated == count);
-            return allocated;
+        for (auto& a : arena_list) {
+            /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
+            if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
+                if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
+                    continue;
+            }
+
+            size_t allocated = a.AllocContiguous(count, alignment_log2, pa, list);
+            if (allocated > 0) {
+                DEBUG_ASSERT(allocated == count);
+                return allocated;
+            }
         }
     }
 
@@ -317,24 +720,19 @@ size_t pmm_free(struct list_node* list) {
 
     DEBUG_ASSERT(list);
 
-    AutoLock al(&arena_lock);
-
-    uint count = 0;
-    while (!list_is_empty(list)) {
-        vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
-
-        DEBUG_ASSERT_MSG(!page_is_free(page), "page %p state %u\n", page, page->state);
+    size_t count = 0;
+    list_node overflow = LIST_INITIAL_VALUE(overflow);
+    if (page_cache_enabled) {
+        count += page_cache_give(list, &overflow);
+    }
 
-        /* see which arena this page belongs to and add it */
-        for (auto& a : arena_list) {
-            if (a.FreePage(page) >= 0) {
-                count++;
-                break;
-            }
-        }
+    if (!list_is_empty(list) || !list_is_empty(&overflow)) {
+        AutoLock al(&arena_lock);
+        count += pmm_free_locked(list);
+        pmm_free_locked(&overflow);
     }
 
-    LTRACEF("returning count %u\n", count);
+    LTRACEF("returning count %zu\n", count);
 
     return count;
 }
@@ -348,17 +746,11 @@ size_t pmm_free_page(vm_page_t* page) {
     return pmm_free(&list);
 }
 
-static size_t pmm_count_free_pages_locked() TA_REQ(arena_lock) {
-    size_t free = 0u;
-    for (const auto& a : arena_list) {
-        free += a.free_count();
-    }
-    return free;
-}
-
 size_t pmm_count_free_pages() {
+    size_t cached = page_cache_count() + zero_pool_count();
+
     AutoLock al(&arena_lock);
-    return pmm_count_free_pages_locked();
+    return pmm_count_free_pages_locked() + cached;
 }
 
 static void pmm_dump_free() TA_REQ(arena_lock) {
@@ -8,7 +8,9 @@
 #include "vm_priv.h"
 
 #include <err.h>
+#include <fbl/algorithm.h>
 #include <inttypes.h>
+#include <pow2.h>
 #include <pretty/sizes.h>
 #include <string.h>
 #include <trace.h>
@@ -23,9 +25,13 @@
 void PmmArena::EnforceFill() {
     DEBUG_ASSERT(!enforce_fill_);
 
-    vm_page_t* page;
-    list_for_every_entry (&free_list_, page, vm_page_t, free.node) {
-        FreeFill(page);
+    for (uint order = 0; order <= kMaxOrder; order++) {
+        vm_page_t* page;
+        list_for_every_entry (&free_lists_[order], page, vm_page_t, free.node) {
+            for (size_t i = 0; i < (1ul << order); i++) {
+                FreeFill(page + i);
+            }
+        }
     }
 
     enforce_fill_ = true;
@@ -46,10 +52,137 @@ void PmmArena::CheckFreeFill(vm_page_t* page) {
 }
 #endif // PMM_ENABLE_FREE_FILL
 
+// Returns the largest order of a block that can start at |index|, given that
+// blocks are aligned to their size in physical address space.
+uint PmmArena::max_block_order(size_t index) const {
+    uint64_t pfn = base() / PAGE_SIZE + index;
+    if (pfn == 0)
+        return kMaxOrder;
+    return fbl::min<uint>(__builtin_ctzl(pfn), kMaxOrder);
+}
+
+bool PmmArena::is_free_block(size_t index, uint order) const {
+    if (index >= size() / PAGE_SIZE)
+        return false;
+    const vm_page_t* page = &page_array_[index];
+    return page_is_free(page) && page->free.order == order;
+}
+
+void PmmArena::AddFreeBlock(size_t index, uint order) {
+    DEBUG_ASSERT(order <= kMaxOrder);
+    DEBUG_ASSERT(max_block_order(index) >= order);
+
+    vm_page_t* page = &page_array_[index];
+    DEBUG_ASSERT(page_is_free(page));
+    page->free.order = static_cast<uint8_t>(order);
+    list_add_head(&free_lists_[order], &page->free.node);
+}
+
+void PmmArena::RemoveFreeBlock(size_t index) {
+    vm_page_t* page = &page_array_[index];
+    DEBUG_ASSERT(page_is_free(page) && page->free.order <= kMaxOrder);
+    DEBUG_ASSERT(list_in_list(&page->free.node));
+
+    list_delete(&page->free.node);
+    page->free.order = VM_PAGE_NOT_BLOCK_HEAD;
+}
+
+// Adds a run of free pages that are not in any block as the fewest blocks possible.
+void PmmArena::AddFreeRange(size_t index, size_t count) {
+    while (count > 0) {
+        uint order = fbl::min(max_block_order(index), log2_ulong_floor(count));
+        AddFreeBlock(index, order);
+        index += 1ul << order;
+        count -= 1ul << order;
+    }
+}
+
+// Takes a free block of |order| out of the free lists, splitting a larger one
+// if there is none. Its pages are left in the free state.
+bool PmmArena::AllocBlock(uint order, size_t* index) {
+    uint o = order;
+    while (o <= kMaxOrder && list_is_empty(&free_lists_[o]))
+        o++;
+    if (o > kMaxOrder)
+        return false;
+
+    vm_page_t* page = list_peek_head_type(&free_lists_[o], vm_page_t, free.node);
+    size_t i = page_index(page);
+    RemoveFreeBlock(i);
+
+    // give back the upper halves until the block is the requested size
+    while (o > order) {
+        o--;
+        AddFreeBlock(i + (1ul << o), o);
+    }
+
+    *index = i;
+    return true;
+}
+
+// Takes the free page at |index| out of the block it is in, splitting the block
+// around it. The page is left in the free state.
+void PmmArena::TakeFreePage(size_t index) {
+    DEBUG_ASSERT(page_is_free(&page_array_[index]));
+
+    // find the block that contains the page
+    const uint64_t base_pfn = base() / PAGE_SIZE;
+    const uint64_t pfn = base_pfn + index;
+    size_t head = 0;
+    uint order = VM_PAGE_NOT_BLOCK_HEAD;
+    for (uint o = 0; o <= kMaxOrder; o++) {
+        uint64_t head_pfn = pfn & ~((1ul << o) - 1);
+        if (head_pfn < base_pfn)
+            break;
+        head = head_pfn - base_pfn;
+        const vm_page_t* page = &page_array_[head];
+        if (page_is_free(page) && page->free.order != VM_PAGE_NOT_BLOCK_HEAD &&
+            page->free.order >= o) {
+            order = page->free.order;
+            break;
+        }
+    }
+    ASSERT_MSG(order <= kMaxOrder, "free page %zu is not in a block\n", index);
+
+    RemoveFreeBlock(head);
+
+    // halve the block, keeping the half with the page, until only the page is left
+    while (order > 0) {
+        order--;
+        size_t half = 1ul << order;
+        if (index < head + half) {
+            AddFreeBlock(head + half, order);
+        } else {
+            AddFreeBlock(head, order);
+            head += half;
+        }
+    }
+    DEBUG_ASSERT(head == index);
+}
+
+void PmmArena::MarkAllocated(vm_page_t* page) {
+    LTRACEF("allocating page %p, pa %#" PRIxPTR "\n", page, page_address_from_arena(page));
+
+    DEBUG_ASSERT(page_is_free(page));
+    DEBUG_ASSERT(free_count_ > 0);
+
+    free_count_--;
+
+#if PMM_ENABLE_FREE_FILL
+    CheckFreeFill(page);
+#endif
+
+    page->state = VM_PAGE_STATE_ALLOC;
+}
+
 zx_status_t PmmArena::Init(const pmm_arena_info_t* info) {
     // TODO: validate that info is sane (page aligned, etc)
     info_ = *info;
 
+    for (auto& list : free_lists_) {
+        list_initialize(&list);
+    }
+
     /* allocate an array of pages to back this one */
     size_t page_count = size() / PAGE_SIZE;
     size_t page_array_size = ROUNDUP_PAGE_SIZE(page_count * VM_PAGE_STRUCT_SIZE);
@@ -87,7 +220,7 @@ zx_status_t PmmArena::Init(const pmm_arena_info_t* info) {
 
     DEBUG_ASSERT(array_start_index < page_count && array_end_index <= page_count);
 
-    /* add all pages that aren't part of the page array to the free list */
+    /* add all pages that aren't part of the page array to the free blocks */
     /* pages part of the free array go to the WIRED state */
     for (size_t i = 0; i < page_count; i++) {
         auto& p = page_array_[i];
@@ -96,29 +229,23 @@ zx_status_t PmmArena::Init(const pmm_arena_info_t* info) {
             p.state = VM_PAGE_STATE_WIRED;
         } else {
             p.state = VM_PAGE_STATE_FREE;
-            list_add_tail(&free_list_, &p.free.node);
+            p.free.order = VM_PAGE_NOT_BLOCK_HEAD;
             free_count_++;
         }
     }
+    AddFreeRange(0, array_start_index);
+    AddFreeRange(array_end_index, page_count - array_end_index);
 
     return ZX_OK;
 }
 
 vm_page_t* PmmArena::AllocPage(paddr_t* pa) {
-    vm_page_t* page = list_remove_head_type(&free_list_, vm_page_t, free.node);
-    if (!page)
+    size_t index;
+    if (!AllocBlock(0, &index))
         return nullptr;
 
-    DEBUG_ASSERT(free_count_ > 0);
-
-    free_count_--;
-
-    DEBUG_ASSERT(page_is_free(page));
-
-    page->state = VM_PAGE_STATE_ALLOC;
-#if PMM_ENABLE_FREE_FILL
-    CheckFreeFill(page);
-#endif
+    vm_page_t* page = &page_array_[index];
+    MarkAllocated(page);
 
     if (pa) {
         /* compute the physical address of the page based on its offset into the arena */
@@ -126,8 +253,6 @@ vm_page_t* PmmArena::AllocPage(paddr_t* pa) {
         LTRACEF("pa %#" PRIxPTR ", page %p\n", *pa, page);
     }
 
-    LTRACEF("allocating page %p, pa %#" PRIxPTR "\n", page, page_address_from_arena(page));
-
     return page;
 }
 
@@ -145,13 +270,8 @@ vm_page_t* PmmArena::AllocSpecific(paddr_t pa) {
         return nullptr;
     }
 
-    list_delete(&page->free.node);
-
-    page->state = VM_PAGE_STATE_ALLOC;
-
-    DEBUG_ASSERT(free_count_ > 0);
-
-    free_count_--;
+    TakeFreePage(index);
+    MarkAllocated(page);
 
     return page;
 }
@@ -160,22 +280,14 @@ size_t PmmArena::AllocPages(size_t count, list_node* list) {
     size_t allocated = 0;
 
     while (allocated < count) {
-        vm_page_t* page = list_remove_head_type(&free_list_, vm_page_t, free.node);
-        if (!page)
+        // single pages come from the smallest blocks, which keeps the large ones
+        // for contiguous allocations
+        size_t index;
+        if (!AllocBlock(0, &index))
             return allocated;
 
-        LTRACEF("allocating page %p, pa %#" PRIxPTR "\n", page, page_address_from_arena(page));
-
-        DEBUG_ASSERT(free_count_ > 0);
-
-        free_count_--;
-
-        DEBUG_ASSERT(page_is_free(page));
-#if PMM_ENABLE_FREE_FILL
-        CheckFreeFill(page);
-#endif
-
-        page->state = VM_PAGE_STATE_ALLOC;
+        vm_page_t* page = &page_array_[index];
+        MarkAllocated(page);
         list_add_tail(list, &page->free.node);
 
         allocated++;
@@ -184,69 +296,75 @@ size_t PmmArena::AllocPages(size_t count, list_node* list) {
     return allocated;
 }
 
-size_t PmmArena::AllocContiguous(size_t count, uint8_t alignment_log2, paddr_t* pa, struct list_node* list) {
-    /* walk the list starting at alignment boundaries.
-     * calculate the starting offset into this arena, based on the
-     * base address of the arena to handle the case where the arena
-     * is not aligned on the same boundary requested.
+// Finds and takes |count| free pages in a row, starting at an address aligned
+// to |alignment_log2|. The pages are left in the free state.
+bool PmmArena::AllocRun(size_t count, uint8_t alignment_log2, size_t* index) {
+    uint align_order = alignment_log2 > PAGE_SIZE_SHIFT ? alignment_log2 - PAGE_SIZE_SHIFT : 0;
+    uint order = fbl::max(log2_ulong_ceil(count), align_order);
+
+    if (order <= kMaxOrder && AllocBlock(order, index)) {
+        // give back the part of the block past the run
+        AddFreeRange(*index + count, (1ul << order) - count);
+        return true;
+    }
+
+    /* No single block is big enough, but the run may still fit in several smaller
+     * adjacent blocks. Fall back to walking the pages, starting at alignment
+     * boundaries. Calculate the starting offset into this arena based on the
+     * base address of the arena, to handle the case where the arena is not
+     * aligned on the same boundary requested.
      */
     paddr_t rounded_base = ROUNDUP(base(), 1UL << alignment_log2);
     if (rounded_base < base() || rounded_base > base() + size() - 1)
-        return 0;
-
-    paddr_t aligned_offset = (rounded_base - base()) / PAGE_SIZE;
-    paddr_t start = aligned_offset;
-    LTRACEF("starting search at aligned offset %#" PRIxPTR "\n", start);
-    LTRACEF("arena base %#" PRIxPTR " size %zu\n", base(), size());
+        return false;
+
+    const size_t page_count = size() / PAGE_SIZE;
+    const size_t aligned_offset = (rounded_base - base()) / PAGE_SIZE;
+    size_t start = aligned_offset;
+    LTRACEF("starting search at aligned offset %#zx\n", start);
+
+    while (start + count <= page_count) {
+        size_t i;
+        for (i = 0; i < count; i++) {
+            if (!page_is_free(&page_array_[start + i]))
+                break;
+        }
 
-retry:
-    /* search while we're still within the arena and have a chance of finding a slot
-       (start + count < end of arena) */
-    while ((start < size() / PAGE_SIZE) && ((start + count) <= size() / PAGE_SIZE)) {
-        vm_page_t* p = &page_array_[start];
-        for (uint i = 0; i < count; i++) {
-            if (!page_is_free(p)) {
-                /* this run is broken, break out of the inner loop.
-                 * start over at the next alignment boundary
-                 */
-                start = ROUNDUP(start - aligned_offset + i + 1, 1UL << (alignment_log2 - PAGE_SIZE_SHIFT)) +
-                        aligned_offset;
-                goto retry;
+        if (i == count) {
+            for (i = 0; i < count; i++) {
+                TakeFreePage(start + i);
             }
-            p++;
+            *index = start;
+            return true;
         }
 
-        /* we found a run */
-        LTRACEF("found run from pn %" PRIuPTR " to %" PRIuPTR "\n", start, start + count);
-
-        /* remove the pages from the run out of the free list */
-        for (paddr_t i = start; i < start + count; i++) {
-            p = &page_array_[i];
-            DEBUG_ASSERT(page_is_free(p));
-            DEBUG_ASSERT(list_in_list(&p->free.node));
-
-            list_delete(&p->free.node);
-            p->state = VM_PAGE_STATE_ALLOC;
-
-            DEBUG_ASSERT(free_count_ > 0);
+        /* this run is broken, start over at the next alignment boundary */
+        start = ROUNDUP(start - aligned_offset + i + 1, 1UL << align_order) + aligned_offset;
+    }
 
-            free_count_--;
+    return false;
+}
 
-#if PMM_ENABLE_FREE_FILL
-            CheckFreeFill(p);
-#endif
+size_t PmmArena::AllocContiguous(size_t count, uint8_t alignment_log2, paddr_t* pa, struct list_node* list) {
+    LTRACEF("arena base %#" PRIxPTR " size %zu\n", base(), size());
 
-            if (list)
-                list_add_tail(list, &p->free.node);
-        }
+    size_t start;
+    if (!AllocRun(count, alignment_log2, &start))
+        return 0;
 
-        if (pa)
-            *pa = base() + start * PAGE_SIZE;
+    LTRACEF("found run from pn %zu to %zu\n", start, start + count);
 
-        return count;
+    for (size_t i = start; i < start + count; i++) {
+        vm_page_t* p = &page_array_[i];
+        MarkAllocated(p);
+        if (list)
+            list_add_tail(list, &p->free.node);
     }
 
-    return 0;
+    if (pa)
+        *pa = base() + start * PAGE_SIZE;
+
+    return count;
 }
 
 zx_status_t PmmArena::FreePage(vm_page_t* page) {
@@ -261,8 +379,26 @@ zx_status_t PmmArena::FreePage(vm_page_t* page) {
 #endif
 
     page->state = VM_PAGE_STATE_FREE;
+    page->free.order = VM_PAGE_NOT_BLOCK_HEAD;
+
+    /* merge with the buddy block for as long as it is free and the same size */
+    const uint64_t base_pfn = base() / PAGE_SIZE;
+    size_t index = page_index(page);
+    uint order = 0;
+    while (order < kMaxOrder) {
+        uint64_t buddy_pfn = (base_pfn + index) ^ (1ul << order);
+        if (buddy_pfn < base_pfn)
+            break;
+        size_t buddy = buddy_pfn - base_pfn;
+        if (!is_free_block(buddy, order))
+            break;
+
+        RemoveFreeBlock(buddy);
+        index = fbl::min(index, buddy);
+        order++;
+    }
+    AddFreeBlock(index, order);
 
-    list_add_head(&free_list_, &page->free.node);
     free_count_++;
     return ZX_OK;
 }
@@ -279,6 +415,12 @@ void PmmArena::Dump(bool dump_pages, bool dump_free_ranges) {
            format_size(pbuf, sizeof(pbuf), size()), size(), priority(), flags());
     printf("\tpage_array %p, free_count %zu\n", page_array_, free_count_);
 
+    printf("\tfree blocks by order:");
+    for (uint order = 0; order <= kMaxOrder; order++) {
+        printf(" %zu", list_length(&free_lists_[order]));
+    }
+    printf("\n");
+
     /* dump all of the pages */
     if (dump_pages) {
         for (size_t i = 0; i < size() / PAGE_SIZE; i++) {
@@ -15,8 +15,18 @@
 #define PMM_ENABLE_FREE_FILL 0
 #define PMM_FREE_FILL_BYTE 0x42
 
+// Free pages in an arena are kept by a binary buddy allocator: every free page
+// is part of exactly one free block of 2^order pages, which is aligned to its
+// size in physical address space. The first page of a block is on the free
+// list for its order, the rest are only marked free. Freeing a page merges it
+// with its buddy for as long as the buddy is a free block of the same size, so
+// free runs stay coalesced, and aligned contiguous runs are found by taking a
+// block of the right order instead of scanning the page array.
 class PmmArena : public fbl::DoublyLinkedListable<PmmArena*> {
 public:
+    // the largest block, 4GB with 4k pages
+    static constexpr uint kMaxOrder = 20;
+
     constexpr PmmArena() = default;
     ~PmmArena() = default;
 
@@ -80,11 +90,24 @@ private:
     void CheckFreeFill(vm_page_t* page);
 #endif
 
+    // buddy allocator helpers, all in terms of page indices into the arena
+    size_t page_index(const vm_page_t* page) const { return page - page_array_; }
+    uint max_block_order(size_t index) const;
+    bool is_free_block(size_t index, uint order) const;
+    void AddFreeBlock(size_t index, uint order);
+    void RemoveFreeBlock(size_t index);
+    void AddFreeRange(size_t index, size_t count);
+    bool AllocBlock(uint order, size_t* index);
+    bool AllocRun(size_t count, uint8_t alignment_log2, size_t* index);
+    void TakeFreePage(size_t index);
+    void MarkAllocated(vm_page_t* page);
+
     pmm_arena_info_t info_ = {};
     vm_page_t* page_array_ = nullptr;
 
     size_t free_count_ = 0;
-    list_node free_list_ = LIST_INITIAL_VALUE(free_list_);
+    // heads of the free blocks of each order, initialized by Init()
+    list_node free_lists_[kMaxOrder + 1] = {};
 
 #if PMM_ENABLE_FREE_FILL
     bool enforce_fill_ = false;
@@ -10,10 +10,12 @@ LOCAL_DIR := $(GET_LOCAL_DIR)
 MODULE := $(LOCAL_DIR)
 
 MODULE_DEPS += \
+    kernel/lib/counters \
     kernel/lib/fbl \
     kernel/lib/pretty \
     kernel/lib/user_copy \
-    third_party/lib/cryptolib
+    third_party/lib/cryptolib \
+    third_party/lib/lz4
 
 MODULE_SRCS += \
     $(LOCAL_DIR)/bootalloc.cpp \
@@ -21,10 +23,12 @@ MODULE_SRCS += \
     $(LOCAL_DIR)/page.cpp \
     $(LOCAL_DIR)/pmm.cpp \
     $(LOCAL_DIR)/pmm_arena.cpp \
+    $(LOCAL_DIR)/scanner.cpp \
     $(LOCAL_DIR)/vm.cpp \
     $(LOCAL_DIR)/vm_address_region.cpp \
     $(LOCAL_DIR)/vm_address_region_or_mapping.cpp \
     $(LOCAL_DIR)/vm_aspace.cpp \
+    $(LOCAL_DIR)/vm_compressed_page.cpp \
     $(LOCAL_DIR)/vm_mapping.cpp \
     $(LOCAL_DIR)/vm_object.cpp \
     $(LOCAL_DIR)/vm_object_paged.cpp \
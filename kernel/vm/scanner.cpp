@@ -0,0 +1,155 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <vm/scanner.h>
+
+#include <fbl/algorithm.h>
+#include <kernel/cmdline.h>
+#include <kernel/thread.h>
+#include <lib/console.h>
+#include <lib/counters.h>
+#include <lk/init.h>
+#include <stdio.h>
+#include <string.h>
+#include <vm/pmm.h>
+#include <vm/vm_object.h>
+#include <zircon/types.h>
+
+KCOUNTER(zero_scan_scanned, "kernel.vm.zero_scan.scanned");
+KCOUNTER(zero_scan_reclaimed, "kernel.vm.zero_scan.reclaimed");
+KCOUNTER(page_age_pressure_ticks, "kernel.vm.page_age.pressure_ticks");
+
+// The background scanner looks at a slice of its pages per second every tick,
+// and rests for a while after every pass over all VMOs.
+static constexpr zx_duration_t kScanTick = ZX_MSEC(100);
+static constexpr zx_duration_t kScanPassInterval = ZX_SEC(30);
+
+// Under memory pressure the scanner ages pages this much faster, and does not
+// rest between passes, so that idle pages get to kCompressAge in seconds.
+static constexpr size_t kPressureRate = 4;
+
+// How many pages the synchronous scans look at between checks of their target.
+static constexpr size_t kReclaimBatch = 1024;
+
+static uint64_t scan_pages_per_sec = 4096;
+
+// Pages get compressed while free memory is below this, 0 to never compress.
+static uint64_t compress_free_bytes = 128 * MB;
+
+static bool under_pressure() {
+    return pmm_count_free_pages() * PAGE_SIZE < compress_free_bytes;
+}
+
+static void scan(VmObject::ScanAction action, size_t max_pages, VmObject::ScanStats* stats,
+                 bool* wrapped) {
+    VmObject::ScanStats s = {};
+    VmObject::ScanAllPages(action, max_pages, &s, wrapped);
+    kcounter_add(zero_scan_scanned, s.scanned);
+    kcounter_add(zero_scan_reclaimed, s.zero);
+
+    stats->scanned += s.scanned;
+    stats->zero += s.zero;
+    stats->compressed += s.compressed;
+    stats->compressed_bytes += s.compressed_bytes;
+}
+
+// Scans with |action| until |done| returns true or every VMO was looked at.
+template <typename T>
+static void scan_until(VmObject::ScanAction action, VmObject::ScanStats* stats, T done) {
+    // the scan can start in the middle of the VMO list, so it takes getting to
+    // the end of it twice to be sure that every VMO was looked at
+    int wraps = 0;
+    while (!done() && wraps < 2) {
+        bool wrapped;
+        scan(action, kReclaimBatch, stats, &wrapped);
+        if (wrapped)
+            wraps++;
+    }
+}
+
+size_t scanner_reclaim_zero_pages(size_t target_pages) {
+    VmObject::ScanStats stats = {};
+    scan_until(VmObject::ScanAction::kReclaimZero, &stats,
+               [&stats, target_pages]() { return stats.zero >= target_pages; });
+    return stats.zero;
+}
+
+size_t scanner_compress_pages(size_t target_pages) {
+    if (compress_free_bytes == 0)
+        return 0;
+
+    // what the compressed pages take up in the heap counts against what they freed
+    VmObject::ScanStats stats = {};
+    auto freed = [&stats]() {
+        return stats.zero + stats.compressed - stats.compressed_bytes / PAGE_SIZE;
+    };
+    scan_until(VmObject::ScanAction::kCompress, &stats,
+               [&freed, target_pages]() { return freed() >= target_pages; });
+    return freed();
+}
+
+static int scanner_thread(void*) {
+    const size_t pages_per_tick = fbl::max<size_t>(
+        static_cast<size_t>(scan_pages_per_sec * kScanTick / ZX_SEC(1)), 1);
+
+    for (;;) {
+        VmObject::ScanStats stats = {};
+        bool wrapped;
+        if (under_pressure()) {
+            kcounter_add(page_age_pressure_ticks, 1u);
+            scan(VmObject::ScanAction::kAge, pages_per_tick * kPressureRate, &stats, &wrapped);
+            thread_sleep_relative(kScanTick);
+        } else {
+            scan(VmObject::ScanAction::kReclaimZero, pages_per_tick, &stats, &wrapped);
+            thread_sleep_relative(wrapped ? kScanPassInterval : kScanTick);
+        }
+    }
+    return 0;
+}
+
+static void scanner_init(uint level) {
+    compress_free_bytes =
+        cmdline_get_uint64("kernel.vm.compress-free-mb", compress_free_bytes / MB) * MB;
+    scan_pages_per_sec =
+        cmdline_get_uint64("kernel.vm.zero-scan-pages-per-sec", scan_pages_per_sec);
+    if (scan_pages_per_sec == 0)
+        return;
+
+    thread_t* t = thread_create("vm-scanner", &scanner_thread, nullptr, LOW_PRIORITY,
+                                DEFAULT_STACK_SIZE);
+    if (t)
+        thread_detach_and_resume(t);
+}
+
+LK_INIT_HOOK(vm_scanner, &scanner_init, LK_INIT_LEVEL_USER);
+
+static int cmd_scanner(int argc, const cmd_args* argv, uint32_t flags) {
+    if (argc < 2) {
+    usage:
+        printf("usage:\n");
+        printf("%s reclaim [<pages>]  : free zero pages now, all of them by default\n",
+               argv[0].str);
+        printf("%s compress [<pages>] : compress pages now, all of them by default\n",
+               argv[0].str);
+        return ZX_ERR_INVALID_ARGS;
+    }
+
+    size_t target = (argc > 2) ? argv[2].u : SIZE_MAX;
+    if (!strcmp(argv[1].str, "reclaim")) {
+        printf("reclaimed %zu zero pages\n", scanner_reclaim_zero_pages(target));
+    } else if (!strcmp(argv[1].str, "compress")) {
+        printf("freed %zu pages\n", scanner_compress_pages(target));
+    } else {
+        goto usage;
+    }
+    return ZX_OK;
+}
+
+STATIC_COMMAND_START
+#if LK_DEBUGLEVEL > 0
+STATIC_COMMAND("scanner", "zero page scanner and page compression", &cmd_scanner)
+#endif
+STATIC_COMMAND_END(scanner);
@@ -309,6 +309,10 @@ zx_status_t VmAddressRegion::DestroyLocked() {
     DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
     LTRACEF("%p '%s'\n", this, name_);
 
+    if (!subregions_.is_empty()) {
+        UnmapArchRangeLocked(base_, size_);
+    }
+
     // The cur reference prevents regions from being destructed after dropping
     // the last reference to them when removing from their parent.
     fbl::RefPtr<VmAddressRegion> cur(this);
@@ -355,6 +359,12 @@ void VmAddressRegion::RemoveSubregion(VmAddressRegionOrMapping* region) {
     subregions_.erase(*region);
 }
 
+void VmAddressRegion::SubregionResized(VmAddressRegionOrMapping* region) {
+    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(region->subregion_list_node_.InContainer());
+    subregions_.subtree_changed(*region);
+}
+
 fbl::RefPtr<VmAddressRegionOrMapping> VmAddressRegion::FindRegion(vaddr_t addr) {
     AutoLock guard(aspace_->lock());
     if (state_ != LifeCycleState::ALIVE) {
@@ -635,12 +645,18 @@ zx_status_t VmAddressRegion::UnmapInternalLocked(vaddr_t base, size_t size, bool
 
     // Check if we're partially spanning a subregion, or aren't allowed to
     // destroy regions and are spanning a region, and bail if we are.
+    size_t count = 0;
     for (auto itr = begin; itr != end; ++itr) {
         const vaddr_t itr_end = itr->base() + itr->size();
         if (!itr->is_mapping() && (!can_destroy_regions ||
                                    itr->base() < base || itr_end > end_addr)) {
             return ZX_ERR_INVALID_ARGS;
         }
+        count++;
+    }
+
+    if (count > 1 || (count == 1 && !begin->is_mapping())) {
+        UnmapArchRangeLocked(base, size);
     }
 
     for (auto itr = begin; itr != end;) {
@@ -682,6 +698,39 @@ zx_status_t VmAddressRegion::UnmapInternalLocked(vaddr_t base, size_t size, bool
     return ZX_OK;
 }
 
+void VmAddressRegion::UnmapArchRangeLocked(vaddr_t base, size_t size) {
+    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+
+    // Faults cannot map the range again since we hold the aspace lock, and the
+    // mappings only need their own unmaps for bookkeeping after this. If one of
+    // them fails to go away, its pages are simply faulted in again. The batch
+    // ends before any mapping is destroyed and can free its pages.
+    ArchVmAspaceBatch batch;
+    batch.Add(&aspace_->arch_aspace());
+
+    auto unmap = [this](vaddr_t unmap_base, vaddr_t unmap_end) {
+        if (unmap_base >= unmap_end) {
+            return;
+        }
+        LTRACEF("unmapping base %#lx size %#lx\n", unmap_base, unmap_end - unmap_base);
+        __UNUSED zx_status_t status =
+            aspace_->arch_aspace().Unmap(unmap_base, (unmap_end - unmap_base) / PAGE_SIZE,
+                                         nullptr);
+        DEBUG_ASSERT(status == ZX_OK);
+    };
+
+    const vaddr_t end = base + size;
+#if WITH_LIB_VDSO
+    // The vDSO code mapping cannot be unmapped, so leave it in place.
+    const VmMapping* vdso = aspace_->vdso_code_mapping_.get();
+    if (vdso && vdso->base() < end && vdso->base() + vdso->size() > base) {
+        unmap(base, vdso->base());
+        base = vdso->base() + vdso->size();
+    }
+#endif
+    unmap(base, end);
+}
+
 zx_status_t VmAddressRegion::Protect(vaddr_t base, size_t size, uint new_arch_mmu_flags) {
     canary_.Assert();
 
@@ -739,6 +788,10 @@ zx_status_t VmAddressRegion::Protect(vaddr_t base, size_t size, uint new_arch_mm
         return ZX_ERR_NOT_FOUND;
     }
 
+    // Protecting frees no pages, so the mappings can share one shootdown.
+    ArchVmAspaceBatch batch;
+    batch.Add(&aspace_->arch_aspace());
+
     for (auto itr = begin; itr != end;) {
         DEBUG_ASSERT(itr->is_mapping());
 
@@ -775,53 +828,128 @@ zx_status_t VmAddressRegion::LinearRegionAllocatorLocked(size_t size, uint8_t al
     const vaddr_t align = 1UL << align_pow2;
 
     // Find the first gap in the address space which can contain a region of the
-    // requested size.
-    auto before_iter = subregions_.end();
-    auto after_iter = subregions_.begin();
+    // requested size.  Gaps which are too small to ever fit it are skipped
+    // without looking at them.
+    zx_status_t status = ZX_ERR_NO_MEMORY;
+    ForEachUnalignedGap([&](vaddr_t gap_base, size_t gap_len,
+                            VmAddressRegionOrMapping* next) -> bool {
+        auto after_iter = next ? subregions_.make_iterator(*next) : subregions_.end();
+        auto before_iter = after_iter;
+        if (after_iter == subregions_.begin()) {
+            before_iter = subregions_.end();
+        } else {
+            --before_iter;
+        }
 
-    do {
         if (CheckGapLocked(before_iter, after_iter, spot, base, align, size, 0, arch_mmu_flags)) {
             if (*spot != static_cast<vaddr_t>(-1)) {
-                return ZX_OK;
-            } else {
-                return ZX_ERR_NO_MEMORY;
+                status = ZX_OK;
             }
+            return false;
         }
+        return true;
+    },
+                        size);
 
-        before_iter = after_iter++;
-    } while (before_iter.IsValid());
+    return status;
+}
 
-    // couldn't find anything
-    return ZX_ERR_NO_MEMORY;
+VmAddressRegionOrMapping* VmAddressRegion::SubregionRootLocked() {
+    using PtrTraits = ChildList::PtrTraits;
+
+    if (subregions_.is_empty()) {
+        return nullptr;
+    }
+
+    VmAddressRegionOrMapping* root = &subregions_.front();
+    while (PtrTraits::IsValid(root->subregion_list_node_.parent_)) {
+        root = root->subregion_list_node_.parent_;
+    }
+    return root;
 }
 
 template <typename F>
-void VmAddressRegion::ForEachGap(F func, uint8_t align_pow2) {
-    const vaddr_t align = 1UL << align_pow2;
+bool VmAddressRegion::ForEachUnalignedGapInSubtree(F& func, VmAddressRegionOrMapping* node,
+                                                   vaddr_t gap_base, size_t min_size) {
+    using PtrTraits = ChildList::PtrTraits;
+
+    // Report the gap to the left of each region in address order, going into
+    // a child's subtree only if it has a gap we are looking for.  The gap
+    // between a region and its right subtree is the one to the left of the
+    // subtree's first region.
+    const auto& ns = node->subregion_list_node_;
+    if (PtrTraits::IsValid(ns.left_)) {
+        VmAddressRegionOrMapping* left = PtrTraits::GetRaw(ns.left_);
+        if (left->subtree_max_gap_ >= min_size || left->subtree_first_ - gap_base >= min_size) {
+            if (!ForEachUnalignedGapInSubtree(func, left, gap_base, min_size)) {
+                return false;
+            }
+        }
+        gap_base = left->subtree_last_ + 1;
+    }
+
+    if (node->base_ - gap_base >= min_size) {
+        if (!func(gap_base, node->base_ - gap_base, node)) {
+            return false;
+        }
+    }
 
-    // Scan the regions list to find the gap to the left of each region.  We
-    // round up the end of the previous region to the requested alignment, so
-    // all gaps reported will be for aligned ranges.
-    vaddr_t prev_region_end = ROUNDUP(base_, align);
-    for (const auto& region : subregions_) {
-        if (region.base() > prev_region_end) {
-            const size_t gap = region.base() - prev_region_end;
-            if (!func(prev_region_end, gap)) {
+    if (PtrTraits::IsValid(ns.right_)) {
+        VmAddressRegionOrMapping* right = PtrTraits::GetRaw(ns.right_);
+        gap_base = node->base_ + node->size_;
+        if (right->subtree_max_gap_ >= min_size || right->subtree_first_ - gap_base >= min_size) {
+            return ForEachUnalignedGapInSubtree(func, right, gap_base, min_size);
+        }
+    }
+    return true;
+}
+
+template <typename F>
+void VmAddressRegion::ForEachUnalignedGap(F func, size_t min_size) {
+    // Empty gaps are never interesting.
+    min_size = fbl::max<size_t>(min_size, 1);
+
+    const vaddr_t last = base_ + size_ - 1;
+    vaddr_t gap_base = base_;
+
+    VmAddressRegionOrMapping* root = SubregionRootLocked();
+    if (root) {
+        if (root->subtree_max_gap_ >= min_size || root->subtree_first_ - base_ >= min_size) {
+            if (!ForEachUnalignedGapInSubtree(func, root, base_, min_size)) {
                 return;
             }
         }
-        prev_region_end = ROUNDUP(region.base() + region.size(), align);
+        if (root->subtree_last_ == last) {
+            return;
+        }
+        gap_base = root->subtree_last_ + 1;
     }
 
     // Grab the gap to the right of the last region (note that if there are no
     // regions, this handles reporting the VMAR's whole span as a gap).
-    const vaddr_t end = base_ + size_;
-    if (end > prev_region_end) {
-        const size_t gap = end - prev_region_end;
-        func(prev_region_end, gap);
+    const size_t gap = last - gap_base + 1;
+    if (gap >= min_size) {
+        func(gap_base, gap, nullptr);
     }
 }
 
+template <typename F>
+void VmAddressRegion::ForEachGap(F func, uint8_t align_pow2, size_t min_size) {
+    const vaddr_t align = 1UL << align_pow2;
+
+    // Round up the start of each gap to the requested alignment, so all gaps
+    // reported will be for aligned ranges.
+    ForEachUnalignedGap([&func, align](vaddr_t gap_base, size_t gap_len,
+                                       VmAddressRegionOrMapping* next) -> bool {
+        const vaddr_t aligned_base = ROUNDUP(gap_base, align);
+        if (aligned_base < gap_base || aligned_base - gap_base >= gap_len) {
+            return true;
+        }
+        return func(aligned_base, gap_len - (aligned_base - gap_base));
+    },
+                        min_size);
+}
+
 namespace {
 
 // Compute the number of allocation spots that satisfy the alignment within the
@@ -832,6 +960,101 @@ constexpr size_t AllocationSpotsInRange(size_t range_size, size_t alloc_size, ui
 
 } // namespace {}
 
+// How many times the randomized allocator draws a spot in O(log n) time before
+// it counts all of the spots that could satisfy the allocation instead.
+static constexpr int kRandomSpotSamples = 8;
+
+// Every gap in the region takes up its size plus one alignment unit of a
+// weighted space that the random draws are made in.  A gap with that much room
+// has at most (size / align + 1) spots, so if each of those gets the same
+// align-wide slice of its range, every spot in every gap is equally likely to
+// be drawn.  The rest of the space is where draws get rejected.
+bool VmAddressRegion::SampleRandomSpotLocked(size_t size, uint8_t align_pow2, vaddr_t* spot) {
+    using PtrTraits = ChildList::PtrTraits;
+
+    const vaddr_t align = 1UL << align_pow2;
+    auto weight = [align](size_t gap) -> uint64_t { return gap ? gap + align : 0; };
+    auto subtree_weight = [align](const VmAddressRegionOrMapping* node) -> uint64_t {
+        return node->subtree_gap_bytes_ + node->subtree_gaps_ * align;
+    };
+
+    // The gaps at either end of the region are not in any subtree.
+    VmAddressRegionOrMapping* root = SubregionRootLocked();
+    const size_t first_gap = root ? root->subtree_first_ - base_ : size_;
+    const size_t last_gap = root ? (base_ + size_ - 1) - root->subtree_last_ : 0;
+    const uint64_t total = weight(first_gap) + (root ? subtree_weight(root) : 0) +
+                           weight(last_gap);
+    if (total == 0) {
+        return false;
+    }
+
+    // Find the gap that the draw landed in, and where in its range.
+    uint64_t pick = aspace_->AslrPrng().RandInt(total);
+    vaddr_t gap_base;
+    size_t gap_len;
+    if (pick < weight(first_gap)) {
+        gap_base = base_;
+        gap_len = first_gap;
+    } else if ((pick -= weight(first_gap)) >= subtree_weight(root)) {
+        pick -= subtree_weight(root);
+        gap_base = root->subtree_last_ + 1;
+        gap_len = last_gap;
+    } else {
+        VmAddressRegionOrMapping* node = root;
+        for (;;) {
+            const auto& ns = node->subregion_list_node_;
+            VmAddressRegionOrMapping* left = PtrTraits::IsValid(ns.left_)
+                                                 ? PtrTraits::GetRaw(ns.left_)
+                                                 : nullptr;
+            VmAddressRegionOrMapping* right = PtrTraits::IsValid(ns.right_)
+                                                  ? PtrTraits::GetRaw(ns.right_)
+                                                  : nullptr;
+            if (left) {
+                if (pick < subtree_weight(left)) {
+                    node = left;
+                    continue;
+                }
+                pick -= subtree_weight(left);
+
+                gap_base = left->subtree_last_ + 1;
+                gap_len = node->base_ - gap_base;
+                if (pick < weight(gap_len)) {
+                    break;
+                }
+                pick -= weight(gap_len);
+            }
+
+            // Everything else in the subtree is to the right of the node.
+            DEBUG_ASSERT(right);
+            gap_base = node->base_ + node->size_;
+            gap_len = right->subtree_first_ - gap_base;
+            if (pick < weight(gap_len)) {
+                break;
+            }
+            pick -= weight(gap_len);
+            node = right;
+        }
+    }
+    DEBUG_ASSERT(pick < weight(gap_len));
+
+    // Only accept the draw if it landed in the slice of one of the gap's spots.
+    const vaddr_t aligned_base = ROUNDUP(gap_base, align);
+    if (aligned_base < gap_base || aligned_base - gap_base >= gap_len) {
+        return false;
+    }
+    const size_t aligned_len = gap_len - (aligned_base - gap_base);
+    if (aligned_len < size) {
+        return false;
+    }
+    const size_t index = pick >> align_pow2;
+    if (index >= AllocationSpotsInRange(aligned_len, size, align_pow2)) {
+        return false;
+    }
+
+    *spot = aligned_base + (index << align_pow2);
+    return true;
+}
+
 // Perform allocations for VMARs that aren't using the COMPACT policy.  This
 // allocator works by choosing uniformly at random from the set of positions
 // that could satisfy the allocation.
@@ -844,42 +1067,54 @@ zx_status_t VmAddressRegion::NonCompactRandomizedRegionAllocatorLocked(size_t si
     align_pow2 = fbl::max(align_pow2, static_cast<uint8_t>(PAGE_SIZE_SHIFT));
     const vaddr_t align = 1UL << align_pow2;
 
-    // Calculate the number of spaces that we can fit this allocation in.
-    size_t candidate_spaces = 0;
-    ForEachGap([align, align_pow2, size, &candidate_spaces](vaddr_t gap_base, size_t gap_len) -> bool {
-        DEBUG_ASSERT(IS_ALIGNED(gap_base, align));
-        if (gap_len >= size) {
-            candidate_spaces += AllocationSpotsInRange(gap_len, size, align_pow2);
+    // Usually the gaps are much larger than the allocation, and a few random
+    // draws find a spot.  Each one that does is uniformly chosen, so if they
+    // all miss, falling back to choosing among all the spots keeps it that way.
+    vaddr_t alloc_spot = static_cast<vaddr_t>(-1);
+    for (int i = 0; i < kRandomSpotSamples; i++) {
+        if (SampleRandomSpotLocked(size, align_pow2, &alloc_spot)) {
+            break;
         }
-        return true;
-    },
-               align_pow2);
-
-    if (candidate_spaces == 0) {
-        return ZX_ERR_NO_MEMORY;
     }
 
-    // Choose the index of the allocation to use.
-    size_t selected_index = aspace_->AslrPrng().RandInt(candidate_spaces);
-    DEBUG_ASSERT(selected_index < candidate_spaces);
-
-    // Find which allocation we picked.
-    vaddr_t alloc_spot = static_cast<vaddr_t>(-1);
-    ForEachGap([align_pow2, size, &alloc_spot, &selected_index](vaddr_t gap_base,
+    if (alloc_spot == static_cast<vaddr_t>(-1)) {
+        // Calculate the number of spaces that we can fit this allocation in.
+        size_t candidate_spaces = 0;
+        ForEachGap([align, align_pow2, size, &candidate_spaces](vaddr_t gap_base,
                                                                 size_t gap_len) -> bool {
-        if (gap_len < size) {
+            DEBUG_ASSERT(IS_ALIGNED(gap_base, align));
+            if (gap_len >= size) {
+                candidate_spaces += AllocationSpotsInRange(gap_len, size, align_pow2);
+            }
             return true;
-        }
+        },
+                   align_pow2, size);
 
-        const size_t spots = AllocationSpotsInRange(gap_len, size, align_pow2);
-        if (selected_index < spots) {
-            alloc_spot = gap_base + (selected_index << align_pow2);
-            return false;
+        if (candidate_spaces == 0) {
+            return ZX_ERR_NO_MEMORY;
         }
-        selected_index -= spots;
-        return true;
-    },
-               align_pow2);
+
+        // Choose the index of the allocation to use.
+        size_t selected_index = aspace_->AslrPrng().RandInt(candidate_spaces);
+        DEBUG_ASSERT(selected_index < candidate_spaces);
+
+        // Find which allocation we picked.
+        ForEachGap([align_pow2, size, &alloc_spot, &selected_index](vaddr_t gap_base,
+                                                                    size_t gap_len) -> bool {
+            if (gap_len < size) {
+                return true;
+            }
+
+            const size_t spots = AllocationSpotsInRange(gap_len, size, align_pow2);
+            if (selected_index < spots) {
+                alloc_spot = gap_base + (selected_index << align_pow2);
+                return false;
+            }
+            selected_index -= spots;
+            return true;
+        },
+                   align_pow2, size);
+    }
     ASSERT(alloc_spot != static_cast<vaddr_t>(-1));
     ASSERT(IS_ALIGNED(alloc_spot, align));
 
@@ -10,6 +10,7 @@
 #include <assert.h>
 #include <err.h>
 #include <fbl/auto_call.h>
+#include <fbl/algorithm.h>
 #include <fbl/auto_lock.h>
 #include <inttypes.h>
 #include <string.h>
@@ -86,6 +87,45 @@ bool VmAddressRegionOrMapping::is_valid_mapping_flags(uint arch_mmu_flags) {
     return true;
 }
 
+void VmAddressRegionOrMapping::UpdateSubtree() {
+    using PtrTraits = fbl::internal::ContainerPtrTraits<fbl::RefPtr<VmAddressRegionOrMapping>>;
+
+    subtree_first_ = base_;
+    subtree_last_ = base_ + size_ - 1;
+    subtree_max_gap_ = 0;
+    subtree_gap_bytes_ = 0;
+    subtree_gaps_ = 0;
+
+    auto add_child = [this](const VmAddressRegionOrMapping& child) {
+        subtree_max_gap_ = fbl::max(subtree_max_gap_, child.subtree_max_gap_);
+        subtree_gap_bytes_ += child.subtree_gap_bytes_;
+        subtree_gaps_ += child.subtree_gaps_;
+    };
+    auto add_gap = [this](size_t gap) {
+        if (gap == 0) {
+            return;
+        }
+        subtree_max_gap_ = fbl::max(subtree_max_gap_, gap);
+        subtree_gap_bytes_ += gap;
+        subtree_gaps_++;
+    };
+
+    // Our children are in the parent's list, so they sort before and after us.
+    const auto& node = subregion_list_node_;
+    if (PtrTraits::IsValid(node.left_)) {
+        const VmAddressRegionOrMapping& left = *node.left_;
+        add_child(left);
+        add_gap(base_ - left.subtree_last_ - 1);
+        subtree_first_ = left.subtree_first_;
+    }
+    if (PtrTraits::IsValid(node.right_)) {
+        const VmAddressRegionOrMapping& right = *node.right_;
+        add_child(right);
+        add_gap(right.subtree_first_ - (base_ + size_));
+        subtree_last_ = right.subtree_last_;
+    }
+}
+
 size_t VmAddressRegionOrMapping::AllocatedPages() const {
     AutoLock guard(aspace_->lock());
     if (state_ != LifeCycleState::ALIVE) {
@@ -551,6 +551,58 @@ zx_status_t VmAspace::PageFault(vaddr_t va, uint flags) {
     return root_vmar_->PageFault(va, flags);
 }
 
+zx_status_t VmAspace::FindUserRange(vaddr_t va, size_t len, uint arch_mmu_flags,
+                                    fbl::RefPtr<VmObject>* vmo, uint64_t* offset) {
+    canary_.Assert();
+
+    if (!is_user() || len == 0 || !IS_PAGE_ALIGNED(va) || !IS_PAGE_ALIGNED(len))
+        return ZX_ERR_INVALID_ARGS;
+
+    AutoLock a(&lock_);
+
+    if (aspace_destroyed_)
+        return ZX_ERR_BAD_STATE;
+
+    fbl::RefPtr<VmMapping> mapping;
+    for (auto vmar = root_vmar_;
+         auto next = vmar->FindRegionLocked(va);
+         vmar = next->as_vm_address_region()) {
+        if (next->is_mapping()) {
+            mapping = next->as_vm_mapping();
+            break;
+        }
+    }
+    if (!mapping || len > mapping->size() - (va - mapping->base()))
+        return ZX_ERR_NOT_FOUND;
+    if ((mapping->arch_mmu_flags() & arch_mmu_flags) != arch_mmu_flags)
+        return ZX_ERR_ACCESS_DENIED;
+
+    *vmo = mapping->vmo();
+    *offset = mapping->object_offset() + (va - mapping->base());
+    return ZX_OK;
+}
+
+zx_status_t VmAspace::TakeUserPages(vaddr_t va, size_t len, list_node* pages) {
+    fbl::RefPtr<VmObject> vmo;
+    uint64_t offset;
+    zx_status_t status = FindUserRange(va, len, ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE,
+                                       &vmo, &offset);
+    if (status != ZX_OK)
+        return status;
+
+    return vmo->TakePages(offset, len, pages);
+}
+
+zx_status_t VmAspace::SupplyUserPages(vaddr_t va, size_t len, list_node* pages) {
+    fbl::RefPtr<VmObject> vmo;
+    uint64_t offset;
+    zx_status_t status = FindUserRange(va, len, ARCH_MMU_FLAG_PERM_WRITE, &vmo, &offset);
+    if (status != ZX_OK)
+        return status;
+
+    return vmo->SupplyPages(offset, len, pages);
+}
+
 void VmAspace::Dump(bool verbose) const {
     canary_.Assert();
     printf("as %p [%#" PRIxPTR " %#" PRIxPTR "] sz %#zx fl %#x ref %d '%s'\n", this,
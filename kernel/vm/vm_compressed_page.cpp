@@ -0,0 +1,80 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <vm/vm_compressed_page.h>
+
+#include <assert.h>
+#include <fbl/alloc_checker.h>
+#include <fbl/auto_lock.h>
+#include <fbl/mutex.h>
+#include <lib/counters.h>
+#include <lz4/lz4.h>
+#include <string.h>
+#include <vm/physmap.h>
+#include <zircon/types.h>
+
+KCOUNTER(compressed_pages, "kernel.vm.compress.compressed_pages");
+KCOUNTER(compressed_bytes, "kernel.vm.compress.compressed_bytes");
+KCOUNTER(rejected_pages, "kernel.vm.compress.rejected");
+KCOUNTER(decompressed_pages, "kernel.vm.compress.decompressed_pages");
+KCOUNTER(freed_pages, "kernel.vm.compress.freed_pages");
+KCOUNTER(freed_bytes, "kernel.vm.compress.freed_bytes");
+
+namespace {
+
+// The LZ4 hash table is too big for a kernel stack, so compression shares one,
+// along with a buffer big enough for any page we keep.
+fbl::Mutex compress_lock;
+LZ4_stream_t compress_state TA_GUARDED(compress_lock);
+char compress_buffer[VmCompressedPage::kMaxSize] TA_GUARDED(compress_lock);
+
+} // namespace
+
+fbl::unique_ptr<VmCompressedPage> VmCompressedPage::Create(uint64_t offset, paddr_t pa) {
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(offset));
+
+    fbl::AutoLock lock(&compress_lock);
+
+    const char* src = static_cast<const char*>(paddr_to_physmap(pa));
+    int size = LZ4_compress_fast_extState(&compress_state, src, compress_buffer, PAGE_SIZE,
+                                          sizeof(compress_buffer), 1);
+    if (size <= 0) {
+        kcounter_add(rejected_pages, 1);
+        return nullptr;
+    }
+
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<uint8_t[]> data(new (&ac) uint8_t[size]);
+    if (!ac.check())
+        return nullptr;
+    memcpy(data.get(), compress_buffer, size);
+
+    fbl::unique_ptr<VmCompressedPage> page(
+        new (&ac) VmCompressedPage(offset, fbl::move(data), size));
+    if (!ac.check())
+        return nullptr;
+
+    kcounter_add(compressed_pages, 1);
+    kcounter_add(compressed_bytes, size);
+    return page;
+}
+
+VmCompressedPage::VmCompressedPage(uint64_t offset, fbl::unique_ptr<uint8_t[]> data, size_t size)
+    : offset_(offset), data_(fbl::move(data)), size_(size) {}
+
+VmCompressedPage::~VmCompressedPage() {
+    kcounter_add(freed_pages, 1);
+    kcounter_add(freed_bytes, size_);
+}
+
+void VmCompressedPage::Decompress(paddr_t pa) const {
+    char* dst = static_cast<char*>(paddr_to_physmap(pa));
+    __UNUSED int size = LZ4_decompress_safe(reinterpret_cast<const char*>(data_.get()), dst,
+                                            static_cast<int>(size_), PAGE_SIZE);
+    DEBUG_ASSERT(size == PAGE_SIZE);
+
+    kcounter_add(decompressed_pages, 1);
+}
@@ -9,10 +9,12 @@
 #include "vm_priv.h"
 #include <assert.h>
 #include <err.h>
+#include <fbl/algorithm.h>
 #include <fbl/alloc_checker.h>
 #include <fbl/auto_call.h>
 #include <fbl/auto_lock.h>
 #include <inttypes.h>
+#include <lib/counters.h>
 #include <trace.h>
 #include <vm/fault.h>
 #include <vm/vm.h>
@@ -161,6 +163,7 @@ zx_status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mm
         arch_mmu_flags_ = new_arch_mmu_flags;
 
         size_ = size;
+        parent_->SubregionResized(this);
         mapping->ActivateLocked();
         return ZX_OK;
     }
@@ -182,6 +185,7 @@ zx_status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mm
         LTRACEF("arch_mmu_protect returns %d\n", status);
 
         size_ -= size;
+        parent_->SubregionResized(this);
         mapping->ActivateLocked();
         return ZX_OK;
     }
@@ -211,6 +215,7 @@ zx_status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mm
 
     // Turn us into the left half
     size_ = left_size;
+    parent_->SubregionResized(this);
 
     center_mapping->ActivateLocked();
     right_mapping->ActivateLocked();
@@ -286,6 +291,10 @@ zx_status_t VmMapping::UnmapLocked(vaddr_t base, size_t size) {
             parent_->subregions_.insert(fbl::move(ref));
         }
         size_ -= size;
+        // If nothing is left, we are about to be removed from the parent's list.
+        if (size_ != 0) {
+            parent_->SubregionResized(this);
+        }
 
         return ZX_OK;
     }
@@ -314,6 +323,7 @@ zx_status_t VmMapping::UnmapLocked(vaddr_t base, size_t size) {
 
     // Turn us into the left half
     size_ = base - base_;
+    parent_->SubregionResized(this);
     mapping->ActivateLocked();
     return ZX_OK;
 }
@@ -344,8 +354,9 @@ zx_status_t VmMapping::UnmapVmoRangeLocked(uint64_t offset, uint64_t len) const
     // back to us, detect the recursion and abort here.
     // The specific path we're avoiding is if the VMO calls back into us during vmo->GetPageLocked()
     // via UnmapVmoRangeLocked(). If we set this flag we're short circuiting the unmap operation
-    // so that we don't do extra work.
-    if (likely(currently_faulting_)) {
+    // so that we don't do extra work. A fault that commits a whole large page still has to
+    // unmap the zero page from the rest of it.
+    if (likely(currently_faulting_) && len <= PAGE_SIZE) {
         LTRACEF("recursing to ourself, abort\n");
         return ZX_OK;
     }
@@ -595,6 +606,118 @@ zx_status_t VmMapping::DestroyLocked() {
     return ZX_OK;
 }
 
+KCOUNTER(vm_fault_around_faults, "kernel.vm.fault_around.faults");
+KCOUNTER(vm_fault_around_pages, "kernel.vm.fault_around.pages");
+KCOUNTER(vm_large_page_mappings, "kernel.vm.large_page.mappings");
+
+bool VmMapping::MapLargePageLocked(vaddr_t va, uint64_t vmo_offset) TA_NO_THREAD_SAFETY_ANALYSIS {
+    DEBUG_ASSERT(object_->lock()->IsHeld());
+
+    // the mapping must cover the whole large page, at an aligned address
+    const vaddr_t large_va = ROUNDDOWN(va, VM_LARGE_PAGE_SIZE);
+    const uint64_t large_offset = vmo_offset - (va - large_va);
+    if (large_va < base_ || large_va + VM_LARGE_PAGE_SIZE - 1 > base_ + size_ - 1 ||
+        !IS_ALIGNED(large_offset, VM_LARGE_PAGE_SIZE)) {
+        return false;
+    }
+
+    paddr_t pa;
+    if (!object_->IsLargePageLocked(large_offset, &pa))
+        return false;
+
+    // leave racing faults and permission changes to the regular path
+    uint page_flags;
+    if (aspace_->arch_aspace().Query(va, nullptr, &page_flags) == ZX_OK)
+        return false;
+
+    // the pages belong to the object itself, so they can be writable even on a read fault
+    const size_t count = VM_LARGE_PAGE_SIZE / PAGE_SIZE;
+    size_t mapped;
+    zx_status_t status = aspace_->arch_aspace().MapContiguous(large_va, pa, count,
+                                                              arch_mmu_flags_, &mapped);
+    if (status != ZX_OK) {
+        LTRACEF("failed to map large page at va %#" PRIxPTR ": %d\n", large_va, status);
+        return false;
+    }
+    DEBUG_ASSERT(mapped == count);
+
+    kcounter_add(vm_large_page_mappings, 1u);
+    return true;
+}
+
+void VmMapping::FaultAroundLocked(vaddr_t va) TA_NO_THREAD_SAFETY_ANALYSIS {
+    DEBUG_ASSERT(object_->lock()->IsHeld());
+
+    if (!object_->is_paged())
+        return;
+    const size_t window = object_->fault_around_pages();
+    if (window <= 1)
+        return;
+
+    // the window is aligned to its size within the mapping
+    const size_t index = (va - base_) / PAGE_SIZE;
+    const vaddr_t start = base_ + (index - index % window) * PAGE_SIZE;
+    const vaddr_t end = fbl::min(start + window * PAGE_SIZE, base_ + size_);
+
+    paddr_t pas[VmObject::kFaultAroundMaxPages];
+    size_t run = 0;
+    vaddr_t run_va = 0;
+    uint run_flags = 0;
+    size_t total = 0;
+
+    // map the pages collected so far with one arch call
+    auto map_run = [&]() {
+        if (run == 0)
+            return;
+        size_t mapped = 0;
+        if (aspace_->arch_aspace().Map(run_va, pas, run, run_flags, &mapped) == ZX_OK) {
+            total += mapped;
+#if ARCH_ARM64
+            if (run_flags & ARCH_MMU_FLAG_PERM_EXECUTE)
+                arch_sync_cache_range(run_va, mapped * PAGE_SIZE);
+#endif
+        }
+        run = 0;
+    };
+
+    for (vaddr_t addr = start; addr < end; addr += PAGE_SIZE) {
+        uint64_t vmo_offset = addr - base_ + object_offset_;
+        vm_page_t* page;
+        paddr_t pa;
+        uint page_flags;
+        // only pages that are committed already, without faulting new ones in or
+        // bringing back compressed ones, and only where nothing is mapped, which
+        // includes |va| itself. pages the page scanner has aged are left to fault on
+        // their next access, which is how it learns they are in use.
+        if (addr == va ||
+            object_->GetPageLocked(vmo_offset, 0, nullptr, &page, &pa) != ZX_OK ||
+            page->object.age != 0 ||
+            aspace_->arch_aspace().Query(addr, nullptr, &page_flags) == ZX_OK) {
+            map_run();
+            continue;
+        }
+
+        // pages shared with a parent must fault on write to be copied
+        uint mmu_flags = arch_mmu_flags_;
+        if (!object_->HasOwnPageLocked(vmo_offset))
+            mmu_flags &= ~ARCH_MMU_FLAG_PERM_WRITE;
+
+        if (run > 0 && mmu_flags != run_flags)
+            map_run();
+        if (run == 0) {
+            run_va = addr;
+            run_flags = mmu_flags;
+        }
+        pas[run++] = pa;
+    }
+    map_run();
+
+    if (total > 0) {
+        kcounter_add(vm_fault_around_faults, 1u);
+        kcounter_add(vm_fault_around_pages, total);
+    }
+}
+
 zx_status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
     canary_.Assert();
     DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
@@ -652,6 +775,10 @@ zx_status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
         return status;
     }
 
+    // map the whole large page around the address if the object has one there
+    if (VM_LARGE_PAGES && !(pf_flags & VMM_PF_FLAG_GUEST) && MapLargePageLocked(va, vmo_offset))
+        return ZX_OK;
+
     // if we read faulted, make sure we map or modify the page without any write permissions
     // this ensures we will fault again if a write is attempted so we can potentially
     // replace this page with a copy or a new one
@@ -726,6 +853,9 @@ zx_status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
             return ZX_ERR_NO_MEMORY;
         }
         DEBUG_ASSERT(mapped == 1);
+
+        if (!(pf_flags & VMM_PF_FLAG_GUEST))
+            FaultAroundLocked(va);
     }
 
 // TODO: figure out what to do with this
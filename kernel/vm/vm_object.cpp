@@ -10,17 +10,22 @@
 
 #include <assert.h>
 #include <err.h>
+#include <fbl/algorithm.h>
 #include <fbl/auto_lock.h>
 #include <fbl/mutex.h>
 #include <fbl/ref_ptr.h>
 #include <inttypes.h>
+#include <kernel/cmdline.h>
 #include <lib/console.h>
+#include <lib/lockstat.h>
+#include <lk/init.h>
 #include <stdlib.h>
 #include <string.h>
 #include <trace.h>
 
 #include <vm/vm.h>
 #include <vm/vm_address_region.h>
+#include <vm/vm_aspace.h>
 
 #include <zircon/types.h>
 
@@ -29,13 +34,29 @@ using fbl::AutoLock;
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
 
 fbl::Mutex VmObject::all_vmos_lock_ = {};
+
+static uint32_t fault_around_default_pages = 16;
+
+static void fault_around_init(uint level) {
+    fault_around_default_pages = fbl::min(
+        cmdline_get_uint32("kernel.vm.fault-around-pages", fault_around_default_pages),
+        VmObject::kFaultAroundMaxPages);
+}
+
+LK_INIT_HOOK(vm_fault_around, &fault_around_init, LK_INIT_LEVEL_VM);
 VmObject::GlobalList VmObject::all_vmos_ = {};
 
+fbl::Mutex VmObject::page_scan_lock_ = {};
+fbl::RefPtr<VmObject> VmObject::page_scan_cursor_;
+uint64_t VmObject::page_scan_offset_ = 0;
+
 VmObject::VmObject(fbl::RefPtr<VmObject> parent)
     : lock_(parent ? parent->lock_ref() : local_lock_),
       parent_(fbl::move(parent)) {
     LTRACEF("%p\n", this);
 
+    LOCK_CLASS_MUTEX(local_lock_.GetInternal(), "vm.vmo_lock");
+
     // Add ourself to the global VMO list, newer VMOs at the end.
     {
         AutoLock a(&all_vmos_lock_);
@@ -132,12 +153,58 @@ void VmObject::RemoveMappingLocked(VmMapping* r) {
     mapping_list_len_--;
 }
 
+uint32_t VmObject::fault_around_pages() const {
+    uint32_t pages = fault_around_pages_;
+    return pages == kFaultAroundDefault ? fault_around_default_pages : pages;
+}
+
+zx_status_t VmObject::set_fault_around_pages(uint32_t pages) {
+    if (pages > kFaultAroundMaxPages && pages != kFaultAroundDefault)
+        return ZX_ERR_OUT_OF_RANGE;
+    fault_around_pages_ = pages;
+    return ZX_OK;
+}
+
 uint32_t VmObject::num_mappings() const {
     canary_.Assert();
     AutoLock a(&lock_);
     return mapping_list_len_;
 }
 
+void VmObject::ScanAllPages(ScanAction action, size_t max_pages, ScanStats* stats,
+                            bool* wrapped) {
+    AutoLock scan_lock(&page_scan_lock_);
+
+    const size_t end = stats->scanned + max_pages;
+    *wrapped = false;
+    while (stats->scanned < end) {
+        if (page_scan_cursor_ && page_scan_offset_ != UINT64_MAX) {
+            page_scan_cursor_->ScanPages(action, &page_scan_offset_, end - stats->scanned,
+                                         stats);
+            continue;
+        }
+
+        // move on to the next VMO, skipping the ones that are being destroyed
+        fbl::RefPtr<VmObject> next;
+        {
+            AutoLock a(&all_vmos_lock_);
+            auto iter = page_scan_cursor_ ? ++all_vmos_.make_iterator(*page_scan_cursor_)
+                                          : all_vmos_.begin();
+            for (; iter.IsValid() && !next; ++iter) {
+                next = fbl::internal::MakeRefPtrUpgradeFromRaw(&*iter, all_vmos_lock_);
+            }
+        }
+
+        // the old cursor may hold the last reference, so drop it without all_vmos_lock_
+        page_scan_cursor_ = fbl::move(next);
+        page_scan_offset_ = 0;
+        if (!page_scan_cursor_) {
+            *wrapped = true;
+            break;
+        }
+    }
+}
+
 bool VmObject::IsMappedByUser() const {
     canary_.Assert();
     AutoLock a(&lock_);
@@ -239,8 +306,13 @@ void VmObject::RangeChangeUpdateLocked(uint64_t offset, uint64_t len) {
     const uint64_t aligned_offset = ROUNDDOWN(offset, PAGE_SIZE);
     const uint64_t aligned_len = ROUNDUP(offset + len, PAGE_SIZE) - aligned_offset;
 
+    // Mappings in the same aspace share one shootdown, which the batch issues
+    // before we return and the caller can free the pages.
+    ArchVmAspaceBatch batch;
+
     // other mappings may have covered this offset into the vmo, so unmap those ranges
     for (auto& m : mapping_list_) {
+        batch.Add(&m.aspace()->arch_aspace());
         m.UnmapVmoRangeLocked(aligned_offset, aligned_len);
     }
 
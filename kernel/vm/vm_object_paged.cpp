@@ -13,8 +13,12 @@
 #include <err.h>
 #include <fbl/alloc_checker.h>
 #include <fbl/auto_lock.h>
+#include <fbl/vector.h>
 #include <inttypes.h>
+#include <kernel/cmdline.h>
 #include <lib/console.h>
+#include <lib/counters.h>
+#include <lk/init.h>
 #include <stdlib.h>
 #include <string.h>
 #include <trace.h>
@@ -28,8 +32,28 @@ using fbl::AutoLock;
 
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
 
+KCOUNTER(vm_large_page_commits, "kernel.vm.large_page.commits");
+KCOUNTER(vm_large_page_commit_failures, "kernel.vm.large_page.commit_failures");
+KCOUNTER(vm_page_age_aged, "kernel.vm.page_age.aged");
+KCOUNTER(vm_page_age_refaults, "kernel.vm.page_age.refaults");
+
+// VMOs with the default large page policy use large pages if they are at least
+// this big, 0 if never.
+static uint64_t large_page_min_bytes = 64 * MB;
+
+static void large_page_init(uint level) {
+    large_page_min_bytes =
+        cmdline_get_uint64("kernel.vm.large-pages-min-mb", large_page_min_bytes / MB) * MB;
+}
+
+LK_INIT_HOOK(vm_large_pages, &large_page_init, LK_INIT_LEVEL_VM);
+
 namespace {
 
+// vm_page::object.age of pages that did not compress, so that the page scanner does
+// not try them again until they are faulted on
+constexpr uint8_t kIncompressibleAge = UINT8_MAX;
+
 void ZeroPage(paddr_t pa) {
     void* ptr = paddr_to_physmap(pa);
     DEBUG_ASSERT(ptr);
@@ -42,11 +66,22 @@ void ZeroPage(vm_page_t* p) {
     ZeroPage(pa);
 }
 
+bool IsZeroPage(vm_page_t* p) {
+    auto base = static_cast<const uint64_t*>(paddr_to_physmap(vm_page_to_paddr(p)));
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+        if (base[i] != 0)
+            return false;
+    }
+    return true;
+}
+
 void InitializeVmPage(vm_page_t* p) {
     DEBUG_ASSERT(p->state == VM_PAGE_STATE_ALLOC);
     p->state = VM_PAGE_STATE_OBJECT;
     p->object.pin_count = 0;
     p->object.contiguous_pin = 0;
+    p->object.committed = 0;
+    p->object.age = 0;
 }
 
 // round up the size to the next page size boundary and make sure we dont wrap
@@ -132,6 +167,13 @@ zx_status_t VmObjectPaged::CloneCOW(uint64_t offset, uint64_t size, bool copy_na
         return ZX_ERR_BAD_STATE;
     }
 
+    // the clone looks for our pages without faulting them in, which leaves compressed
+    // pages compressed, so bring them all back. the page scanner leaves us alone from
+    // now on.
+    status = DecompressPagesLocked(0, size_);
+    if (status != ZX_OK)
+        return status;
+
     // set the offset with the parent
     status = vmo->SetParentOffsetLocked(offset);
     if (status != ZX_OK)
@@ -163,8 +205,8 @@ void VmObjectPaged::Dump(uint depth, bool verbose) {
         printf("  ");
     }
     printf("vmo %p/k%" PRIu64 " size %#" PRIx64
-           " pages %zu ref %d parent k%" PRIu64 "\n",
-           this, user_id_, size_, count, ref_count_debug(), parent_id);
+           " pages %zu compressed %zu ref %d parent k%" PRIu64 "\n",
+           this, user_id_, size_, count, compressed_pages_.size(), ref_count_debug(), parent_id);
 
     if (verbose) {
         auto f = [depth](const auto p, uint64_t offset) {
@@ -255,7 +297,9 @@ zx_status_t VmObjectPaged::CreateFromROData(const void* data, size_t size, fbl::
 
             if (page->state == VM_PAGE_STATE_WIRED) {
                 // it's wired to the kernel, so we can just use it directly
-            } else if (page->state == VM_PAGE_STATE_FREE) {
+            } else if (page->state == VM_PAGE_STATE_FREE ||
+                       page->state == VM_PAGE_STATE_CACHED) {
+                // pmm_alloc_range() drains the page caches first
                 ASSERT(pmm_alloc_range(pa, 1, nullptr) == 1);
                 page->state = VM_PAGE_STATE_WIRED;
             } else {
@@ -295,6 +339,12 @@ zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_no
     // see if we already have a page at that offset
     p = page_list_.GetPage(offset);
     if (p) {
+        // a fault means the page is in use, so the page scanner should leave it be
+        if ((pf_flags & VMM_PF_FLAG_FAULT_MASK) && p->object.age != 0) {
+            if (p->object.age != kIncompressibleAge)
+                kcounter_add(vm_page_age_refaults, 1u);
+            p->object.age = 0;
+        }
         if (page_out)
             *page_out = p;
         if (pa_out)
@@ -306,6 +356,40 @@ zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_no
     LTRACEF("vmo %p, offset %#" PRIx64 ", pf_flags %#x (%s)\n", this, offset, pf_flags,
             vmm_pf_flags_to_string(pf_flags, pf_string));
 
+    // bring back a page the page scanner compressed, but only for a fault, so that
+    // looking around for pages that are already there leaves it compressed
+    auto compressed = compressed_pages_.find(offset);
+    if (compressed.IsValid()) {
+        if ((pf_flags & VMM_PF_FLAG_FAULT_MASK) == 0)
+            return ZX_ERR_NOT_FOUND;
+
+        p = nullptr;
+        if (free_list) {
+            p = list_remove_head_type(free_list, vm_page_t, free.node);
+            if (p)
+                pa = vm_page_to_paddr(p);
+        }
+        if (!p)
+            p = pmm_alloc_page(pmm_alloc_flags_, &pa);
+        if (!p)
+            return ZX_ERR_NO_MEMORY;
+
+        compressed->Decompress(pa);
+        compressed_pages_.erase(compressed);
+
+        InitializeVmPage(p);
+        zx_status_t status = AddPageLocked(p, offset);
+        DEBUG_ASSERT(status == ZX_OK);
+
+        LTRACEF("decompressed page %p, pa %#" PRIxPTR "\n", p, pa);
+
+        if (page_out)
+            *page_out = p;
+        if (pa_out)
+            *pa_out = pa;
+        return ZX_OK;
+    }
+
     // if we have a parent see if they have a page for us
     if (parent_) {
         uint64_t parent_offset;
@@ -388,15 +472,29 @@ zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_no
         return ZX_OK;
     }
 
-    // allocate a page
+    // commit the whole large page around the offset if we can, unless the caller
+    // has allocated pages for us
+    if (!free_list && UseLargePagesLocked() &&
+        CommitLargePageLocked(ROUNDDOWN(offset, VM_LARGE_PAGE_SIZE)) == ZX_OK) {
+        p = page_list_.GetPage(offset);
+        DEBUG_ASSERT(p);
+        if (page_out)
+            *page_out = p;
+        if (pa_out)
+            *pa_out = vm_page_to_paddr(p);
+        return ZX_OK;
+    }
+
+    // allocate a page, pages from the caller still need to be zeroed
     if (free_list) {
         p = list_remove_head_type(free_list, vm_page_t, free.node);
         if (p) {
             pa = vm_page_to_paddr(p);
+            ZeroPage(pa);
         }
     }
     if (!p) {
-        p = pmm_alloc_page(pmm_alloc_flags_, &pa);
+        p = pmm_alloc_zeroed_page(pmm_alloc_flags_, &pa);
     }
     if (!p) {
         return ZX_ERR_NO_MEMORY;
@@ -404,9 +502,6 @@ zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_no
 
     InitializeVmPage(p);
 
-    // TODO: remove once pmm returns zeroed pages
-    ZeroPage(pa);
-
     // if ARM and not fully cached, clean/invalidate the page after zeroing it
 #if ARCH_ARM64
     if (cache_policy_ != ARCH_MMU_FLAG_CACHED) {
@@ -453,6 +548,45 @@ zx_status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t*
     DEBUG_ASSERT(end > offset);
     offset = ROUNDDOWN(offset, PAGE_SIZE);
 
+    // commit the large pages that the range covers entirely first, remembering them so
+    // that they can be given back if the rest of the range can't be committed. once one
+    // can't be allocated, the pmm has already drained its caches looking for it and is
+    // unlikely to find another, so the rest of the range gets small pages.
+    const uint64_t large_start = ROUNDUP(offset, VM_LARGE_PAGE_SIZE);
+    fbl::Vector<uint64_t> large_pages;
+    if (UseLargePagesLocked() && large_start + VM_LARGE_PAGE_SIZE <= end) {
+        fbl::AllocChecker ac;
+        large_pages.reserve((end - large_start) / VM_LARGE_PAGE_SIZE, &ac);
+        if (ac.check()) {
+            for (uint64_t o = large_start; o + VM_LARGE_PAGE_SIZE <= end;
+                 o += VM_LARGE_PAGE_SIZE) {
+                zx_status_t status = CommitLargePageLocked(o);
+                if (status == ZX_ERR_NO_MEMORY)
+                    break;
+                if (status == ZX_OK) {
+                    // there is room for it already
+                    large_pages.push_back(o, &ac);
+                    __UNUSED bool reserved = ac.check();
+                    DEBUG_ASSERT(reserved);
+                }
+            }
+        }
+    }
+    const uint64_t large_committed = large_pages.size() * VM_LARGE_PAGE_SIZE;
+    if (committed)
+        *committed = large_committed;
+
+    // whoever commits pages expects them to stay, so keep the zero page scanner
+    // from freeing them
+    auto mark_committed = [this, offset, end]() TA_NO_THREAD_SAFETY_ANALYSIS {
+        page_list_.ForEveryPageInRange(
+            [](const auto p, uint64_t off) {
+                p->object.committed = true;
+                return ZX_ERR_NEXT;
+            },
+            offset, end);
+    };
+
     // make a pass through the list, counting the number of pages we need to allocate
     size_t count = 0;
     uint64_t expected_next_off = offset;
@@ -469,8 +603,10 @@ zx_status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t*
     // the end.  Add it back in
     DEBUG_ASSERT(end >= expected_next_off);
     count += (end - expected_next_off) / PAGE_SIZE;
-    if (count == 0)
+    if (count == 0) {
+        mark_committed();
         return ZX_OK;
+    }
 
     // allocate count number of pages
     list_node page_list;
@@ -480,6 +616,17 @@ zx_status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t*
     if (allocated < count) {
         LTRACEF("failed to allocate enough pages (asked for %zu, got %zu)\n", count, allocated);
         pmm_free(&page_list);
+
+        // don't leave the range partly committed by the large pages above
+        for (uint64_t o : large_pages) {
+            RangeChangeUpdateLocked(o, VM_LARGE_PAGE_SIZE);
+            for (uint64_t page = o; page < o + VM_LARGE_PAGE_SIZE; page += PAGE_SIZE) {
+                zx_status_t status = page_list_.FreePage(page);
+                DEBUG_ASSERT(status == ZX_OK);
+            }
+        }
+        if (committed)
+            *committed = 0;
         return ZX_ERR_NO_MEMORY;
     }
 
@@ -507,9 +654,10 @@ zx_status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t*
     }
 
     DEBUG_ASSERT(list_is_empty(&page_list));
+    mark_committed();
 
     // for now we only support committing as much as we were asked for
-    DEBUG_ASSERT(!committed || *committed == count * PAGE_SIZE);
+    DEBUG_ASSERT(!committed || *committed == large_committed + count * PAGE_SIZE);
 
     return ZX_OK;
 }
@@ -545,7 +693,7 @@ zx_status_t VmObjectPaged::CommitRangeContiguous(uint64_t offset, uint64_t len,
     // make a pass through the list, making sure we have an empty run on the object
     size_t count = 0;
     for (uint64_t o = offset; o < end; o += PAGE_SIZE) {
-        if (!page_list_.GetPage(o))
+        if (!page_list_.GetPage(o) && !compressed_pages_.find(o).IsValid())
             count++;
     }
 
@@ -636,6 +784,8 @@ zx_status_t VmObjectPaged::DecommitRange(uint64_t offset, uint64_t len, uint64_t
     // unmap all of the pages in this range on all the mapping regions
     RangeChangeUpdateLocked(start, page_aligned_len);
 
+    DiscardCompressedPagesLocked(start, end);
+
     // iterate through the pages, freeing them
     // TODO: use page_list iterator, move pages to list, free at once
     while (start < end) {
@@ -649,6 +799,90 @@ zx_status_t VmObjectPaged::DecommitRange(uint64_t offset, uint64_t len, uint64_t
     return ZX_OK;
 }
 
+zx_status_t VmObjectPaged::TakePages(uint64_t offset, uint64_t len, list_node* pages) {
+    canary_.Assert();
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(offset) && IS_PAGE_ALIGNED(len));
+    LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 "\n", offset, len);
+
+    AutoLock a(&lock_);
+
+    if (unlikely(!InRange(offset, len, size_)))
+        return ZX_ERR_OUT_OF_RANGE;
+
+    // A clone's pages may be its parent's, and a child sees this object's pages
+    // through the ones it lacks, so neither can give pages away. Neither can an
+    // object that userspace knows the physical pages of.
+    if (parent_ || children_list_len_ > 0 || user_lookup_done_ ||
+        cache_policy_ != ARCH_MMU_FLAG_CACHED)
+        return ZX_ERR_BAD_STATE;
+
+    const uint64_t end = offset + len;
+    for (uint64_t o = offset; o < end; o += PAGE_SIZE) {
+        vm_page_t* p = page_list_.GetPage(o);
+        if (!p || p->object.pin_count > 0)
+            return ZX_ERR_BAD_STATE;
+    }
+
+    // unmap all of the pages in this range on all the mapping regions
+    RangeChangeUpdateLocked(offset, len);
+
+    for (uint64_t o = offset; o < end; o += PAGE_SIZE) {
+        vm_page_t* p = page_list_.TakePage(o);
+        DEBUG_ASSERT(p && p->state == VM_PAGE_STATE_OBJECT);
+        p->state = VM_PAGE_STATE_ALLOC;
+        list_add_tail(pages, &p->free.node);
+    }
+
+    return ZX_OK;
+}
+
+zx_status_t VmObjectPaged::SupplyPages(uint64_t offset, uint64_t len, list_node* pages) {
+    canary_.Assert();
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(offset) && IS_PAGE_ALIGNED(len));
+    LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 "\n", offset, len);
+
+    AutoLock a(&lock_);
+
+    if (unlikely(!InRange(offset, len, size_)))
+        return ZX_ERR_OUT_OF_RANGE;
+
+    // Replacing pages is the same as writing them, which a clone does to its own
+    // copies and a child sees, but the pages have to be free to go.
+    if (user_lookup_done_ || cache_policy_ != ARCH_MMU_FLAG_CACHED ||
+        AnyPagesPinnedLocked(offset, len))
+        return ZX_ERR_BAD_STATE;
+
+    // unmap all of the pages in this range on all the mapping regions
+    RangeChangeUpdateLocked(offset, len);
+
+    const uint64_t end = offset + len;
+    DiscardCompressedPagesLocked(offset, end);
+
+    list_node freed = LIST_INITIAL_VALUE(freed);
+    zx_status_t status = ZX_OK;
+    for (uint64_t o = offset; o < end; o += PAGE_SIZE) {
+        vm_page_t* old = page_list_.TakePage(o);
+        if (old)
+            list_add_tail(&freed, &old->free.node);
+
+        vm_page_t* p = list_remove_head_type(pages, vm_page_t, free.node);
+        DEBUG_ASSERT(p);
+        InitializeVmPage(p);
+        status = page_list_.AddPage(p, o);
+        if (status != ZX_OK) {
+            // only the page list's own nodes can fail to allocate
+            p->state = VM_PAGE_STATE_ALLOC;
+            list_add_head(pages, &p->free.node);
+            break;
+        }
+    }
+
+    if (!list_is_empty(&freed))
+        pmm_free(&freed);
+
+    return status;
+}
+
 zx_status_t VmObjectPaged::Pin(uint64_t offset, uint64_t len) {
     canary_.Assert();
 
@@ -669,8 +903,13 @@ zx_status_t VmObjectPaged::PinLocked(uint64_t offset, uint64_t len) {
     const uint64_t start_page_offset = ROUNDDOWN(offset, PAGE_SIZE);
     const uint64_t end_page_offset = ROUNDUP(offset + len, PAGE_SIZE);
 
+    // pages the page scanner compressed are still committed, bring them back first
+    zx_status_t status = DecompressPagesLocked(start_page_offset, end_page_offset);
+    if (status != ZX_OK)
+        return status;
+
     uint64_t expected_next_off = start_page_offset;
-    zx_status_t status = page_list_.ForEveryPageInRange(
+    status = page_list_.ForEveryPageInRange(
         [&expected_next_off](const auto p, uint64_t off) {
             if (off != expected_next_off) {
                 return ZX_ERR_NOT_FOUND;
@@ -789,6 +1028,8 @@ zx_status_t VmObjectPaged::ResizeLocked(uint64_t s) {
         // unmap all of the pages in this range on all the mapping regions
         RangeChangeUpdateLocked(start, len);
 
+        DiscardCompressedPagesLocked(start, end);
+
         // iterate through the pages, freeing them
         // TODO: use page_list iterator, move pages to list, free at once
         while (start < end) {
@@ -938,8 +1179,13 @@ zx_status_t VmObjectPaged::Lookup(uint64_t offset, uint64_t len, uint pf_flags,
     const uint64_t start_page_offset = ROUNDDOWN(offset, PAGE_SIZE);
     const uint64_t end_page_offset = ROUNDUP(offset + len, PAGE_SIZE);
 
+    // compressed pages are committed too, so look them up as real pages
+    zx_status_t status = DecompressPagesLocked(start_page_offset, end_page_offset);
+    if (status != ZX_OK)
+        return status;
+
     uint64_t expected_next_off = start_page_offset;
-    zx_status_t status = page_list_.ForEveryPageInRange(
+    status = page_list_.ForEveryPageInRange(
         [&expected_next_off, this, pf_flags, lookup_fn, context,
          start_page_offset](const auto p, uint64_t off) {
 
@@ -1036,10 +1282,180 @@ zx_status_t VmObjectPaged::LookupUser(uint64_t offset, uint64_t len, user_inout_
         user_inout_ptr<paddr_t>* buffer = static_cast<user_inout_ptr<paddr_t>*>(context);
         return buffer->element_offset(index).copy_to_user(pa);
     };
+    {
+        AutoLock a(&lock_);
+        user_lookup_done_ = true;
+    }
+
     // only lookup pages that are already present
     return Lookup(offset, len, 0, copy_to_user, &buffer);
 }
 
+void VmObjectPaged::ScanPages(ScanAction action, uint64_t* offset, size_t max_pages,
+                              ScanStats* stats) {
+    canary_.Assert();
+
+    // bounds how long the lock is held at a time
+    static constexpr size_t kMaxBatch = 64;
+    uint64_t offsets[kMaxBatch];
+    max_pages = MIN(max_pages, kMaxBatch);
+
+    AutoLock a(&lock_);
+
+    // Clones see their parent's pages through the ones they lack, and parents
+    // share theirs with clones, so leave both alone. Also skip uncached objects,
+    // objects mapped into the kernel, where faults are not allowed everywhere,
+    // and objects whose page addresses userspace knows about.
+    bool eligible = !parent_ && children_list_len_ == 0 &&
+                    cache_policy_ == ARCH_MMU_FLAG_CACHED && !user_lookup_done_ &&
+                    *offset < size_;
+    for (const auto& m : mapping_list_) {
+        eligible = eligible && m.aspace()->is_user();
+    }
+    if (!eligible) {
+        *offset = UINT64_MAX;
+        return;
+    }
+
+    // pages of a committed large page are skipped rather than breaking it up, so
+    // look each large page up once and restart the walk past it
+    size_t count = 0;
+    uint64_t next = *offset;
+    bool done = false;
+    while (!done) {
+        done = true;
+        uint64_t large_offset = UINT64_MAX;
+        bool large = false;
+        page_list_.ForEveryPageInRange(
+            [&](const auto p, uint64_t off) TA_NO_THREAD_SAFETY_ANALYSIS {
+                if (count == max_pages)
+                    return ZX_ERR_STOP;
+                if (ROUNDDOWN(off, VM_LARGE_PAGE_SIZE) != large_offset) {
+                    paddr_t pa;
+                    large_offset = ROUNDDOWN(off, VM_LARGE_PAGE_SIZE);
+                    large = IsLargePageLocked(large_offset, &pa);
+                }
+                if (large) {
+                    next = large_offset + VM_LARGE_PAGE_SIZE;
+                    done = false;
+                    return ZX_ERR_STOP;
+                }
+                offsets[count++] = off;
+                return ZX_ERR_NEXT;
+            },
+            next, size_);
+    }
+    *offset = (count == max_pages) ? offsets[count - 1] + PAGE_SIZE : UINT64_MAX;
+    stats->scanned += count;
+    if (count == 0)
+        return;
+
+    // unmaps the first |n| offsets, one run of consecutive pages at a time
+    auto unmap = [this, &offsets](size_t n) TA_NO_THREAD_SAFETY_ANALYSIS {
+        size_t run = 0;
+        for (size_t i = 1; i <= n; i++) {
+            if (i == n || offsets[i] != offsets[i - 1] + PAGE_SIZE) {
+                RangeChangeUpdateLocked(offsets[run],
+                                        offsets[i - 1] + PAGE_SIZE - offsets[run]);
+                run = i;
+            }
+        }
+    };
+
+    if (action == ScanAction::kReclaimZero) {
+        // unmap the zero pages, then look at them again, since they may have been
+        // written through a mapping in the meantime
+        size_t zero = 0;
+        for (size_t i = 0; i < count; i++) {
+            vm_page_t* p = page_list_.GetPage(offsets[i]);
+            DEBUG_ASSERT(p);
+            if (p->object.pin_count == 0 && !p->object.committed && IsZeroPage(p))
+                offsets[zero++] = offsets[i];
+        }
+        unmap(zero);
+
+        for (size_t i = 0; i < zero; i++) {
+            if (!IsZeroPage(page_list_.GetPage(offsets[i])))
+                continue;
+            page_list_.FreePage(offsets[i]);
+            stats->zero++;
+        }
+        return;
+    }
+
+    // aging relies on the next access to each page faulting, and compressed pages
+    // must not stay mapped, so unmap the whole batch first
+    unmap(count);
+
+    for (size_t i = 0; i < count; i++) {
+        vm_page_t* p = page_list_.GetPage(offsets[i]);
+        DEBUG_ASSERT(p);
+        if (p->object.pin_count > 0)
+            continue;
+
+        if (IsZeroPage(p)) {
+            page_list_.FreePage(offsets[i]);
+            stats->zero++;
+            continue;
+        }
+
+        if (p->object.age == kIncompressibleAge)
+            continue;
+        if (action == ScanAction::kAge) {
+            kcounter_add(vm_page_age_aged, 1u);
+            if (++p->object.age < kCompressAge)
+                continue;
+        }
+
+        size_t size = CompressPageLocked(offsets[i]);
+        if (size > 0) {
+            stats->compressed++;
+            stats->compressed_bytes += size;
+        } else {
+            p->object.age = kIncompressibleAge;
+        }
+    }
+}
+
+size_t VmObjectPaged::CompressPageLocked(uint64_t offset) {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    vm_page_t* p = page_list_.GetPage(offset);
+    DEBUG_ASSERT(p && p->object.pin_count == 0);
+
+    auto compressed = VmCompressedPage::Create(offset, vm_page_to_paddr(p));
+    if (!compressed)
+        return 0;
+
+    size_t size = compressed->size();
+    compressed_pages_.insert(fbl::move(compressed));
+    page_list_.FreePage(offset);
+    return size;
+}
+
+zx_status_t VmObjectPaged::DecompressPagesLocked(uint64_t start, uint64_t end) {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    for (auto iter = compressed_pages_.lower_bound(start);
+         iter.IsValid() && iter->offset() < end;
+         iter = compressed_pages_.lower_bound(start)) {
+        zx_status_t status = GetPageLocked(iter->offset(), VMM_PF_FLAG_SW_FAULT, nullptr,
+                                           nullptr, nullptr);
+        if (status != ZX_OK)
+            return status;
+    }
+    return ZX_OK;
+}
+
+void VmObjectPaged::DiscardCompressedPagesLocked(uint64_t start, uint64_t end) {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    auto iter = compressed_pages_.lower_bound(start);
+    while (iter.IsValid() && iter->offset() < end) {
+        compressed_pages_.erase(iter++);
+    }
+}
+
 zx_status_t VmObjectPaged::InvalidateCache(const uint64_t offset, const uint64_t len) {
     return CacheOp(offset, len, CacheOpType::Invalidate);
 }
@@ -1156,6 +1572,116 @@ zx_status_t VmObjectPaged::SetMappingCachePolicy(const uint32_t cache_policy) {
     return ZX_OK;
 }
 
+zx_status_t VmObjectPaged::GetLargePagePolicy(uint32_t* policy) {
+    AutoLock lock(&lock_);
+    *policy = large_page_policy_;
+    return ZX_OK;
+}
+
+zx_status_t VmObjectPaged::SetLargePagePolicy(uint32_t policy) {
+    if (policy != ZX_VMO_LARGE_PAGES_DEFAULT && policy != ZX_VMO_LARGE_PAGES_ALWAYS &&
+        policy != ZX_VMO_LARGE_PAGES_NEVER) {
+        return ZX_ERR_INVALID_ARGS;
+    }
+
+    AutoLock lock(&lock_);
+
+    // only applies to pages committed from now on
+    large_page_policy_ = policy;
+
+    return ZX_OK;
+}
+
+bool VmObjectPaged::UseLargePagesLocked() const {
+    if (!VM_LARGE_PAGES)
+        return false;
+
+    // clones share pages with their parent, and uncached memory is left alone
+    if (parent_ || cache_policy_ != ARCH_MMU_FLAG_CACHED)
+        return false;
+
+    switch (large_page_policy_) {
+    case ZX_VMO_LARGE_PAGES_ALWAYS:
+        return true;
+    case ZX_VMO_LARGE_PAGES_DEFAULT:
+        return large_page_min_bytes != 0 && size_ >= large_page_min_bytes;
+    default:
+        return false;
+    }
+}
+
+zx_status_t VmObjectPaged::CommitLargePageLocked(uint64_t offset) {
+    DEBUG_ASSERT(IS_ALIGNED(offset, VM_LARGE_PAGE_SIZE));
+
+    if (offset + VM_LARGE_PAGE_SIZE > size_)
+        return ZX_ERR_OUT_OF_RANGE;
+
+    // the large page must not have any pages yet, compressed ones included
+    bool empty = true;
+    page_list_.ForEveryPageInRange(
+        [&empty](const auto p, uint64_t off) {
+            empty = false;
+            return ZX_ERR_STOP;
+        },
+        offset, offset + VM_LARGE_PAGE_SIZE);
+    auto compressed = compressed_pages_.lower_bound(offset);
+    if (compressed.IsValid() && compressed->offset() < offset + VM_LARGE_PAGE_SIZE)
+        empty = false;
+    if (!empty)
+        return ZX_ERR_ALREADY_EXISTS;
+
+    const size_t count = VM_LARGE_PAGE_SIZE / PAGE_SIZE;
+    list_node pages = LIST_INITIAL_VALUE(pages);
+    paddr_t pa;
+    if (pmm_alloc_contiguous(count, pmm_alloc_flags_, VM_LARGE_PAGE_SIZE_SHIFT, &pa, &pages) !=
+        count) {
+        // physical memory is too fragmented, fall back to small pages
+        kcounter_add(vm_large_page_commit_failures, 1u);
+        return ZX_ERR_NO_MEMORY;
+    }
+
+    uint64_t o = offset;
+    vm_page_t* p;
+    while ((p = list_remove_head_type(&pages, vm_page_t, free.node)) != nullptr) {
+        InitializeVmPage(p);
+        ZeroPage(p);
+        zx_status_t status = AddPageLocked(p, o);
+        DEBUG_ASSERT(status == ZX_OK);
+        o += PAGE_SIZE;
+    }
+
+    // other mappings may have covered this range with the zero page, so unmap it
+    RangeChangeUpdateLocked(offset, VM_LARGE_PAGE_SIZE);
+
+    LTRACEF("committed large page at offset %#" PRIx64 ", pa %#" PRIxPTR "\n", offset, pa);
+    kcounter_add(vm_large_page_commits, 1u);
+
+    return ZX_OK;
+}
+
+bool VmObjectPaged::IsLargePageLocked(uint64_t offset, paddr_t* pa) {
+    DEBUG_ASSERT(IS_ALIGNED(offset, VM_LARGE_PAGE_SIZE));
+
+    if (!VM_LARGE_PAGES || offset + VM_LARGE_PAGE_SIZE > size_)
+        return false;
+
+    vm_page_t* p = page_list_.GetPage(offset);
+    if (!p)
+        return false;
+    paddr_t base = vm_page_to_paddr(p);
+    if (!IS_ALIGNED(base, VM_LARGE_PAGE_SIZE))
+        return false;
+
+    for (size_t i = 1; i < VM_LARGE_PAGE_SIZE / PAGE_SIZE; i++) {
+        p = page_list_.GetPage(offset + i * PAGE_SIZE);
+        if (!p || vm_page_to_paddr(p) != base + i * PAGE_SIZE)
+            return false;
+    }
+
+    *pa = base;
+    return true;
+}
+
 void VmObjectPaged::RangeChangeUpdateFromParentLocked(const uint64_t offset, const uint64_t len) {
     canary_.Assert();
 
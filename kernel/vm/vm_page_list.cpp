@@ -18,129 +18,166 @@
 
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
 
-VmPageListNode::VmPageListNode(uint64_t offset)
-    : obj_offset_(offset) {
-    LTRACEF("%p offset %#" PRIx64 "\n", this, obj_offset_);
+VmPageListNode::VmPageListNode() {
+    LTRACEF("%p\n", this);
 }
 
 VmPageListNode::~VmPageListNode() {
-    LTRACEF("%p offset %#" PRIx64 "\n", this, obj_offset_);
+    LTRACEF("%p\n", this);
     canary_.Assert();
 
-    for (__UNUSED auto p : pages_) {
-        DEBUG_ASSERT(p == nullptr);
+    for (__UNUSED const auto& slot : slots_) {
+        DEBUG_ASSERT(slot.node == nullptr);
     }
 }
 
-vm_page* VmPageListNode::GetPage(size_t index) {
-    canary_.Assert();
-    DEBUG_ASSERT(index < kPageFanOut);
-    return pages_[index];
-}
-
-vm_page* VmPageListNode::RemovePage(size_t index) {
-    canary_.Assert();
-    DEBUG_ASSERT(index < kPageFanOut);
-
-    auto p = pages_[index];
-    if (!p)
-        return nullptr;
-
-    pages_[index] = nullptr;
-
-    return p;
-}
-
-zx_status_t VmPageListNode::AddPage(vm_page* p, size_t index) {
-    canary_.Assert();
-    DEBUG_ASSERT(index < kPageFanOut);
-    if (pages_[index])
-        return ZX_ERR_ALREADY_EXISTS;
-    pages_[index] = p;
-    return ZX_OK;
-}
-
 VmPageList::VmPageList() {
     LTRACEF("%p\n", this);
 }
 
 VmPageList::~VmPageList() {
     LTRACEF("%p\n", this);
-    DEBUG_ASSERT(list_.is_empty());
+    DEBUG_ASSERT(root_ == nullptr);
 }
 
 zx_status_t VmPageList::AddPage(vm_page* p, uint64_t offset) {
-    uint64_t node_offset = ROUNDDOWN(offset, PAGE_SIZE * VmPageListNode::kPageFanOut);
-    size_t index = (offset >> PAGE_SIZE_SHIFT) % VmPageListNode::kPageFanOut;
-
-    LTRACEF_LEVEL(2, "%p page %p, offset %#" PRIx64 " node_offset %#" PRIx64 " index %zu\n", this, p, offset,
-                  node_offset, index);
-
-    // lookup the tree node that holds this page
-    auto pln = list_.find(node_offset);
-    if (!pln.IsValid()) {
-        fbl::AllocChecker ac;
-        fbl::unique_ptr<VmPageListNode> pl =
-            fbl::unique_ptr<VmPageListNode>(new (&ac) VmPageListNode(node_offset));
+    const uint64_t index = offset >> PAGE_SIZE_SHIFT;
+    const uint height = HeightFor(index);
+
+    LTRACEF_LEVEL(2, "%p page %p, offset %#" PRIx64 " height %u\n", this, p, offset, height);
+
+    fbl::AllocChecker ac;
+    if (!root_) {
+        root_ = new (&ac) Node();
+        if (!ac.check())
+            return ZX_ERR_NO_MEMORY;
+        height_ = height;
+    }
+
+    // grow the tree until it reaches the page, the old root becoming the first
+    // child of the new one
+    while (height_ < height) {
+        Node* node = new (&ac) Node();
         if (!ac.check())
             return ZX_ERR_NO_MEMORY;
 
-        LTRACEF("allocating new inner node %p\n", pl.get());
-        __UNUSED auto status = pl->AddPage(p, index);
-        DEBUG_ASSERT(status == ZX_OK);
+        LTRACEF("growing the tree to %u levels\n", height_ + 1);
+        node->slots_[0].node = root_;
+        node->count_ = 1;
+        root_ = node;
+        height_++;
+    }
 
-        list_.insert(fbl::move(pl));
-    } else {
-        pln->AddPage(p, index);
+    // walk down to the leaf, filling in the missing nodes on the way
+    Node* node = root_;
+    for (uint level = height_ - 1; level > 0; level--) {
+        Node*& child = node->slots_[Node::SlotIndex(index, level)].node;
+        if (!child) {
+            child = new (&ac) Node();
+            if (!ac.check()) {
+                // drop the nodes this left empty
+                RemovePage(index);
+                return ZX_ERR_NO_MEMORY;
+            }
+            node->count_++;
+        }
+        node = child;
     }
 
+    vm_page*& slot = node->slots_[Node::SlotIndex(index, 0)].page;
+    if (slot)
+        return ZX_ERR_ALREADY_EXISTS;
+    slot = p;
+    node->count_++;
+
     return ZX_OK;
 }
 
 vm_page* VmPageList::GetPage(uint64_t offset) {
-    uint64_t node_offset = ROUNDDOWN(offset, PAGE_SIZE * VmPageListNode::kPageFanOut);
-    size_t index = (offset >> PAGE_SIZE_SHIFT) % VmPageListNode::kPageFanOut;
+    const uint64_t index = offset >> PAGE_SIZE_SHIFT;
 
-    LTRACEF_LEVEL(2, "%p offset %#" PRIx64 " node_offset %#" PRIx64 " index %zu\n", this, offset, node_offset,
-                  index);
+    LTRACEF_LEVEL(2, "%p offset %#" PRIx64 "\n", this, offset);
 
-    // lookup the tree node that holds this page
-    auto pln = list_.find(node_offset);
-    if (!pln.IsValid()) {
+    if (!root_ || HeightFor(index) > height_)
         return nullptr;
-    }
 
-    return pln->GetPage(index);
+    Node* node = root_;
+    for (uint level = height_ - 1; level > 0; level--) {
+        node = node->slots_[Node::SlotIndex(index, level)].node;
+        if (!node)
+            return nullptr;
+    }
+    return node->slots_[Node::SlotIndex(index, 0)].page;
 }
 
-zx_status_t VmPageList::FreePage(uint64_t offset) {
-    uint64_t node_offset = ROUNDDOWN(offset, PAGE_SIZE * VmPageListNode::kPageFanOut);
-    size_t index = (offset >> PAGE_SIZE_SHIFT) % VmPageListNode::kPageFanOut;
-
-    LTRACEF_LEVEL(2, "%p offset %#" PRIx64 " node_offset %#" PRIx64 " index %zu\n", this, offset, node_offset,
-                  index);
+vm_page* VmPageList::RemovePage(uint64_t index) {
+    if (!root_ || HeightFor(index) > height_)
+        return nullptr;
 
-    // lookup the tree node that holds this page
-    auto pln = list_.find(node_offset);
-    if (!pln.IsValid()) {
-        return ZX_ERR_NOT_FOUND;
+    // the nodes on the way to the page by level, as far down as they go
+    Node* path[kMaxHeight] = {};
+    uint level = height_ - 1;
+    path[level] = root_;
+    while (level > 0 && path[level]) {
+        path[level - 1] = path[level]->slots_[Node::SlotIndex(index, level)].node;
+        level--;
     }
 
-    // free this page
-    auto page = pln->RemovePage(index);
-    if (page) {
-        // if it was the last page in the node, remove the node from the tree
-        if (pln->IsEmpty()) {
-            LTRACEF_LEVEL(2, "%p freeing the list node\n", this);
-            list_.erase(*pln);
+    vm_page* page = nullptr;
+    if (path[0]) {
+        vm_page*& slot = path[0]->slots_[Node::SlotIndex(index, 0)].page;
+        page = slot;
+        if (page) {
+            slot = nullptr;
+            path[0]->count_--;
         }
+    }
 
-        pmm_free_page(page);
+    // free the nodes that are empty now, bottom up
+    for (level = 0; level < height_; level++) {
+        Node* node = path[level];
+        if (!node)
+            continue;
+        if (node->count_ > 0)
+            break;
+
+        if (level + 1 < height_) {
+            path[level + 1]->slots_[Node::SlotIndex(index, level + 1)].node = nullptr;
+            path[level + 1]->count_--;
+        } else {
+            LTRACEF_LEVEL(2, "%p freeing the root\n", this);
+            root_ = nullptr;
+            height_ = 0;
+        }
+        delete node;
     }
 
+    return page;
+}
+
+zx_status_t VmPageList::FreePage(uint64_t offset) {
+    LTRACEF_LEVEL(2, "%p offset %#" PRIx64 "\n", this, offset);
+
+    vm_page* page = RemovePage(offset >> PAGE_SIZE_SHIFT);
+    if (!page)
+        return ZX_ERR_NOT_FOUND;
+
+    pmm_free_page(page);
     return ZX_OK;
 }
 
+void VmPageList::FreeNodes(Node* node, uint level) {
+    if (level > 0) {
+        for (auto& slot : node->slots_) {
+            if (slot.node) {
+                FreeNodes(slot.node, level - 1);
+                slot.node = nullptr;
+            }
+        }
+    }
+    delete node;
+}
+
 size_t VmPageList::FreeAllPages() {
     LTRACEF("%p\n", this);
 
@@ -149,16 +186,16 @@ size_t VmPageList::FreeAllPages() {
 
     size_t count = 0;
 
-    // per page get a reference to the page pointer inside the page list node
+    // per page get a reference to the page pointer inside the leaf node
     auto per_page_func = [&](vm_page*& p, uint64_t offset) {
-        // add the page to our list and null out the inner node
+        // add the page to our list and null out the leaf slot
         list_add_tail(&list, &p->free.node);
         p = nullptr;
         count++;
         return ZX_ERR_NEXT;
     };
 
-    // walk the tree in order, freeing all the pages on every node
+    // walk the tree in order, freeing all the pages on every leaf
     ForEveryPage(per_page_func);
 
     // return all the pages to the pmm at once
@@ -166,11 +203,15 @@ size_t VmPageList::FreeAllPages() {
     DEBUG_ASSERT(freed == count);
 
     // empty the tree
-    list_.clear();
+    if (root_) {
+        FreeNodes(root_, height_ - 1);
+        root_ = nullptr;
+        height_ = 0;
+    }
 
     return count;
 }
 
 bool VmPageList::IsEmpty() {
-    return list_.is_empty();
+    return root_ == nullptr;
 }
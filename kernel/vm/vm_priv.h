@@ -17,6 +17,17 @@
 
 #define VM_GLOBAL_TRACE 0
 
+// Paged VMOs are only backed and mapped with large pages where the arch page
+// tables split a large page when part of it is unmapped or protected.
+#if ARCH_X86
+#define VM_LARGE_PAGES 1
+#else
+#define VM_LARGE_PAGES 0
+#endif
+
+#define VM_LARGE_PAGE_SIZE_SHIFT 21
+#define VM_LARGE_PAGE_SIZE (1UL << VM_LARGE_PAGE_SIZE_SHIFT)
+
 // utility function to test that offset + len is entirely within a range
 // returns false if out of range
 // NOTE: only use unsigned lengths
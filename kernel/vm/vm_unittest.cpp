@@ -8,15 +8,21 @@
 #include <err.h>
 #include <fbl/alloc_checker.h>
 #include <fbl/array.h>
+#include <lib/counters.h>
+#include <string.h>
 #include <unittest.h>
+#include <vm/physmap.h>
 #include <vm/vm.h>
 #include <vm/vm_address_region.h>
 #include <vm/vm_aspace.h>
 #include <vm/vm_object.h>
 #include <vm/vm_object_paged.h>
 #include <vm/vm_object_physical.h>
+#include <vm/vm_page_list.h>
 #include <zircon/types.h>
 
+#include "vm_priv.h"
+
 static const uint kArchRwFlags = ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE;
 
 // Allocates a single page, translates it to a vm_page_t and frees it.
@@ -53,6 +59,62 @@ static bool pmm_large_alloc_test() {
     END_TEST;
 }
 
+// Allocates aligned contiguous runs of odd sizes, checks them and frees them.
+static bool pmm_alloc_contiguous_test() {
+    BEGIN_TEST;
+
+    static const struct {
+        size_t count;
+        uint8_t alignment_log2;
+    } runs[] = {{2, PAGE_SIZE_SHIFT}, {3, PAGE_SIZE_SHIFT}, {5, 16}, {16, 20}, {33, 21}};
+
+    for (const auto& run : runs) {
+        list_node list = LIST_INITIAL_VALUE(list);
+        paddr_t pa;
+
+        auto count = pmm_alloc_contiguous(run.count, 0, run.alignment_log2, &pa, &list);
+        ASSERT_EQ(run.count, count, "pmm_alloc_contiguous count");
+        EXPECT_EQ(0u, pa & ((1ul << run.alignment_log2) - 1), "pmm_alloc_contiguous alignment");
+
+        paddr_t expected = pa;
+        vm_page_t* page;
+        list_for_every_entry (&list, page, vm_page_t, free.node) {
+            EXPECT_EQ(expected, vm_page_to_paddr(page), "pmm_alloc_contiguous run");
+            expected += PAGE_SIZE;
+        }
+
+        auto ret = pmm_free(&list);
+        EXPECT_EQ(run.count, ret, "pmm_free on a contiguous run");
+    }
+
+    END_TEST;
+}
+
+// Allocates zeroed pages, dirties them and frees them, so that later
+// allocations may get them back from the caches and must still see zeros.
+static bool pmm_alloc_zeroed_page_test() {
+    BEGIN_TEST;
+
+    for (int i = 0; i < 64; i++) {
+        paddr_t pa;
+        vm_page_t* page = pmm_alloc_zeroed_page(0, &pa);
+        ASSERT_NE(nullptr, page, "pmm_alloc_zeroed_page");
+        EXPECT_EQ(pa, vm_page_to_paddr(page), "pmm_alloc_zeroed_page address");
+
+        uint64_t* ptr = static_cast<uint64_t*>(paddr_to_physmap(pa));
+        bool zero = true;
+        for (size_t j = 0; j < PAGE_SIZE / sizeof(uint64_t); j++) {
+            zero &= ptr[j] == 0;
+        }
+        EXPECT_TRUE(zero, "page is zeroed");
+
+        memset(ptr, 0xa5, PAGE_SIZE);
+        pmm_free_page(page);
+    }
+
+    END_TEST;
+}
+
 // Allocates too many pages and makes sure it fails nicely.
 static bool pmm_oversized_alloc_test() {
     BEGIN_TEST;
@@ -305,6 +367,190 @@ static bool vmaspace_alloc_smoke_test() {
     END_TEST;
 }
 
+// Maps several committed regions next to each other in a vmar and unmaps
+// them with a single call, which shoots down the whole range at once.
+// Protecting them, decommitting a vmo mapped in several of them, and
+// destroying the vmar share one shootdown each too.
+static bool vmar_multiple_unmap_test() {
+    BEGIN_TEST;
+    static const size_t kMappings = 3;
+    static const size_t kMappingSize = 4 * PAGE_SIZE;
+    static const size_t kVmarSize = 2 * kMappings * kMappingSize;
+
+    auto aspace = VmAspace::Create(0, "test aspace3");
+    ASSERT_TRUE(aspace, "creating aspace\n");
+
+    auto map_all = [&](fbl::RefPtr<VmAddressRegion> vmar) -> bool {
+        for (size_t i = 0; i < kMappings; i++) {
+            fbl::RefPtr<VmObject> vmo;
+            zx_status_t status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, kMappingSize, &vmo);
+            if (status != ZX_OK)
+                return false;
+            fbl::RefPtr<VmMapping> mapping;
+            status = vmar->CreateVmMapping(i * kMappingSize, kMappingSize, 0,
+                                           VMAR_FLAG_SPECIFIC | VMAR_CAN_RWX_FLAGS,
+                                           fbl::move(vmo), 0, kArchRwFlags, "test", &mapping);
+            if (status != ZX_OK || mapping->MapRange(0, kMappingSize, true) != ZX_OK)
+                return false;
+        }
+        return true;
+    };
+    auto mapped_pages = [&](vaddr_t base) {
+        size_t count = 0;
+        for (size_t off = 0; off < kMappings * kMappingSize; off += PAGE_SIZE) {
+            if (aspace->arch_aspace().Query(base + off, nullptr, nullptr) == ZX_OK)
+                count++;
+        }
+        return count;
+    };
+#if ARCH_X86
+    uint64_t last_shootdowns = aspace->arch_aspace().tlb_shootdowns();
+    auto new_shootdowns = [&]() {
+        uint64_t shootdowns = aspace->arch_aspace().tlb_shootdowns();
+        uint64_t delta = shootdowns - last_shootdowns;
+        last_shootdowns = shootdowns;
+        return delta;
+    };
+#endif
+
+    fbl::RefPtr<VmAddressRegion> vmar;
+    zx_status_t status = aspace->RootVmar()->CreateSubVmar(
+        0, kVmarSize, 0, VMAR_FLAG_CAN_MAP_SPECIFIC | VMAR_CAN_RWX_FLAGS, "test vmar", &vmar);
+    ASSERT_EQ(ZX_OK, status, "creating vmar\n");
+
+    // unmap all the mappings at once
+    ASSERT_TRUE(map_all(vmar), "mapping regions\n");
+    EXPECT_EQ(kMappings * kMappingSize / PAGE_SIZE, mapped_pages(vmar->base()), "mapped\n");
+#if ARCH_X86
+    new_shootdowns();
+#endif
+    status = vmar->Unmap(vmar->base(), kMappings * kMappingSize);
+    EXPECT_EQ(ZX_OK, status, "unmapping regions\n");
+    EXPECT_EQ(0u, mapped_pages(vmar->base()), "unmapped\n");
+#if ARCH_X86
+    EXPECT_EQ(1u, new_shootdowns(), "one shootdown for the unmap\n");
+#endif
+
+    // protect all of them at once
+    ASSERT_TRUE(map_all(vmar), "mapping regions\n");
+#if ARCH_X86
+    new_shootdowns();
+#endif
+    status = vmar->Protect(vmar->base(), kMappings * kMappingSize, ARCH_MMU_FLAG_PERM_READ);
+    EXPECT_EQ(ZX_OK, status, "protecting regions\n");
+#if ARCH_X86
+    EXPECT_EQ(1u, new_shootdowns(), "one shootdown for the protect\n");
+#endif
+    status = vmar->Unmap(vmar->base(), kMappings * kMappingSize);
+    EXPECT_EQ(ZX_OK, status, "unmapping regions\n");
+
+    // decommit a vmo that every mapping maps
+    {
+        fbl::RefPtr<VmObject> vmo;
+        status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, kMappingSize, &vmo);
+        ASSERT_EQ(ZX_OK, status, "creating vmo\n");
+        for (size_t i = 0; i < kMappings; i++) {
+            fbl::RefPtr<VmMapping> mapping;
+            status = vmar->CreateVmMapping(i * kMappingSize, kMappingSize, 0,
+                                           VMAR_FLAG_SPECIFIC | VMAR_CAN_RWX_FLAGS, vmo, 0,
+                                           kArchRwFlags, "test", &mapping);
+            ASSERT_EQ(ZX_OK, status, "mapping vmo\n");
+            ASSERT_EQ(ZX_OK, mapping->MapRange(0, kMappingSize, true), "committing\n");
+        }
+#if ARCH_X86
+        new_shootdowns();
+#endif
+        status = vmo->DecommitRange(0, kMappingSize, nullptr);
+        EXPECT_EQ(ZX_OK, status, "decommitting vmo\n");
+        EXPECT_EQ(0u, mapped_pages(vmar->base()), "decommitted\n");
+#if ARCH_X86
+        EXPECT_EQ(1u, new_shootdowns(), "one shootdown for the decommit\n");
+#endif
+        status = vmar->Unmap(vmar->base(), kMappings * kMappingSize);
+        EXPECT_EQ(ZX_OK, status, "unmapping regions\n");
+    }
+
+    // unmap the middle of them, splitting the first and last
+    ASSERT_TRUE(map_all(vmar), "mapping regions\n");
+    status = vmar->Unmap(vmar->base() + PAGE_SIZE, (kMappings * kMappingSize) - 2 * PAGE_SIZE);
+    EXPECT_EQ(ZX_OK, status, "unmapping regions\n");
+    EXPECT_EQ(2u, mapped_pages(vmar->base()), "partly unmapped\n");
+
+    // destroying the vmar unmaps what is left
+    vaddr_t base = vmar->base();
+#if ARCH_X86
+    new_shootdowns();
+#endif
+    status = vmar->Destroy();
+    EXPECT_EQ(ZX_OK, status, "destroying vmar\n");
+    EXPECT_EQ(0u, mapped_pages(base), "destroyed\n");
+#if ARCH_X86
+    EXPECT_EQ(1u, new_shootdowns(), "one shootdown for the destroy\n");
+#endif
+
+    aspace->Destroy();
+    END_TEST;
+}
+
+// Fills a vmar with mappings and checks that the allocator finds the gaps that
+// unmapping leaves, which the vmar only knows about through its subregion tree.
+static bool vmar_alloc_gap_test() {
+    BEGIN_TEST;
+    static const size_t kPages = 64;
+    static const size_t kFirstPages = 4;
+
+    auto aspace = VmAspace::Create(0, "test aspace4");
+    ASSERT_TRUE(aspace, "creating aspace\n");
+
+    fbl::RefPtr<VmAddressRegion> vmar;
+    zx_status_t status = aspace->RootVmar()->CreateSubVmar(
+        0, kPages * PAGE_SIZE, 0, VMAR_FLAG_CAN_MAP_SPECIFIC | VMAR_CAN_RWX_FLAGS, "test vmar",
+        &vmar);
+    ASSERT_EQ(ZX_OK, status, "creating vmar\n");
+
+    fbl::RefPtr<VmObject> vmo;
+    status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, kPages * PAGE_SIZE, &vmo);
+    ASSERT_EQ(ZX_OK, status, "creating vmo\n");
+
+    // maps |pages| anywhere in the vmar, returns the address or 0
+    auto map = [&](size_t pages) -> vaddr_t {
+        fbl::RefPtr<VmMapping> mapping;
+        if (vmar->CreateVmMapping(0, pages * PAGE_SIZE, 0, VMAR_CAN_RWX_FLAGS, vmo, 0,
+                                  kArchRwFlags, "test", &mapping) != ZX_OK)
+            return 0;
+        return mapping->base();
+    };
+
+    // one mapping at the start, and single pages everywhere else
+    fbl::RefPtr<VmMapping> first;
+    status = vmar->CreateVmMapping(0, kFirstPages * PAGE_SIZE, 0,
+                                   VMAR_FLAG_SPECIFIC | VMAR_CAN_RWX_FLAGS, vmo, 0,
+                                   kArchRwFlags, "test", &first);
+    ASSERT_EQ(ZX_OK, status, "mapping first region\n");
+    for (size_t i = kFirstPages; i < kPages; i++) {
+        EXPECT_NE(0u, map(1), "filling vmar\n");
+    }
+    EXPECT_EQ(0u, map(1), "vmar is full\n");
+
+    // a gap left by unmapping two whole mappings
+    const vaddr_t gap = vmar->base() + 10 * PAGE_SIZE;
+    EXPECT_EQ(ZX_OK, vmar->Unmap(gap, 2 * PAGE_SIZE), "unmapping two pages\n");
+    EXPECT_EQ(gap, map(2), "mapping the gap\n");
+    EXPECT_EQ(0u, map(1), "vmar is full\n");
+
+    // a gap left by shrinking a mapping in place
+    const vaddr_t tail = vmar->base() + (kFirstPages - 1) * PAGE_SIZE;
+    EXPECT_EQ(ZX_OK, vmar->Unmap(tail, PAGE_SIZE), "unmapping tail of first region\n");
+    EXPECT_EQ((kFirstPages - 1) * PAGE_SIZE, first->size(), "first region shrank\n");
+    EXPECT_EQ(0u, map(2), "gap is one page\n");
+    EXPECT_EQ(tail, map(1), "mapping the tail\n");
+    EXPECT_EQ(0u, map(1), "vmar is full\n");
+
+    EXPECT_EQ(ZX_OK, vmar->Destroy(), "destroying vmar\n");
+    aspace->Destroy();
+    END_TEST;
+}
+
 // Doesn't do anything, just prints all aspaces.
 // Should be run after all other tests so that people can manually comb
 // through the output for leaked test aspaces.
@@ -455,6 +701,114 @@ static bool vmo_multiple_pin_test() {
     END_TEST;
 }
 
+// Commits pages of a vm object by writing to them, writes something other than
+// zeros to one of them, and checks that the rest are given back as zero pages,
+// unless they were committed explicitly.
+static bool vmo_reclaim_zero_pages_test() {
+    BEGIN_TEST;
+    static const size_t alloc_size = PAGE_SIZE * 4;
+    fbl::RefPtr<VmObject> vmo;
+    zx_status_t status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size, &vmo);
+    ASSERT_EQ(status, ZX_OK, "vmobject creation\n");
+    ASSERT_TRUE(vmo, "vmobject creation\n");
+
+    static const uint8_t kZero = 0;
+    for (uint64_t off = 0; off < alloc_size; off += PAGE_SIZE) {
+        status = vmo->Write(&kZero, off, sizeof(kZero));
+        EXPECT_EQ(ZX_OK, status, "writing vm object\n");
+    }
+    static const uint8_t kValue = 0x5a;
+    status = vmo->Write(&kValue, PAGE_SIZE + 17, sizeof(kValue));
+    EXPECT_EQ(ZX_OK, status, "writing vm object\n");
+
+    // a clone keeps its parent's pages
+    fbl::RefPtr<VmObject> clone;
+    status = vmo->CloneCOW(0, alloc_size, false, &clone);
+    ASSERT_EQ(ZX_OK, status, "cloning vm object\n");
+    uint64_t offset = 0;
+    VmObject::ScanStats stats = {};
+    vmo->ScanPages(VmObject::ScanAction::kReclaimZero, &offset, 64, &stats);
+    EXPECT_EQ(0u, stats.zero, "reclaim with a clone\n");
+    EXPECT_EQ(UINT64_MAX, offset, "reclaim with a clone\n");
+    clone.reset();
+
+    // scan in two steps
+    offset = 0;
+    stats = {};
+    vmo->ScanPages(VmObject::ScanAction::kReclaimZero, &offset, 2, &stats);
+    EXPECT_EQ(2u * PAGE_SIZE, offset, "first step\n");
+    vmo->ScanPages(VmObject::ScanAction::kReclaimZero, &offset, 64, &stats);
+    EXPECT_EQ(UINT64_MAX, offset, "second step\n");
+    EXPECT_EQ(alloc_size / PAGE_SIZE, stats.scanned, "scanned pages\n");
+    EXPECT_EQ(alloc_size / PAGE_SIZE - 1, stats.zero, "reclaimed pages\n");
+    EXPECT_EQ(1u, vmo->AllocatedPages(), "allocated pages\n");
+
+    uint8_t value;
+    status = vmo->Read(&value, PAGE_SIZE + 17, sizeof(value));
+    EXPECT_EQ(ZX_OK, status, "reading vm object\n");
+    EXPECT_EQ(kValue, value, "written page is kept\n");
+    status = vmo->Read(&value, 17, sizeof(value));
+    EXPECT_EQ(ZX_OK, status, "reading vm object\n");
+    EXPECT_EQ(0u, value, "reclaimed page reads as zero\n");
+
+    // explicitly committed pages are kept
+    uint64_t committed;
+    status = vmo->CommitRange(0, alloc_size, &committed);
+    EXPECT_EQ(ZX_OK, status, "committing vm object\n");
+    offset = 0;
+    stats = {};
+    vmo->ScanPages(VmObject::ScanAction::kReclaimZero, &offset, 64, &stats);
+    EXPECT_EQ(alloc_size / PAGE_SIZE, stats.scanned, "scanned committed pages\n");
+    EXPECT_EQ(0u, stats.zero, "reclaimed committed pages\n");
+    EXPECT_EQ(alloc_size / PAGE_SIZE, vmo->AllocatedPages(), "allocated pages\n");
+
+    END_TEST;
+}
+
+// Commits pages of a vm object, fills them with compressible and random data,
+// and checks that the scanner compresses the former and that they read back intact.
+static bool vmo_compress_pages_test() {
+    BEGIN_TEST;
+    static const size_t alloc_size = PAGE_SIZE * 2;
+    fbl::RefPtr<VmObject> vmo;
+    zx_status_t status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size, &vmo);
+    ASSERT_EQ(status, ZX_OK, "vmobject creation\n");
+    ASSERT_TRUE(vmo, "vmobject creation\n");
+
+    fbl::AllocChecker ac;
+    fbl::Array<uint8_t> data(new (&ac) uint8_t[alloc_size], alloc_size);
+    ASSERT_TRUE(ac.check(), "allocating buffer\n");
+    for (size_t i = 0; i < PAGE_SIZE; i++) {
+        data[i] = static_cast<uint8_t>(i / 64);
+    }
+    fill_region(99, data.get() + PAGE_SIZE, PAGE_SIZE);
+    status = vmo->Write(data.get(), 0, alloc_size);
+    EXPECT_EQ(ZX_OK, status, "writing vm object\n");
+
+    // aging alone does not compress a page right away
+    uint64_t offset = 0;
+    VmObject::ScanStats stats = {};
+    vmo->ScanPages(VmObject::ScanAction::kAge, &offset, 64, &stats);
+    EXPECT_EQ(2u, stats.scanned, "aged pages\n");
+    EXPECT_EQ(0u, stats.compressed, "aged pages\n");
+
+    offset = 0;
+    stats = {};
+    vmo->ScanPages(VmObject::ScanAction::kCompress, &offset, 64, &stats);
+    EXPECT_EQ(1u, stats.compressed, "compressed pages\n");
+    EXPECT_LE(stats.compressed_bytes, VmCompressedPage::kMaxSize, "compressed size\n");
+    EXPECT_EQ(1u, vmo->AllocatedPages(), "allocated pages\n");
+
+    fbl::Array<uint8_t> readback(new (&ac) uint8_t[alloc_size], alloc_size);
+    ASSERT_TRUE(ac.check(), "allocating buffer\n");
+    status = vmo->Read(readback.get(), 0, alloc_size);
+    EXPECT_EQ(ZX_OK, status, "reading vm object\n");
+    EXPECT_EQ(0, memcmp(data.get(), readback.get(), alloc_size), "contents after decompress\n");
+    EXPECT_EQ(2u, vmo->AllocatedPages(), "allocated pages\n");
+
+    END_TEST;
+}
+
 // Creates a vm object, commits odd sized memory.
 static bool vmo_odd_size_commit_test() {
     BEGIN_TEST;
@@ -537,6 +891,47 @@ static bool vmo_demand_paged_map_test() {
     END_TEST;
 }
 
+// Maps a committed vm object without mapping its pages, touches one page, and
+// checks that the single fault maps the rest of the fault-around window as well.
+static bool vmo_fault_around_test() {
+    BEGIN_TEST;
+    static const size_t alloc_size = PAGE_SIZE * 16;
+    fbl::RefPtr<VmObject> vmo;
+    zx_status_t status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size, &vmo);
+    ASSERT_EQ(status, ZX_OK, "vmobject creation\n");
+    ASSERT_TRUE(vmo, "vmobject creation\n");
+    EXPECT_EQ(ZX_OK, vmo->set_fault_around_pages(alloc_size / PAGE_SIZE), "set window\n");
+
+    uint64_t committed;
+    status = vmo->CommitRange(0, alloc_size, &committed);
+    EXPECT_EQ(ZX_OK, status, "committing vm object\n");
+
+    auto ka = VmAspace::kernel_aspace();
+    void* ptr;
+    auto ret = ka->MapObjectInternal(vmo, "test", 0, alloc_size, &ptr,
+                                     0, 0, kArchRwFlags);
+    ASSERT_EQ(ZX_OK, ret, "mapping object");
+
+    auto mapped_pages = [&]() {
+        size_t count = 0;
+        for (size_t off = 0; off < alloc_size; off += PAGE_SIZE) {
+            if (ka->arch_aspace().Query((vaddr_t)ptr + off, nullptr, nullptr) == ZX_OK)
+                count++;
+        }
+        return count;
+    };
+    EXPECT_EQ(0u, mapped_pages(), "mapped before the fault\n");
+
+    volatile uint8_t* p = static_cast<volatile uint8_t*>(ptr);
+    EXPECT_EQ(0u, p[PAGE_SIZE * 5], "read from faulting page\n");
+    EXPECT_EQ(alloc_size / PAGE_SIZE, mapped_pages(), "mapped after one fault\n");
+    EXPECT_EQ(alloc_size / PAGE_SIZE, vmo->AllocatedPages(), "allocated pages\n");
+
+    auto err = ka->FreeRegion((vaddr_t)ptr);
+    EXPECT_EQ(ZX_OK, err, "unmapping object");
+    END_TEST;
+}
+
 // Creates a vm object, maps it, drops ref before unmapping.
 static bool vmo_dropped_ref_test() {
     BEGIN_TEST;
@@ -869,6 +1264,206 @@ static bool vmo_lookup_test() {
     END_TEST;
 }
 
+// Moves pages from one vm object to another.
+static bool vmo_move_pages_test() {
+    BEGIN_TEST;
+
+    static const size_t alloc_size = PAGE_SIZE * 4;
+    fbl::RefPtr<VmObject> src;
+    fbl::RefPtr<VmObject> dst;
+    ASSERT_EQ(ZX_OK, VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size, &src), "");
+    ASSERT_EQ(ZX_OK, VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size, &dst), "");
+
+    list_node pages = LIST_INITIAL_VALUE(pages);
+
+    // every page of the range has to be committed
+    uint64_t committed;
+    EXPECT_EQ(ZX_OK, src->CommitRange(0, PAGE_SIZE, &committed), "");
+    EXPECT_EQ(ZX_ERR_BAD_STATE, src->TakePages(0, alloc_size, &pages), "");
+    EXPECT_TRUE(list_is_empty(&pages), "");
+
+    uint32_t value = 0x12345678;
+    for (size_t offset = 0; offset < alloc_size; offset += PAGE_SIZE) {
+        EXPECT_EQ(ZX_OK, src->Write(&value, offset, sizeof(value)), "");
+    }
+    EXPECT_EQ(ZX_OK, src->TakePages(PAGE_SIZE, PAGE_SIZE * 2, &pages), "");
+    EXPECT_EQ(2u, list_length(&pages), "");
+    EXPECT_EQ(2u, src->AllocatedPages(), "");
+
+    EXPECT_EQ(ZX_OK, dst->CommitRange(0, alloc_size, &committed), "");
+    EXPECT_EQ(ZX_OK, dst->SupplyPages(0, PAGE_SIZE * 2, &pages), "");
+    EXPECT_TRUE(list_is_empty(&pages), "");
+    EXPECT_EQ(alloc_size / PAGE_SIZE, dst->AllocatedPages(), "");
+
+    uint32_t read = 0;
+    EXPECT_EQ(ZX_OK, dst->Read(&read, PAGE_SIZE, sizeof(read)), "");
+    EXPECT_EQ(value, read, "");
+
+    // a taken range reads as zeros again
+    EXPECT_EQ(ZX_OK, src->Read(&read, PAGE_SIZE, sizeof(read)), "");
+    EXPECT_EQ(0u, read, "");
+
+    END_TEST;
+}
+
+// Commits a vm object with large pages, and checks that each large page is physically
+// contiguous and aligned, unless the pmm had to fall back to small pages.
+static bool vmo_large_page_test() {
+    BEGIN_TEST;
+
+    static const size_t alloc_size = VM_LARGE_PAGE_SIZE * 2;
+    static const size_t large_page_count = VM_LARGE_PAGE_SIZE / PAGE_SIZE;
+    fbl::RefPtr<VmObject> vmo;
+    zx_status_t status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size, &vmo);
+    ASSERT_EQ(status, ZX_OK, "vmobject creation\n");
+    ASSERT_TRUE(vmo, "vmobject creation\n");
+
+    EXPECT_EQ(ZX_ERR_INVALID_ARGS, vmo->SetLargePagePolicy(3u), "bad policy\n");
+    EXPECT_EQ(ZX_OK, vmo->SetLargePagePolicy(ZX_VMO_LARGE_PAGES_ALWAYS), "set policy\n");
+    uint32_t policy;
+    EXPECT_EQ(ZX_OK, vmo->GetLargePagePolicy(&policy), "get policy\n");
+    EXPECT_EQ(ZX_VMO_LARGE_PAGES_ALWAYS, policy, "get policy\n");
+
+    const uint64_t commits = kcounter_get_total("kernel.vm.large_page.commits");
+    uint64_t committed;
+    status = vmo->CommitRange(0, alloc_size, &committed);
+    EXPECT_EQ(ZX_OK, status, "committing vm object\n");
+    EXPECT_EQ(alloc_size, committed, "committing vm object\n");
+    if (VM_LARGE_PAGES) {
+        EXPECT_LT(commits, kcounter_get_total("kernel.vm.large_page.commits"),
+                  "committed a large page\n");
+    }
+
+    fbl::AllocChecker ac;
+    fbl::Array<paddr_t> pa(new (&ac) paddr_t[alloc_size / PAGE_SIZE], alloc_size / PAGE_SIZE);
+    ASSERT_TRUE(ac.check(), "allocating array\n");
+    auto lookup_fn = [](void* context, size_t offset, size_t index, paddr_t page_pa) {
+        static_cast<paddr_t*>(context)[index] = page_pa;
+        return ZX_OK;
+    };
+    status = vmo->Lookup(0, alloc_size, 0, lookup_fn, pa.get());
+    EXPECT_EQ(ZX_OK, status, "lookup\n");
+
+    for (size_t i = 0; VM_LARGE_PAGES && i < alloc_size / PAGE_SIZE; i += large_page_count) {
+        if (!IS_ALIGNED(pa[i], VM_LARGE_PAGE_SIZE))
+            continue;
+        // an aligned first page may be a coincidence, but then the next one is elsewhere
+        if (pa[i + 1] != pa[i] + PAGE_SIZE)
+            continue;
+        for (size_t j = 1; j < large_page_count; j++) {
+            EXPECT_EQ(pa[i] + j * PAGE_SIZE, pa[i + j], "large page is contiguous\n");
+        }
+    }
+
+    // a fault in an aligned mapping maps the whole large page around it
+    auto ka = VmAspace::kernel_aspace();
+    void* ptr;
+    status = ka->MapObjectInternal(vmo, "test", 0, alloc_size, &ptr,
+                                   VM_LARGE_PAGE_SIZE_SHIFT, 0, kArchRwFlags);
+    ASSERT_EQ(ZX_OK, status, "mapping object\n");
+    const uint64_t mappings = kcounter_get_total("kernel.vm.large_page.mappings");
+    volatile uint8_t* p = static_cast<volatile uint8_t*>(ptr);
+    EXPECT_EQ(0u, p[PAGE_SIZE * 3], "read from large page\n");
+    if (VM_LARGE_PAGES) {
+        EXPECT_LT(mappings, kcounter_get_total("kernel.vm.large_page.mappings"),
+                  "mapped a large page\n");
+    }
+    status = ka->FreeRegion(reinterpret_cast<vaddr_t>(ptr));
+    EXPECT_EQ(ZX_OK, status, "unmapping object\n");
+
+    // decommitting part of a large page leaves the rest of it in place
+    status = vmo->DecommitRange(PAGE_SIZE, PAGE_SIZE, &committed);
+    EXPECT_EQ(ZX_OK, status, "decommitting vm object\n");
+    EXPECT_EQ(static_cast<uint64_t>(PAGE_SIZE), committed, "decommitting vm object\n");
+    EXPECT_EQ(alloc_size / PAGE_SIZE - 1, vmo->AllocatedPages(), "allocated pages\n");
+
+    // the zero page scanner leaves the explicitly committed pages alone, those of
+    // the broken up first large page included
+    uint64_t offset = 0;
+    VmObject::ScanStats stats = {};
+    while (offset != UINT64_MAX) {
+        vmo->ScanPages(VmObject::ScanAction::kReclaimZero, &offset, 64, &stats);
+    }
+    EXPECT_EQ(0u, stats.zero, "reclaimed committed pages\n");
+    EXPECT_EQ(alloc_size / PAGE_SIZE - 1, vmo->AllocatedPages(), "allocated pages\n");
+
+    // commit the large pages again by writing to them, so that they are up to the
+    // scanner, which takes the pages of the broken up first large page, but
+    // leaves the second one alone if it got one
+    status = vmo->DecommitRange(0, alloc_size, &committed);
+    EXPECT_EQ(ZX_OK, status, "decommitting vm object\n");
+    static const uint8_t kZero = 0;
+    for (uint64_t off = 0; off < alloc_size; off += VM_LARGE_PAGE_SIZE) {
+        status = vmo->Write(&kZero, off, sizeof(kZero));
+        EXPECT_EQ(ZX_OK, status, "writing vm object\n");
+    }
+    bool second_large = false;
+    if (VM_LARGE_PAGES &&
+        vmo->Lookup(VM_LARGE_PAGE_SIZE, VM_LARGE_PAGE_SIZE, 0, lookup_fn, pa.get()) == ZX_OK) {
+        second_large = IS_ALIGNED(pa[0], VM_LARGE_PAGE_SIZE) && pa[1] == pa[0] + PAGE_SIZE;
+    }
+    status = vmo->DecommitRange(PAGE_SIZE, PAGE_SIZE, &committed);
+    EXPECT_EQ(ZX_OK, status, "decommitting vm object\n");
+    offset = 0;
+    while (offset != UINT64_MAX) {
+        vmo->ScanPages(VmObject::ScanAction::kReclaimZero, &offset, 64, &stats);
+    }
+    EXPECT_EQ(second_large ? large_page_count : 0u, vmo->AllocatedPages(), "allocated pages\n");
+
+    END_TEST;
+}
+
+// Compresses a page of a vm object, turns on large pages, and checks that a fault
+// elsewhere in the large page does not commit a large page over the compressed one.
+static bool vmo_large_page_compressed_test() {
+    BEGIN_TEST;
+
+    static const size_t alloc_size = VM_LARGE_PAGE_SIZE;
+    fbl::RefPtr<VmObject> vmo;
+    zx_status_t status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size, &vmo);
+    ASSERT_EQ(status, ZX_OK, "vmobject creation\n");
+    ASSERT_TRUE(vmo, "vmobject creation\n");
+
+    fbl::AllocChecker ac;
+    fbl::Array<uint8_t> data(new (&ac) uint8_t[PAGE_SIZE], PAGE_SIZE);
+    ASSERT_TRUE(ac.check(), "allocating buffer\n");
+    for (size_t i = 0; i < PAGE_SIZE; i++) {
+        data[i] = static_cast<uint8_t>(i / 64);
+    }
+    status = vmo->Write(data.get(), 0, PAGE_SIZE);
+    EXPECT_EQ(ZX_OK, status, "writing vm object\n");
+
+    uint64_t offset = 0;
+    VmObject::ScanStats stats = {};
+    vmo->ScanPages(VmObject::ScanAction::kCompress, &offset, 64, &stats);
+    EXPECT_EQ(1u, stats.compressed, "compressed pages\n");
+    EXPECT_EQ(0u, vmo->AllocatedPages(), "allocated pages\n");
+
+    EXPECT_EQ(ZX_OK, vmo->SetLargePagePolicy(ZX_VMO_LARGE_PAGES_ALWAYS), "set policy\n");
+
+    auto ka = VmAspace::kernel_aspace();
+    void* ptr;
+    status = ka->MapObjectInternal(vmo, "test", 0, alloc_size, &ptr,
+                                   VM_LARGE_PAGE_SIZE_SHIFT, 0, kArchRwFlags);
+    ASSERT_EQ(ZX_OK, status, "mapping object\n");
+
+    volatile uint8_t* p = static_cast<volatile uint8_t*>(ptr);
+    p[PAGE_SIZE * 5] = 1;
+    EXPECT_EQ(1u, vmo->AllocatedPages(), "allocated pages\n");
+
+    bool intact = true;
+    for (size_t i = 0; i < PAGE_SIZE; i++) {
+        intact = intact && p[i] == data[i];
+    }
+    EXPECT_TRUE(intact, "contents after decompress\n");
+    EXPECT_EQ(2u, vmo->AllocatedPages(), "allocated pages\n");
+
+    status = ka->FreeRegion(reinterpret_cast<vaddr_t>(ptr));
+    EXPECT_EQ(ZX_OK, status, "unmapping object\n");
+
+    END_TEST;
+}
+
 // TODO(ZX-1431): The ARM code's error codes are always ZX_ERR_INTERNAL, so
 // special case that.
 #if ARCH_ARM64
@@ -946,11 +1541,65 @@ static bool arch_noncontiguous_map() {
     END_TEST;
 }
 
+// Adds pages to a page list at offsets far apart, so that the tree has to grow and
+// fill in inner nodes, then walks and frees them.
+static bool vmpl_sparse_pages_test() {
+    BEGIN_TEST;
+    static const uint64_t offsets[] = {
+        0, PAGE_SIZE, 63 * PAGE_SIZE, 64 * PAGE_SIZE, 5 * GB, 4 * GB * GB,
+    };
+
+    VmPageList pl;
+    for (uint64_t offset : offsets) {
+        paddr_t pa;
+        vm_page_t* page = pmm_alloc_page(0, &pa);
+        ASSERT_NONNULL(page, "allocating page\n");
+        EXPECT_EQ(ZX_OK, pl.AddPage(page, offset), "adding page\n");
+        EXPECT_EQ(page, pl.GetPage(offset), "looking up page\n");
+        EXPECT_EQ(ZX_ERR_ALREADY_EXISTS, pl.AddPage(page, offset), "adding page twice\n");
+    }
+    EXPECT_NULL(pl.GetPage(2 * PAGE_SIZE), "looking up missing page\n");
+    EXPECT_NULL(pl.GetPage(5 * GB + PAGE_SIZE), "looking up missing page\n");
+
+    // the EXPECT macros cannot be used in the callbacks, so record what they saw
+    uint64_t seen[fbl::count_of(offsets)];
+    size_t i = 0;
+    auto record = [&](const auto p, uint64_t off) {
+        if (i < fbl::count_of(seen))
+            seen[i] = off;
+        i++;
+        return ZX_ERR_NEXT;
+    };
+
+    pl.ForEveryPage(record);
+    EXPECT_EQ(fbl::count_of(offsets), i, "walking all pages\n");
+    for (size_t j = 0; j < fbl::min(i, fbl::count_of(seen)); j++) {
+        EXPECT_EQ(offsets[j], seen[j], "walking pages in order\n");
+    }
+
+    i = 0;
+    pl.ForEveryPageInRange(record, 2 * PAGE_SIZE, 5 * GB + PAGE_SIZE);
+    EXPECT_EQ(3u, i, "walking a range\n");
+    for (size_t j = 0; j < fbl::min(i, fbl::count_of(seen)); j++) {
+        EXPECT_EQ(offsets[j + 2], seen[j], "walking a range\n");
+    }
+
+    EXPECT_EQ(ZX_OK, pl.FreePage(5 * GB), "freeing page\n");
+    EXPECT_EQ(ZX_ERR_NOT_FOUND, pl.FreePage(5 * GB), "freeing page twice\n");
+    EXPECT_NULL(pl.GetPage(5 * GB), "looking up freed page\n");
+    EXPECT_EQ(fbl::count_of(offsets) - 1, pl.FreeAllPages(), "freeing all pages\n");
+    EXPECT_TRUE(pl.IsEmpty(), "page list is empty\n");
+
+    END_TEST;
+}
+
 // Use the function name as the test name
 #define VM_UNITTEST(fname) UNITTEST(#fname, fname)
 
 UNITTEST_START_TESTCASE(vm_tests)
 VM_UNITTEST(pmm_smoke_test)
+VM_UNITTEST(pmm_alloc_contiguous_test)
+VM_UNITTEST(pmm_alloc_zeroed_page_test)
 // runs the system out of memory, uncomment for debugging
 //VM_UNITTEST(pmm_large_alloc_test)
 //VM_UNITTEST(pmm_oversized_alloc_test)
@@ -963,20 +1612,29 @@ VM_UNITTEST(vmm_alloc_contiguous_missing_flag_commit_fails)
 VM_UNITTEST(vmm_alloc_contiguous_zero_size_fails)
 VM_UNITTEST(vmaspace_create_smoke_test)
 VM_UNITTEST(vmaspace_alloc_smoke_test)
+VM_UNITTEST(vmar_multiple_unmap_test)
+VM_UNITTEST(vmar_alloc_gap_test)
 VM_UNITTEST(vmo_create_test)
 VM_UNITTEST(vmo_pin_test)
 VM_UNITTEST(vmo_multiple_pin_test)
 VM_UNITTEST(vmo_commit_test)
+VM_UNITTEST(vmo_reclaim_zero_pages_test)
+VM_UNITTEST(vmo_compress_pages_test)
 VM_UNITTEST(vmo_odd_size_commit_test)
 VM_UNITTEST(vmo_contiguous_commit_test)
 VM_UNITTEST(vmo_precommitted_map_test)
 VM_UNITTEST(vmo_demand_paged_map_test)
+VM_UNITTEST(vmo_fault_around_test)
 VM_UNITTEST(vmo_dropped_ref_test)
 VM_UNITTEST(vmo_remap_test)
 VM_UNITTEST(vmo_double_remap_test)
 VM_UNITTEST(vmo_read_write_smoke_test)
 VM_UNITTEST(vmo_cache_test)
 VM_UNITTEST(vmo_lookup_test)
+VM_UNITTEST(vmo_move_pages_test)
+VM_UNITTEST(vmo_large_page_test)
+VM_UNITTEST(vmo_large_page_compressed_test)
+VM_UNITTEST(vmpl_sparse_pages_test)
 VM_UNITTEST(arch_noncontiguous_map)
 // Uncomment for debugging
 // VM_UNITTEST(dump_all_aspaces)  // Run last
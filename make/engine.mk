@@ -24,6 +24,7 @@ ENABLE_BUILD_SYSROOT ?= false
 ENABLE_BUILD_LISTFILES := $(call TOBOOL,$(ENABLE_BUILD_LISTFILES))
 ENABLE_BUILD_SYSROOT := $(call TOBOOL,$(ENABLE_BUILD_SYSROOT))
 ENABLE_DDK_DEPRECATIONS ?= false
+ENABLE_LOCK_STATS ?= false
 ENABLE_NEW_BOOTDATA := true
 DISABLE_UTEST ?= false
 ENABLE_ULIB_ONLY ?= false
@@ -387,6 +388,11 @@ MDI_HEADER := $(MDI_GEN_HEADER_DIR)/mdi/mdi-defs.h
 KERNEL_DEFINES += WITH_PANIC_BACKTRACE=1 WITH_FRAME_POINTERS=1
 KERNEL_COMPILEFLAGS += $(KEEP_FRAME_POINTER_COMPILEFLAGS)
 
+# Lock contention statistics, see kernel/include/lib/lockstat.h
+ifeq ($(call TOBOOL,$(ENABLE_LOCK_STATS)),true)
+KERNEL_DEFINES += ENABLE_LOCK_STATS=1
+endif
+
 # userspace boot file system generated by the build system
 USER_BOOTDATA := $(BUILDDIR)/bootdata.bin
 USER_FS := $(BUILDDIR)/user.fs
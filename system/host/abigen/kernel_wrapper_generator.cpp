@@ -95,10 +95,12 @@ bool KernelWrapperGenerator::syscall(ofstream& os, const Syscall& sc) {
         os << inin << "return ZX_ERR_BAD_STATE;\n";
     } else {
         for (const auto& arg : out_handles) {
-            os << inin << "if (out_handle_" << arg
+            os << inin << "zx_status_t copyout_status_" << arg
+               << " = out_handle_" << arg
                << ".begin_copyout(current_process, make_user_out_ptr("
-               << arg << ")))\n"
-               << inin << in << "return ZX_ERR_INVALID_ARGS;\n";
+               << arg << "));\n"
+               << inin << "if (copyout_status_" << arg << " != ZX_OK)\n"
+               << inin << in << "return copyout_status_" << arg << ";\n";
         }
         for (const auto& arg : out_handles) {
             os << inin << "out_handle_" << arg
@@ -46,7 +46,7 @@ KTRACE_DEF(0x131,32B,CHANNEL_WRITE,IPC) // id0, bytes, handles
 KTRACE_DEF(0x132,32B,CHANNEL_READ,IPC) // id1, bytes, handles
 
 KTRACE_DEF(0x140,32B,PORT_WAIT,IPC) // id
-KTRACE_DEF(0x141,32B,PORT_WAIT_DONE,IPC) // id, status
+KTRACE_DEF(0x141,32B,PORT_WAIT_DONE,IPC) // id, status, count
 KTRACE_DEF(0x142,32B,PORT_CREATE,IPC) // id
 KTRACE_DEF(0x143,32B,PORT_QUEUE,IPC) // id, size
 
@@ -57,6 +57,8 @@ KTRACE_DEF(0x160,32B,KWAIT_BLOCK,SCHEDULER) // queue_hi, queue_hi
 KTRACE_DEF(0x161,32B,KWAIT_WAKE,SCHEDULER) // queue_hi, queue_hi, is_mutex
 KTRACE_DEF(0x162,32B,KWAIT_UNBLOCK,SCHEDULER) // queue_hi, queue_hi, blocked_status
 
+KTRACE_DEF(0x163,32B,DEADLINE_MISS,SCHEDULER) // tid, cpu, lateness_lo, lateness_hi
+
 KTRACE_DEF(0x170,32B,VCPU_ENTER,TASKS)
 KTRACE_DEF(0x171,32B,VCPU_EXIT,TASKS) // meta
 KTRACE_DEF(0x172,32B,VCPU_BLOCK,TASKS) // meta
@@ -76,6 +78,9 @@ KTRACE_DEF(0x203,32B,IPT_PROCESS_CREATE,ARCH) // pid, cr3
 // purposes. Let's keep the record size constant - these are infrequently used.
 KTRACE_DEF(0x204,32B,IPM_START,ARCH)
 KTRACE_DEF(0x205,32B,IPM_STOP,ARCH)
+
+// One per TLB shootdown of a page table change.
+KTRACE_DEF(0x206,32B,TLB_SHOOTDOWN,ARCH) // target cpu mask, ipis, pages (0 if full), global
 #endif
 
 #undef KTRACE_DEF
@@ -33,6 +33,11 @@ typedef enum {
     ZX_INFO_HANDLE_COUNT               = 19, // zx_info_handle_count_t[1]
     ZX_INFO_BTI                        = 20, // zx_info_bti_t[1]
     ZX_INFO_PROCESS_HANDLE_STATS       = 21, // zx_info_process_handle_stats_t[1]
+    ZX_INFO_JOB                        = 22, // zx_info_job_t[1]
+    ZX_INFO_LOCK_STATS                 = 23, // zx_info_lock_stats_t[n]
+    ZX_INFO_PROCESS_CHANNEL_STATS      = 24, // zx_info_process_channel_stats_t[1]
+    ZX_INFO_PROCESS_PORT_STATS         = 25, // zx_info_process_port_stats_t[1]
+    ZX_INFO_PORT_PACKET_STATS          = 26, // zx_info_port_packet_stats_t[1]
     ZX_INFO_LAST
 } zx_object_info_topic_t;
 
@@ -73,6 +78,37 @@ typedef struct zx_info_process_handle_stats {
     uint32_t handle_count[64];
 } zx_info_process_handle_stats_t;
 
+typedef struct zx_info_process_channel_stats {
+    // The channel messages written by the process that have not been read
+    // or discarded yet, and the kernel memory they take up.
+    uint64_t queued_messages;
+    uint64_t queued_bytes;
+
+    // The most kernel memory that messages written by the process took up at
+    // any one time.
+    uint64_t peak_queued_bytes;
+
+    // All of the channel messages ever written by the process, and the kernel
+    // memory they took up.
+    uint64_t total_messages;
+    uint64_t total_bytes;
+} zx_info_process_channel_stats_t;
+
+typedef struct zx_info_process_port_stats {
+    // The packets queued by the process with zx_port_queue() that have not
+    // been dequeued yet, and the most there may be at once.
+    uint64_t pending_packets;
+    uint64_t max_pending_packets;
+
+    // The most packets the process had pending at any one time.
+    uint64_t peak_pending_packets;
+
+    // All of the packets ever queued by the process, and the number of times
+    // queuing one failed because the process had too many pending.
+    uint64_t total_packets;
+    uint64_t quota_failures;
+} zx_info_process_port_stats_t;
+
 typedef struct zx_info_process {
     // The process's return code; only valid if |exited| is true.
     // Guaranteed to be non-zero if the process was killed by |zx_task_kill|.
@@ -106,6 +142,24 @@ typedef struct zx_info_thread_stats {
     zx_duration_t total_runtime;
 } zx_info_thread_stats_t;
 
+typedef struct zx_info_job {
+    // The CPU bandwidth limit set with ZX_JOB_POL_CPU_BANDWIDTH, or zero if
+    // the job is not limited.
+    zx_duration_t cpu_quota;
+    zx_duration_t cpu_period;
+
+    // Total CPU time used by threads in the job and its descendants.
+    zx_duration_t cpu_runtime;
+
+    // Total time the job has spent throttled for going over its quota, and
+    // the number of times it has been throttled.
+    zx_duration_t cpu_throttled_time;
+    uint64_t cpu_throttled_count;
+
+    // True if the job is throttled right now.
+    bool cpu_throttled;
+} zx_info_job_t;
+
 // Statistics about resources (e.g., memory) used by a task. Can be relatively
 // expensive to gather.
 typedef struct zx_info_task_stats {
@@ -336,8 +390,43 @@ typedef struct zx_info_kmem_stats {
 
     // Non-free memory that isn't accounted for in any other field.
     uint64_t other_bytes;
+
+    // The amount of memory in the kernel's pool of channel message buffers,
+    // including free buffers it keeps for reuse. Added after |other_bytes|;
+    // a buffer that ends before this field gets the fields before it, with
+    // this memory counted in |other_bytes|.
+    uint64_t ipc_bytes;
 } zx_info_kmem_stats_t;
 
+typedef struct zx_info_lock_stats {
+    // The name of the class of kernel locks these statistics are for.
+    char name[ZX_MAX_NAME_LEN];
+
+    // Number of times a lock of the class was acquired, and how many of
+    // those found it held and had to wait.
+    uint64_t acquisitions;
+    uint64_t contentions;
+
+    // Total and longest time spent waiting by the contended acquisitions.
+    zx_duration_t total_wait_time;
+    zx_duration_t max_wait_time;
+} zx_info_lock_stats_t;
+
+typedef struct zx_info_port_packet_stats {
+    // The packets allocated by the kernel for zx_port_queue() and exceptions
+    // that are in use, and the most there may be at once.
+    uint64_t allocated_packets;
+    uint64_t max_packets;
+
+    // The free packets held in the per-cpu caches.
+    uint64_t cached_packets;
+
+    // The number of packet allocations, and how many of those found the
+    // cache of their cpu empty.
+    uint64_t allocations;
+    uint64_t cache_misses;
+} zx_info_port_packet_stats_t;
+
 typedef struct zx_info_resource {
     // The resource kind, one of:
     // {ZX_RSRC_KIND_ROOT, ZX_RSRC_KIND_MMIO, ZX_RSRC_KIND_IOPORT, ZX_RSRC_KIND_IRQ}
@@ -377,6 +466,13 @@ typedef struct zx_info_resource {
 #define ZX_PROP_SOCKET_TX_BUF_MAX           10u
 #define ZX_PROP_SOCKET_TX_BUF_SIZE          11u
 
+// Argument is a uint32_t count of pages.
+#define ZX_PROP_VMO_FAULT_AROUND            12u
+#define ZX_VMO_FAULT_AROUND_DEFAULT         UINT32_MAX
+
+// Argument is a uint32_t, one of the ZX_VMO_LARGE_PAGES_* values.
+#define ZX_PROP_VMO_LARGE_PAGES             13u
+
 // Describes how important a job is.
 typedef int32_t zx_job_importance_t;
 
@@ -26,6 +26,17 @@ typedef struct zx_policy_basic {
     uint32_t policy;
 } zx_policy_basic_t;
 
+// CPU bandwidth policy topic.
+#define ZX_JOB_POL_CPU_BANDWIDTH            1u
+
+// Input structure to use with ZX_JOB_POL_CPU_BANDWIDTH. Threads in the job and
+// its descendants may together run for at most |quota| in every |period|. A
+// |quota| of 0 removes the limit.
+typedef struct zx_policy_cpu_bandwidth {
+    zx_duration_t quota;
+    zx_duration_t period;
+} zx_policy_cpu_bandwidth_t;
+
 // Conditions handled by job policy.
 #define ZX_POL_BAD_HANDLE                    0u
 #define ZX_POL_WRONG_OBJECT                  1u
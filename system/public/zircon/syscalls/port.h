@@ -21,6 +21,9 @@ __BEGIN_CDECLS
 #define ZX_PKT_TYPE_GUEST_IO        0x05u
 #define ZX_PKT_TYPE_GUEST_VCPU      0x06u
 #define ZX_PKT_TYPE_EXCEPTION(n)    (0x07u | (((n) & 0xFFu) << 8))
+// Follows the last packet returned by zx_port_wait() when it returns fewer
+// packets than asked for.
+#define ZX_PKT_TYPE_NONE            0xFFu
 
 #define ZX_PKT_TYPE_MASK            0xFFu
 
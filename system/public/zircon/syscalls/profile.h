@@ -12,6 +12,7 @@ __BEGIN_CDECLS
 // clang-format off
 
 #define ZX_PROFILE_INFO_SCHEDULER   1
+#define ZX_PROFILE_INFO_DEADLINE    2
 
 typedef struct zx_profile_scheduler {
     uint32_t priority;
@@ -20,11 +21,23 @@ typedef struct zx_profile_scheduler {
     uint32_t quantum;
 } zx_profile_scheduler_t;
 
-
+// A thread with a deadline profile is guaranteed |runtime| of cpu time in
+// every |period|, delivered within |deadline| of the start of the period.
+// Requires 0 < runtime <= deadline <= period.
+typedef struct zx_profile_deadline {
+    zx_duration_t runtime;
+    zx_duration_t deadline;
+    zx_duration_t period;
+} zx_profile_deadline_t;
+
+// ABI note: adding zx_profile_deadline_t made the union 8-byte aligned. That
+// moved |scheduler| from offset 4 to offset 8 and grew the struct from 20 to
+// 32 bytes, so callers built against the older layout must be rebuilt.
 typedef struct zx_profile_info {
     uint32_t type;                  // one of ZX_PROFILE_INFO_
     union {
         zx_profile_scheduler_t scheduler;
+        zx_profile_deadline_t deadline;
     };
 } zx_profile_info_t;
 
@@ -291,6 +291,8 @@ typedef uint64_t zx_off_t;
 
 // Channel options and limits.
 #define ZX_CHANNEL_READ_MAY_DISCARD         1u
+#define ZX_CHANNEL_READ_MOVE_PAGES          2u
+#define ZX_CHANNEL_WRITE_MOVE_PAGES         1u
 
 #define ZX_CHANNEL_MAX_MSG_BYTES            65536u
 #define ZX_CHANNEL_MAX_MSG_HANDLES          64u
@@ -318,6 +320,11 @@ typedef uint64_t zx_off_t;
 #define ZX_CACHE_POLICY_WRITE_COMBINING     3u
 #define ZX_CACHE_POLICY_MASK                3u
 
+// VM Object large page policies
+#define ZX_VMO_LARGE_PAGES_DEFAULT          0u
+#define ZX_VMO_LARGE_PAGES_ALWAYS           1u
+#define ZX_VMO_LARGE_PAGES_NEVER            2u
+
 // Flag bits for zx_cache_flush.
 #define ZX_CACHE_FLUSH_INSN         (1u << 0)
 #define ZX_CACHE_FLUSH_DATA         (1u << 1)
@@ -6,6 +6,7 @@
 #include <errno.h>
 #include <getopt.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -34,10 +35,12 @@ struct TestArgs {
     uint32_t queue;
 };
 
-void do_test(uint32_t duration, const TestArgs& test_args) {
+void do_test(uint32_t duration, uint32_t write_options, const TestArgs& test_args) {
     __UNUSED zx_status_t status;
 
     uint64_t duration_ns = duration * 1000000000ull;
+    const uint32_t read_options =
+        (write_options & ZX_CHANNEL_WRITE_MOVE_PAGES) ? ZX_CHANNEL_READ_MOVE_PAGES : 0u;
 
     // We'll write to mp[0] (and read from mp[1]).
     zx_handle_t mp[2] = {ZX_HANDLE_INVALID, ZX_HANDLE_INVALID};
@@ -48,10 +51,13 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
     zx_handle_t event;
     assert(zx_event_create(0u, &event) == ZX_OK);
 
-    // Storage space for our messages' stuff.
-    fbl::unique_ptr<uint8_t[]> data;
+    // Storage space for our messages' stuff. The data is page aligned so that
+    // large messages can have their pages moved rather than copied.
+    uint8_t* data = nullptr;
     if (test_args.size) {
-        data.reset(new uint8_t[test_args.size]);
+        data = static_cast<uint8_t*>(
+            aligned_alloc(PAGE_SIZE, fbl::round_up(test_args.size, PAGE_SIZE)));
+        assert(data);
         for (uint32_t i = 0; i < test_args.size; i++)
             data[i] = static_cast<uint8_t>(i);
     }
@@ -62,7 +68,7 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
     // Pre-queue |test_args.queue| messages (there'll always be this many messages in the queue).
     for (uint32_t i = 0; i < test_args.queue; i++) {
         duplicate_handles(test_args.handles, event, handles.get());
-        status = zx_channel_write(mp[0], 0u, data.get(), test_args.size,
+        status = zx_channel_write(mp[0], write_options, data, test_args.size,
                                   handles.get(), test_args.handles);
         assert(status == ZX_OK);
     }
@@ -76,13 +82,13 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
     for (;;) {
         big_its++;
         for (uint32_t i = 0; i < big_it_size; i++) {
-            status = zx_channel_write(mp[0], 0, data.get(), test_args.size,
+            status = zx_channel_write(mp[0], write_options, data, test_args.size,
                                       handles.get(), test_args.handles);
             assert(status == ZX_OK);
 
             uint32_t r_size = test_args.size;
             uint32_t r_handles = test_args.handles;
-            status = zx_channel_read(mp[1], 0u, data.get(), handles.get(), r_size,
+            status = zx_channel_read(mp[1], read_options, data, handles.get(), r_size,
                                      r_handles, &r_size, &r_handles);
             assert(status == ZX_OK);
             assert(r_size == test_args.size);
@@ -104,12 +110,15 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
     assert(status == ZX_OK);
     status = zx_handle_close(mp[1]);
     assert(status == ZX_OK);
+    free(data);
 
     double real_duration = static_cast<double>(end_ns - start_ns) / 1000000000.0;
     double its_per_second = static_cast<double>(big_its) * big_it_size / real_duration;
-    printf("write/read %" PRIu32 " bytes, %" PRIu32 " handles (%" PRIu32 " pre-queued): "
+    printf("write/read %" PRIu32 " bytes, %" PRIu32 " handles (%" PRIu32 " pre-queued)%s: "
                "%.0f iterations/second\n",
-           test_args.size, test_args.handles, test_args.queue, its_per_second);
+           test_args.size, test_args.handles, test_args.queue,
+           (write_options & ZX_CHANNEL_WRITE_MOVE_PAGES) ? ", moving pages" : "",
+           its_per_second);
 }
 
 }  // namespace
@@ -126,11 +135,13 @@ int main(int argc, char** argv) {
         "  -d N  set test duration to N seconds (default: 5)\n"
         "  -S N  set message size to N bytes (default: 10)\n"
         "  -H N  set message handle count to N handles (default: 0)\n"
-        "  -Q N  set message pre-queue count to N messages (default: 0)\n";
+        "  -Q N  set message pre-queue count to N messages (default: 0)\n"
+        "  -M    write and read with ZX_CHANNEL_{WRITE,READ}_MOVE_PAGES\n";
 
     bool run_suite = false;  // -o/-s
     uint32_t duration = 5;   // -d
     uint32_t repeats = 1;    // -n
+    uint32_t write_options = 0u; // -M
     // Ignored when running a suite:
     TestArgs test_args = {
         10,                  // -S (size)
@@ -139,7 +150,7 @@ int main(int argc, char** argv) {
     };
 
     int opt;
-    while ((opt = getopt(argc, argv, "+hosn:d:S:H:Q:")) != -1) {
+    while ((opt = getopt(argc, argv, "+hosMn:d:S:H:Q:")) != -1) {
         // Our option values are always unsigned numbers.
         uint32_t value = 0;
         if (optarg) {
@@ -161,6 +172,9 @@ int main(int argc, char** argv) {
             case 's':
                 run_suite = true;
                 break;
+            case 'M':
+                write_options = ZX_CHANNEL_WRITE_MOVE_PAGES;
+                break;
             case 'n':
                 assert(optarg);
                 repeats = value;
@@ -214,11 +228,16 @@ int main(int argc, char** argv) {
                 {10, 0, 1},
                 {100, 0, 1},
                 {1000, 0, 1},
+                {4096, 0, 0},
+                {16384, 0, 0},
+                {32768, 0, 0},
+                {65536, 0, 0},
+                {65536, 0, 1},
             };
             for (size_t i = 0; i < fbl::count_of(suite); i++)
-                do_test(duration, suite[i]);
+                do_test(duration, write_options, suite[i]);
         } else {
-            do_test(duration, test_args);
+            do_test(duration, write_options, test_args);
         }
     }
 
@@ -147,11 +147,56 @@ static zx_status_t memstats(zx_handle_t root_resource) {
     return ZX_OK;
 }
 
+static zx_status_t lockstats(zx_handle_t root_resource) {
+    // Ask with a guess at the number of lock classes, then again with as many
+    // as the kernel says it has, until they all fit.
+    zx_info_lock_stats_t* stats = NULL;
+    size_t count = 64;
+    size_t actual, avail;
+    for (;;) {
+        zx_info_lock_stats_t* grown = realloc(stats, count * sizeof(*stats));
+        if (grown == NULL) {
+            free(stats);
+            fprintf(stderr, "cannot allocate stats for %zu lock classes\n", count);
+            return ZX_ERR_NO_MEMORY;
+        }
+        stats = grown;
+
+        zx_status_t err = zx_object_get_info(
+            root_resource, ZX_INFO_LOCK_STATS, stats, count * sizeof(*stats), &actual, &avail);
+        if (err != ZX_OK) {
+            free(stats);
+            fprintf(stderr, "ZX_INFO_LOCK_STATS returns %d (%s)\n",
+                    err, zx_status_get_string(err));
+            if (err == ZX_ERR_NOT_SUPPORTED) {
+                fprintf(stderr, "the kernel must be built with ENABLE_LOCK_STATS=true\n");
+            }
+            return err;
+        }
+        if (actual == avail)
+            break;
+        count = avail;
+    }
+
+    printf("%-24s %14s %12s %14s %10s %10s\n",
+           "lock class", "acquisitions", "contentions", "wait ns", "avg ns", "max ns");
+    for (size_t i = 0; i < actual; i++) {
+        printf("%-24s %14" PRIu64 " %12" PRIu64 " %14" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n",
+               stats[i].name, stats[i].acquisitions, stats[i].contentions,
+               stats[i].total_wait_time,
+               stats[i].contentions ? stats[i].total_wait_time / stats[i].contentions : 0,
+               stats[i].max_wait_time);
+    }
+    free(stats);
+    return ZX_OK;
+}
+
 static void print_help(FILE* f) {
     fprintf(f, "Usage: kstats [options]\n");
     fprintf(f, "Options:\n");
     fprintf(f, " -c              Print system CPU stats\n");
     fprintf(f, " -m              Print system memory stats\n");
+    fprintf(f, " -l              Print kernel lock contention stats\n");
     fprintf(f, " -d <delay>      Delay in seconds (default 1 second)\n");
     fprintf(f, " -n <times>      Run this many times and then exit\n");
     fprintf(f, " -t              Print timestamp for each report\n");
@@ -179,12 +224,13 @@ static void print_help(FILE* f) {
 int main(int argc, char** argv) {
     bool cpu_stats = false;
     bool mem_stats = false;
+    bool lock_stats = false;
     zx_time_t delay = ZX_SEC(1);
     int num_loops = -1;
     bool timestamp = false;
 
     int c;
-    while ((c = getopt(argc, argv, "cd:n:hmt")) > 0) {
+    while ((c = getopt(argc, argv, "cd:n:hlmt")) > 0) {
         switch (c) {
             case 'c':
                 cpu_stats = true;
@@ -208,6 +254,9 @@ int main(int argc, char** argv) {
             case 'h':
                 print_help(stdout);
                 return 0;
+            case 'l':
+                lock_stats = true;
+                break;
             case 'm':
                 mem_stats = true;
                 break;
@@ -221,7 +270,7 @@ int main(int argc, char** argv) {
         }
     }
 
-    if (!cpu_stats && !mem_stats) {
+    if (!cpu_stats && !mem_stats && !lock_stats) {
         fprintf(stderr, "No statistics selected\n");
         print_help(stderr);
         return 1;
@@ -258,6 +307,9 @@ int main(int argc, char** argv) {
         if (mem_stats) {
             ret |= memstats(root_resource);
         }
+        if (lock_stats) {
+            ret |= lockstats(root_resource);
+        }
 
         if (ret != ZX_OK)
             break;
@@ -363,6 +363,7 @@ zx_status_t dump_kernel_memory() {
     print_kernel_json("wired", "kernel/physmem", stats.wired_bytes);
     print_kernel_json("mmu", "kernel/physmem", stats.mmu_overhead_bytes);
     print_kernel_json("other", "kernel/physmem", stats.other_bytes);
+    print_kernel_json("ipc", "kernel/physmem", stats.ipc_bytes);
 
     return ZX_OK;
 }
@@ -7,6 +7,8 @@
 #include <assert.h>
 #include <stdatomic.h>
 #include <stdlib.h>
+#include <string.h>
+#include <threads.h>
 
 #include <zircon/assert.h>
 #include <zircon/listnode.h>
@@ -21,6 +23,9 @@
 // The port wait key associated with the dispatcher's control messages.
 #define KEY_CONTROL (0u)
 
+// The most packets a dispatch thread takes from the port at once.
+#define MAX_BATCH_PACKETS (16u)
+
 static zx_time_t async_loop_now(async_t* async);
 static zx_status_t async_loop_begin_wait(async_t* async, async_wait_t* wait);
 static zx_status_t async_loop_cancel_wait(async_t* async, async_wait_t* wait);
@@ -64,9 +69,32 @@ typedef struct async_loop {
     list_node_t task_list;   // pending tasks, earliest deadline first
     list_node_t due_list;    // due tasks, earliest deadline first
     list_node_t thread_list; // earliest created thread first
+
+    // Packets a batch had taken from the port when the loop quit, dispatched
+    // first once the loop runs again.  Guarded by |lock|.
+    zx_port_packet_t stash[MAX_BATCH_PACKETS];
+    size_t stash_count;
 } async_loop_t;
 
+// Packets a thread has taken from the port of |loop| and not dispatched yet.
+// Handlers run on the same thread may cancel waits whose packets are pending
+// here, which then must not be dispatched.
+typedef struct packet_batch {
+    async_loop_t* loop;
+    struct packet_batch* outer; // batch of a loop this one runs nested in
+    zx_port_packet_t packets[MAX_BATCH_PACKETS];
+    size_t count;
+    size_t next;
+} packet_batch_t;
+
+static thread_local packet_batch_t* t_batch;
+
 static zx_status_t async_loop_run_once(async_loop_t* loop, zx_time_t deadline);
+static zx_status_t async_loop_run_batch(async_loop_t* loop, zx_time_t deadline);
+static zx_status_t async_loop_dispatch(async_loop_t* loop, zx_port_packet_t* packet);
+static size_t async_loop_stash(async_loop_t* loop, const zx_port_packet_t* packets, size_t count);
+static size_t async_loop_unstash(async_loop_t* loop, zx_port_packet_t* packets, size_t count);
+static bool async_loop_drop_pending_wait(async_loop_t* loop, async_wait_t* wait);
 static zx_status_t async_loop_dispatch_wait(async_loop_t* loop, async_wait_t* wait,
                                             zx_status_t status, const zx_packet_signal_t* signal);
 static zx_status_t async_loop_dispatch_tasks(async_loop_t* loop);
@@ -174,6 +202,11 @@ void async_loop_shutdown(async_t* async) {
     async_loop_wake_threads(loop);
     async_loop_join_threads(async);
 
+    // Stashed waits are canceled along with the rest of the wait list.
+    mtx_lock(&loop->lock);
+    loop->stash_count = 0u;
+    mtx_unlock(&loop->lock);
+
     list_node_t* node;
     while ((node = list_remove_head(&loop->wait_list))) {
         async_wait_t* wait = node_to_wait(node);
@@ -212,7 +245,8 @@ zx_status_t async_loop_run(async_t* async, zx_time_t deadline, bool once) {
     zx_status_t status;
     atomic_fetch_add_explicit(&loop->active_threads, 1u, memory_order_acq_rel);
     do {
-        status = async_loop_run_once(loop, deadline);
+        status = once ? async_loop_run_once(loop, deadline)
+                      : async_loop_run_batch(loop, deadline);
     } while (status == ZX_OK && !once);
     atomic_fetch_sub_explicit(&loop->active_threads, 1u, memory_order_acq_rel);
     return status;
@@ -226,45 +260,150 @@ zx_status_t async_loop_run_until_idle(async_t* async) {
     return status;
 }
 
-static zx_status_t async_loop_run_once(async_loop_t* loop, zx_time_t deadline) {
+static zx_status_t async_loop_check_runnable(async_loop_t* loop) {
     async_loop_state_t state = atomic_load_explicit(&loop->state, memory_order_acquire);
     if (state == ASYNC_LOOP_SHUTDOWN)
         return ZX_ERR_BAD_STATE;
     if (state != ASYNC_LOOP_RUNNABLE)
         return ZX_ERR_CANCELED;
+    return ZX_OK;
+}
+
+static zx_status_t async_loop_run_once(async_loop_t* loop, zx_time_t deadline) {
+    zx_status_t status = async_loop_check_runnable(loop);
+    if (status != ZX_OK)
+        return status;
 
     zx_port_packet_t packet;
-    zx_status_t status = zx_port_wait(loop->port, deadline, &packet, 0);
+    if (async_loop_unstash(loop, &packet, 1u) == 0u) {
+        status = zx_port_wait(loop->port, deadline, &packet, 1u);
+        if (status != ZX_OK)
+            return status;
+    }
+
+    return async_loop_dispatch(loop, &packet);
+}
+
+static zx_status_t async_loop_run_batch(async_loop_t* loop, zx_time_t deadline) {
+    zx_status_t status = async_loop_check_runnable(loop);
     if (status != ZX_OK)
         return status;
 
-    if (packet.key == KEY_CONTROL) {
+    // Taking many packets at once saves syscalls, but leaves the other threads
+    // of a multi-threaded loop nothing to do, so only a lone thread does.
+    packet_batch_t batch = {.loop = loop, .outer = t_batch};
+    size_t count = 1u;
+    if (atomic_load_explicit(&loop->active_threads, memory_order_acquire) == 1u)
+        count = MAX_BATCH_PACKETS;
+    batch.count = async_loop_unstash(loop, batch.packets, count);
+    if (batch.count == 0u) {
+        status = zx_port_wait(loop->port, deadline, batch.packets, count);
+        if (status != ZX_OK)
+            return status;
+        while (batch.count < count && batch.packets[batch.count].type != ZX_PKT_TYPE_NONE)
+            batch.count++;
+    }
+
+    // Every thread of the loop needs a wake-up packet of its own, so pass on
+    // any beyond the first to the others.
+    bool woken = false;
+    for (size_t i = 0; i < batch.count; i++) {
+        zx_port_packet_t* packet = &batch.packets[i];
+        if (packet->key != KEY_CONTROL || packet->type != ZX_PKT_TYPE_USER)
+            continue;
+        if (woken) {
+            status = zx_port_queue(loop->port, packet, 0u);
+            ZX_DEBUG_ASSERT_MSG(status == ZX_OK, "status=%d", status);
+            packet->type = ZX_PKT_TYPE_NONE;
+        }
+        woken = true;
+    }
+
+    // A handler may quit or shut down the loop, and other threads may do so
+    // at any time. The packets cannot be put back in the port, so on quit the
+    // rest are stashed for the next run, and on shutdown they are dropped.
+    t_batch = &batch;
+    status = ZX_OK;
+    while (batch.next < batch.count && status == ZX_OK) {
+        async_loop_state_t state = atomic_load_explicit(&loop->state, memory_order_acquire);
+        if (state == ASYNC_LOOP_QUIT) {
+            batch.next += async_loop_stash(loop, &batch.packets[batch.next],
+                                           batch.count - batch.next);
+            if (batch.next == batch.count) {
+                status = ZX_ERR_CANCELED;
+                break;
+            }
+        } else if (state == ASYNC_LOOP_SHUTDOWN) {
+            status = ZX_ERR_BAD_STATE;
+            break;
+        }
+        status = async_loop_dispatch(loop, &batch.packets[batch.next++]);
+    }
+    t_batch = batch.outer;
+    return status;
+}
+
+static size_t async_loop_stash(async_loop_t* loop, const zx_port_packet_t* packets, size_t count) {
+    // Wake-up packets were meant for the quit itself. If the stash is full, which
+    // takes several threads quitting at once, the rest are dispatched after all.
+    size_t taken = 0u;
+    mtx_lock(&loop->lock);
+    for (; taken < count; taken++) {
+        const zx_port_packet_t* packet = &packets[taken];
+        if (packet->type == ZX_PKT_TYPE_NONE ||
+            (packet->key == KEY_CONTROL && packet->type == ZX_PKT_TYPE_USER))
+            continue;
+        if (loop->stash_count == MAX_BATCH_PACKETS)
+            break;
+        loop->stash[loop->stash_count++] = *packet;
+    }
+    mtx_unlock(&loop->lock);
+    return taken;
+}
+
+static size_t async_loop_unstash(async_loop_t* loop, zx_port_packet_t* packets, size_t count) {
+    mtx_lock(&loop->lock);
+    if (count > loop->stash_count)
+        count = loop->stash_count;
+    memcpy(packets, loop->stash, count * sizeof(*packets));
+    loop->stash_count -= count;
+    memmove(loop->stash, loop->stash + count, loop->stash_count * sizeof(*packets));
+    mtx_unlock(&loop->lock);
+    return count;
+}
+
+static zx_status_t async_loop_dispatch(async_loop_t* loop, zx_port_packet_t* packet) {
+    // Skip packets dropped from a batch.
+    if (packet->type == ZX_PKT_TYPE_NONE)
+        return ZX_OK;
+
+    if (packet->key == KEY_CONTROL) {
         // Handle wake-up packets.
-        if (packet.type == ZX_PKT_TYPE_USER)
+        if (packet->type == ZX_PKT_TYPE_USER)
             return ZX_OK;
 
         // Handle task timer expirations.
-        if (packet.type == ZX_PKT_TYPE_SIGNAL_REP &&
-            packet.signal.observed & ZX_TIMER_SIGNALED) {
+        if (packet->type == ZX_PKT_TYPE_SIGNAL_REP &&
+            packet->signal.observed & ZX_TIMER_SIGNALED) {
             return async_loop_dispatch_tasks(loop);
         }
     } else {
         // Handle wait completion packets.
-        if (packet.type == ZX_PKT_TYPE_SIGNAL_ONE) {
-            async_wait_t* wait = (void*)(uintptr_t)packet.key;
-            return async_loop_dispatch_wait(loop, wait, packet.status, &packet.signal);
+        if (packet->type == ZX_PKT_TYPE_SIGNAL_ONE) {
+            async_wait_t* wait = (void*)(uintptr_t)packet->key;
+            return async_loop_dispatch_wait(loop, wait, packet->status, &packet->signal);
         }
 
         // Handle queued user packets.
-        if (packet.type == ZX_PKT_TYPE_USER) {
-            async_receiver_t* receiver = (void*)(uintptr_t)packet.key;
-            return async_loop_dispatch_packet(loop, receiver, packet.status, &packet.user);
+        if (packet->type == ZX_PKT_TYPE_USER) {
+            async_receiver_t* receiver = (void*)(uintptr_t)packet->key;
+            return async_loop_dispatch_packet(loop, receiver, packet->status, &packet->user);
         }
 
         // Handle guest bell trap packets.
-        if (packet.type == ZX_PKT_TYPE_GUEST_BELL) {
-            async_guest_bell_trap_t* trap = (void*)(uintptr_t)packet.key;
-            return async_loop_dispatch_guest_bell_trap(loop, trap, &packet.guest_bell);
+        if (packet->type == ZX_PKT_TYPE_GUEST_BELL) {
+            async_guest_bell_trap_t* trap = (void*)(uintptr_t)packet->key;
+            return async_loop_dispatch_guest_bell_trap(loop, trap, &packet->guest_bell);
         }
     }
 
@@ -491,6 +630,8 @@ static zx_status_t async_loop_cancel_wait(async_t* async, async_wait_t* wait) {
     // invoked again past this point.
     zx_status_t status = zx_port_cancel(loop->port, wait->object,
                                         (uintptr_t)wait);
+    if (status == ZX_ERR_NOT_FOUND && async_loop_drop_pending_wait(loop, wait))
+        status = ZX_OK;
     if (status == ZX_OK && (wait->flags & ASYNC_FLAG_HANDLE_SHUTDOWN)) {
         mtx_lock(&loop->lock);
         list_delete(wait_to_node(wait));
@@ -499,6 +640,36 @@ static zx_status_t async_loop_cancel_wait(async_t* async, async_wait_t* wait) {
     return status;
 }
 
+static bool async_loop_drop_pending_wait(async_loop_t* loop, async_wait_t* wait) {
+    // A packet for |wait| taken from the port by the current thread can still
+    // be canceled if the thread has not dispatched it yet.
+    for (packet_batch_t* batch = t_batch; batch; batch = batch->outer) {
+        if (batch->loop != loop)
+            continue;
+        for (size_t i = batch->next; i < batch->count; i++) {
+            zx_port_packet_t* packet = &batch->packets[i];
+            if (packet->key == (uintptr_t)wait && packet->type == ZX_PKT_TYPE_SIGNAL_ONE) {
+                packet->type = ZX_PKT_TYPE_NONE;
+                return true;
+            }
+        }
+    }
+
+    // So can one stashed when the loop quit.
+    bool dropped = false;
+    mtx_lock(&loop->lock);
+    for (size_t i = 0; i < loop->stash_count; i++) {
+        zx_port_packet_t* packet = &loop->stash[i];
+        if (packet->key == (uintptr_t)wait && packet->type == ZX_PKT_TYPE_SIGNAL_ONE) {
+            packet->type = ZX_PKT_TYPE_NONE;
+            dropped = true;
+            break;
+        }
+    }
+    mtx_unlock(&loop->lock);
+    return dropped;
+}
+
 static zx_status_t async_loop_post_task(async_t* async, async_task_t* task) {
     async_loop_t* loop = (async_loop_t*)async;
     ZX_DEBUG_ASSERT(loop);
@@ -360,6 +360,16 @@ public:
         return internal_erase(&obj);
     }
 
+    // subtree_changed
+    //
+    // For trees whose Observer keeps state about the subtree under each node
+    // (see DefaultWAVLTreeObserver::kAugmented).  Call after changing "obj" in a
+    // way which changes that state, without changing its key, so that the state
+    // of "obj" and of all of its ancestors gets recomputed.
+    void subtree_changed(ValueType& obj) {
+        UpdateAugmentedPath(&obj);
+    }
+
     // clear
     //
     // Clear out the tree, unlinking all of the elements in the process.  For
@@ -694,6 +704,7 @@ private:
 
             ++count_;
             Observer::RecordInsert();
+            UpdateAugmentedPath(PtrTraits::GetRaw(root_));
             return;
         }
 
@@ -771,7 +782,9 @@ private:
         Observer::RecordInsert();
 
         // Finally, perform post-insert balance operations.
-        BalancePostInsert(PtrTraits::GetRaw(*owner));
+        RawPtrType inserted = PtrTraits::GetRaw(*owner);
+        BalancePostInsert(inserted);
+        UpdateAugmentedPath(inserted);
     }
 
     PtrType internal_erase(RawPtrType ptr) {
@@ -929,6 +942,11 @@ private:
             }
         }
 
+        // Every node whose subtree lost the target is an ancestor of its old
+        // parent, including any node which was swapped or rotated into place
+        // above it.
+        UpdateAugmentedPath(parent);
+
         // Release the pointer to the node we just removed back to the caller.
         return removed;
     }
@@ -990,9 +1008,26 @@ private:
         // caller.
         PtrTraits::Swap(GetLinkPtrToNode(old_node), new_node);
         pod_swap(old_ns.parent_, new_ns.parent_);
+        UpdateAugmentedPath(new_raw);
         return fbl::move(new_node);
     }
 
+    // UpdateAugmentedPath
+    //
+    // Tells an augmenting Observer that the subtrees under "node" and under
+    // each of its ancestors changed, from the bottom up, so each one gets to
+    // recompute its state from its children.  Compiles away for Observers
+    // which do not keep any such state.
+    void UpdateAugmentedPath(RawPtrType node) {
+        if (!Observer::kAugmented)
+            return;
+
+        while (PtrTraits::IsValid(node)) {
+            Observer::RecordSubtreeChanged(node);
+            node = NodeTraits::node_state(*node).parent_;
+        }
+    }
+
     template <typename BoundTraits>
     const_iterator internal_upper_lower_bound(const KeyType& key) const {
         RawPtrType node  = PtrTraits::GetRaw(root_);
@@ -1348,6 +1383,14 @@ private:
         Z_ns.parent_ = X;
         if (Y)
             NodeTraits::node_state(*Y).parent_ = Z;
+
+        // Z is now X's child, and the only nodes whose subtrees changed are Z
+        // and X, in that order.  If either is on the path of the insert or
+        // erase in progress, it gets fixed up again at the end of it.
+        if (Observer::kAugmented) {
+            Observer::RecordSubtreeChanged(Z);
+            Observer::RecordSubtreeChanged(X);
+        }
     }
 
     // PostInsertFixupLR<LRTraits>
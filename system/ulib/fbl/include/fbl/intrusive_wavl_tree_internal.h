@@ -26,7 +26,20 @@ class WAVLTreeChecker;
 // phase of rebalancing are considered to be part of the cost of rotation and
 // are not tallied in the overall promote/demote accounting.
 //
+// Observers may also be used to augment the tree with state about the subtree
+// under each node (such as the largest key in the subtree).  An Observer which
+// sets kAugmented is called with RecordSubtreeChanged for every node whose set
+// of descendants changed, after that node's children have been updated.  It is
+// expected to recompute the state of the node from the node and its immediate
+// children.  Users must call WAVLTree::subtree_changed after modifying a node
+// in a way which changes its state.
+//
 struct DefaultWAVLTreeObserver {
+    static constexpr bool kAugmented = false;
+
+    template <typename RawPtrType>
+    static void RecordSubtreeChanged(RawPtrType node) { }
+
     static void RecordInsert()               { }
     static void RecordInsertPromote()        { }
     static void RecordInsertRotation()       { }
@@ -97,6 +97,23 @@ protected:
     }
 };
 
+class CancelingWait : public TestWait {
+public:
+    CancelingWait(zx_handle_t object, zx_signals_t trigger)
+        : TestWait(object, trigger) {}
+
+    CancelingWait* other = nullptr;
+    zx_status_t cancel_status = ZX_ERR_INTERNAL;
+
+protected:
+    async_wait_result_t Handle(async_t* async, zx_status_t status,
+                               const zx_packet_signal_t* signal) override {
+        TestWait::Handle(async, status, signal);
+        other->cancel_status = other->op.Cancel(async);
+        return ASYNC_WAIT_FINISHED;
+    }
+};
+
 class TestTask {
 public:
     TestTask(zx_time_t deadline)
@@ -419,6 +436,32 @@ bool wait_test() {
     END_TEST;
 }
 
+bool wait_cancel_pending_test() {
+    BEGIN_TEST;
+
+    async::Loop loop;
+    zx::event event;
+    EXPECT_EQ(ZX_OK, zx::event::create(0u, &event), "create event");
+
+    // Both waits are notified at once, so the loop may take both of their
+    // packets from the port before running either handler. Whichever runs
+    // first cancels the other, which then must not run.
+    CancelingWait wait1(event.get(), ZX_USER_SIGNAL_0);
+    CancelingWait wait2(event.get(), ZX_USER_SIGNAL_0);
+    wait1.other = &wait2;
+    wait2.other = &wait1;
+    EXPECT_EQ(ZX_OK, wait1.op.Begin(loop.async()), "wait 1");
+    EXPECT_EQ(ZX_OK, wait2.op.Begin(loop.async()), "wait 2");
+
+    EXPECT_EQ(ZX_OK, event.signal(0u, ZX_USER_SIGNAL_0), "signal");
+    EXPECT_EQ(ZX_OK, loop.RunUntilIdle(), "run loop");
+    EXPECT_EQ(1u, wait1.run_count + wait2.run_count, "run count");
+    CancelingWait* canceled = wait1.run_count ? &wait2 : &wait1;
+    EXPECT_EQ(ZX_OK, canceled->cancel_status, "cancel status");
+
+    END_TEST;
+}
+
 bool wait_invalid_handle_test() {
     BEGIN_TEST;
 
@@ -696,6 +739,48 @@ bool receiver_shutdown_test() {
     END_TEST;
 }
 
+class QuitReceiver : public TestReceiver {
+protected:
+    void Handle(async_t* async, zx_status_t status, const zx_packet_user_t* data) override {
+        TestReceiver::Handle(async, status, data);
+        async_loop_quit(async);
+    }
+};
+
+bool receiver_quit_test() {
+    BEGIN_TEST;
+
+    async::Loop loop;
+
+    // Both packets are queued at once, so the loop may take both of them
+    // from the port before running either handler. The first quits the
+    // loop, so the second must wait until the loop runs again.
+    QuitReceiver receiver1;
+    TestReceiver receiver2;
+    EXPECT_EQ(ZX_OK, receiver1.op.Queue(loop.async()), "queue 1");
+    EXPECT_EQ(ZX_OK, receiver2.op.Queue(loop.async()), "queue 2");
+
+    EXPECT_EQ(ZX_ERR_CANCELED, loop.Run(), "run loop");
+    EXPECT_EQ(1u, receiver1.run_count, "run count 1");
+    EXPECT_EQ(0u, receiver2.run_count, "run count 2");
+
+    EXPECT_EQ(ZX_OK, loop.ResetQuit());
+    EXPECT_EQ(ZX_OK, loop.RunUntilIdle(), "run loop again");
+    EXPECT_EQ(1u, receiver1.run_count, "run count 1, again");
+    EXPECT_EQ(1u, receiver2.run_count, "run count 2, again");
+    EXPECT_EQ(ZX_OK, receiver2.last_status, "status 2");
+
+    // Once shut down, the loop drops whatever it had taken from the port.
+    EXPECT_EQ(ZX_OK, receiver1.op.Queue(loop.async()), "queue 1, again");
+    EXPECT_EQ(ZX_OK, receiver2.op.Queue(loop.async()), "queue 2, again");
+    EXPECT_EQ(ZX_ERR_CANCELED, loop.Run(), "run loop until quit");
+    loop.Shutdown();
+    EXPECT_EQ(2u, receiver1.run_count, "run count 1 after shutdown");
+    EXPECT_EQ(1u, receiver2.run_count, "run count 2 after shutdown");
+
+    END_TEST;
+}
+
 class GetDefaultDispatcherTask : public QuitTask {
 public:
     async_t* last_default_dispatcher;
@@ -981,6 +1066,7 @@ RUN_TEST(make_default_true_test)
 RUN_TEST(quit_test)
 RUN_TEST(time_test)
 RUN_TEST(wait_test)
+RUN_TEST(wait_cancel_pending_test)
 RUN_TEST(wait_invalid_handle_test)
 RUN_TEST(wait_shutdown_test)
 RUN_TEST(wait_method_test)
@@ -988,6 +1074,7 @@ RUN_TEST(task_test)
 RUN_TEST(task_shutdown_test)
 RUN_TEST(receiver_test)
 RUN_TEST(receiver_shutdown_test)
+RUN_TEST(receiver_quit_test)
 RUN_TEST(threads_have_default_dispatcher)
 for (int i = 0; i < 3; i++) {
     RUN_TEST(threads_quit)
@@ -3,7 +3,10 @@
 // found in the LICENSE file.
 
 #include <assert.h>
+#include <limits.h>
+#include <string.h>
 #include <zircon/compiler.h>
+#include <zircon/process.h>
 #include <zircon/rights.h>
 #include <zircon/syscalls.h>
 #include <zircon/syscalls/object.h>
@@ -294,6 +297,36 @@ static bool channel_duplicate_handles(void) {
     END_TEST;
 }
 
+static bool channel_write_failure_keeps_handles(void) {
+    BEGIN_TEST;
+
+    zx_handle_t channel[2];
+    ASSERT_EQ(zx_channel_create(0, &channel[0], &channel[1]), ZX_OK, "");
+    ASSERT_EQ(zx_handle_close(channel[1]), ZX_OK, "");
+
+    zx_handle_t events[2];
+    ASSERT_EQ(zx_event_create(0u, &events[0]), ZX_OK, "");
+    ASSERT_EQ(zx_event_create(0u, &events[1]), ZX_OK, "");
+
+    EXPECT_EQ(zx_channel_write(channel[0], 0u, NULL, 0, events, 2u), ZX_ERR_PEER_CLOSED, "");
+
+    // The handles are back at the values they had, and new handles do not
+    // take those values.
+    zx_handle_t other;
+    ASSERT_EQ(zx_event_create(0u, &other), ZX_OK, "");
+    EXPECT_NE(other, events[0], "");
+    EXPECT_NE(other, events[1], "");
+    EXPECT_EQ(zx_object_signal(events[0], 0u, ZX_USER_SIGNAL_0), ZX_OK, "");
+    EXPECT_EQ(zx_object_signal(events[1], 0u, ZX_USER_SIGNAL_0), ZX_OK, "");
+
+    EXPECT_EQ(zx_handle_close(other), ZX_OK, "");
+    EXPECT_EQ(zx_handle_close(events[0]), ZX_OK, "");
+    EXPECT_EQ(zx_handle_close(events[1]), ZX_OK, "");
+    EXPECT_EQ(zx_handle_close(channel[0]), ZX_OK, "");
+
+    END_TEST;
+}
+
 static const uint32_t multithread_read_num_messages = 5000u;
 
 #define MSG_UNSET       ((uint32_t)-1)
@@ -949,12 +982,87 @@ static bool channel_read_etc(void) {
     END_TEST;
 }
 
+static uint8_t large_message_byte(size_t i, uint32_t size) {
+    return (uint8_t)(i * 7u + size);
+}
+
+static bool large_message_matches(const uint8_t* data, uint32_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] != large_message_byte(i, size))
+            return false;
+    }
+    return true;
+}
+
+// Large messages are kept in pages by the kernel, which may be moved rather
+// than copied between page aligned buffers. Either way the reader sees the
+// bytes that were written.
+static bool channel_large_messages(void) {
+    BEGIN_TEST;
+
+    zx_handle_t channel[2];
+    ASSERT_EQ(zx_channel_create(0, &channel[0], &channel[1]), ZX_OK, "");
+
+    const size_t buffer_size = ZX_CHANNEL_MAX_MSG_BYTES + PAGE_SIZE;
+    zx_handle_t vmo;
+    ASSERT_EQ(zx_vmo_create(buffer_size * 2, 0u, &vmo), ZX_OK, "");
+    uintptr_t addr;
+    ASSERT_EQ(zx_vmar_map(zx_vmar_root_self(), 0u, vmo, 0u, buffer_size * 2,
+                          ZX_VM_FLAG_PERM_READ | ZX_VM_FLAG_PERM_WRITE, &addr), ZX_OK, "");
+    uint8_t* out = (uint8_t*)addr;
+    uint8_t* in = out + buffer_size;
+
+    static const uint32_t sizes[] = {PAGE_SIZE * 4, PAGE_SIZE * 4 + 100, ZX_CHANNEL_MAX_MSG_BYTES};
+    static const uint32_t options[] = {0u, ZX_CHANNEL_WRITE_MOVE_PAGES};
+    static const uint32_t read_options[] = {0u, ZX_CHANNEL_READ_MOVE_PAGES};
+    static const size_t offsets[] = {0u, 1u};
+
+    for (size_t s = 0; s < countof(sizes); s++) {
+        for (size_t o = 0; o < countof(options) * countof(read_options); o++) {
+            for (size_t a = 0; a < countof(offsets); a++) {
+                const uint32_t size = sizes[s];
+                uint8_t* wr = out + offsets[a];
+                uint8_t* rd = in + offsets[a];
+                for (size_t i = 0; i < size; i++)
+                    wr[i] = large_message_byte(i, size);
+                memset(in, 0, buffer_size);
+
+                const uint32_t write_option = options[o / countof(read_options)];
+                const uint32_t read_option = read_options[o % countof(read_options)];
+                EXPECT_EQ(zx_channel_write(channel[0], write_option, wr, size, NULL, 0u), ZX_OK, "");
+                uint32_t actual_bytes = 0u;
+                EXPECT_EQ(zx_channel_read(channel[1], read_option, rd, NULL, size, 0u,
+                                          &actual_bytes, NULL),
+                          ZX_OK, "");
+                EXPECT_EQ(actual_bytes, size, "");
+                EXPECT_TRUE(large_message_matches(rd, size), "read the wrong bytes");
+                if (write_option == 0u)
+                    EXPECT_TRUE(large_message_matches(wr, size), "written bytes changed");
+            }
+        }
+    }
+
+    EXPECT_EQ(zx_channel_write(channel[0], ~ZX_CHANNEL_WRITE_MOVE_PAGES, out, PAGE_SIZE, NULL, 0u),
+              ZX_ERR_INVALID_ARGS, "");
+    EXPECT_EQ(zx_channel_read(channel[1], ~(ZX_CHANNEL_READ_MAY_DISCARD | ZX_CHANNEL_READ_MOVE_PAGES),
+                              in, NULL, PAGE_SIZE, 0u, NULL, NULL),
+              ZX_ERR_NOT_SUPPORTED, "");
+
+    EXPECT_EQ(zx_vmar_unmap(zx_vmar_root_self(), addr, buffer_size * 2), ZX_OK, "");
+    EXPECT_EQ(zx_handle_close(vmo), ZX_OK, "");
+    EXPECT_EQ(zx_handle_close(channel[0]), ZX_OK, "");
+    EXPECT_EQ(zx_handle_close(channel[1]), ZX_OK, "");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(channel_tests)
 RUN_TEST(channel_test)
 RUN_TEST(channel_read_error_test)
 RUN_TEST(channel_close_test)
 RUN_TEST(channel_non_transferable)
 RUN_TEST(channel_duplicate_handles)
+RUN_TEST(channel_write_failure_keeps_handles)
 RUN_TEST(channel_multithread_read)
 RUN_TEST(channel_may_discard)
 RUN_TEST(channel_call)
@@ -963,6 +1071,7 @@ RUN_TEST(bad_channel_call_finish)
 RUN_TEST(channel_nest)
 RUN_TEST(channel_disallow_write_to_self)
 RUN_TEST(channel_read_etc)
+RUN_TEST(channel_large_messages)
 END_TEST_CASE(channel_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -920,6 +920,49 @@ bool handle_stats_control() {
     return true;
 }
 
+bool channel_stats_control() {
+    zx_info_process_channel_stats_t before;
+    zx_status_t status = zx_object_get_info(zx_process_self(), ZX_INFO_PROCESS_CHANNEL_STATS,
+                                            &before, sizeof(before), nullptr, nullptr);
+    ASSERT_EQ(status, ZX_OK);
+
+    zx_handle_t h1, h2;
+    ASSERT_EQ(zx_channel_create(0, &h1, &h2), ZX_OK);
+    char data[100] = {};
+    ASSERT_EQ(zx_channel_write(h1, 0, data, sizeof(data), nullptr, 0), ZX_OK);
+    ASSERT_EQ(zx_channel_write(h1, 0, data, sizeof(data), nullptr, 0), ZX_OK);
+
+    // Both messages are queued and charged to this process.
+    zx_info_process_channel_stats_t info;
+    status = zx_object_get_info(zx_process_self(), ZX_INFO_PROCESS_CHANNEL_STATS,
+                                &info, sizeof(info), nullptr, nullptr);
+    ASSERT_EQ(status, ZX_OK);
+    EXPECT_EQ(info.queued_messages, before.queued_messages + 2);
+    EXPECT_GE(info.queued_bytes, before.queued_bytes + 2 * sizeof(data));
+    EXPECT_GE(info.peak_queued_bytes, info.queued_bytes);
+    EXPECT_EQ(info.total_messages, before.total_messages + 2);
+
+    // Reading one releases its charge, closing the channel the other's.
+    uint32_t actual_bytes;
+    ASSERT_EQ(zx_channel_read(h2, 0, data, nullptr, sizeof(data), 0, &actual_bytes, nullptr),
+              ZX_OK);
+    status = zx_object_get_info(zx_process_self(), ZX_INFO_PROCESS_CHANNEL_STATS,
+                                &info, sizeof(info), nullptr, nullptr);
+    ASSERT_EQ(status, ZX_OK);
+    EXPECT_EQ(info.queued_messages, before.queued_messages + 1);
+
+    zx_handle_close(h2);
+    status = zx_object_get_info(zx_process_self(), ZX_INFO_PROCESS_CHANNEL_STATS,
+                                &info, sizeof(info), nullptr, nullptr);
+    ASSERT_EQ(status, ZX_OK);
+    EXPECT_EQ(info.queued_messages, before.queued_messages);
+    EXPECT_EQ(info.queued_bytes, before.queued_bytes);
+    EXPECT_EQ(info.total_messages, before.total_messages + 2);
+
+    zx_handle_close(h1);
+    return true;
+}
+
 } // namespace
 
 // Tests that should pass for any topic. Use the wrappers below instead of
@@ -1038,6 +1081,17 @@ RUN_TEST(handle_count_valid);
 
 RUN_TEST(handle_stats_control);
 
+RUN_TEST(channel_stats_control);
+RUN_SINGLE_ENTRY_TESTS(ZX_INFO_PROCESS_CHANNEL_STATS, zx_info_process_channel_stats_t,
+                       zx_process_self);
+RUN_TEST((wrong_handle_type_fails<ZX_INFO_PROCESS_CHANNEL_STATS, zx_info_process_channel_stats_t,
+                                  zx_thread_self>));
+
+RUN_SINGLE_ENTRY_TESTS(ZX_INFO_PROCESS_PORT_STATS, zx_info_process_port_stats_t,
+                       zx_process_self);
+RUN_TEST((wrong_handle_type_fails<ZX_INFO_PROCESS_PORT_STATS, zx_info_process_port_stats_t,
+                                  zx_thread_self>));
+
 END_TEST_CASE(object_info_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -102,9 +102,8 @@ static bool wait_count_valid_test() {
     status = zx_port_queue(port, &in, 1u);
     EXPECT_EQ(status, ZX_OK);
 
-    // This test relies on only 0 or 1 being a valid count. This might
-    // eventually change. For now, we can stack allocate 1 packet and
-    // know it is sufficient for all instantiations of this test.
+    // Only one packet is queued, so one is enough room for all
+    // instantiations of this test.
     static_assert(Count <= 1, "");
     zx_port_packet_t out = {
     };
@@ -116,23 +115,45 @@ static bool wait_count_valid_test() {
     END_TEST;
 }
 
+// Waits for |Count| packets at a time out of 20 queued ones.
 template <size_t Count>
-static bool wait_count_invalid_test() {
+static bool wait_count_many_test() {
     BEGIN_TEST;
 
     zx_handle_t port;
     zx_status_t status = zx_port_create(0u, &port);
     EXPECT_EQ(status, ZX_OK);
 
-    const zx_port_packet_t in = {
-    };
-    status = zx_port_queue(port, &in, 1u);
-    EXPECT_EQ(status, ZX_OK);
+    constexpr uint64_t kQueued = 20u;
+    for (uint64_t key = 0u; key < kQueued; key++) {
+        const zx_port_packet_t in = {key, ZX_PKT_TYPE_USER, 0, {}};
+        status = zx_port_queue(port, &in, 1u);
+        EXPECT_EQ(status, ZX_OK);
+    }
 
-    zx_port_packet_t out[Count] = {
-    };
-    status = zx_port_wait(port, ZX_TIME_INFINITE, out, Count);
-    EXPECT_EQ(status, ZX_ERR_INVALID_ARGS);
+    uint64_t next_key = 0u;
+    while (next_key < kQueued) {
+        zx_port_packet_t out[Count];
+        for (size_t i = 0; i < Count; i++)
+            out[i].type = ZX_PKT_TYPE_SIGNAL_ONE;
+        status = zx_port_wait(port, 0u, out, Count);
+        ASSERT_EQ(status, ZX_OK);
+
+        const size_t expected = fbl::min<size_t>(Count, kQueued - next_key);
+        for (size_t i = 0; i < expected; i++) {
+            EXPECT_EQ(out[i].type, ZX_PKT_TYPE_USER);
+            EXPECT_EQ(out[i].key, next_key++);
+        }
+        if (expected < Count) {
+            EXPECT_EQ(out[expected].type, ZX_PKT_TYPE_NONE);
+            for (size_t i = expected + 1; i < Count; i++)
+                EXPECT_EQ(out[i].type, ZX_PKT_TYPE_SIGNAL_ONE, "packet written past the end");
+        }
+    }
+
+    zx_port_packet_t out[Count];
+    status = zx_port_wait(port, 0u, out, Count);
+    EXPECT_EQ(status, ZX_ERR_TIMED_OUT);
 
     EXPECT_EQ(zx_handle_close(port), ZX_OK);
 
@@ -167,6 +188,92 @@ static bool queue_and_close_test(void) {
     END_TEST;
 }
 
+static bool queue_quota_test(void) {
+    BEGIN_TEST;
+
+    zx_info_process_port_stats_t before;
+    ASSERT_EQ(zx_object_get_info(zx_process_self(), ZX_INFO_PROCESS_PORT_STATS,
+                                 &before, sizeof(before), nullptr, nullptr), ZX_OK);
+    ASSERT_GT(before.max_pending_packets, before.pending_packets);
+
+    zx_handle_t port;
+    ASSERT_EQ(zx_port_create(0, &port), ZX_OK);
+
+    // Queue up to the limit of the process; the next packet is refused until
+    // one is dequeued.
+    const zx_port_packet_t in = {};
+    const uint64_t room = before.max_pending_packets - before.pending_packets;
+    for (uint64_t i = 0; i < room; i++) {
+        ASSERT_EQ(zx_port_queue(port, &in, 0u), ZX_OK);
+    }
+    EXPECT_EQ(zx_port_queue(port, &in, 0u), ZX_ERR_SHOULD_WAIT);
+
+    zx_port_packet_t out;
+    EXPECT_EQ(zx_port_wait(port, 0, &out, 1u), ZX_OK);
+    EXPECT_EQ(zx_port_queue(port, &in, 0u), ZX_OK);
+
+    zx_info_process_port_stats_t info;
+    ASSERT_EQ(zx_object_get_info(zx_process_self(), ZX_INFO_PROCESS_PORT_STATS,
+                                 &info, sizeof(info), nullptr, nullptr), ZX_OK);
+    EXPECT_EQ(info.pending_packets, info.max_pending_packets);
+    EXPECT_EQ(info.peak_pending_packets, info.max_pending_packets);
+    EXPECT_EQ(info.total_packets, before.total_packets + room + 1);
+    EXPECT_EQ(info.quota_failures, before.quota_failures + 1);
+
+    // Closing the port releases the charge for the packets left on it.
+    EXPECT_EQ(zx_handle_close(port), ZX_OK);
+    ASSERT_EQ(zx_object_get_info(zx_process_self(), ZX_INFO_PROCESS_PORT_STATS,
+                                 &info, sizeof(info), nullptr, nullptr), ZX_OK);
+    EXPECT_EQ(info.pending_packets, before.pending_packets);
+
+    END_TEST;
+}
+
+#ifdef BUILD_COMBINED_TESTS
+extern "C" zx_handle_t get_root_resource(void);
+
+static bool packet_stats_test(void) {
+    BEGIN_TEST;
+
+    zx_handle_t root = get_root_resource();
+    ASSERT_NE(root, ZX_HANDLE_INVALID, "no root resource handle");
+
+    zx_info_port_packet_stats_t before;
+    ASSERT_EQ(zx_object_get_info(root, ZX_INFO_PORT_PACKET_STATS,
+                                 &before, sizeof(before), nullptr, nullptr), ZX_OK);
+    EXPECT_GT(before.max_packets, 0u);
+    EXPECT_LE(before.allocated_packets + before.cached_packets, before.max_packets);
+    EXPECT_LE(before.cache_misses, before.allocations);
+
+    zx_handle_t port;
+    ASSERT_EQ(zx_port_create(0, &port), ZX_OK);
+
+    // The queued packets stay allocated until they are dequeued.
+    constexpr uint64_t kPackets = 8u;
+    const zx_port_packet_t in = {};
+    for (uint64_t i = 0; i < kPackets; i++) {
+        ASSERT_EQ(zx_port_queue(port, &in, 0u), ZX_OK);
+    }
+
+    zx_info_port_packet_stats_t info;
+    ASSERT_EQ(zx_object_get_info(root, ZX_INFO_PORT_PACKET_STATS,
+                                 &info, sizeof(info), nullptr, nullptr), ZX_OK);
+    EXPECT_EQ(info.max_packets, before.max_packets);
+    EXPECT_GE(info.allocated_packets, kPackets);
+    EXPECT_LE(info.allocated_packets + info.cached_packets, info.max_packets);
+    EXPECT_GE(info.allocations, before.allocations + kPackets);
+    EXPECT_LE(info.cache_misses, info.allocations);
+
+    EXPECT_EQ(zx_handle_close(port), ZX_OK);
+
+    // Only the root resource gives the stats.
+    EXPECT_EQ(zx_object_get_info(zx_process_self(), ZX_INFO_PORT_PACKET_STATS,
+                                 &info, sizeof(info), nullptr, nullptr), ZX_ERR_WRONG_TYPE);
+
+    END_TEST;
+}
+#endif
+
 static bool async_wait_channel_test(void) {
     BEGIN_TEST;
     zx_status_t status;
@@ -744,9 +851,14 @@ RUN_TEST(queue_count_invalid_test<2u>)
 RUN_TEST(queue_count_invalid_test<23u>)
 RUN_TEST(wait_count_valid_test<0u>)
 RUN_TEST(wait_count_valid_test<1u>)
-RUN_TEST(wait_count_invalid_test<2u>)
-RUN_TEST(wait_count_invalid_test<23u>)
+RUN_TEST(wait_count_many_test<2u>)
+RUN_TEST(wait_count_many_test<3u>)
+RUN_TEST(wait_count_many_test<23u>)
 RUN_TEST(queue_and_close_test)
+RUN_TEST(queue_quota_test)
+#ifdef BUILD_COMBINED_TESTS
+RUN_TEST(packet_stats_test)
+#endif
 RUN_TEST(async_wait_channel_test)
 RUN_TEST(async_wait_event_test_single)
 RUN_TEST(async_wait_event_test_repeat)
@@ -88,6 +88,8 @@ using RPTE = DEFINE_TEST_THUNK(OrderedAssociative, WAVL, RefPtr);
 //    both insert and erase operations, are obeyed.
 // 3) Sufficient code coverage has been achieved during testing (eg. all of the
 //    rebalancing edge cases have been run over the length of the test).
+// 4) Augmented state (here, the number of nodes in each node's subtree) is kept
+//    up to date through inserts, erases and rotations.
 class WAVLBalanceTestObserver {
 public:
     struct OpCounts {
@@ -138,6 +140,11 @@ public:
     static void RecordEraseRotation()           { ++op_counts_.erase_rotations_; }
     static void RecordEraseDoubleRotation()     { ++op_counts_.erase_double_rotations_; }
 
+    static constexpr bool kAugmented = true;
+
+    template <typename RawPtrType>
+    static void RecordSubtreeChanged(RawPtrType node) { node->UpdateSubtreeSize(); }
+
     template <typename TreeType>
     static bool VerifyRankRule(const TreeType& tree, typename TreeType::RawPtrType node) {
         BEGIN_TEST;
@@ -153,6 +160,14 @@ public:
         const auto& ns = NodeTraits::node_state(*node);
         ASSERT_LE(0, ns.rank_, "All ranks must be non-negative.");
 
+        // Check the augmented state while we are here.
+        size_t subtree_size = 1;
+        if (PtrTraits::IsValid(ns.left_))
+            subtree_size += ns.left_->SubtreeSize();
+        if (PtrTraits::IsValid(ns.right_))
+            subtree_size += ns.right_->SubtreeSize();
+        ASSERT_EQ(subtree_size, node->SubtreeSize(), "Stale subtree size!");
+
         if (!PtrTraits::IsValid(ns.left_) && !PtrTraits::IsValid(ns.right_)) {
             ASSERT_EQ(0, ns.rank_, "Leaf nodes must have rank 0!");
         } else {
@@ -261,6 +276,15 @@ public:
 
     bool InContainer() const { return wavl_node_state_.InContainer(); }
 
+    size_t SubtreeSize() const { return subtree_size_; }
+    void UpdateSubtreeSize() {
+        subtree_size_ = 1;
+        if (BalanceTestTree::PtrTraits::IsValid(wavl_node_state_.left_))
+            subtree_size_ += wavl_node_state_.left_->subtree_size_;
+        if (BalanceTestTree::PtrTraits::IsValid(wavl_node_state_.right_))
+            subtree_size_ += wavl_node_state_.right_->subtree_size_;
+    }
+
 private:
     friend DefaultWAVLTreeTraits<BalanceTestObjPtr, int32_t>;
 
@@ -272,6 +296,7 @@ private:
 
     BalanceTestKeyType key_;
     BalanceTestObj* erase_deck_ptr_;
+    size_t subtree_size_ = 0;
     WAVLTreeNodeState<BalanceTestObjPtr, int32_t> wavl_node_state_;
 };
 
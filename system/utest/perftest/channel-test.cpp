@@ -0,0 +1,188 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <threads.h>
+
+#include <fbl/algorithm.h>
+#include <fbl/string_printf.h>
+#include <fbl/unique_ptr.h>
+#include <launchpad/launchpad.h>
+#include <perftest/perftest.h>
+#include <zircon/assert.h>
+#include <zircon/processargs.h>
+#include <zircon/syscalls.h>
+
+#include "channel-test.h"
+
+const char* g_perftest_executable;
+
+int ChannelEchoSubprocessMain() {
+    zx_handle_t channel = zx_get_startup_handle(PA_HND(PA_USER0, 0));
+    ZX_ASSERT(channel != ZX_HANDLE_INVALID);
+    fbl::unique_ptr<uint8_t[]> buffer(new uint8_t[ZX_CHANNEL_MAX_MSG_BYTES]);
+    for (;;) {
+        zx_signals_t observed;
+        ZX_ASSERT(zx_object_wait_one(channel, ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+                                     ZX_TIME_INFINITE, &observed) == ZX_OK);
+        if (!(observed & ZX_CHANNEL_READABLE))
+            return 0;
+        uint32_t bytes_read;
+        ZX_ASSERT(zx_channel_read(channel, 0, buffer.get(), nullptr, ZX_CHANNEL_MAX_MSG_BYTES,
+                                  0, &bytes_read, nullptr) == ZX_OK);
+        // Echoing the message keeps its txid, which makes it the reply.
+        ZX_ASSERT(zx_channel_write(channel, 0, buffer.get(), bytes_read, nullptr, 0) == ZX_OK);
+    }
+}
+
+namespace {
+
+// Bounces a message back and forth between two threads over a channel.
+//
+// Each round trip wakes up the other thread twice, so this measures the
+// cost of cross-thread wakeups as well as the channel operations.  The
+// result is sensitive to where the scheduler places the woken thread
+// relative to the waker: ideally on an idle cpu sharing a cache with it.
+class ChannelPingPong {
+public:
+    explicit ChannelPingPong(uint32_t size)
+        : size_(size), buffer_(new uint8_t[size > 0 ? size : 1]) {
+        ZX_ASSERT(zx_channel_create(0, &local_, &remote_) == ZX_OK);
+        ZX_ASSERT(thrd_create(&thread_, EchoThread, this) == thrd_success);
+    }
+
+    ~ChannelPingPong() {
+        // Closing our end makes the echo thread exit.
+        ZX_ASSERT(zx_handle_close(local_) == ZX_OK);
+        ZX_ASSERT(thrd_join(thread_, nullptr) == thrd_success);
+        ZX_ASSERT(zx_handle_close(remote_) == ZX_OK);
+    }
+
+    void RoundTrip() {
+        ZX_ASSERT(zx_channel_write(local_, 0, buffer_.get(), size_, nullptr, 0) == ZX_OK);
+        ReadOne(local_, buffer_.get());
+    }
+
+private:
+    void ReadOne(zx_handle_t channel, uint8_t* buffer) {
+        ZX_ASSERT(zx_object_wait_one(channel, ZX_CHANNEL_READABLE, ZX_TIME_INFINITE,
+                                     nullptr) == ZX_OK);
+        uint32_t bytes_read;
+        ZX_ASSERT(zx_channel_read(channel, 0, buffer, nullptr, size_, 0,
+                                  &bytes_read, nullptr) == ZX_OK);
+        ZX_ASSERT(bytes_read == size_);
+    }
+
+    static int EchoThread(void* arg) {
+        auto self = static_cast<ChannelPingPong*>(arg);
+        fbl::unique_ptr<uint8_t[]> buffer(new uint8_t[self->size_ > 0 ? self->size_ : 1]);
+        for (;;) {
+            zx_signals_t observed;
+            ZX_ASSERT(zx_object_wait_one(self->remote_,
+                                         ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+                                         ZX_TIME_INFINITE, &observed) == ZX_OK);
+            if (!(observed & ZX_CHANNEL_READABLE))
+                return 0;
+            self->ReadOne(self->remote_, buffer.get());
+            ZX_ASSERT(zx_channel_write(self->remote_, 0, buffer.get(), self->size_,
+                                       nullptr, 0) == ZX_OK);
+        }
+    }
+
+    const uint32_t size_;
+    fbl::unique_ptr<uint8_t[]> buffer_;
+    zx_handle_t local_;
+    zx_handle_t remote_;
+    thrd_t thread_;
+};
+
+// Makes zx_channel_call()s to a server in another process.
+//
+// Unlike ChannelPingPong, each call switches to the other process's address
+// space and back when both ends run on the same cpu, so this also measures
+// the cost of address space switches and of the TLB misses after them.
+// Comparing runs with kernel.x86.pcid=false shows what PCIDs save there.
+class ChannelCallProcess {
+public:
+    explicit ChannelCallProcess(uint32_t size)
+        : size_(size), buffer_(new uint8_t[size]), reply_(new uint8_t[size]) {
+        zx_handle_t remote;
+        ZX_ASSERT(zx_channel_create(0, &local_, &remote) == ZX_OK);
+
+        launchpad_t* lp;
+        launchpad_create(ZX_HANDLE_INVALID, "channel-echo", &lp);
+        launchpad_load_from_file(lp, g_perftest_executable);
+        const char* args[] = {g_perftest_executable, CHANNEL_ECHO_SUBPROCESS_ARG};
+        launchpad_set_args(lp, static_cast<int>(fbl::count_of(args)), args);
+        launchpad_clone(lp, LP_CLONE_ALL);
+        launchpad_add_handle(lp, remote, PA_HND(PA_USER0, 0));
+        const char* errmsg;
+        ZX_ASSERT(launchpad_go(lp, &process_, &errmsg) == ZX_OK);
+    }
+
+    ~ChannelCallProcess() {
+        // Closing our end makes the echo process exit.
+        ZX_ASSERT(zx_handle_close(local_) == ZX_OK);
+        ZX_ASSERT(zx_object_wait_one(process_, ZX_PROCESS_TERMINATED, ZX_TIME_INFINITE,
+                                     nullptr) == ZX_OK);
+        ZX_ASSERT(zx_handle_close(process_) == ZX_OK);
+    }
+
+    void Call() {
+        zx_channel_call_args_t args = {
+            .wr_bytes = buffer_.get(),
+            .wr_handles = nullptr,
+            .rd_bytes = reply_.get(),
+            .rd_handles = nullptr,
+            .wr_num_bytes = size_,
+            .wr_num_handles = 0,
+            .rd_num_bytes = size_,
+            .rd_num_handles = 0,
+        };
+        uint32_t bytes_read;
+        uint32_t handles_read;
+        ZX_ASSERT(zx_channel_call(local_, 0, ZX_TIME_INFINITE, &args, &bytes_read,
+                                  &handles_read, nullptr) == ZX_OK);
+        ZX_ASSERT(bytes_read == size_);
+    }
+
+private:
+    const uint32_t size_;
+    fbl::unique_ptr<uint8_t[]> buffer_;
+    fbl::unique_ptr<uint8_t[]> reply_;
+    zx_handle_t local_;
+    zx_handle_t process_;
+};
+
+bool ChannelCallProcessTest(perftest::RepeatState* state, uint32_t message_size) {
+    ChannelCallProcess call(message_size);
+    while (state->KeepRunning()) {
+        call.Call();
+    }
+    return true;
+}
+
+bool ChannelPingPongTest(perftest::RepeatState* state, uint32_t message_size) {
+    ChannelPingPong ping_pong(message_size);
+    while (state->KeepRunning()) {
+        ping_pong.RoundTrip();
+    }
+    return true;
+}
+
+void RegisterTests() {
+    static const uint32_t kMessageSizes[] = {
+        64,
+        1024,
+        32 * 1024,
+    };
+    for (auto message_size : kMessageSizes) {
+        auto name = fbl::StringPrintf("Channel/PingPong/%ubytes", message_size);
+        perftest::RegisterTest(name.c_str(), ChannelPingPongTest, message_size);
+        name = fbl::StringPrintf("Channel/CallProcess/%ubytes", message_size);
+        perftest::RegisterTest(name.c_str(), ChannelCallProcessTest, message_size);
+    }
+}
+PERFTEST_CTOR(RegisterTests);
+
+}  // namespace
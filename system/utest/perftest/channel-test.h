@@ -0,0 +1,15 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+// The cross-process channel tests run perf-test itself, with this argument,
+// as the other process.
+#define CHANNEL_ECHO_SUBPROCESS_ARG "--channel-echo-subprocess"
+
+// Path of the perf-test executable, set by main().
+extern const char* g_perftest_executable;
+
+// Echoes messages on the channel passed as PA_USER0 until its peer closes.
+int ChannelEchoSubprocessMain();
@@ -0,0 +1,116 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fbl/algorithm.h>
+#include <fbl/string_printf.h>
+#include <fbl/vector.h>
+#include <launchpad/launchpad.h>
+#include <perftest/perftest.h>
+#include <zircon/assert.h>
+#include <zircon/processargs.h>
+#include <zircon/syscalls.h>
+
+#include "channel-test.h"
+#include "handle-test.h"
+
+namespace {
+
+void DuplicateClose(zx_handle_t handle) {
+    zx_handle_t dup;
+    ZX_ASSERT(zx_handle_duplicate(handle, ZX_RIGHT_SAME_RIGHTS, &dup) == ZX_OK);
+    ZX_ASSERT(zx_handle_close(dup) == ZX_OK);
+}
+
+}  // namespace
+
+int HandleChurnSubprocessMain() {
+    zx_handle_t channel = zx_get_startup_handle(PA_HND(PA_USER0, 0));
+    ZX_ASSERT(channel != ZX_HANDLE_INVALID);
+    zx_handle_t event;
+    ZX_ASSERT(zx_event_create(0, &event) == ZX_OK);
+    for (;;) {
+        for (int i = 0; i < 1000; i++)
+            DuplicateClose(event);
+        zx_signals_t observed;
+        zx_status_t status = zx_object_wait_one(channel, ZX_CHANNEL_PEER_CLOSED, 0, &observed);
+        if (status == ZX_OK)
+            return 0;
+        ZX_ASSERT(status == ZX_ERR_TIMED_OUT);
+    }
+}
+
+namespace {
+
+// Runs |count| other processes that duplicate and close handles as fast as
+// they can, until destroyed.
+class HandleChurnProcesses {
+public:
+    explicit HandleChurnProcesses(uint32_t count) {
+        for (uint32_t i = 0; i < count; i++) {
+            zx_handle_t remote;
+            zx_handle_t local;
+            ZX_ASSERT(zx_channel_create(0, &local, &remote) == ZX_OK);
+
+            launchpad_t* lp;
+            launchpad_create(ZX_HANDLE_INVALID, "handle-churn", &lp);
+            launchpad_load_from_file(lp, g_perftest_executable);
+            const char* args[] = {g_perftest_executable, HANDLE_CHURN_SUBPROCESS_ARG};
+            launchpad_set_args(lp, static_cast<int>(fbl::count_of(args)), args);
+            launchpad_clone(lp, LP_CLONE_ALL);
+            launchpad_add_handle(lp, remote, PA_HND(PA_USER0, 0));
+            zx_handle_t process;
+            const char* errmsg;
+            ZX_ASSERT(launchpad_go(lp, &process, &errmsg) == ZX_OK);
+
+            channels_.push_back(local);
+            processes_.push_back(process);
+        }
+    }
+
+    ~HandleChurnProcesses() {
+        // Closing our ends makes the processes exit.
+        for (zx_handle_t channel : channels_)
+            ZX_ASSERT(zx_handle_close(channel) == ZX_OK);
+        for (zx_handle_t process : processes_) {
+            ZX_ASSERT(zx_object_wait_one(process, ZX_PROCESS_TERMINATED, ZX_TIME_INFINITE,
+                                         nullptr) == ZX_OK);
+            ZX_ASSERT(zx_handle_close(process) == ZX_OK);
+        }
+    }
+
+private:
+    fbl::Vector<zx_handle_t> channels_;
+    fbl::Vector<zx_handle_t> processes_;
+};
+
+// Duplicates and closes a handle while |processes| - 1 other processes do
+// the same.  Every duplicate allocates a handle and adds it to the handle
+// table of the process, and every close takes it out and frees it, so this
+// measures how well handle churn scales across cpus.  Each process has its
+// own handle table, and free handles are cached on each cpu, so the time
+// should not grow with the number of processes as long as there are as many
+// cpus.
+bool HandleDuplicateCloseTest(perftest::RepeatState* state, uint32_t processes) {
+    HandleChurnProcesses others(processes - 1);
+    zx_handle_t event;
+    ZX_ASSERT(zx_event_create(0, &event) == ZX_OK);
+
+    while (state->KeepRunning()) {
+        DuplicateClose(event);
+    }
+
+    ZX_ASSERT(zx_handle_close(event) == ZX_OK);
+    return true;
+}
+
+void RegisterTests() {
+    static const uint32_t kProcesses[] = {1, 2, 4, 8};
+    for (uint32_t processes : kProcesses) {
+        auto name = fbl::StringPrintf("Handle/DuplicateClose/%uprocesses", processes);
+        perftest::RegisterTest(name.c_str(), HandleDuplicateCloseTest, processes);
+    }
+}
+PERFTEST_CTOR(RegisterTests);
+
+}  // namespace
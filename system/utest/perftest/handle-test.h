@@ -0,0 +1,13 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+// The handle churn tests run perf-test itself, with this argument, as the
+// other processes.
+#define HANDLE_CHURN_SUBPROCESS_ARG "--handle-churn-subprocess"
+
+// Duplicates and closes handles until the peer of the channel passed as
+// PA_USER0 closes.
+int HandleChurnSubprocessMain();
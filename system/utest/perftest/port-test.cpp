@@ -0,0 +1,56 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fbl/string_printf.h>
+#include <fbl/unique_ptr.h>
+#include <perftest/perftest.h>
+#include <zircon/assert.h>
+#include <zircon/syscalls.h>
+#include <zircon/syscalls/port.h>
+
+namespace {
+
+constexpr uint32_t kPacketsPerRun = 64;
+
+// Queues kPacketsPerRun packets on a port and takes them off again,
+// |batch_size| packets per zx_port_wait() call.  This measures the
+// per-packet throughput of a busy port, such as that of an event loop
+// handling many signals.
+bool PortQueueWaitTest(perftest::RepeatState* state, uint32_t batch_size) {
+    zx_handle_t port;
+    ZX_ASSERT(zx_port_create(0, &port) == ZX_OK);
+    fbl::unique_ptr<zx_port_packet_t[]> packets(new zx_port_packet_t[batch_size]);
+
+    zx_port_packet_t packet = {};
+    packet.type = ZX_PKT_TYPE_USER;
+
+    while (state->KeepRunning()) {
+        for (uint32_t i = 0; i < kPacketsPerRun; i++) {
+            packet.key = i;
+            ZX_ASSERT(zx_port_queue(port, &packet, 1) == ZX_OK);
+        }
+        for (uint32_t received = 0; received < kPacketsPerRun;) {
+            ZX_ASSERT(zx_port_wait(port, 0, packets.get(), batch_size) == ZX_OK);
+            uint32_t i = 0;
+            while (i < batch_size && packets[i].type != ZX_PKT_TYPE_NONE)
+                i++;
+            received += i;
+        }
+    }
+
+    ZX_ASSERT(zx_handle_close(port) == ZX_OK);
+    return true;
+}
+
+void RegisterTests() {
+    static const uint32_t kBatchSizes[] = {1, 4, 16, 64};
+    for (uint32_t batch_size : kBatchSizes) {
+        auto name = fbl::StringPrintf("Port/QueueWait/%upackets/%ubatch",
+                                      kPacketsPerRun, batch_size);
+        perftest::RegisterTest(name.c_str(), PortQueueWaitTest, batch_size);
+    }
+}
+PERFTEST_CTOR(RegisterTests);
+
+}  // namespace
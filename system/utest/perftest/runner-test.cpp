@@ -2,11 +2,16 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <string.h>
+
 #include <perftest/perftest.h>
 #include <perftest/runner.h>
 #include <unittest/unittest.h>
 #include <zircon/assert.h>
 
+#include "channel-test.h"
+#include "handle-test.h"
+
 // This is a helper for creating a FILE* that we can redirect output to, in
 // order to make the tests below less noisy.  We don't look at the output
 // that is sent to the stream.
@@ -141,5 +146,12 @@ RUN_TEST(test_parsing_command_args)
 END_TEST_CASE(perftest_runner_test)
 
 int main(int argc, char** argv) {
+    g_perftest_executable = argv[0];
+    if (argc == 2 && strcmp(argv[1], CHANNEL_ECHO_SUBPROCESS_ARG) == 0) {
+        return ChannelEchoSubprocessMain();
+    }
+    if (argc == 2 && strcmp(argv[1], HANDLE_CHURN_SUBPROCESS_ARG) == 0) {
+        return HandleChurnSubprocessMain();
+    }
     return perftest::PerfTestMain(argc, argv);
 }
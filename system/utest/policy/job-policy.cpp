@@ -21,6 +21,7 @@
 #include <zircon/process.h>
 #include <zircon/syscalls/debug.h>
 #include <zircon/syscalls/exception.h>
+#include <zircon/syscalls/object.h>
 #include <zircon/syscalls/policy.h>
 #include <zircon/syscalls/port.h>
 
@@ -409,6 +410,90 @@ static bool test_exception_on_bad_handle() {
     END_TEST;
 }
 
+static bool cpu_bandwidth() {
+    BEGIN_TEST;
+
+    auto job = make_job();
+    zx_info_job_t info;
+    ASSERT_EQ(job.get_info(ZX_INFO_JOB, &info, sizeof(info), nullptr, nullptr), ZX_OK);
+    EXPECT_EQ(info.cpu_quota, 0);
+    EXPECT_EQ(info.cpu_runtime, 0);
+    EXPECT_FALSE(info.cpu_throttled);
+
+    zx_policy_cpu_bandwidth_t policy = { ZX_MSEC(10), ZX_MSEC(100) };
+    EXPECT_EQ(job.set_policy(ZX_JOB_POL_RELATIVE, ZX_JOB_POL_CPU_BANDWIDTH, &policy, 1u), ZX_OK);
+    ASSERT_EQ(job.get_info(ZX_INFO_JOB, &info, sizeof(info), nullptr, nullptr), ZX_OK);
+    EXPECT_EQ(info.cpu_quota, ZX_MSEC(10));
+    EXPECT_EQ(info.cpu_period, ZX_MSEC(100));
+    EXPECT_FALSE(info.cpu_throttled);
+
+    // A limit can be set on a job that already has children.
+    zx::job child;
+    ASSERT_EQ(zx::job::create(job, 0u, &child), ZX_OK);
+    policy.quota = ZX_MSEC(20);
+    EXPECT_EQ(job.set_policy(ZX_JOB_POL_RELATIVE, ZX_JOB_POL_CPU_BANDWIDTH, &policy, 1u), ZX_OK);
+
+    // Only one entry is allowed, and the period has to be reasonable.
+    zx_policy_cpu_bandwidth_t two[] = { policy, policy };
+    EXPECT_EQ(job.set_policy(ZX_JOB_POL_RELATIVE, ZX_JOB_POL_CPU_BANDWIDTH, two, 2u),
+              ZX_ERR_INVALID_ARGS);
+    zx_policy_cpu_bandwidth_t bad_period = { ZX_MSEC(10), ZX_SEC(10) };
+    EXPECT_EQ(job.set_policy(ZX_JOB_POL_RELATIVE, ZX_JOB_POL_CPU_BANDWIDTH, &bad_period, 1u),
+              ZX_ERR_INVALID_ARGS);
+
+    // A quota of zero lifts the limit.
+    zx_policy_cpu_bandwidth_t none = { 0, 0 };
+    EXPECT_EQ(job.set_policy(ZX_JOB_POL_RELATIVE, ZX_JOB_POL_CPU_BANDWIDTH, &none, 1u), ZX_OK);
+    ASSERT_EQ(job.get_info(ZX_INFO_JOB, &info, sizeof(info), nullptr, nullptr), ZX_OK);
+    EXPECT_EQ(info.cpu_quota, 0);
+
+    END_TEST;
+}
+
+// Test that a busy thread in a job with a cpu bandwidth limit is throttled to
+// its quota.
+static bool cpu_bandwidth_throttles() {
+    BEGIN_TEST;
+
+    auto job = make_job();
+    zx_policy_cpu_bandwidth_t policy = { ZX_MSEC(5), ZX_MSEC(50) };
+    ASSERT_EQ(job.set_policy(ZX_JOB_POL_RELATIVE, ZX_JOB_POL_CPU_BANDWIDTH, &policy, 1u), ZX_OK);
+
+    zx::process proc;
+    zx::vmar vmar;
+    ASSERT_EQ(zx::process::create(job, "spinner", 7u, 0u, &proc, &vmar), ZX_OK);
+    zx::thread thread;
+    ASSERT_EQ(zx::thread::create(proc, "spinner", 7u, 0u, &thread), ZX_OK);
+    zx::event event;
+    ASSERT_EQ(zx::event::create(0u, &event), ZX_OK);
+
+    // Without a control channel, the mini process spins forever.
+    zx_time_t start = zx_clock_get(ZX_CLOCK_MONOTONIC);
+    ASSERT_EQ(start_mini_process_etc(proc.get(), thread.get(), vmar.get(), event.release(),
+                                     nullptr), ZX_OK);
+
+    zx_info_job_t info;
+    do {
+        zx_nanosleep(zx_deadline_after(ZX_MSEC(10)));
+        ASSERT_EQ(job.get_info(ZX_INFO_JOB, &info, sizeof(info), nullptr, nullptr), ZX_OK);
+    } while (info.cpu_throttled_count == 0 &&
+             zx_clock_get(ZX_CLOCK_MONOTONIC) - start < ZX_SEC(10));
+    EXPECT_GT(info.cpu_throttled_count, 0u);
+
+    // Over a few more periods it gets no more than its quota in each, give or
+    // take the time it takes to notice it went over.
+    zx_nanosleep(zx_deadline_after(ZX_MSEC(500)));
+    ASSERT_EQ(job.get_info(ZX_INFO_JOB, &info, sizeof(info), nullptr, nullptr), ZX_OK);
+    zx_duration_t elapsed = zx_clock_get(ZX_CLOCK_MONOTONIC) - start;
+    EXPECT_LE(info.cpu_runtime, (elapsed / policy.period + 2) * policy.quota + ZX_MSEC(20));
+    EXPECT_GT(info.cpu_throttled_time, 0);
+
+    ASSERT_EQ(proc.kill(), ZX_OK);
+    ASSERT_EQ(proc.wait_one(ZX_TASK_TERMINATED, zx::time::infinite(), nullptr), ZX_OK);
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(job_policy)
 RUN_TEST(invalid_calls_abs)
 RUN_TEST(invalid_calls_rel)
@@ -422,6 +507,8 @@ RUN_TEST(test_exception_on_new_event_and_deny)
 RUN_TEST(test_exception_on_new_event_but_allow)
 RUN_TEST(test_error_on_bad_handle)
 RUN_TEST(test_exception_on_bad_handle)
+RUN_TEST(cpu_bandwidth)
+RUN_TEST(cpu_bandwidth_throttles)
 END_TEST_CASE(job_policy)
 
 int main(int argc, char** argv) {
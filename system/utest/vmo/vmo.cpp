@@ -1111,6 +1111,114 @@ bool vmo_clone_decommit_test() {
     END_TEST;
 }
 
+// pages mapped ahead by fault-around must still be copied on write in a clone
+bool vmo_fault_around_test() {
+    BEGIN_TEST;
+
+    const size_t size = PAGE_SIZE * 16;
+    zx_handle_t vmo;
+    ASSERT_EQ(ZX_OK, zx_vmo_create(size, 0, &vmo), "vm_object_create");
+
+    uint32_t pages;
+    EXPECT_EQ(ZX_OK, zx_object_get_property(vmo, ZX_PROP_VMO_FAULT_AROUND, &pages, sizeof(pages)));
+    pages = 33;
+    EXPECT_EQ(ZX_ERR_OUT_OF_RANGE,
+              zx_object_set_property(vmo, ZX_PROP_VMO_FAULT_AROUND, &pages, sizeof(pages)));
+    pages = 16;
+    EXPECT_EQ(ZX_OK, zx_object_set_property(vmo, ZX_PROP_VMO_FAULT_AROUND, &pages, sizeof(pages)));
+    pages = 0;
+    EXPECT_EQ(ZX_OK, zx_object_get_property(vmo, ZX_PROP_VMO_FAULT_AROUND, &pages, sizeof(pages)));
+    EXPECT_EQ(16u, pages);
+
+    // commit every page of the original with its index
+    for (uint32_t i = 0; i < size / PAGE_SIZE; i++) {
+        EXPECT_EQ(ZX_OK, zx_vmo_write(vmo, &i, i * PAGE_SIZE, sizeof(i)), "vm_write");
+    }
+
+    zx_handle_t clone_vmo;
+    ASSERT_EQ(ZX_OK, zx_vmo_clone(vmo, ZX_VMO_CLONE_COPY_ON_WRITE, 0, size, &clone_vmo), "vm_clone");
+    pages = 16;
+    EXPECT_EQ(ZX_OK, zx_object_set_property(clone_vmo, ZX_PROP_VMO_FAULT_AROUND, &pages, sizeof(pages)));
+
+    uintptr_t ptr;
+    ASSERT_EQ(ZX_OK,
+              zx_vmar_map(zx_vmar_root_self(), 0, clone_vmo, 0, size,
+                          ZX_VM_FLAG_PERM_READ | ZX_VM_FLAG_PERM_WRITE, &ptr),
+              "map");
+    volatile uint32_t* p = (volatile uint32_t*)ptr;
+
+    // reading one page maps its neighbors from the original
+    EXPECT_EQ(0u, p[0], "read back from clone");
+
+    // writing a neighbor must copy it rather than write through to the original
+    p[PAGE_SIZE / sizeof(uint32_t)] = 100;
+    EXPECT_EQ(100u, p[PAGE_SIZE / sizeof(uint32_t)], "read back from clone");
+    for (uint32_t i = 0; i < size / PAGE_SIZE; i++) {
+        uint32_t val;
+        EXPECT_EQ(ZX_OK, zx_vmo_read(vmo, &val, i * PAGE_SIZE, sizeof(val)), "vm_read");
+        EXPECT_EQ(i, val, "original unchanged");
+        if (i != 1)
+            EXPECT_EQ(i, p[i * PAGE_SIZE / sizeof(uint32_t)], "read back from clone");
+    }
+
+    EXPECT_EQ(ZX_OK, zx_vmar_unmap(zx_vmar_root_self(), ptr, size), "unmap");
+    EXPECT_EQ(ZX_OK, zx_handle_close(clone_vmo), "handle_close");
+    EXPECT_EQ(ZX_OK, zx_handle_close(vmo), "handle_close");
+
+    END_TEST;
+}
+
+// large pages must look like any other memory to the mapping
+bool vmo_large_pages_test() {
+    BEGIN_TEST;
+
+    const size_t size = 4 * 1024 * 1024;
+    zx_handle_t vmo;
+    ASSERT_EQ(ZX_OK, zx_vmo_create(size, 0, &vmo), "vm_object_create");
+
+    uint32_t policy = 3;
+    EXPECT_EQ(ZX_ERR_INVALID_ARGS,
+              zx_object_set_property(vmo, ZX_PROP_VMO_LARGE_PAGES, &policy, sizeof(policy)));
+    policy = ZX_VMO_LARGE_PAGES_ALWAYS;
+    EXPECT_EQ(ZX_OK, zx_object_set_property(vmo, ZX_PROP_VMO_LARGE_PAGES, &policy, sizeof(policy)));
+    policy = 0;
+    EXPECT_EQ(ZX_OK, zx_object_get_property(vmo, ZX_PROP_VMO_LARGE_PAGES, &policy, sizeof(policy)));
+    EXPECT_EQ(ZX_VMO_LARGE_PAGES_ALWAYS, policy);
+
+    uintptr_t ptr;
+    ASSERT_EQ(ZX_OK,
+              zx_vmar_map(zx_vmar_root_self(), 0, vmo, 0, size,
+                          ZX_VM_FLAG_PERM_READ | ZX_VM_FLAG_PERM_WRITE, &ptr),
+              "map");
+    volatile uint32_t* p = (volatile uint32_t*)ptr;
+
+    // a read sees zeroes, and the first write commits the whole large page
+    EXPECT_EQ(0u, p[0], "read back");
+    for (uint32_t i = 0; i < size / PAGE_SIZE; i++) {
+        p[i * PAGE_SIZE / sizeof(uint32_t)] = i;
+    }
+    for (uint32_t i = 0; i < size / PAGE_SIZE; i++) {
+        uint32_t val;
+        EXPECT_EQ(ZX_OK, zx_vmo_read(vmo, &val, i * PAGE_SIZE, sizeof(val)), "vm_read");
+        EXPECT_EQ(i, val, "read back through vmo");
+    }
+
+    // unmapping and protecting part of a large page leaves the rest mapped
+    EXPECT_EQ(ZX_OK, zx_vmar_protect(zx_vmar_root_self(), ptr + PAGE_SIZE, PAGE_SIZE,
+                                     ZX_VM_FLAG_PERM_READ), "protect");
+    EXPECT_EQ(1u, p[PAGE_SIZE / sizeof(uint32_t)], "read back");
+    EXPECT_EQ(ZX_OK, zx_vmar_unmap(zx_vmar_root_self(), ptr, PAGE_SIZE), "unmap");
+    for (uint32_t i = 1; i < size / PAGE_SIZE; i++) {
+        EXPECT_EQ(i, p[i * PAGE_SIZE / sizeof(uint32_t)], "read back");
+    }
+
+    EXPECT_EQ(ZX_OK, zx_vmar_unmap(zx_vmar_root_self(), ptr + PAGE_SIZE, size - PAGE_SIZE),
+              "unmap");
+    EXPECT_EQ(ZX_OK, zx_handle_close(vmo), "handle_close");
+
+    END_TEST;
+}
+
 // verify the affect of commit on a clone
 bool vmo_clone_commit_test() {
     BEGIN_TEST;
@@ -1663,6 +1771,8 @@ RUN_TEST(vmo_clone_test_3);
 RUN_TEST(vmo_clone_test_4);
 RUN_TEST(vmo_clone_decommit_test);
 RUN_TEST(vmo_clone_commit_test);
+RUN_TEST(vmo_fault_around_test);
+RUN_TEST(vmo_large_pages_test);
 RUN_TEST(vmo_clone_rights_test);
 RUN_TEST_LARGE(vmo_unmap_coherency);
 END_TEST_CASE(vmo_tests)